@@ -0,0 +1,207 @@
+//
+// bench: Loopback throughput benchmark with an on-device traffic generator
+//
+// FlexCAN is switched into internal loopback, frames are generated into
+// the regular TX queue and come back through the regular RX FIFO, slcan
+// encoder and CDC path, so the result is the adapter's end-to-end rate.
+//
+
+#include <string.h>
+#include "bench.h"
+#include "can.h"
+#include "led.h"
+#include "slcan.h"
+#include "tusb.h"
+
+typedef enum bench_state_
+{
+    BENCH_IDLE = 0,
+    BENCH_RUNNING,
+    BENCH_SETTLING,
+} bench_state_t;
+
+// Private variables
+static bench_state_t state = BENCH_IDLE;
+static bench_params_t params;
+static bench_result_t result;
+static can_bus_state_t prev_bus_state;
+static uint32_t generated;
+static uint32_t forwarded;
+static uint32_t cdc_bytes;
+static uint32_t start_tick;
+static uint32_t last_tick;
+static uint16_t next_id;
+static uint8_t next_dlc;
+
+
+// Send the result line: 'B' + frames + frames/s + CDC bytes/s + drops.
+// CDC bytes are those queued for the host, not yet confirmed by it
+static void bench_report(void)
+{
+    uint8_t reply[40];
+    uint8_t pos = 0;
+
+    reply[pos++] = 'B';
+    pos += slcan_put_hex(&reply[pos], result.frames, 8);
+    pos += slcan_put_hex(&reply[pos], result.frames_per_s, 8);
+    pos += slcan_put_hex(&reply[pos], result.cdc_bytes_per_s, 8);
+    pos += slcan_put_hex(&reply[pos], result.drops, 8);
+    reply[pos++] = '\r';
+
+    tud_cdc_write(reply, pos);
+    tud_cdc_write_flush();
+}
+
+static void bench_finish(void)
+{
+    uint32_t elapsed = last_tick - start_tick;
+    if (elapsed == 0)
+    {
+        elapsed = 1;
+    }
+
+    result.frames = forwarded;
+    result.frames_per_s = (uint32_t)(((uint64_t)forwarded * 1000u) / elapsed);
+    result.cdc_bytes_per_s = (uint32_t)(((uint64_t)cdc_bytes * 1000u) / elapsed);
+    result.drops = generated - forwarded;
+
+    // Back to the previous mode and bus state
+    can_disable();
+    can_set_loopback(0);
+    if (prev_bus_state == ON_BUS)
+    {
+        can_enable();
+    }
+
+    state = BENCH_IDLE;
+    bench_report();
+}
+
+// Queue the next generated frame
+static void bench_generate(void)
+{
+    FLEXCAN_Mb_Type frame;
+    uint8_t data[8] = {0};
+
+    memset(&frame, 0, sizeof(frame));
+    frame.ID = next_id;
+    frame.FORMAT = FLEXCAN_MbFormat_Standard;
+    frame.TYPE = FLEXCAN_MbType_Data;
+    frame.LENGTH = next_dlc;
+
+    // Payload carries the sequence number so lost frames show on the host
+    frame.BYTE0 = generated >> 24;
+    frame.BYTE1 = generated >> 16;
+    frame.BYTE2 = generated >> 8;
+    frame.BYTE3 = generated;
+    frame.BYTE4 = next_id >> 8;
+    frame.BYTE5 = next_id;
+    frame.BYTE6 = 0x55;
+    frame.BYTE7 = 0xAA;
+
+    can_tx(&frame, data);
+    generated++;
+
+    next_id = (next_id >= params.id_last) ? params.id_first : (next_id + 1);
+    next_dlc = (next_dlc >= params.dlc_max) ? params.dlc_min : (next_dlc + 1);
+}
+
+
+// Start a benchmark run, returns nonzero if the parameters are invalid
+uint8_t bench_start(bench_params_t *p)
+{
+    if (state != BENCH_IDLE || p->id_first > p->id_last || p->id_last > 0x7FF
+        || p->dlc_min > p->dlc_max || p->dlc_max > 8 || p->count == 0)
+    {
+        return 1u;
+    }
+
+    params = *p;
+    memset(&result, 0, sizeof(result));
+    generated = 0;
+    forwarded = 0;
+    cdc_bytes = 0;
+    next_id = params.id_first;
+    next_dlc = params.dlc_min;
+
+    prev_bus_state = can_get_bus_state();
+    can_disable();
+    can_set_loopback(1);
+    can_enable();
+
+    start_tick = uwTick;
+    last_tick = start_tick;
+    state = BENCH_RUNNING;
+
+    return 0u;
+}
+
+// Abort a run and report what was measured so far
+void bench_stop(void)
+{
+    if (state != BENCH_IDLE)
+    {
+        bench_finish();
+    }
+}
+
+uint8_t bench_running(void)
+{
+    return state != BENCH_IDLE;
+}
+
+// Generate traffic at the requested rate and detect the end of the run
+void bench_process(void)
+{
+    uint32_t now = uwTick;
+
+    if (state == BENCH_RUNNING)
+    {
+        // Frames due so far at the requested rate
+        uint32_t due = params.count;
+        if (params.rate)
+        {
+            due = (uint32_t)(((uint64_t)(now - start_tick) * params.rate) / 1000u) + 1;
+            if (due > params.count)
+            {
+                due = params.count;
+            }
+        }
+
+        while (generated < due && can_tx_free() > 0)
+        {
+            bench_generate();
+        }
+
+        if (generated >= params.count)
+        {
+            state = BENCH_SETTLING;
+            last_tick = now;
+        }
+    }
+    else if (state == BENCH_SETTLING)
+    {
+        if (forwarded >= generated || (now - last_tick) > BENCH_SETTLE_MS)
+        {
+            bench_finish();
+        }
+    }
+}
+
+// Account a frame the RX path has handed to the CDC FIFO
+void bench_rx_forwarded(uint16_t bytes)
+{
+    if (state == BENCH_IDLE)
+    {
+        return;
+    }
+
+    forwarded++;
+    cdc_bytes += bytes;
+    last_tick = uwTick;
+}
+
+void bench_get_result(bench_result_t *out)
+{
+    *out = result;
+}
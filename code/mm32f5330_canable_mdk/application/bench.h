@@ -0,0 +1,35 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include "stdint.h"
+
+// Time allowed for looped-back frames to arrive after the last transmit
+#define BENCH_SETTLE_MS     100u
+
+typedef struct bench_params_
+{
+    uint16_t id_first;      // Standard IDs cycled through first..last
+    uint16_t id_last;
+    uint8_t dlc_min;        // DLCs cycled through min..max
+    uint8_t dlc_max;
+    uint32_t count;         // Number of frames to generate
+    uint16_t rate;          // Frames per second, 0 = as fast as possible
+} bench_params_t;
+
+typedef struct bench_result_
+{
+    uint32_t frames;        // Frames which made it to the CDC FIFO
+    uint32_t frames_per_s;
+    uint32_t cdc_bytes_per_s;   // slcan bytes put into the CDC TX FIFO
+    uint32_t drops;         // Generated but never forwarded
+} bench_result_t;
+
+// Prototypes
+uint8_t bench_start(bench_params_t *params);
+void bench_stop(void);
+uint8_t bench_running(void);
+void bench_process(void);
+void bench_rx_forwarded(uint16_t cdc_bytes);
+void bench_get_result(bench_result_t *result);
+
+#endif // _BENCH_H
@@ -0,0 +1,217 @@
+//
+// busload: Exact on-wire bit accounting and bus load measurement
+//
+
+#include "busload.h"
+#include "can.h"
+#include "led.h"
+
+// CAN CRC-15 generator polynomial x^15+x^14+x^10+x^8+x^7+x^4+x^3+1
+#define BUSLOAD_CRC15_POLY  0x4599u
+#define BUSLOAD_CRC15_MASK  0x7FFFu
+
+// State of a frame being serialised bit by bit from SOF up to the CRC
+typedef struct busload_stream_
+{
+    uint16_t crc;       // Running CRC-15 over SOF..data
+    uint16_t bits;      // Bits emitted so far including stuff bits
+    uint8_t last;       // Level of the previous bit on the wire
+    uint8_t run;        // Number of consecutive bits at that level
+} busload_stream_t;
+
+// Private variables
+static uint32_t window_ms = BUSLOAD_WINDOW_DEFAULT_MS;
+static uint32_t window_start = 0;
+static uint32_t window_bits = 0;
+static uint32_t window_frames = 0;
+static busload_stats_t stats = {0};
+
+
+// Push the nbits least significant bits of value (MSB first) onto the wire
+static void busload_push(busload_stream_t *s, uint32_t value, uint8_t nbits, uint8_t update_crc)
+{
+    while (nbits > 0)
+    {
+        nbits--;
+        uint8_t bit = (value >> nbits) & 1u;
+
+        if (update_crc)
+        {
+            uint8_t crcnxt = bit ^ ((s->crc >> 14) & 1u);
+            s->crc = (s->crc << 1) & BUSLOAD_CRC15_MASK;
+            if (crcnxt)
+            {
+                s->crc ^= BUSLOAD_CRC15_POLY;
+            }
+        }
+
+        s->bits++;
+        if (s->run > 0 && bit == s->last)
+        {
+            s->run++;
+        } else {
+            s->last = bit;
+            s->run = 1;
+        }
+
+        // Five equal bits: the transmitter inserts one bit of opposite
+        // level, which itself starts the next run
+        if (s->run == 5)
+        {
+            s->bits++;
+            s->last = !bit;
+            s->run = 1;
+        }
+    }
+}
+
+// Serialise SOF, arbitration, control and data fields of a frame
+static void busload_walk(busload_stream_t *s, FLEXCAN_Mb_Type *frame)
+{
+    uint8_t data[8] = {
+        frame->BYTE0, frame->BYTE1, frame->BYTE2, frame->BYTE3,
+        frame->BYTE4, frame->BYTE5, frame->BYTE6, frame->BYTE7,
+    };
+    uint8_t rtr = (frame->TYPE == FLEXCAN_MbType_Remote);
+    uint8_t dlc = frame->LENGTH;
+    uint8_t data_len = (dlc > 8) ? 8 : dlc;
+
+    s->crc = 0;
+    s->bits = 0;
+    s->last = 0;
+    s->run = 0;
+
+    // SOF (dominant)
+    busload_push(s, 0, 1, 1);
+
+    if (frame->FORMAT == FLEXCAN_MbFormat_Extended)
+    {
+        // Base ID, SRR (recessive), IDE (recessive), extended ID, RTR, r1, r0
+        busload_push(s, (frame->ID >> 18) & 0x7FFu, 11, 1);
+        busload_push(s, 0x3u, 2, 1);
+        busload_push(s, frame->ID & 0x3FFFFu, 18, 1);
+        busload_push(s, rtr, 1, 1);
+        busload_push(s, 0, 2, 1);
+    } else {
+        // ID, RTR, IDE (dominant), r0
+        busload_push(s, frame->ID & 0x7FFu, 11, 1);
+        busload_push(s, rtr, 1, 1);
+        busload_push(s, 0, 2, 1);
+    }
+
+    busload_push(s, dlc, 4, 1);
+
+    // Remote frames carry a DLC but no data field
+    if (!rtr)
+    {
+        for (uint8_t i = 0; i < data_len; i++)
+        {
+            busload_push(s, data[i], 8, 1);
+        }
+    }
+}
+
+
+// Reset counters and start a new measurement window
+void busload_init(void)
+{
+    window_start = uwTick;
+    window_bits = 0;
+    window_frames = 0;
+
+    stats.load = 0;
+    stats.peak = 0;
+    stats.peak_tick = 0;
+    stats.frames = 0;
+    stats.window_ms = window_ms;
+}
+
+// Set the measurement window length, restarting the measurement
+void busload_set_window(uint32_t ms)
+{
+    if (ms < BUSLOAD_WINDOW_MIN_MS)
+    {
+        ms = BUSLOAD_WINDOW_MIN_MS;
+    }
+    window_ms = ms;
+
+    busload_init();
+}
+
+// Compute the CRC-15 which is transmitted in the frame's CRC field
+uint16_t busload_crc15(FLEXCAN_Mb_Type *frame)
+{
+    busload_stream_t s;
+    busload_walk(&s, frame);
+    return s.crc;
+}
+
+// Compute the exact number of bit times a frame occupies on the bus,
+// including stuff bits and the intermission following the frame
+uint16_t busload_frame_bits(FLEXCAN_Mb_Type *frame)
+{
+    busload_stream_t s;
+    busload_walk(&s, frame);
+
+    // The CRC sequence is subject to stuffing as well
+    busload_push(&s, s.crc, 15, 0);
+
+    return s.bits + BUSLOAD_TRAILER_BITS;
+}
+
+// Account a frame seen on the bus (received or transmitted)
+void busload_add_frame(FLEXCAN_Mb_Type *frame)
+{
+    busload_add_bits(busload_frame_bits(frame), 1u);
+}
+
+// Account frames sized elsewhere, e.g. by an interrupt which may not
+// touch the window itself
+void busload_add_bits(uint32_t bits, uint32_t frames)
+{
+    window_bits += bits;
+    window_frames += frames;
+}
+
+// Close the measurement window once it has elapsed
+void busload_process(void)
+{
+    uint32_t now = uwTick;
+
+    if ((now - window_start) < window_ms)
+    {
+        return;
+    }
+
+    uint32_t bitrate = can_get_bitrate();
+    uint32_t load = 0;
+
+    if (bitrate > 0)
+    {
+        // Bits available in the window: bitrate * window_ms / 1000
+        uint64_t capacity = (uint64_t)bitrate * (now - window_start);
+        load = (uint32_t)(((uint64_t)window_bits * BUSLOAD_FULL_SCALE * 1000u) / capacity);
+        if (load > BUSLOAD_FULL_SCALE)
+        {
+            load = BUSLOAD_FULL_SCALE;
+        }
+    }
+
+    stats.load = load;
+    stats.frames = window_frames;
+    if (load > stats.peak)
+    {
+        stats.peak = load;
+        stats.peak_tick = now;
+    }
+
+    window_start = now;
+    window_bits = 0;
+    window_frames = 0;
+}
+
+// Copy out the results of the last completed window
+void busload_get_stats(busload_stats_t *out)
+{
+    *out = stats;
+}
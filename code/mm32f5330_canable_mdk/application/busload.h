@@ -0,0 +1,37 @@
+#ifndef _BUSLOAD_H
+#define _BUSLOAD_H
+
+#include "stdint.h"
+#include "hal_flexcan.h"
+
+// Default measurement window in milliseconds
+#define BUSLOAD_WINDOW_DEFAULT_MS   1000u
+#define BUSLOAD_WINDOW_MIN_MS       10u
+
+// Bits following the CRC sequence which are never stuffed:
+// CRC delimiter (1), ACK slot (1), ACK delimiter (1), EOF (7), intermission (3)
+#define BUSLOAD_TRAILER_BITS        13u
+
+// Load values are reported in units of 0.01 %
+#define BUSLOAD_FULL_SCALE          10000u
+
+typedef struct busload_stats_
+{
+    uint16_t load;          // Load of the last completed window
+    uint16_t peak;          // Highest load of any window since reset
+    uint32_t peak_tick;     // uwTick at the end of the peak window
+    uint32_t window_ms;     // Length of a measurement window
+    uint32_t frames;        // Frames counted in the last completed window
+} busload_stats_t;
+
+// Prototypes
+void busload_init(void);
+void busload_set_window(uint32_t window_ms);
+uint16_t busload_frame_bits(FLEXCAN_Mb_Type *frame);
+uint16_t busload_crc15(FLEXCAN_Mb_Type *frame);
+void busload_add_frame(FLEXCAN_Mb_Type *frame);
+void busload_add_bits(uint32_t bits, uint32_t frames);
+void busload_process(void);
+void busload_get_stats(busload_stats_t *stats);
+
+#endif // _BUSLOAD_H
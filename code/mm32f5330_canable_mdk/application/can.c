@@ -1,6 +1,22 @@
+#include <string.h>
 #include "can.h"
 #include "led.h"
 #include "error.h"
+#include "busload.h"
+#include "config.h"
+#include "remote.h"
+#include "e2e.h"
+#include "latency.h"
+#include "ecu.h"
+#include "profile.h"
+#include "timebase.h"
+
+// Frame taken from the RX FIFO by the interrupt, waiting for the main loop
+typedef struct can_rx_slot_
+{
+    FLEXCAN_Mb_Type frame;
+    uint32_t time_us;       // timebase_us() when read from the FIFO
+} can_rx_slot_t;
 
 static FLEXCAN_TimConf_Type flexcan_tim_conf;
 static FLEXCAN_Init_Type flexcan_init;
@@ -8,8 +24,22 @@ static FLEXCAN_RxFifoConf_Type rxfifo_conf;
 static FLEXCAN_RxFifoMaskConf_Type rxfifo_mask;
 static can_bus_state_t bus_state = OFF_BUS;
 static uint8_t can_autoretransmit = 1u;
+static uint8_t can_silent = 0u;
+static uint8_t can_loopback = 0u;
 static uint32_t can_bitrate;
+static enum can_bitrate can_bitrate_index = CAN_BITRATE_125K;
+static uint32_t can_filter_table[1] = {0};
+static uint32_t can_filter_id = 0;
+static uint32_t can_filter_mask = 0;
+static uint8_t can_filter_ext = 0;
 static can_txbuf_t txqueue = {0};
+static uint32_t can_error_flags = 0;
+static can_rx_slot_t rx_ring[CAN_RX_RING_LEN];
+static volatile uint8_t rx_head = 0;     // Written by the RX interrupt
+static volatile uint8_t rx_tail = 0;     // Written by the main loop
+static uint32_t rx_time_us = 0;
+static volatile uint32_t rx_lost = 0;    // Frames lost, counted by the RX interrupt
+static uint32_t rx_lost_reported = 0;
 
 void app_flexcan_init(void);          /* Setup flexcan. */
 void app_flexcan_tx(uint8_t *tx_buf); /* Transport frame. */
@@ -50,14 +80,42 @@ void can_init(void)
     
 
     /* Set rx_fifo. */
-    uint32_t FileterTable[] = {0,0,0,0};
     rxfifo_conf.FilterFormat = FLEXCAN_FifoIdFilterFormat_A;
     rxfifo_conf.IdFilterNum = 1;
     rxfifo_conf.priority = FLEXCAN_FifoPriority_FifoFirst;
-    rxfifo_conf.IdFilterTable = FileterTable;
+    rxfifo_conf.IdFilterTable = can_filter_table;
     
 
     bus_state = OFF_BUS;
+    can_bitrate = APP_FLEXCAN_XFER_BITRATE;
+
+    // Above the timebase, so that ECU rules answer within microseconds
+    // whatever else is running; only the FIFO interrupt is ever unmasked,
+    // and only while on-bus
+    NVIC_SetPriority(BOARD_FLEXCAN_IRQn, 0u);
+    NVIC_EnableIRQ(BOARD_FLEXCAN_IRQn);
+
+    // Restore the stored configuration and go on-bus straight away if asked to
+    config_t config;
+    if (config_load(&config) && config.bitrate < CAN_BITRATE_INVALID)
+    {
+        if (config.prop_seg && config.phase_seg1 && config.phase_seg2 && config.jump_width)
+        {
+            flexcan_tim_conf.PropSegLen = config.prop_seg;
+            flexcan_tim_conf.PhaSegLen1 = config.phase_seg1;
+            flexcan_tim_conf.PhaSegLen2 = config.phase_seg2;
+            flexcan_tim_conf.JumpWidth  = config.jump_width;
+        }
+        can_set_bitrate(config.bitrate);
+        can_set_silent(config.silent);
+        can_set_autoretransmit(config.autoretransmit);
+        can_set_filter(config.filter_id, config.filter_mask, config.filter_ext);
+
+        if (config.autoopen)
+        {
+            can_enable();
+        }
+    }
 }
 
 // Start the CAN peripheral
@@ -71,21 +129,43 @@ void can_enable(void)
         
         FLEXCAN_SetRxFifoGlobalMaskConf(BOARD_FLEXCAN_PORT, &rxfifo_mask);
         FLEXCAN_EnableRxFifo(BOARD_FLEXCAN_PORT, &rxfifo_conf);
-        
+
+        // Frames left from the last session are dropped with the FIFO
+        rx_tail = rx_head;
+        FLEXCAN_EnableMbInterrupts(BOARD_FLEXCAN_PORT, BOARD_FLEXCAN_RXFIFO_AVAIL_INT, true);
+
         bus_state = ON_BUS;
+        remote_apply();
 
         led_blue_on();
     }
 }
 
+// Start the CAN peripheral listen-only for this session, whatever the
+// configured mode; the next can_enable() uses the configured mode again
+void can_enable_listen_only(void)
+{
+    if (bus_state == OFF_BUS)
+    {
+        FLEXCAN_WorkMode_Type mode = flexcan_init.WorkMode;
+        flexcan_init.WorkMode = FLEXCAN_WorkMode_ListenOnly;
+        can_enable();
+        flexcan_init.WorkMode = mode;
+    }
+}
+
 // Disable the CAN peripheral and go off-bus
 void can_disable(void)
 {
     if (bus_state == ON_BUS)
     {
+        FLEXCAN_EnableMbInterrupts(BOARD_FLEXCAN_PORT, BOARD_FLEXCAN_RXFIFO_AVAIL_INT, false);
         FLEXCAN_Enable(BOARD_FLEXCAN_PORT, false);
         bus_state = OFF_BUS;
 
+        // Frames not yet in the mailbox are dropped with the channel
+        txqueue.tail = txqueue.head;
+
         led_green_on();
     }
 }
@@ -99,6 +179,8 @@ void can_set_bitrate(enum can_bitrate bitrate)
         return;
     }
 
+    can_bitrate_index = bitrate;
+
     switch (bitrate)
     {
         case CAN_BITRATE_10K:
@@ -138,6 +220,12 @@ void can_set_bitrate(enum can_bitrate bitrate)
     led_green_on();
 }
 
+// Get the bitrate the CAN peripheral is (or will be) running at
+uint32_t can_get_bitrate(void)
+{
+    return can_bitrate;
+}
+
 // Set CAN peripheral to silent mode
 void can_set_silent(uint8_t silent)
 {
@@ -146,6 +234,7 @@ void can_set_silent(uint8_t silent)
         // cannot set silent mode while on bus
         return;
     }
+    can_silent = (silent != 0);
     if (silent)
     {
         flexcan_init.WorkMode = FLEXCAN_WorkMode_ListenOnly;
@@ -156,6 +245,26 @@ void can_set_silent(uint8_t silent)
     led_green_on();
 }
 
+// Set CAN peripheral to internal loopback mode, frames sent are received
+// back without driving the bus
+void can_set_loopback(uint8_t loopback)
+{
+    if (bus_state == ON_BUS)
+    {
+        // cannot set loopback mode while on bus
+        return;
+    }
+    can_loopback = (loopback != 0);
+    if (can_loopback)
+    {
+        flexcan_init.WorkMode = FLEXCAN_WorkMode_LoopBack;
+        flexcan_init.EnableSelfReception = true;
+    } else {
+        flexcan_init.WorkMode = can_silent ? FLEXCAN_WorkMode_ListenOnly : FLEXCAN_WorkMode_Normal;
+        flexcan_init.EnableSelfReception = false;
+    }
+}
+
 // Enable/disable auto-retransmission
 void can_set_autoretransmit(uint8_t autoretransmit)
 {
@@ -164,6 +273,7 @@ void can_set_autoretransmit(uint8_t autoretransmit)
         // Cannot set autoretransmission while on bus
         return;
     }
+    can_autoretransmit = (autoretransmit != 0);
     if (autoretransmit)
     {
         //can_autoretransmit = ENABLE;
@@ -174,6 +284,102 @@ void can_set_autoretransmit(uint8_t autoretransmit)
     led_green_on();
 }
 
+// Set the RX acceptance filter, a mask of 0 accepts all frames
+void can_set_filter(uint32_t id, uint32_t mask, uint8_t extended)
+{
+    if (bus_state == ON_BUS)
+    {
+        // Cannot change filters while on bus
+        return;
+    }
+
+    can_filter_id = id;
+    can_filter_mask = mask;
+    can_filter_ext = (extended != 0);
+
+    // Format A element: RTR[31] IDE[30] ID[29:1], standard IDs in [29:19]
+    if (can_filter_ext)
+    {
+        can_filter_table[0] = (1u << 30) | ((id & 0x1FFFFFFFu) << 1);
+    } else {
+        can_filter_table[0] = (id & 0x7FFu) << 19;
+    }
+
+    // The mask is always given in extended layout so that IDE is compared
+    // as well; with a zero mask nothing is compared at all
+    rxfifo_mask.MbType = FLEXCAN_MbType_Data;
+    if (mask == 0)
+    {
+        rxfifo_mask.MbFormat = FLEXCAN_MbFormat_Standard;
+        rxfifo_mask.RxIdA = 0x0;
+    } else if (can_filter_ext) {
+        rxfifo_mask.MbFormat = FLEXCAN_MbFormat_Extended;
+        rxfifo_mask.RxIdA = mask & 0x1FFFFFFFu;
+    } else {
+        rxfifo_mask.MbFormat = FLEXCAN_MbFormat_Extended;
+        rxfifo_mask.RxIdA = (mask & 0x7FFu) << 18;
+    }
+
+    led_green_on();
+}
+
+// Store the current settings in flash. autostart follows the slcan 'Q'
+// command: 0 = stay off-bus, 1 = open on power-up, 2 = open listen-only
+uint8_t can_store_config(uint8_t autostart)
+{
+    config_t config;
+
+    memset(&config, 0, sizeof(config));
+    config.bitrate = can_bitrate_index;
+    config.silent = (autostart == 2) ? 1 : can_silent;
+    config.autoretransmit = can_autoretransmit;
+    config.autoopen = (autostart != 0);
+    config.prop_seg = flexcan_tim_conf.PropSegLen;
+    config.phase_seg1 = flexcan_tim_conf.PhaSegLen1;
+    config.phase_seg2 = flexcan_tim_conf.PhaSegLen2;
+    config.jump_width = flexcan_tim_conf.JumpWidth;
+    config.filter_id = can_filter_id;
+    config.filter_mask = can_filter_mask;
+    config.filter_ext = can_filter_ext;
+
+    if (!config_save(&config))
+    {
+        error_assert(ERR_FLASH_WRITE);
+        return 1u;
+    }
+    return 0u;
+}
+
+// Get whether the CAN peripheral is on bus
+can_bus_state_t can_get_bus_state(void)
+{
+    return bus_state;
+}
+
+// Read the FlexCAN status. Error flags clear on read, so they are
+// latched here until collected with can_take_errors()
+uint32_t can_get_status(void)
+{
+    uint32_t status = FLEXCAN_GetStatus(BOARD_FLEXCAN_PORT);
+    can_error_flags |= status & CAN_STATUS_ERRORS;
+    return status;
+}
+
+// Return and clear the error flags latched since the last call
+uint32_t can_take_errors(void)
+{
+    uint32_t flags = can_error_flags | (can_get_status() & CAN_STATUS_ERRORS);
+    can_error_flags = 0;
+    return flags;
+}
+
+// Number of frames which can still be queued by can_tx()
+uint8_t can_tx_free(void)
+{
+    // One slot always stays empty to tell a full queue from an empty one
+    return (TXQUEUE_LEN - 1) - ((txqueue.head + TXQUEUE_LEN - txqueue.tail) % TXQUEUE_LEN);
+}
+
 // Send a message on the CAN bus
 uint32_t can_tx(FLEXCAN_Mb_Type *tx_msg_header, uint8_t* tx_msg_data)
 {
@@ -186,6 +392,7 @@ uint32_t can_tx(FLEXCAN_Mb_Type *tx_msg_header, uint8_t* tx_msg_data)
 
     // Copy header struct into array
     txqueue.header[txqueue.head] = *tx_msg_header;
+    LATENCY_TX_QUEUED(txqueue.head);
 
     // Increment the head pointer
     txqueue.head = (txqueue.head + 1) % TXQUEUE_LEN;
@@ -193,25 +400,93 @@ uint32_t can_tx(FLEXCAN_Mb_Type *tx_msg_header, uint8_t* tx_msg_data)
     return 0u;
 }
 
-// Receive message from the CAN bus RXFIFO
+// Receive the next message taken from the CAN bus RXFIFO by the interrupt
 uint32_t can_rx(FLEXCAN_Mb_Type *rx_msg_header, uint8_t* rx_msg_data)
 {
-    uint32_t status = FLEXCAN_ReadRxFifo(BOARD_FLEXCAN_PORT, rx_msg_header);//HAL_CAN_GetRxMessage(&can_handle, CAN_RX_FIFO0, rx_msg_header, rx_msg_data);
-    FLEXCAN_ClearMbStatus(BOARD_FLEXCAN_PORT, BOARD_FLEXCAN_RXFIFO_AVAIl_STATUS);
+    (void)rx_msg_data;
+
+    uint8_t tail = rx_tail;
+    if (tail == rx_head)
+    {
+        return false;
+    }
+    *rx_msg_header = rx_ring[tail].frame;
+    rx_time_us = rx_ring[tail].time_us;
+    rx_tail = (tail + 1) % CAN_RX_RING_LEN;
 
     led_blue_on();
 
-    return status;
+    return true;
+}
+
+// Time the frame last returned by can_rx() was read from the RX FIFO
+uint32_t can_rx_time(void)
+{
+    return rx_time_us;
+}
+
+// Number of frames taken from the RX FIFO and not yet read by can_rx()
+uint8_t can_rx_count(void)
+{
+    return (rx_head + CAN_RX_RING_LEN - rx_tail) % CAN_RX_RING_LEN;
+}
+
+// Move every frame from the RX FIFO into the ring; the ECU simulation
+// answers each one here, before the main loop gets to see it. With the
+// ring full the frame is still answered, then dropped.
+void BOARD_FLEXCAN_IRQHandler(void)
+{
+    can_rx_slot_t spare;
+
+    while (FLEXCAN_GetMbStatus(BOARD_FLEXCAN_PORT) & BOARD_FLEXCAN_RXFIFO_AVAIl_STATUS)
+    {
+        uint8_t head = rx_head;
+        uint8_t next = (head + 1) % CAN_RX_RING_LEN;
+        can_rx_slot_t *slot = (next == rx_tail) ? &spare : &rx_ring[head];
+
+        FLEXCAN_ReadRxFifo(BOARD_FLEXCAN_PORT, &slot->frame);
+        slot->time_us = timebase_us();
+        FLEXCAN_ClearMbStatus(BOARD_FLEXCAN_PORT, BOARD_FLEXCAN_RXFIFO_AVAIl_STATUS);
+
+        PROFILE_ENTER(PROFILE_ECU_RX);
+        ecu_rx_frame(&slot->frame);
+        PROFILE_EXIT(PROFILE_ECU_RX);
+
+        if (slot == &spare)
+        {
+            rx_lost++;
+        } else {
+            rx_head = next;
+        }
+    }
+
+    // Frames arriving while the FIFO was full have been lost
+    if (FLEXCAN_GetMbStatus(BOARD_FLEXCAN_PORT) & BOARD_FLEXCAN_RXFIFO_OVERFLOW_STATUS)
+    {
+        FLEXCAN_ClearMbStatus(BOARD_FLEXCAN_PORT, BOARD_FLEXCAN_RXFIFO_OVERFLOW_STATUS);
+        rx_lost++;
+    }
 }
 
 // Process messages in the TX output queue
 void can_process(void)
 {
-    if((txqueue.tail != txqueue.head) && ((FLEXCAN_GetStatus(BOARD_FLEXCAN_PORT) & FLEXCAN_STATUS_TX) == 0u) )
+    // Frames the RX interrupt could not keep, error_assert() is not
+    // interrupt safe
+    uint32_t lost = rx_lost;
+    for (; rx_lost_reported != lost; rx_lost_reported++)
+    {
+        error_assert(ERR_CANRXFIFO_OVERFLOW);
+    }
+
+    if((bus_state == ON_BUS) && (txqueue.tail != txqueue.head) && ((can_get_status() & FLEXCAN_STATUS_TX) == 0u) )
     {
-        // Transmit can frame
+        // Transmit can frame, E2E counter and CRC are filled in last
+        e2e_protect(&txqueue.header[txqueue.tail]);
         uint32_t status = FLEXCAN_WriteTxMb(BOARD_FLEXCAN_PORT, BOARD_FLEXCAN_TX_MB_CH, &txqueue.header[txqueue.tail]);
         FLEXCAN_SetMbCode(BOARD_FLEXCAN_PORT, BOARD_FLEXCAN_TX_MB_CH, FLEXCAN_MbCode_TxDataOrRemote); /* Write code to send. */
+        busload_add_frame(&txqueue.header[txqueue.tail]);
+        LATENCY_TX_LOADED(txqueue.tail);
         txqueue.tail = (txqueue.tail + 1) % TXQUEUE_LEN;
 
         led_green_on();
@@ -225,12 +500,12 @@ void can_process(void)
     }
 }
 
-// Check if a CAN message has been received and is waiting in the FIFO
+// Check if a CAN message has been received and is waiting in the ring
 uint8_t is_can_msg_pending(void)
 {
     if (bus_state == OFF_BUS)
     {
         return 0;
     }
-    return ((FLEXCAN_GetMbStatus(BOARD_FLEXCAN_PORT) & BOARD_FLEXCAN_RXFIFO_AVAIl_STATUS) > 0);
+    return (rx_head != rx_tail);
 }
@@ -10,6 +10,7 @@
 
 #include "board_init.h"
 #include "hal_flexcan.h"
+#include "mem_plan.h"
 
 enum can_bitrate {
     CAN_BITRATE_10K = 0,
@@ -30,8 +31,19 @@ typedef enum can_bus_state {
     ON_BUS = 1,
 } can_bus_state_t;
 
+// FlexCAN status flags reporting an error frame on the bus
+#define CAN_STATUS_ERRORS (FLEXCAN_STATUS_STFERR | FLEXCAN_STATUS_FMRERR | FLEXCAN_STATUS_CRCERR \
+                         | FLEXCAN_STATUS_ACKERR | FLEXCAN_STATUS_BIT0ERR | FLEXCAN_STATUS_BIT1ERR)
+
+// Maximum number of frames taken from the RX ring per main loop pass
+#define CAN_RX_BURST 6
+
+// Frames the RX FIFO interrupt can hold for the main loop, one slot
+// always stays empty
+#define CAN_RX_RING_LEN 16
+
 // CAN transmit buffering
-#define TXQUEUE_LEN 28 // Number of buffers allocated
+#define TXQUEUE_LEN MEM_CAN_TXQ_LEN // Number of buffers allocated
 #define TXQUEUE_DATALEN 8 // CAN DLC length of data buffers
 
 typedef struct cantxbuf_
@@ -48,12 +60,23 @@ typedef struct cantxbuf_
 // Prototypes
 void can_init(void);
 void can_enable(void);
+void can_enable_listen_only(void);
 void can_disable(void);
 void can_set_bitrate(enum can_bitrate bitrate);
+uint32_t can_get_bitrate(void);
 void can_set_silent(uint8_t silent);
+void can_set_loopback(uint8_t loopback);
 void can_set_autoretransmit(uint8_t autoretransmit);
+void can_set_filter(uint32_t id, uint32_t mask, uint8_t extended);
+uint8_t can_store_config(uint8_t autostart);
+can_bus_state_t can_get_bus_state(void);
+uint8_t can_tx_free(void);
+uint32_t can_get_status(void);
+uint32_t can_take_errors(void);
 uint32_t can_tx(FLEXCAN_Mb_Type *tx_msg_header, uint8_t *tx_msg_data);
 uint32_t can_rx(FLEXCAN_Mb_Type *rx_msg_header, uint8_t *rx_msg_data);
+uint32_t can_rx_time(void);
+uint8_t can_rx_count(void);
 void can_process(void);
 uint8_t is_can_msg_pending(void);
 
@@ -0,0 +1,458 @@
+//
+// cannelloni: CAN over UDP on the CDC-NCM network function
+//
+// There is no IP stack, only what a point to point USB link needs: ARP
+// replies for our address and IPv4/UDP datagrams to the cannelloni port.
+// Frames of a datagram from the host are queued for the bus, the datagram
+// is held until they all fit into the CAN TX queue. Received frames go to
+// the peer that sent the last datagram, batched into one datagram which
+// is sent once full or CANNELLONI_FLUSH_MS after its first frame.
+//
+
+#include <string.h>
+#include "cannelloni.h"
+
+#if APP_NCM_ENABLE
+
+#include "can.h"
+#include "error.h"
+#include "led.h"
+#include "tusb.h"
+
+#define ETH_HDR_LEN         14u
+#define ETH_TYPE_IPV4       0x0800u
+#define ETH_TYPE_ARP        0x0806u
+#define ARP_LEN             28u
+#define IP_HDR_LEN          20u
+#define IP_PROTO_UDP        17u
+#define UDP_HDR_LEN         8u
+
+// cannelloni version 2 data datagrams
+#define CNL_VERSION         2u
+#define CNL_OP_DATA         0u
+#define CNL_HDR_LEN         5u
+#define CNL_EFF_FLAG        0x80000000u
+#define CNL_RTR_FLAG        0x40000000u
+#define CNL_ERR_FLAG        0x20000000u
+#define CNL_FD_FLAG         0x80u       // In the length byte, a flags byte follows
+#define CNL_FRAME_MAX       (4u + 1u + 8u)
+
+#define CNL_HEADERS_LEN     (ETH_HDR_LEN + IP_HDR_LEN + UDP_HDR_LEN + CNL_HDR_LEN)
+
+// Packets built by tud_network_xmit_cb()
+enum
+{
+    CNL_TX_ARP_REPLY = 0,
+    CNL_TX_BATCH,
+};
+
+// Host side MAC address, announced in the NCM descriptor. Ours is the
+// same with the lowest bit of the last byte inverted
+const uint8_t tud_network_mac_address[6] = {0x02u, 0x02u, 0x84u, 0x6Au, 0x96u, 0x00u};
+
+// Private variables
+static const uint8_t own_ip[4] = CANNELLONI_IP;
+
+// Ethernet frame handed over by the NCM driver, owned until renewed
+static const uint8_t * volatile rx_frame = NULL;
+static uint16_t rx_len = 0;
+static uint16_t rx_pos = 0;         // Next cannelloni frame, 0 before parsing
+static uint16_t rx_end = 0;
+static uint16_t rx_left = 0;        // Frames announced and not read yet
+
+static uint8_t peer_valid = 0;
+static uint8_t peer_mac[6];
+static uint8_t peer_ip[4];
+static uint16_t peer_port = 0;
+
+static uint8_t arp_pending = 0;
+static uint8_t arp_mac[6];
+static uint8_t arp_ip[4];
+
+static uint8_t batch[MEM_NCM_BATCH];
+static uint16_t batch_len = 0;
+static uint16_t batch_count = 0;
+static uint32_t batch_tick = 0;
+static uint8_t tx_seq = 0;
+static uint16_t ip_id = 0;
+
+
+static uint16_t cnl_get16(const uint8_t *p)
+{
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static uint32_t cnl_get32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint8_t *cnl_put16(uint8_t *p, uint16_t v)
+{
+    *p++ = v >> 8;
+    *p++ = v & 0xFFu;
+    return p;
+}
+
+static uint8_t *cnl_put_own_mac(uint8_t *p)
+{
+    memcpy(p, tud_network_mac_address, 6);
+    p[5] ^= 0x01u;
+    return p + 6;
+}
+
+// Ones' complement sum over the IPv4 header, 0 if a received one is intact
+static uint16_t cnl_ip_checksum(const uint8_t *hdr, uint16_t len)
+{
+    uint32_t sum = 0;
+
+    for (uint16_t i = 0; i < len; i += 2)
+    {
+        sum += cnl_get16(&hdr[i]);
+    }
+    while (sum >> 16)
+    {
+        sum = (sum & 0xFFFFu) + (sum >> 16);
+    }
+    return ~sum & 0xFFFFu;
+}
+
+// ARP request for our address: remember whom to answer
+static uint8_t cnl_input_arp(const uint8_t *arp, uint16_t len)
+{
+    if (len < ARP_LEN || cnl_get16(&arp[0]) != 1u || cnl_get16(&arp[2]) != ETH_TYPE_IPV4
+        || arp[4] != 6u || arp[5] != 4u || cnl_get16(&arp[6]) != 1u
+        || memcmp(&arp[24], own_ip, 4) != 0)
+    {
+        return 1u;
+    }
+
+    // Hold the request until the previous reply has been sent
+    if (arp_pending)
+        return 0u;
+
+    memcpy(arp_mac, &arp[8], 6);
+    memcpy(arp_ip, &arp[14], 4);
+    arp_pending = 1;
+    return 1u;
+}
+
+// Locate the cannelloni payload of a datagram to our port, learn the peer
+static uint8_t cnl_input_ip(const uint8_t *frame, uint16_t len)
+{
+    const uint8_t *ip = frame + ETH_HDR_LEN;
+    len -= ETH_HDR_LEN;
+
+    if (len < IP_HDR_LEN || (ip[0] >> 4) != 4u)
+        return 1u;
+
+    uint16_t ihl = (ip[0] & 0x0Fu) * 4u;
+    uint16_t total = cnl_get16(&ip[2]);
+
+    // No fragments, the host keeps datagrams within the MTU
+    if (ihl < IP_HDR_LEN || total < ihl + UDP_HDR_LEN || total > len
+        || (cnl_get16(&ip[6]) & 0x3FFFu) != 0u || ip[9] != IP_PROTO_UDP
+        || memcmp(&ip[16], own_ip, 4) != 0 || cnl_ip_checksum(ip, ihl) != 0u)
+    {
+        return 1u;
+    }
+
+    const uint8_t *udp = ip + ihl;
+    uint16_t udp_len = cnl_get16(&udp[4]);
+    if (cnl_get16(&udp[2]) != CANNELLONI_PORT || udp_len < UDP_HDR_LEN + CNL_HDR_LEN
+        || udp_len > total - ihl)
+    {
+        return 1u;
+    }
+
+    const uint8_t *cnl = udp + UDP_HDR_LEN;
+    if (cnl[0] != CNL_VERSION || cnl[1] != CNL_OP_DATA)
+        return 1u;
+
+    // Received frames go to whoever sent us the last datagram
+    memcpy(peer_mac, &frame[6], 6);
+    memcpy(peer_ip, &ip[12], 4);
+    peer_port = cnl_get16(&udp[0]);
+    peer_valid = 1;
+
+    rx_pos = (cnl + CNL_HDR_LEN) - frame;
+    rx_end = (udp + udp_len) - frame;
+    rx_left = cnl_get16(&cnl[3]);
+    return 0u;
+}
+
+// Queue the frames of a datagram for the bus. Returns 0 while some are
+// still waiting for room in the CAN TX queue
+static uint8_t cnl_input_frames(const uint8_t *frame)
+{
+    FLEXCAN_Mb_Type tx_frame;
+    uint8_t unused[8] = {0};
+
+    while (rx_left && rx_pos + 5u <= rx_end)
+    {
+        if (can_tx_free() == 0u)
+            return 0u;
+
+        uint32_t can_id = cnl_get32(&frame[rx_pos]);
+        uint8_t dlc = frame[rx_pos + 4u];
+        uint16_t pos = rx_pos + 5u;
+        uint8_t size = dlc;
+        uint8_t skip = 0;
+
+        if (dlc & CNL_FD_FLAG)
+        {
+            // CAN FD frames have a flags byte and are skipped
+            size = dlc & ~CNL_FD_FLAG;
+            pos++;
+            skip = 1;
+        } else if (can_id & CNL_RTR_FLAG) {
+            size = 0;
+        }
+
+        if (pos + size > rx_end)
+            break;
+        rx_pos = pos + size;
+        rx_left--;
+
+        if (skip || dlc > 8u || (can_id & CNL_ERR_FLAG))
+            continue;
+
+        memset(&tx_frame, 0, sizeof(tx_frame));
+        if (can_id & CNL_EFF_FLAG)
+        {
+            tx_frame.FORMAT = FLEXCAN_MbFormat_Extended;
+            tx_frame.ID = can_id & 0x1FFFFFFFu;
+        } else {
+            tx_frame.FORMAT = FLEXCAN_MbFormat_Standard;
+            tx_frame.ID = can_id & 0x7FFu;
+        }
+        tx_frame.TYPE = (can_id & CNL_RTR_FLAG) ? FLEXCAN_MbType_Remote : FLEXCAN_MbType_Data;
+        tx_frame.LENGTH = dlc;
+
+        // Payload byte i of a mailbox is byte i ^ 3 of WORD0/WORD1
+        for (uint8_t i = 0; i < size; i++)
+        {
+            ((uint8_t *)&tx_frame.WORD0)[i ^ 3u] = frame[pos + i];
+        }
+        can_tx(&tx_frame, unused);
+    }
+
+    rx_pos = 0;
+    return 1u;
+}
+
+// Handle an Ethernet frame from the host. Returns 1 once it can be released
+static uint8_t cnl_input(const uint8_t *frame, uint16_t len)
+{
+    if (rx_pos == 0u)
+    {
+        if (len < ETH_HDR_LEN)
+            return 1u;
+
+        switch (cnl_get16(&frame[12]))
+        {
+            case ETH_TYPE_ARP:
+                return cnl_input_arp(frame + ETH_HDR_LEN, len - ETH_HDR_LEN);
+
+            case ETH_TYPE_IPV4:
+                if (cnl_input_ip(frame, len))
+                    return 1u;
+                break;
+
+            default:
+                return 1u;
+        }
+    }
+
+    // Frames for a closed bus are dropped rather than blocking the link
+    if (can_get_bus_state() != ON_BUS)
+    {
+        rx_pos = 0;
+        return 1u;
+    }
+    return cnl_input_frames(frame);
+}
+
+// Hand a packet to the NCM driver if it has room in the current block
+static void cnl_xmit(uint16_t len, uint16_t kind)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    // The driver's block state is also used from tud_task() in the USB interrupt
+    if (tud_network_can_xmit(len))
+    {
+        tud_network_xmit(NULL, kind);
+    }
+
+    __set_PRIMASK(primask);
+}
+
+
+// Add a received frame to the next datagram. Returns 0 if there is no
+// peer yet, the frame then goes to the slcan interface. With the batch
+// still full because the host is not taking datagrams the frame is
+// dropped and counted, it must not turn up on slcan instead.
+uint8_t cannelloni_rx_frame(FLEXCAN_Mb_Type *frame)
+{
+    if (!peer_valid)
+        return 0u;
+
+    if (batch_len + CNL_FRAME_MAX > sizeof(batch))
+    {
+        error_assert(ERR_USBTX_BUSY);
+        return 1u;
+    }
+
+    uint32_t can_id = frame->ID;
+    if (frame->FORMAT == FLEXCAN_MbFormat_Extended)
+    {
+        can_id |= CNL_EFF_FLAG;
+    }
+    if (frame->TYPE == FLEXCAN_MbType_Remote)
+    {
+        can_id |= CNL_RTR_FLAG;
+    }
+
+    uint8_t *p = &batch[batch_len];
+    p = cnl_put16(p, can_id >> 16);
+    p = cnl_put16(p, can_id & 0xFFFFu);
+    *p++ = frame->LENGTH;
+    if (frame->TYPE != FLEXCAN_MbType_Remote)
+    {
+        for (uint8_t i = 0; i < frame->LENGTH; i++)
+        {
+            *p++ = ((uint8_t *)&frame->WORD0)[i ^ 3u];
+        }
+    }
+
+    if (batch_count == 0u)
+    {
+        batch_tick = uwTick;
+    }
+    batch_len = p - batch;
+    batch_count++;
+    return 1u;
+}
+
+// Release datagrams from the host once handled, send ARP replies and batches
+void cannelloni_process(void)
+{
+    const uint8_t *frame = rx_frame;
+    if (frame != NULL && cnl_input(frame, rx_len))
+    {
+        // Renewing may hand over the next datagram of the same block at once
+        rx_frame = NULL;
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        tud_network_recv_renew();
+        __set_PRIMASK(primask);
+    }
+
+    if (arp_pending)
+    {
+        cnl_xmit(ETH_HDR_LEN + ARP_LEN, CNL_TX_ARP_REPLY);
+    }
+
+    if (batch_count && (batch_len + CNL_FRAME_MAX > sizeof(batch)
+        || (uwTick - batch_tick) >= CANNELLONI_FLUSH_MS))
+    {
+        cnl_xmit(CNL_HEADERS_LEN + batch_len, CNL_TX_BATCH);
+    }
+}
+
+
+//--------------------------------------------------------------------+
+// Network callbacks, called from tud_task()
+//--------------------------------------------------------------------+
+
+// Take an Ethernet frame; it stays valid until tud_network_recv_renew()
+bool tud_network_recv_cb(const uint8_t *src, uint16_t size)
+{
+    if (rx_frame != NULL)
+        return false;
+
+    rx_len = size;
+    rx_frame = src;
+    return true;
+}
+
+// Build the packet selected by arg into the transfer block
+uint16_t tud_network_xmit_cb(uint8_t *dst, void *ref, uint16_t arg)
+{
+    uint8_t *p = dst;
+    (void) ref;
+
+    if (arg == CNL_TX_ARP_REPLY)
+    {
+        memcpy(p, arp_mac, 6);
+        p = cnl_put_own_mac(p + 6);
+        p = cnl_put16(p, ETH_TYPE_ARP);
+        p = cnl_put16(p, 1u);                   // Ethernet
+        p = cnl_put16(p, ETH_TYPE_IPV4);
+        *p++ = 6u;
+        *p++ = 4u;
+        p = cnl_put16(p, 2u);                   // Reply
+        p = cnl_put_own_mac(p);
+        memcpy(p, own_ip, 4);
+        memcpy(p + 4, arp_mac, 6);
+        memcpy(p + 10, arp_ip, 4);
+        p += 14;
+
+        arp_pending = 0;
+        return p - dst;
+    }
+
+    uint16_t udp_len = UDP_HDR_LEN + CNL_HDR_LEN + batch_len;
+
+    memcpy(p, peer_mac, 6);
+    p = cnl_put_own_mac(p + 6);
+    p = cnl_put16(p, ETH_TYPE_IPV4);
+
+    uint8_t *ip = p;
+    *p++ = 0x45u;                               // IPv4, no options
+    *p++ = 0u;
+    p = cnl_put16(p, IP_HDR_LEN + udp_len);
+    p = cnl_put16(p, ip_id++);
+    p = cnl_put16(p, 0x4000u);                  // Don't fragment
+    *p++ = 64u;                                 // TTL
+    *p++ = IP_PROTO_UDP;
+    p = cnl_put16(p, 0u);
+    memcpy(p, own_ip, 4);
+    memcpy(p + 4, peer_ip, 4);
+    p += 8;
+    cnl_put16(&ip[10], cnl_ip_checksum(ip, IP_HDR_LEN));
+
+    p = cnl_put16(p, CANNELLONI_PORT);
+    p = cnl_put16(p, peer_port);
+    p = cnl_put16(p, udp_len);
+    p = cnl_put16(p, 0u);                       // No UDP checksum
+
+    *p++ = CNL_VERSION;
+    *p++ = CNL_OP_DATA;
+    *p++ = tx_seq++;
+    p = cnl_put16(p, batch_count);
+    memcpy(p, batch, batch_len);
+    p += batch_len;
+
+    batch_len = 0;
+    batch_count = 0;
+    return p - dst;
+}
+
+// The host disabled or enabled the data interface
+void tud_network_link_state_cb(bool state)
+{
+    if (!state)
+    {
+        // The driver starts over, and so does the peer
+        rx_frame = NULL;
+        rx_pos = 0;
+        peer_valid = 0;
+        arp_pending = 0;
+        batch_len = 0;
+        batch_count = 0;
+    }
+}
+
+#endif // APP_NCM_ENABLE
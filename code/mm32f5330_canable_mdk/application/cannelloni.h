@@ -0,0 +1,31 @@
+#ifndef _CANNELLONI_H
+#define _CANNELLONI_H
+
+#include "stdint.h"
+#include "hal_flexcan.h"
+#include "mem_plan.h"
+
+// Address of the device on the USB network link. The host takes another
+// address of the subnet, e.g. 192.168.7.1/24
+#define CANNELLONI_IP       {192u, 168u, 7u, 2u}
+
+// UDP port of the device, cannelloni's default
+#define CANNELLONI_PORT     20000u
+
+// Time (ms) received frames wait for others to share their datagram
+#define CANNELLONI_FLUSH_MS 1u
+
+#if APP_NCM_ENABLE
+
+// Prototypes
+uint8_t cannelloni_rx_frame(FLEXCAN_Mb_Type *frame);
+void cannelloni_process(void);
+
+#else
+
+#define cannelloni_rx_frame(frame)  0u
+#define cannelloni_process()
+
+#endif // APP_NCM_ENABLE
+
+#endif // _CANNELLONI_H
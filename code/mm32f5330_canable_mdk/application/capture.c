@@ -0,0 +1,244 @@
+//
+// capture: Triggered pre/post recording of received frames
+//
+// While armed every received frame is recorded into a RAM ring. When the
+// trigger fires, up to 'pre' frames before it are kept, 'post' more frames
+// are recorded and the ring is frozen until the host streams it out.
+//
+// Payload conditions are staged before arming, so an ID trigger is
+// complete from the first recorded frame on. They apply to the next ID
+// trigger only and are cleared when that capture ends.
+//
+
+#include <string.h>
+#include "capture.h"
+#include "can.h"
+#include "led.h"
+#include "slcan.h"
+#include "tusb.h"
+
+// Longest line streamed for a captured frame:
+// 'x' + 8 digit tick + slcan frame including CR
+#define CAPTURE_LINE_LEN    (1u + 8u + SLCAN_MTU)
+
+typedef enum capture_state_
+{
+    CAPTURE_OFF = 0,
+    CAPTURE_ARMED,      // Recording, waiting for the trigger
+    CAPTURE_POST,       // Triggered, recording the post-trigger frames
+    CAPTURE_FROZEN,     // Snapshot complete, waiting to be streamed
+    CAPTURE_STREAMING,
+} capture_state_t;
+
+// Private variables
+static capture_entry_t ring[CAPTURE_DEPTH];
+static uint8_t head = 0;        // Next slot to write
+static uint8_t filled = 0;      // Valid entries in the ring
+
+static capture_state_t state = CAPTURE_OFF;
+static capture_trigger_t trigger;
+static uint8_t pre_frames;
+static uint8_t post_frames;
+static uint8_t post_left;
+
+static uint32_t match_id;
+static uint32_t match_mask;
+static uint8_t match_ext;
+static uint8_t match_data[8];
+static uint8_t match_data_mask[8];
+
+static uint8_t snap_start;
+static uint8_t snap_len;
+static uint8_t snap_pos;
+
+
+static void capture_clear_payload(void)
+{
+    memset(match_data, 0, sizeof(match_data));
+    memset(match_data_mask, 0, sizeof(match_data_mask));
+}
+
+static uint8_t capture_matches(FLEXCAN_Mb_Type *frame)
+{
+    uint8_t data[8] = {
+        frame->BYTE0, frame->BYTE1, frame->BYTE2, frame->BYTE3,
+        frame->BYTE4, frame->BYTE5, frame->BYTE6, frame->BYTE7,
+    };
+
+    if ((frame->FORMAT == FLEXCAN_MbFormat_Extended) != match_ext)
+        return 0;
+    if ((frame->ID & match_mask) != (match_id & match_mask))
+        return 0;
+
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        if ((data[i] & match_data_mask[i]) != (match_data[i] & match_data_mask[i]))
+            return 0;
+    }
+    return 1;
+}
+
+// Fire the trigger. 'included' is 1 when the triggering frame itself is
+// the newest ring entry, 0 for triggers without a frame (errors).
+static void capture_fire(uint8_t included)
+{
+    uint8_t before = filled - included;
+    if (before > pre_frames)
+    {
+        before = pre_frames;
+    }
+
+    snap_len = before + included;
+    snap_start = (head + CAPTURE_DEPTH - snap_len) % CAPTURE_DEPTH;
+    post_left = post_frames;
+
+    state = (post_left > 0) ? CAPTURE_POST : CAPTURE_FROZEN;
+}
+
+
+// Arm the capture; pre + post + 1 must fit into the ring
+uint8_t capture_arm(capture_trigger_t trig, uint8_t pre, uint8_t post)
+{
+    if ((uint32_t)pre + post + 1 > CAPTURE_DEPTH)
+    {
+        return 1u;
+    }
+
+    trigger = trig;
+    pre_frames = pre;
+    post_frames = post;
+    head = 0;
+    filled = 0;
+
+    // Drop errors seen before arming
+    can_take_errors();
+
+    state = CAPTURE_ARMED;
+    return 0u;
+}
+
+// Set the ID trigger condition, returns nonzero while a capture is recording
+uint8_t capture_set_id(uint32_t id, uint32_t mask, uint8_t extended)
+{
+    if (state == CAPTURE_ARMED || state == CAPTURE_POST)
+    {
+        return 1u;
+    }
+
+    match_id = id;
+    match_mask = mask;
+    match_ext = (extended != 0);
+    return 0u;
+}
+
+// Stage the payload condition for four bytes starting at offset (0 or 4),
+// returns nonzero while a capture is recording
+uint8_t capture_set_payload(uint8_t offset, uint32_t data, uint32_t mask)
+{
+    if (offset > 4 || state == CAPTURE_ARMED || state == CAPTURE_POST)
+    {
+        return 1u;
+    }
+
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        match_data[offset + i] = data >> (24 - 8 * i);
+        match_data_mask[offset + i] = mask >> (24 - 8 * i);
+    }
+    return 0u;
+}
+
+// Stop recording and drop the staged payload conditions
+void capture_disarm(void)
+{
+    state = CAPTURE_OFF;
+    capture_clear_payload();
+}
+
+// Start streaming a frozen snapshot, returns nonzero if there is none
+uint8_t capture_stream(void)
+{
+    if (state != CAPTURE_FROZEN)
+    {
+        return 1u;
+    }
+
+    snap_pos = 0;
+    state = CAPTURE_STREAMING;
+    return 0u;
+}
+
+// Record a frame seen on the bus
+void capture_frame(FLEXCAN_Mb_Type *frame)
+{
+    if (state != CAPTURE_ARMED && state != CAPTURE_POST)
+    {
+        return;
+    }
+
+    ring[head].tick = uwTick;
+    ring[head].frame = *frame;
+    head = (head + 1) % CAPTURE_DEPTH;
+    if (filled < CAPTURE_DEPTH)
+    {
+        filled++;
+    }
+
+    if (state == CAPTURE_POST)
+    {
+        snap_len++;
+        if (--post_left == 0)
+        {
+            state = CAPTURE_FROZEN;
+        }
+    }
+    else if (trigger == CAPTURE_TRIGGER_ID && capture_matches(frame))
+    {
+        capture_fire(1);
+    }
+}
+
+// Watch for error triggers and stream a requested snapshot. Output is
+//   'x' + tick + slcan frame    per captured frame, oldest first
+//   'X' + frame count           end of snapshot
+void capture_process(void)
+{
+    if (state == CAPTURE_ARMED && trigger == CAPTURE_TRIGGER_ERROR)
+    {
+        if (can_take_errors() != 0u)
+        {
+            capture_fire(0);
+        }
+        return;
+    }
+
+    if (state != CAPTURE_STREAMING)
+    {
+        return;
+    }
+
+    uint8_t line[CAPTURE_LINE_LEN];
+    uint8_t pos;
+
+    while (state == CAPTURE_STREAMING && tud_cdc_write_available() >= CAPTURE_LINE_LEN)
+    {
+        pos = 0;
+        if (snap_pos < snap_len)
+        {
+            capture_entry_t *e = &ring[(snap_start + snap_pos) % CAPTURE_DEPTH];
+            line[pos++] = 'x';
+            pos += slcan_put_hex(&line[pos], e->tick, 8);
+            pos += slcan_parse_frame(&line[pos], &e->frame, NULL);
+            snap_pos++;
+        } else {
+            line[pos++] = 'X';
+            pos += slcan_put_hex(&line[pos], snap_len, 4);
+            line[pos++] = '\r';
+            state = CAPTURE_OFF;
+            capture_clear_payload();
+        }
+        tud_cdc_write(line, pos);
+    }
+
+    tud_cdc_write_flush();
+}
@@ -0,0 +1,32 @@
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include "stdint.h"
+#include "hal_flexcan.h"
+
+// Ring depth in frames. 96 entries of 20 bytes take the 2 KB released by
+// setting __HEAP_SIZE to 0 in mm32f5333d_flash.scf.
+#define CAPTURE_DEPTH       96u
+
+typedef enum capture_trigger_
+{
+    CAPTURE_TRIGGER_ID = 1,     // ID/mask (and optional payload) match
+    CAPTURE_TRIGGER_ERROR = 2,  // Error frame seen on the bus
+} capture_trigger_t;
+
+typedef struct capture_entry_
+{
+    uint32_t tick;              // uwTick at reception
+    FLEXCAN_Mb_Type frame;
+} capture_entry_t;
+
+// Prototypes
+uint8_t capture_arm(capture_trigger_t trigger, uint8_t pre, uint8_t post);
+uint8_t capture_set_id(uint32_t id, uint32_t mask, uint8_t extended);
+uint8_t capture_set_payload(uint8_t offset, uint32_t data, uint32_t mask);
+void capture_disarm(void);
+uint8_t capture_stream(void);
+void capture_frame(FLEXCAN_Mb_Type *frame);
+void capture_process(void);
+
+#endif // _CAPTURE_H
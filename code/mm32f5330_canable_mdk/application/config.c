@@ -0,0 +1,169 @@
+//
+// config: Wear-levelled persistent configuration in the last flash page
+//
+// Records are appended to the page one after another; the last record
+// with a good magic and CRC is the current configuration. A record torn by
+// a power loss fails its CRC and is skipped, so the previous one is used.
+// The page is only erased once no blank slot is left.
+//
+
+#include <string.h>
+#include "config.h"
+#include "board_init.h"
+
+// Compile-time check that the record matches its flash slot
+typedef char config_record_size_check[(sizeof(config_record_t) == CONFIG_RECORD_SIZE) ? 1 : -1];
+
+
+// CRC-16/CCITT (poly 0x1021, init 0xFFFF)
+static uint16_t config_crc16(const uint8_t *data, uint32_t len)
+{
+    uint16_t crc = 0xFFFFu;
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t j = 0; j < 8; j++)
+        {
+            crc = (crc & 0x8000u) ? ((crc << 1) ^ 0x1021u) : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+static const config_record_t *config_slot(uint32_t index)
+{
+    return (const config_record_t *)(CONFIG_FLASH_ADDR + index * CONFIG_RECORD_SIZE);
+}
+
+// Returns true if a slot is still in the erased state
+static bool config_slot_blank(uint32_t index)
+{
+    const uint16_t *p = (const uint16_t *)config_slot(index);
+
+    for (uint32_t i = 0; i < CONFIG_RECORD_SIZE / 2; i++)
+    {
+        if (p[i] != 0xFFFFu)
+            return false;
+    }
+    return true;
+}
+
+static bool config_slot_valid(uint32_t index)
+{
+    const config_record_t *rec = config_slot(index);
+
+    return (rec->magic == CONFIG_RECORD_MAGIC)
+        && (rec->crc == config_crc16((const uint8_t *)rec, CONFIG_RECORD_SIZE - 2));
+}
+
+// Index of the newest valid record, or CONFIG_RECORD_NUM if there is none
+static uint32_t config_find_latest(void)
+{
+    uint32_t latest = CONFIG_RECORD_NUM;
+
+    for (uint32_t i = 0; i < CONFIG_RECORD_NUM; i++)
+    {
+        if (config_slot_valid(i))
+            latest = i;
+    }
+    return latest;
+}
+
+static bool config_flash_erase(void)
+{
+    FLASH_SetCmd(FLASH, FLASH_CMD_ERASE_PAGE);
+    FLASH_SetAddr(FLASH, CONFIG_FLASH_ADDR);
+    FLASH_SetCmd(FLASH, FLASH_CMD_START_ERASE);
+    bool done = FLASH_WaitDone(FLASH, CONFIG_FLASH_TIMEOUT);
+    FLASH_ClearCmd(FLASH);
+
+    return done;
+}
+
+static bool config_flash_program(uint32_t addr, const uint16_t *data, uint32_t count)
+{
+    bool done = true;
+
+    FLASH_SetCmd(FLASH, FLASH_CMD_PROGRAM);
+    for (uint32_t i = 0; i < count && done; i++)
+    {
+        FLASH_SetData16b(addr + 2 * i, data[i]);
+        done = FLASH_WaitDone(FLASH, CONFIG_FLASH_TIMEOUT);
+    }
+    FLASH_ClearCmd(FLASH);
+
+    return done;
+}
+
+
+// Load the newest stored configuration, returns false if none is stored
+bool config_load(config_t *config)
+{
+    uint32_t latest = config_find_latest();
+
+    if (latest >= CONFIG_RECORD_NUM)
+        return false;
+
+    *config = config_slot(latest)->config;
+    return true;
+}
+
+// Append a new configuration record, erasing the page when it is full
+bool config_save(const config_t *config)
+{
+    config_record_t rec;
+    uint32_t latest = config_find_latest();
+    uint32_t slot = 0;
+
+    memset(&rec, 0xFF, sizeof(rec));
+    rec.magic = CONFIG_RECORD_MAGIC;
+    rec.seq = (latest < CONFIG_RECORD_NUM) ? (config_slot(latest)->seq + 1) : 0;
+    rec.config = *config;
+    rec.crc = config_crc16((const uint8_t *)&rec, CONFIG_RECORD_SIZE - 2);
+
+    // First blank slot behind everything written so far, torn records included
+    for (uint32_t i = CONFIG_RECORD_NUM; i > 0; i--)
+    {
+        if (!config_slot_blank(i - 1))
+        {
+            slot = i;
+            break;
+        }
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    FLASH_Unlock(FLASH);
+    FLASH_ClearStatus(FLASH, FLASH_STATUS_END_OF_OPERATION
+                           | FLASH_STATUS_PROGRAM_ERR
+                           | FLASH_STATUS_WRITE_PROTECTION_ERR);
+
+    bool done = true;
+    if (slot >= CONFIG_RECORD_NUM)
+    {
+        done = config_flash_erase();
+        slot = 0;
+    }
+    if (done)
+    {
+        done = config_flash_program(CONFIG_FLASH_ADDR + slot * CONFIG_RECORD_SIZE,
+                                    (const uint16_t *)&rec, CONFIG_RECORD_SIZE / 2);
+    }
+
+    FLASH_Lock(FLASH);
+    __set_PRIMASK(primask);
+
+    return done && config_slot_valid(slot);
+}
+
+// Drop all stored configuration records
+void config_erase(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    FLASH_Unlock(FLASH);
+    config_flash_erase();
+    FLASH_Lock(FLASH);
+    __set_PRIMASK(primask);
+}
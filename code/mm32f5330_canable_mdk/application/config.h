@@ -0,0 +1,53 @@
+#ifndef _CONFIG_H
+#define _CONFIG_H
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "hal_flash.h"
+
+// The last flash page is reserved for configuration records (see the
+// __CONFIG_SIZE region carved out in mm32f5333d_flash.scf)
+#define CONFIG_FLASH_BASE       0x08000000u
+#define CONFIG_FLASH_SIZE       0x00020000u
+#define CONFIG_FLASH_ADDR       (CONFIG_FLASH_BASE + CONFIG_FLASH_SIZE - FLASH_PAGE_SIZE)
+
+#define CONFIG_RECORD_MAGIC     0xCA5Eu
+#define CONFIG_RECORD_SIZE      32u
+#define CONFIG_RECORD_NUM       (FLASH_PAGE_SIZE / CONFIG_RECORD_SIZE)
+
+// Busy-wait limit for a single flash program/erase operation
+#define CONFIG_FLASH_TIMEOUT    0x00100000u
+
+// Adapter settings which survive a power cycle
+typedef struct config_
+{
+    uint8_t bitrate;        // enum can_bitrate
+    uint8_t silent;         // Listen-only mode
+    uint8_t autoretransmit; // Automatic retransmission
+    uint8_t autoopen;       // Go on-bus from can_init()
+    uint8_t prop_seg;       // Bit timing, 0 keeps the board default
+    uint8_t phase_seg1;
+    uint8_t phase_seg2;
+    uint8_t jump_width;
+    uint32_t filter_id;     // RX FIFO acceptance filter
+    uint32_t filter_mask;   // 0 accepts all frames
+    uint8_t filter_ext;     // Filter matches extended IDs
+    uint8_t reserved[3];
+} config_t;
+
+// One wear-levelled slot in the configuration page
+typedef struct config_record_
+{
+    uint16_t magic;
+    uint16_t seq;           // Incremented on every write, newest wins
+    config_t config;
+    uint8_t reserved[6];
+    uint16_t crc;           // CRC-16/CCITT over all preceding bytes
+} config_record_t;
+
+// Prototypes
+bool config_load(config_t *config);
+bool config_save(const config_t *config);
+void config_erase(void);
+
+#endif // _CONFIG_H
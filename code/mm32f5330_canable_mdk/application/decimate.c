@@ -0,0 +1,142 @@
+//
+// decimate: Per-ID decimation and rate limiting on the RX path
+//
+// Rules are checked in the order they were added and the first rule whose
+// ID/mask matches decides. Frames matching no rule are always kept. Every
+// ID a rule matches gets its own counter or timestamp in a fixed
+// open-addressing hash table, so a mask rule thins each of its IDs out
+// separately; once the table is full, frames of untracked IDs are kept.
+//
+
+#include <string.h>
+#include "decimate.h"
+#include "led.h"
+
+// Private variables
+static decimate_rule_t rules[DECIMATE_MAX_RULES];
+static decimate_state_t table[DECIMATE_TABLE_SIZE];
+static uint8_t rule_count = 0;
+static uint32_t untracked = 0;
+
+
+static uint32_t decimate_hash(uint32_t key)
+{
+    // Fibonacci hashing spreads sequential IDs over the table
+    return (key * 2654435761u) >> (32 - DECIMATE_TABLE_BITS);
+}
+
+// Find the state for key, or the free slot it belongs in; NULL if full
+static decimate_state_t *decimate_lookup(uint32_t key)
+{
+    uint32_t idx = decimate_hash(key);
+
+    for (uint32_t i = 0; i < DECIMATE_TABLE_SIZE; i++)
+    {
+        decimate_state_t *s = &table[idx];
+        if (s->key == key || s->key == 0)
+        {
+            return s;
+        }
+        idx = (idx + 1) & (DECIMATE_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
+
+
+// Remove all rules and the state of every ID
+void decimate_clear(void)
+{
+    memset(rules, 0, sizeof(rules));
+    memset(table, 0, sizeof(table));
+    rule_count = 0;
+    untracked = 0;
+}
+
+// Append a rule, returns nonzero if the table is full or the rule invalid
+uint8_t decimate_add(decimate_mode_t mode, uint32_t id, uint32_t mask, uint8_t ext, uint16_t param)
+{
+    if (rule_count >= DECIMATE_MAX_RULES || param == 0
+        || (mode != DECIMATE_EVERY_NTH && mode != DECIMATE_MIN_INTERVAL))
+    {
+        return 1u;
+    }
+
+    // The format is part of the match, a standard and an extended frame
+    // with the same ID are different IDs
+    decimate_rule_t *r = &rules[rule_count];
+    r->mask = (mask & 0x1FFFFFFFu) | DECIMATE_KEY_EXT;
+    r->id = (id | (ext ? DECIMATE_KEY_EXT : 0)) & r->mask;
+    r->mode = mode;
+    r->param = param;
+    r->reserved = 0;
+
+    rule_count++;
+    return 0u;
+}
+
+uint8_t decimate_count(void)
+{
+    return rule_count;
+}
+
+// Frames kept because the table had no room for their ID
+uint32_t decimate_untracked(void)
+{
+    return untracked;
+}
+
+// Decide whether a received frame is kept
+uint8_t decimate_keep(FLEXCAN_Mb_Type *frame)
+{
+    uint32_t key = frame->ID & 0x1FFFFFFFu;
+    if (frame->FORMAT == FLEXCAN_MbFormat_Extended)
+    {
+        key |= DECIMATE_KEY_EXT;
+    }
+
+    const decimate_rule_t *r = NULL;
+    for (uint8_t i = 0; i < rule_count; i++)
+    {
+        if ((key & rules[i].mask) == rules[i].id)
+        {
+            r = &rules[i];
+            break;
+        }
+    }
+    if (r == NULL)
+    {
+        return 1u;
+    }
+
+    key |= DECIMATE_KEY_VALID;
+    decimate_state_t *s = decimate_lookup(key);
+    if (s == NULL)
+    {
+        untracked++;
+        return 1u;
+    }
+
+    // The first frame of an ID is always kept
+    uint32_t now = uwTick;
+    if (s->key != key)
+    {
+        s->key = key;
+        s->value = (r->mode == DECIMATE_EVERY_NTH) ? (r->param > 1u) : now;
+        return 1u;
+    }
+
+    if (r->mode == DECIMATE_EVERY_NTH)
+    {
+        // Keep the first frame, then every Nth after it
+        uint8_t keep = (s->value == 0);
+        s->value = (s->value + 1u >= r->param) ? 0 : (s->value + 1u);
+        return keep;
+    }
+
+    if ((now - s->value) >= r->param)
+    {
+        s->value = now;
+        return 1u;
+    }
+    return 0u;
+}
@@ -0,0 +1,47 @@
+#ifndef _DECIMATE_H
+#define _DECIMATE_H
+
+#include "stdint.h"
+#include "hal_flexcan.h"
+
+// Maximum number of decimation rules
+#define DECIMATE_MAX_RULES  128u
+
+// Number of matched IDs with their own counter or timestamp, must be a
+// power of two
+#define DECIMATE_TABLE_BITS 6u
+#define DECIMATE_TABLE_SIZE (1u << DECIMATE_TABLE_BITS)
+
+// Key flags; the low 29 bits hold the CAN ID
+#define DECIMATE_KEY_EXT    (1u << 29)
+#define DECIMATE_KEY_VALID  (1u << 31)
+
+typedef enum decimate_mode_
+{
+    DECIMATE_EVERY_NTH = 1,     // Keep one frame out of every N
+    DECIMATE_MIN_INTERVAL = 2,  // Keep at most one frame per T ms
+} decimate_mode_t;
+
+typedef struct decimate_rule_
+{
+    uint32_t id;            // [DECIMATE_KEY_EXT] | ID, already masked
+    uint32_t mask;          // DECIMATE_KEY_EXT | ID mask
+    uint16_t param;         // N or T, depending on mode
+    uint8_t mode;
+    uint8_t reserved;
+} decimate_rule_t;
+
+typedef struct decimate_state_
+{
+    uint32_t key;           // DECIMATE_KEY_VALID | [DECIMATE_KEY_EXT] | ID
+    uint32_t value;         // Frames since the last one kept, or its uwTick
+} decimate_state_t;
+
+// Prototypes
+void decimate_clear(void);
+uint8_t decimate_add(decimate_mode_t mode, uint32_t id, uint32_t mask, uint8_t ext, uint16_t param);
+uint8_t decimate_count(void);
+uint32_t decimate_untracked(void);
+uint8_t decimate_keep(FLEXCAN_Mb_Type *frame);
+
+#endif // _DECIMATE_H
@@ -0,0 +1,172 @@
+//
+// dedup: Change-only reporting of received frames
+//
+// A frame is forwarded to the host only if its DLC or payload differ from
+// the last one forwarded for the same ID, or if the heartbeat interval has
+// elapsed. IDs are kept in a fixed open-addressing hash table; once it is
+// full, frames of untracked IDs are always forwarded.
+//
+
+#include <string.h>
+#include "dedup.h"
+#include "led.h"
+#include "slcan.h"
+#include "tusb.h"
+
+// Longest report line: 'D' + three counters + CR
+#define DEDUP_LINE_LEN      26u
+
+// Private variables
+static dedup_entry_t table[DEDUP_TABLE_SIZE];
+static uint8_t enabled = 0;
+static uint16_t heartbeat = 0;
+static uint32_t total_forwarded = 0;
+static uint32_t total_suppressed = 0;
+static uint32_t untracked = 0;
+
+static uint8_t report_active = 0;
+static uint8_t report_pos = 0;
+
+
+static uint32_t dedup_hash(uint32_t key)
+{
+    // Fibonacci hashing spreads sequential IDs over the table
+    return (key * 2654435761u) >> (32 - DEDUP_TABLE_BITS);
+}
+
+// Mask of the payload bytes covered by the DLC in one 32-bit payload word
+// holding bytes [first, first + 3], most significant byte first
+static uint32_t dedup_word_mask(uint8_t dlc, uint8_t first)
+{
+    if (dlc <= first)
+        return 0;
+    if (dlc >= first + 4)
+        return 0xFFFFFFFFu;
+    return ~(0xFFFFFFFFu >> (8 * (dlc - first)));
+}
+
+// Find the entry for key, or the free slot it belongs in; NULL if full
+static dedup_entry_t *dedup_lookup(uint32_t key)
+{
+    uint32_t idx = dedup_hash(key);
+
+    for (uint32_t i = 0; i < DEDUP_TABLE_SIZE; i++)
+    {
+        dedup_entry_t *e = &table[idx];
+        if (e->key == key || e->key == 0)
+        {
+            return e;
+        }
+        idx = (idx + 1) & (DEDUP_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
+
+
+// Turn change-only reporting on or off; the table always starts empty
+void dedup_enable(uint8_t enable, uint16_t heartbeat_ms)
+{
+    memset(table, 0, sizeof(table));
+    total_forwarded = 0;
+    total_suppressed = 0;
+    untracked = 0;
+
+    heartbeat = heartbeat_ms;
+    enabled = (enable != 0);
+}
+
+// Decide whether a received frame goes to the host
+uint8_t dedup_forward(FLEXCAN_Mb_Type *frame)
+{
+    if (!enabled || frame->TYPE == FLEXCAN_MbType_Remote)
+    {
+        return 1u;
+    }
+
+    uint32_t key = DEDUP_KEY_VALID | (frame->ID & 0x1FFFFFFFu);
+    if (frame->FORMAT == FLEXCAN_MbFormat_Extended)
+    {
+        key |= DEDUP_KEY_EXT;
+    }
+
+    dedup_entry_t *e = dedup_lookup(key);
+    if (e == NULL)
+    {
+        untracked++;
+        total_forwarded++;
+        return 1u;
+    }
+
+    // Bytes beyond the DLC are not part of the frame
+    uint32_t word0 = frame->WORD0 & dedup_word_mask(frame->LENGTH, 0);
+    uint32_t word1 = frame->WORD1 & dedup_word_mask(frame->LENGTH, 4);
+
+    uint32_t now = uwTick;
+    if (e->key == key && e->dlc == frame->LENGTH
+        && e->word0 == word0 && e->word1 == word1
+        && (heartbeat == 0 || (now - e->tick) < heartbeat))
+    {
+        if (e->suppressed < 0xFFFFu)
+        {
+            e->suppressed++;
+        }
+        total_suppressed++;
+        return 0u;
+    }
+
+    e->key = key;
+    e->dlc = frame->LENGTH;
+    e->word0 = word0;
+    e->word1 = word1;
+    e->tick = now;
+    total_forwarded++;
+    return 1u;
+}
+
+// Begin streaming the per-ID counters to the host
+void dedup_report_start(void)
+{
+    report_active = 1;
+    report_pos = 0;
+}
+
+// Emit report lines while there is room in the CDC TX FIFO. Output is:
+//   'd' + key + suppressed                      per tracked ID
+//   'D' + forwarded + suppressed + untracked    totals, end of report
+void dedup_process(void)
+{
+    uint8_t line[DEDUP_LINE_LEN];
+    uint8_t pos;
+
+    if (!report_active)
+        return;
+
+    while (report_active && tud_cdc_write_available() >= sizeof(line))
+    {
+        pos = 0;
+
+        // Skip empty slots
+        while (report_pos < DEDUP_TABLE_SIZE && table[report_pos].key == 0)
+        {
+            report_pos++;
+        }
+
+        if (report_pos < DEDUP_TABLE_SIZE)
+        {
+            line[pos++] = 'd';
+            pos += slcan_put_hex(&line[pos], table[report_pos].key & ~DEDUP_KEY_VALID, 8);
+            pos += slcan_put_hex(&line[pos], table[report_pos].suppressed, 8);
+            report_pos++;
+        } else {
+            line[pos++] = 'D';
+            pos += slcan_put_hex(&line[pos], total_forwarded, 8);
+            pos += slcan_put_hex(&line[pos], total_suppressed, 8);
+            pos += slcan_put_hex(&line[pos], untracked, 8);
+            report_active = 0;
+        }
+        line[pos++] = '\r';
+        tud_cdc_write(line, pos);
+    }
+
+    tud_cdc_write_flush();
+}
@@ -0,0 +1,32 @@
+#ifndef _DEDUP_H
+#define _DEDUP_H
+
+#include "stdint.h"
+#include "hal_flexcan.h"
+
+// Number of IDs tracked, must be a power of two
+#define DEDUP_TABLE_BITS    6u
+#define DEDUP_TABLE_SIZE    (1u << DEDUP_TABLE_BITS)
+
+// Key flags; the low 29 bits hold the CAN ID
+#define DEDUP_KEY_EXT       (1u << 29)
+#define DEDUP_KEY_VALID     (1u << 31)
+
+typedef struct dedup_entry_
+{
+    uint32_t key;           // DEDUP_KEY_VALID | [DEDUP_KEY_EXT] | ID
+    uint32_t word0;         // Last forwarded payload
+    uint32_t word1;
+    uint32_t tick;          // uwTick of the last forwarded frame
+    uint8_t dlc;
+    uint8_t reserved;
+    uint16_t suppressed;    // Frames suppressed for this ID (saturating)
+} dedup_entry_t;
+
+// Prototypes
+void dedup_enable(uint8_t enable, uint16_t heartbeat_ms);
+uint8_t dedup_forward(FLEXCAN_Mb_Type *frame);
+void dedup_report_start(void);
+void dedup_process(void);
+
+#endif // _DEDUP_H
@@ -0,0 +1,293 @@
+//
+// diag: Diagnostics console on the second CDC interface
+//
+// Single-letter commands select a report which is written one line at a
+// time whenever the interface has room for a whole line. Nothing here
+// ever waits for the host: with no terminal attached, or one that does
+// not read, the report simply stalls while slcan traffic on interface 0
+// carries on.
+//
+
+#include <string.h>
+#include "diag.h"
+#include "can.h"
+#include "busload.h"
+#include "config.h"
+#include "error.h"
+#include "profile.h"
+#include "remote.h"
+#include "sched.h"
+#include "slcan.h"
+#include "tusb.h"
+
+// Names of the error register bits, in error_t order
+static const char *const error_names[ERR_MAX] =
+{
+    "PERIPHINIT",
+    "USBTX_BUSY",
+    "CAN_TXFAIL",
+    "CANRXFIFO_OVERFLOW",
+    "FULLBUF_CANTX",
+    "FULLBUF_USBRX",
+    "FLASH_WRITE",
+    "FULLBUF_ECU",
+    "FULLBUF_SUSPEND",
+};
+
+// Private variables
+static uint8_t report = DIAG_NONE;
+static uint8_t step = 0;
+#if APP_PROFILE_ENABLE
+static uint8_t bucket = 0;
+static profile_stats_t stats;
+#endif
+
+
+static uint8_t diag_put_str(uint8_t *buf, const char *str)
+{
+    uint8_t len = strlen(str);
+    memcpy(buf, str, len);
+    return len;
+}
+
+// Label followed by a value in hex
+static uint8_t diag_put_field(uint8_t *buf, const char *label, uint32_t value, uint8_t digits)
+{
+    uint8_t pos = diag_put_str(buf, label);
+    buf[pos++] = ' ';
+    pos += slcan_put_hex(&buf[pos], value, digits);
+    buf[pos++] = ' ';
+    return pos;
+}
+
+static uint8_t diag_stats_line(uint8_t *line)
+{
+    busload_stats_t load;
+    tud_queue_stats_t usbq;
+    uint8_t pos = 0;
+
+    switch (step)
+    {
+        case 0:
+            pos += diag_put_field(&line[pos], "bus", can_get_bus_state(), 1);
+            pos += diag_put_field(&line[pos], "bitrate", can_get_bitrate(), 8);
+            break;
+        case 1:
+            busload_get_stats(&load);
+            pos += diag_put_field(&line[pos], "load", load.load, 4);
+            pos += diag_put_field(&line[pos], "peak", load.peak, 4);
+            pos += diag_put_field(&line[pos], "frames", load.frames, 8);
+            break;
+        case 2:
+            pos += diag_put_field(&line[pos], "status", can_get_status(), 8);
+            pos += diag_put_field(&line[pos], "errors", error_reg(), 8);
+            break;
+        case 3:
+            pos += diag_put_field(&line[pos], "txfree", can_tx_free(), 2);
+            pos += diag_put_field(&line[pos], "sched", sched_count(), 2);
+            pos += diag_put_field(&line[pos], "lost", sched_lost(), 8);
+            break;
+        case 4:
+            pos += diag_put_field(&line[pos], "remote", remote_count(), 2);
+            pos += diag_put_field(&line[pos], "answered", remote_responses(), 8);
+            break;
+        case 5:
+            tud_queue_stats(&usbq);
+            pos += diag_put_field(&line[pos], "usbq", usbq.depth, 2);
+            pos += diag_put_field(&line[pos], "hwm", usbq.high_water, 2);
+            pos += diag_put_field(&line[pos], "dropped", usbq.overflows, 8);
+            break;
+        default:
+            return 0;
+    }
+    step++;
+    return pos;
+}
+
+static uint8_t diag_errors_line(uint8_t *line)
+{
+    uint8_t pos = 0;
+
+    if (step == 0)
+    {
+        step++;
+        return diag_put_field(line, "errors", error_reg(), 8);
+    }
+
+    // One line per error seen since boot
+    while (step <= ERR_MAX && !error_occurred((error_t)(step - 1)))
+    {
+        step++;
+    }
+    if (step > ERR_MAX)
+    {
+        return 0;
+    }
+    pos += diag_put_str(&line[pos], "error ");
+    pos += diag_put_str(&line[pos], error_names[step - 1]);
+    step++;
+    return pos;
+}
+
+static uint8_t diag_config_line(uint8_t *line)
+{
+    config_t config;
+    uint8_t pos = 0;
+
+    if (step > 2)
+    {
+        return 0;
+    }
+    if (!config_load(&config))
+    {
+        step = 3;
+        return diag_put_str(line, "config none");
+    }
+
+    switch (step)
+    {
+        case 0:
+            pos += diag_put_field(&line[pos], "bitrate", config.bitrate, 1);
+            pos += diag_put_field(&line[pos], "silent", config.silent, 1);
+            pos += diag_put_field(&line[pos], "retransmit", config.autoretransmit, 1);
+            pos += diag_put_field(&line[pos], "autoopen", config.autoopen, 1);
+            break;
+        case 1:
+            pos += diag_put_field(&line[pos], "prop", config.prop_seg, 2);
+            pos += diag_put_field(&line[pos], "seg1", config.phase_seg1, 2);
+            pos += diag_put_field(&line[pos], "seg2", config.phase_seg2, 2);
+            pos += diag_put_field(&line[pos], "sjw", config.jump_width, 2);
+            break;
+        default:
+            pos += diag_put_field(&line[pos], "filter", config.filter_id, 8);
+            pos += diag_put_field(&line[pos], "mask", config.filter_mask, 8);
+            pos += diag_put_field(&line[pos], "ext", config.filter_ext, 1);
+            break;
+    }
+    step++;
+    return pos;
+}
+
+static uint8_t diag_profile_line(uint8_t *line)
+{
+#if APP_PROFILE_ENABLE
+    uint8_t pos = 0;
+
+    while (step < PROFILE_MAX)
+    {
+        if (bucket == 0)
+        {
+            // Section summary, histogram buckets follow
+            profile_get_stats((profile_section_t)step, &stats);
+            uint32_t mean = stats.count ? (uint32_t)(stats.sum / stats.count) : 0;
+            pos += diag_put_field(&line[pos], "sec", step, 1);
+            pos += diag_put_field(&line[pos], "n", stats.count, 8);
+            pos += diag_put_field(&line[pos], "max", stats.max, 8);
+            pos += diag_put_field(&line[pos], "mean", mean, 8);
+            bucket = 1;
+            return pos;
+        }
+
+        while (bucket <= PROFILE_HIST_BUCKETS && stats.hist[bucket - 1] == 0)
+        {
+            bucket++;
+        }
+        if (bucket <= PROFILE_HIST_BUCKETS)
+        {
+            pos += diag_put_field(&line[pos], "  2^", bucket - 1, 2);
+            pos += diag_put_field(&line[pos], "n", stats.hist[bucket - 1], 8);
+            bucket++;
+            return pos;
+        }
+        step++;
+        bucket = 0;
+    }
+    return 0;
+#else
+    if (step++ == 0)
+    {
+        return diag_put_str(line, "profiler not built");
+    }
+    return 0;
+#endif
+}
+
+static uint8_t diag_help_line(uint8_t *line)
+{
+    static const char *const help[] =
+    {
+        "s stats  e errors  c config  p profiler",
+    };
+
+    if (step >= sizeof(help) / sizeof(help[0]))
+    {
+        return 0;
+    }
+    return diag_put_str(line, help[step++]);
+}
+
+static void diag_start(uint8_t c)
+{
+    step = 0;
+#if APP_PROFILE_ENABLE
+    bucket = 0;
+#endif
+    switch (c)
+    {
+        case 's': report = DIAG_STATS; break;
+        case 'e': report = DIAG_ERRORS; break;
+        case 'c': report = DIAG_CONFIG; break;
+        case 'p': report = DIAG_PROFILE; break;
+        case '\r':
+        case '\n':
+        case ' ':
+            break;
+        default:  report = DIAG_HELP; break;
+    }
+}
+
+
+// Read commands and write the current report while there is room
+void diag_process(void)
+{
+    uint8_t line[DIAG_LINE_LEN];
+    uint8_t len;
+
+    if (!tud_cdc_n_connected(DIAG_ITF))
+    {
+        // Discard anything typed before the terminal went away
+        tud_cdc_n_read_flush(DIAG_ITF);
+        report = DIAG_NONE;
+        return;
+    }
+
+    // A new command replaces a report still in progress
+    while (tud_cdc_n_available(DIAG_ITF))
+    {
+        uint8_t c;
+        tud_cdc_n_read(DIAG_ITF, &c, 1);
+        diag_start(c);
+    }
+
+    while (report != DIAG_NONE && tud_cdc_n_write_available(DIAG_ITF) >= sizeof(line))
+    {
+        switch (report)
+        {
+            case DIAG_STATS:   len = diag_stats_line(line); break;
+            case DIAG_ERRORS:  len = diag_errors_line(line); break;
+            case DIAG_CONFIG:  len = diag_config_line(line); break;
+            case DIAG_PROFILE: len = diag_profile_line(line); break;
+            default:           len = diag_help_line(line); break;
+        }
+        if (len == 0)
+        {
+            report = DIAG_NONE;
+            break;
+        }
+        line[len++] = '\r';
+        line[len++] = '\n';
+        tud_cdc_n_write(DIAG_ITF, line, len);
+    }
+
+    tud_cdc_n_write_flush(DIAG_ITF);
+}
@@ -0,0 +1,26 @@
+#ifndef _DIAG_H
+#define _DIAG_H
+
+#include "stdint.h"
+
+// CDC interface of the diagnostics console, slcan stays on interface 0
+#define DIAG_ITF            1u
+
+// Longest console line including CR LF
+#define DIAG_LINE_LEN       48u
+
+// Reports the console can produce
+typedef enum diag_report_
+{
+    DIAG_NONE = 0,
+    DIAG_STATS,             // Bus state, load, status and queue counters
+    DIAG_ERRORS,            // Error register, one line per error seen
+    DIAG_CONFIG,            // Settings stored in flash
+    DIAG_PROFILE,           // Profiler summaries and histograms
+    DIAG_HELP,
+} diag_report_t;
+
+// Prototypes
+void diag_process(void);
+
+#endif // _DIAG_H
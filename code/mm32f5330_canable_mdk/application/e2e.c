@@ -0,0 +1,236 @@
+//
+// e2e: AUTOSAR E2E protection of transmitted frames
+//
+// Frames whose ID has a profile get their alive counter and CRC filled in
+// when they are written into a TX mailbox, so the counter advances once per
+// frame actually sent no matter how the host timed its requests. Mailboxes
+// are also loaded from the timebase interrupt, so profiles are only
+// touched with interrupts masked.
+//
+
+#include <string.h>
+#include "e2e.h"
+#include "board_init.h"
+#include "profile.h"
+
+// CRC-8 SAE J1850, polynomial 0x1D
+static const uint8_t crc8_j1850_table[256] =
+{
+    0x00u, 0x1Du, 0x3Au, 0x27u, 0x74u, 0x69u, 0x4Eu, 0x53u,
+    0xE8u, 0xF5u, 0xD2u, 0xCFu, 0x9Cu, 0x81u, 0xA6u, 0xBBu,
+    0xCDu, 0xD0u, 0xF7u, 0xEAu, 0xB9u, 0xA4u, 0x83u, 0x9Eu,
+    0x25u, 0x38u, 0x1Fu, 0x02u, 0x51u, 0x4Cu, 0x6Bu, 0x76u,
+    0x87u, 0x9Au, 0xBDu, 0xA0u, 0xF3u, 0xEEu, 0xC9u, 0xD4u,
+    0x6Fu, 0x72u, 0x55u, 0x48u, 0x1Bu, 0x06u, 0x21u, 0x3Cu,
+    0x4Au, 0x57u, 0x70u, 0x6Du, 0x3Eu, 0x23u, 0x04u, 0x19u,
+    0xA2u, 0xBFu, 0x98u, 0x85u, 0xD6u, 0xCBu, 0xECu, 0xF1u,
+    0x13u, 0x0Eu, 0x29u, 0x34u, 0x67u, 0x7Au, 0x5Du, 0x40u,
+    0xFBu, 0xE6u, 0xC1u, 0xDCu, 0x8Fu, 0x92u, 0xB5u, 0xA8u,
+    0xDEu, 0xC3u, 0xE4u, 0xF9u, 0xAAu, 0xB7u, 0x90u, 0x8Du,
+    0x36u, 0x2Bu, 0x0Cu, 0x11u, 0x42u, 0x5Fu, 0x78u, 0x65u,
+    0x94u, 0x89u, 0xAEu, 0xB3u, 0xE0u, 0xFDu, 0xDAu, 0xC7u,
+    0x7Cu, 0x61u, 0x46u, 0x5Bu, 0x08u, 0x15u, 0x32u, 0x2Fu,
+    0x59u, 0x44u, 0x63u, 0x7Eu, 0x2Du, 0x30u, 0x17u, 0x0Au,
+    0xB1u, 0xACu, 0x8Bu, 0x96u, 0xC5u, 0xD8u, 0xFFu, 0xE2u,
+    0x26u, 0x3Bu, 0x1Cu, 0x01u, 0x52u, 0x4Fu, 0x68u, 0x75u,
+    0xCEu, 0xD3u, 0xF4u, 0xE9u, 0xBAu, 0xA7u, 0x80u, 0x9Du,
+    0xEBu, 0xF6u, 0xD1u, 0xCCu, 0x9Fu, 0x82u, 0xA5u, 0xB8u,
+    0x03u, 0x1Eu, 0x39u, 0x24u, 0x77u, 0x6Au, 0x4Du, 0x50u,
+    0xA1u, 0xBCu, 0x9Bu, 0x86u, 0xD5u, 0xC8u, 0xEFu, 0xF2u,
+    0x49u, 0x54u, 0x73u, 0x6Eu, 0x3Du, 0x20u, 0x07u, 0x1Au,
+    0x6Cu, 0x71u, 0x56u, 0x4Bu, 0x18u, 0x05u, 0x22u, 0x3Fu,
+    0x84u, 0x99u, 0xBEu, 0xA3u, 0xF0u, 0xEDu, 0xCAu, 0xD7u,
+    0x35u, 0x28u, 0x0Fu, 0x12u, 0x41u, 0x5Cu, 0x7Bu, 0x66u,
+    0xDDu, 0xC0u, 0xE7u, 0xFAu, 0xA9u, 0xB4u, 0x93u, 0x8Eu,
+    0xF8u, 0xE5u, 0xC2u, 0xDFu, 0x8Cu, 0x91u, 0xB6u, 0xABu,
+    0x10u, 0x0Du, 0x2Au, 0x37u, 0x64u, 0x79u, 0x5Eu, 0x43u,
+    0xB2u, 0xAFu, 0x88u, 0x95u, 0xC6u, 0xDBu, 0xFCu, 0xE1u,
+    0x5Au, 0x47u, 0x60u, 0x7Du, 0x2Eu, 0x33u, 0x14u, 0x09u,
+    0x7Fu, 0x62u, 0x45u, 0x58u, 0x0Bu, 0x16u, 0x31u, 0x2Cu,
+    0x97u, 0x8Au, 0xADu, 0xB0u, 0xE3u, 0xFEu, 0xD9u, 0xC4u,
+};
+
+// CRC-8H2F, polynomial 0x2F
+static const uint8_t crc8_h2f_table[256] =
+{
+    0x00u, 0x2Fu, 0x5Eu, 0x71u, 0xBCu, 0x93u, 0xE2u, 0xCDu,
+    0x57u, 0x78u, 0x09u, 0x26u, 0xEBu, 0xC4u, 0xB5u, 0x9Au,
+    0xAEu, 0x81u, 0xF0u, 0xDFu, 0x12u, 0x3Du, 0x4Cu, 0x63u,
+    0xF9u, 0xD6u, 0xA7u, 0x88u, 0x45u, 0x6Au, 0x1Bu, 0x34u,
+    0x73u, 0x5Cu, 0x2Du, 0x02u, 0xCFu, 0xE0u, 0x91u, 0xBEu,
+    0x24u, 0x0Bu, 0x7Au, 0x55u, 0x98u, 0xB7u, 0xC6u, 0xE9u,
+    0xDDu, 0xF2u, 0x83u, 0xACu, 0x61u, 0x4Eu, 0x3Fu, 0x10u,
+    0x8Au, 0xA5u, 0xD4u, 0xFBu, 0x36u, 0x19u, 0x68u, 0x47u,
+    0xE6u, 0xC9u, 0xB8u, 0x97u, 0x5Au, 0x75u, 0x04u, 0x2Bu,
+    0xB1u, 0x9Eu, 0xEFu, 0xC0u, 0x0Du, 0x22u, 0x53u, 0x7Cu,
+    0x48u, 0x67u, 0x16u, 0x39u, 0xF4u, 0xDBu, 0xAAu, 0x85u,
+    0x1Fu, 0x30u, 0x41u, 0x6Eu, 0xA3u, 0x8Cu, 0xFDu, 0xD2u,
+    0x95u, 0xBAu, 0xCBu, 0xE4u, 0x29u, 0x06u, 0x77u, 0x58u,
+    0xC2u, 0xEDu, 0x9Cu, 0xB3u, 0x7Eu, 0x51u, 0x20u, 0x0Fu,
+    0x3Bu, 0x14u, 0x65u, 0x4Au, 0x87u, 0xA8u, 0xD9u, 0xF6u,
+    0x6Cu, 0x43u, 0x32u, 0x1Du, 0xD0u, 0xFFu, 0x8Eu, 0xA1u,
+    0xE3u, 0xCCu, 0xBDu, 0x92u, 0x5Fu, 0x70u, 0x01u, 0x2Eu,
+    0xB4u, 0x9Bu, 0xEAu, 0xC5u, 0x08u, 0x27u, 0x56u, 0x79u,
+    0x4Du, 0x62u, 0x13u, 0x3Cu, 0xF1u, 0xDEu, 0xAFu, 0x80u,
+    0x1Au, 0x35u, 0x44u, 0x6Bu, 0xA6u, 0x89u, 0xF8u, 0xD7u,
+    0x90u, 0xBFu, 0xCEu, 0xE1u, 0x2Cu, 0x03u, 0x72u, 0x5Du,
+    0xC7u, 0xE8u, 0x99u, 0xB6u, 0x7Bu, 0x54u, 0x25u, 0x0Au,
+    0x3Eu, 0x11u, 0x60u, 0x4Fu, 0x82u, 0xADu, 0xDCu, 0xF3u,
+    0x69u, 0x46u, 0x37u, 0x18u, 0xD5u, 0xFAu, 0x8Bu, 0xA4u,
+    0x05u, 0x2Au, 0x5Bu, 0x74u, 0xB9u, 0x96u, 0xE7u, 0xC8u,
+    0x52u, 0x7Du, 0x0Cu, 0x23u, 0xEEu, 0xC1u, 0xB0u, 0x9Fu,
+    0xABu, 0x84u, 0xF5u, 0xDAu, 0x17u, 0x38u, 0x49u, 0x66u,
+    0xFCu, 0xD3u, 0xA2u, 0x8Du, 0x40u, 0x6Fu, 0x1Eu, 0x31u,
+    0x76u, 0x59u, 0x28u, 0x07u, 0xCAu, 0xE5u, 0x94u, 0xBBu,
+    0x21u, 0x0Eu, 0x7Fu, 0x50u, 0x9Du, 0xB2u, 0xC3u, 0xECu,
+    0xD8u, 0xF7u, 0x86u, 0xA9u, 0x64u, 0x4Bu, 0x3Au, 0x15u,
+    0x8Fu, 0xA0u, 0xD1u, 0xFEu, 0x33u, 0x1Cu, 0x6Du, 0x42u,
+};
+
+// Private variables
+static e2e_profile_t profiles[E2E_MAX_PROFILES];
+
+
+static uint8_t e2e_crc8(const uint8_t *table, uint8_t crc, const uint8_t *data, uint8_t len)
+{
+    while (len--)
+    {
+        crc = table[crc ^ *data++];
+    }
+    return crc;
+}
+
+// Payload byte i of a mailbox frame; BYTE0 is the top byte of WORD0
+static uint8_t *e2e_byte(FLEXCAN_Mb_Type *frame, uint8_t i)
+{
+    return (uint8_t *)&frame->WORD0 + (i ^ 3u);
+}
+
+static e2e_profile_t *e2e_find(uint32_t id, uint8_t ext)
+{
+    for (uint8_t i = 0; i < E2E_MAX_PROFILES; i++)
+    {
+        if (profiles[i].type != E2E_NONE && profiles[i].id == id && profiles[i].ext == ext)
+        {
+            return &profiles[i];
+        }
+    }
+    return NULL;
+}
+
+// Counter and CRC of a frame long enough for the profile's layout
+static void e2e_apply(e2e_profile_t *p, FLEXCAN_Mb_Type *frame)
+{
+    uint8_t crc_pos = p->crc_offset >> 3;
+    uint8_t counter_pos = p->counter_offset >> 3;
+    uint8_t data[8];
+    uint8_t shift = p->counter_offset & 4u;
+    uint8_t crc;
+
+    for (uint8_t i = 0; i < frame->LENGTH; i++)
+    {
+        data[i] = *e2e_byte(frame, i);
+    }
+
+    // Profile 2 advances the counter before use and wraps at 16, profile 1
+    // uses it first and skips the invalid value 15
+    if (p->type == E2E_P02)
+    {
+        p->counter = (p->counter + 1u) & 0x0Fu;
+    }
+    data[counter_pos] = (data[counter_pos] & ~(0x0Fu << shift)) | (p->counter << shift);
+
+    if (p->type == E2E_P01)
+    {
+        // Data ID low and high byte, then the payload without the CRC byte;
+        // start value and final XOR are both 0x00 in this profile
+        uint8_t id_bytes[2] = { (uint8_t)p->data_id, (uint8_t)(p->data_id >> 8) };
+        crc = e2e_crc8(crc8_j1850_table, 0x00u, id_bytes, 2);
+        crc = e2e_crc8(crc8_j1850_table, crc, data, crc_pos);
+        crc = e2e_crc8(crc8_j1850_table, crc, &data[crc_pos + 1], frame->LENGTH - crc_pos - 1);
+        p->counter = (p->counter >= 14u) ? 0u : p->counter + 1u;
+    } else {
+        // Payload without the CRC byte, then the data ID of this counter
+        // value; every entry of the data ID list is the low byte of data_id
+        uint8_t id_byte = (uint8_t)p->data_id;
+        crc = e2e_crc8(crc8_h2f_table, 0xFFu, data, crc_pos);
+        crc = e2e_crc8(crc8_h2f_table, crc, &data[crc_pos + 1], frame->LENGTH - crc_pos - 1);
+        crc = e2e_crc8(crc8_h2f_table, crc, &id_byte, 1) ^ 0xFFu;
+    }
+    data[crc_pos] = crc;
+
+    *e2e_byte(frame, counter_pos) = data[counter_pos];
+    *e2e_byte(frame, crc_pos) = crc;
+}
+
+
+// Remove all profiles
+void e2e_clear(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    memset(profiles, 0, sizeof(profiles));
+    __set_PRIMASK(primask);
+}
+
+// Protect frames with this ID. Offsets are in bits from the start of the
+// payload as in the AUTOSAR configuration: the CRC takes a whole byte, the
+// counter a nybble. Setting a slot again restarts its counter.
+uint8_t e2e_set(uint8_t slot, uint8_t type, uint32_t id, uint8_t ext, uint16_t data_id,
+                uint8_t crc_offset, uint8_t counter_offset)
+{
+    if (slot >= E2E_MAX_PROFILES || type > E2E_P02
+        || crc_offset > 56 || (crc_offset & 7) != 0
+        || counter_offset > 60 || (counter_offset & 3) != 0
+        || (counter_offset >> 3) == (crc_offset >> 3))
+    {
+        return 1u;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    e2e_profile_t *p = &profiles[slot];
+    p->id = ext ? (id & 0x1FFFFFFFu) : (id & 0x7FFu);
+    p->ext = (ext != 0);
+    p->type = type;
+    p->data_id = data_id;
+    p->crc_offset = crc_offset;
+    p->counter_offset = counter_offset;
+    p->counter = 0;
+    __set_PRIMASK(primask);
+    return 0u;
+}
+
+// Fill in counter and CRC of a frame about to be loaded into a mailbox,
+// from the main loop or an interrupt
+void e2e_protect(FLEXCAN_Mb_Type *frame)
+{
+    if (frame->TYPE != FLEXCAN_MbType_Data)
+        return;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    e2e_profile_t *p = e2e_find(frame->ID, frame->FORMAT == FLEXCAN_MbFormat_Extended);
+    if (p != NULL && frame->LENGTH > (p->crc_offset >> 3) && frame->LENGTH > (p->counter_offset >> 3))
+    {
+        PROFILE_ENTER(PROFILE_E2E_PROTECT);
+        e2e_apply(p, frame);
+        PROFILE_EXIT(PROFILE_E2E_PROTECT);
+    }
+
+    __set_PRIMASK(primask);
+}
+
+// Crc_CalculateCRC8() of the AUTOSAR CRC library on a first call: start
+// value and final XOR 0xFF
+uint8_t e2e_crc8_j1850(const uint8_t *data, uint8_t len)
+{
+    return e2e_crc8(crc8_j1850_table, 0xFFu, data, len) ^ 0xFFu;
+}
+
+// Crc_CalculateCRC8H2F() on a first call, same start value and final XOR
+uint8_t e2e_crc8_h2f(const uint8_t *data, uint8_t len)
+{
+    return e2e_crc8(crc8_h2f_table, 0xFFu, data, len) ^ 0xFFu;
+}
@@ -0,0 +1,38 @@
+#ifndef _E2E_H
+#define _E2E_H
+
+#include "stdint.h"
+#include "hal_flexcan.h"
+
+// Number of protected frame IDs
+#define E2E_MAX_PROFILES    8u
+
+// Supported AUTOSAR E2E profiles
+typedef enum e2e_type_
+{
+    E2E_NONE = 0,
+    E2E_P01,                // CRC-8 SAE J1850, 16-bit data ID, counter 0..14
+    E2E_P02,                // CRC-8H2F, 8-bit data ID, counter 0..15
+} e2e_type_t;
+
+typedef struct e2e_profile_
+{
+    uint32_t id;
+    uint16_t data_id;
+    uint8_t ext;
+    uint8_t type;
+    uint8_t crc_offset;     // Bit offset of the CRC byte
+    uint8_t counter_offset; // Bit offset of the counter nybble
+    uint8_t counter;        // Value for the next frame sent
+    uint8_t reserved;
+} e2e_profile_t;
+
+// Prototypes
+void e2e_clear(void);
+uint8_t e2e_set(uint8_t slot, uint8_t type, uint32_t id, uint8_t ext, uint16_t data_id,
+                uint8_t crc_offset, uint8_t counter_offset);
+void e2e_protect(FLEXCAN_Mb_Type *frame);
+uint8_t e2e_crc8_j1850(const uint8_t *data, uint8_t len);
+uint8_t e2e_crc8_h2f(const uint8_t *data, uint8_t len);
+
+#endif // _E2E_H
@@ -0,0 +1,337 @@
+//
+// ecu: Rule-based ECU simulation
+//
+// Received data frames are matched against a table of ID/mask/payload
+// patterns. The first matching rule builds a response from its template
+// and sends it from a dedicated mailbox, so that it does not queue behind
+// host traffic. Matching runs in the FlexCAN RX interrupt, which loads
+// the mailbox straight away; delayed responses are loaded by the timebase
+// ECU compare at their due time. Neither waits for the main loop, which
+// only accounts the frames sent to the bus load.
+//
+
+#include <string.h>
+#include "ecu.h"
+#include "can.h"
+#include "busload.h"
+#include "error.h"
+#include "timebase.h"
+#include "e2e.h"
+
+typedef struct ecu_pending_
+{
+    uint32_t due_us;        // timebase_us() at which to send
+    FLEXCAN_Mb_Type frame;
+} ecu_pending_t;
+
+// Private variables
+static ecu_rule_t rules[ECU_MAX_RULES];
+static ecu_pending_t pending[ECU_PENDING];    // Ordered by due time
+static volatile uint8_t pending_count = 0;
+
+// Written by the interrupts, accounted to the bus load and reported by the
+// main loop
+static volatile uint32_t sent_bits = 0;
+static volatile uint32_t sent_frames = 0;
+static volatile uint32_t dropped = 0;
+static uint32_t counted_bits = 0;
+static uint32_t counted_frames = 0;
+static uint32_t counted_dropped = 0;
+
+
+// Rules, queue and mailbox are shared with the FlexCAN RX interrupt and
+// the timebase ECU compare, whose callback masks the former itself. The
+// timebase goes first so that it cannot unmask FlexCAN in between.
+static void ecu_lock(void)
+{
+    NVIC_DisableIRQ(BOARD_TIMEBASE_IRQn);
+    NVIC_DisableIRQ(BOARD_FLEXCAN_IRQn);
+}
+
+static void ecu_unlock(void)
+{
+    NVIC_EnableIRQ(BOARD_FLEXCAN_IRQn);
+    NVIC_EnableIRQ(BOARD_TIMEBASE_IRQn);
+}
+
+static uint8_t ecu_mb_free(void)
+{
+    uint32_t code = (BOARD_FLEXCAN_PORT->MB[BOARD_FLEXCAN_ECU_TX_MB_CH].CS & FLEXCAN_CS_CODE_MASK) >> FLEXCAN_CS_CODE_SHIFT;
+    return (code == FLEXCAN_MbCode_TxInactive) || (code == FLEXCAN_MbCode_RxInactive);
+}
+
+// Called from the FlexCAN RX interrupt, or with it masked
+static void ecu_transmit(FLEXCAN_Mb_Type *frame)
+{
+    FLEXCAN_ClearMbStatus(BOARD_FLEXCAN_PORT, 1u << BOARD_FLEXCAN_ECU_TX_MB_CH);
+    e2e_protect(frame);
+    FLEXCAN_WriteTxMb(BOARD_FLEXCAN_PORT, BOARD_FLEXCAN_ECU_TX_MB_CH, frame);
+    FLEXCAN_SetMbCode(BOARD_FLEXCAN_PORT, BOARD_FLEXCAN_ECU_TX_MB_CH, FLEXCAN_MbCode_TxDataOrRemote);
+    sent_bits += busload_frame_bits(frame);
+    sent_frames++;
+}
+
+static uint8_t ecu_matches(ecu_rule_t *r, FLEXCAN_Mb_Type *frame, uint8_t ext, uint8_t *data)
+{
+    if (r->ext != ext || (frame->ID & r->mask) != (r->id & r->mask))
+        return 0;
+
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        if ((data[i] & r->data_mask[i]) != (r->data[i] & r->data_mask[i]))
+            return 0;
+    }
+    return 1;
+}
+
+// Fill in the response of a rule for the given request payload; the
+// rule counter is advanced by the caller once the response is accepted
+static void ecu_build(ecu_rule_t *r, uint8_t *request, FLEXCAN_Mb_Type *frame)
+{
+    uint8_t data[8];
+
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        uint8_t arg = r->ops[i] & 0x07;
+        switch (r->ops[i] >> 4)
+        {
+            case ECU_OP_REQUEST:
+                data[i] = request[arg] + r->resp_data[i];
+                break;
+            case ECU_OP_COUNTER:
+                data[i] = r->counter + r->resp_data[i];
+                break;
+            case ECU_OP_FIXED:
+            default:
+                data[i] = r->resp_data[i];
+                break;
+        }
+    }
+
+    memset(frame, 0, sizeof(*frame));
+    frame->ID = r->resp_id;
+    frame->FORMAT = r->resp_ext ? FLEXCAN_MbFormat_Extended : FLEXCAN_MbFormat_Standard;
+    frame->TYPE = FLEXCAN_MbType_Data;
+    frame->LENGTH = r->resp_dlc;
+    frame->BYTE0 = data[0];
+    frame->BYTE1 = data[1];
+    frame->BYTE2 = data[2];
+    frame->BYTE3 = data[3];
+    frame->BYTE4 = data[4];
+    frame->BYTE5 = data[5];
+    frame->BYTE6 = data[6];
+    frame->BYTE7 = data[7];
+}
+
+// Queue a response behind those due no later than it. Called from the
+// FlexCAN RX interrupt only. Returns nonzero if the queue is full.
+static uint8_t ecu_defer(FLEXCAN_Mb_Type *frame, uint32_t due_us)
+{
+    uint8_t pos = pending_count;
+
+    if (pending_count >= ECU_PENDING)
+    {
+        dropped++;
+        return 1u;
+    }
+
+    while (pos > 0 && (int32_t)(pending[pos - 1].due_us - due_us) > 0)
+    {
+        pending[pos] = pending[pos - 1];
+        pos--;
+    }
+    pending[pos].due_us = due_us;
+    pending[pos].frame = *frame;
+    pending_count++;
+
+    // A new earliest response moves the compare forward
+    if (pos == 0)
+    {
+        timebase_ecu_set(due_us);
+    }
+    return 0u;
+}
+
+
+// Drop all rules and responses not sent yet
+void ecu_clear(void)
+{
+    ecu_lock();
+    timebase_ecu_cancel();
+    memset(rules, 0, sizeof(rules));
+    pending_count = 0;
+    ecu_unlock();
+}
+
+// Set the request ID pattern and response delay of a rule. This resets
+// the rule: it is disabled with an empty payload pattern and a zero
+// response until completed and enabled again.
+uint8_t ecu_set_match(uint8_t rule, uint8_t ext, uint32_t id, uint32_t mask, uint16_t delay_us)
+{
+    if (rule >= ECU_MAX_RULES)
+    {
+        return 1u;
+    }
+
+    ecu_rule_t *r = &rules[rule];
+    ecu_lock();
+    memset(r, 0, sizeof(*r));
+    r->ext = (ext != 0);
+    r->id = id;
+    r->mask = mask;
+    r->delay_us = delay_us;
+    ecu_unlock();
+    return 0u;
+}
+
+// Set the payload pattern (is_mask = 0) or its mask (is_mask = 1)
+uint8_t ecu_set_match_data(uint8_t rule, uint8_t *data, uint8_t is_mask)
+{
+    if (rule >= ECU_MAX_RULES)
+    {
+        return 1u;
+    }
+
+    ecu_lock();
+    memcpy(is_mask ? rules[rule].data_mask : rules[rule].data, data, 8);
+    ecu_unlock();
+    return 0u;
+}
+
+uint8_t ecu_set_response(uint8_t rule, uint8_t ext, uint32_t id, uint8_t dlc)
+{
+    if (rule >= ECU_MAX_RULES || dlc > 8)
+    {
+        return 1u;
+    }
+
+    ecu_lock();
+    rules[rule].resp_ext = (ext != 0);
+    rules[rule].resp_id = id;
+    rules[rule].resp_dlc = dlc;
+    ecu_unlock();
+    return 0u;
+}
+
+// Set the response template (is_ops = 0) or the per-byte ops (is_ops = 1)
+uint8_t ecu_set_response_data(uint8_t rule, uint8_t *data, uint8_t is_ops)
+{
+    if (rule >= ECU_MAX_RULES)
+    {
+        return 1u;
+    }
+
+    ecu_lock();
+    memcpy(is_ops ? rules[rule].ops : rules[rule].resp_data, data, 8);
+    ecu_unlock();
+    return 0u;
+}
+
+uint8_t ecu_enable(uint8_t rule, uint8_t enable)
+{
+    if (rule >= ECU_MAX_RULES)
+    {
+        return 1u;
+    }
+
+    ecu_lock();
+    rules[rule].counter = 0;
+    rules[rule].enabled = (enable != 0);
+    ecu_unlock();
+    return 0u;
+}
+
+// Answer a received frame if a rule matches it. Called from the FlexCAN
+// RX interrupt as each frame leaves the FIFO; the request itself is still
+// forwarded to the host.
+void ecu_rx_frame(FLEXCAN_Mb_Type *frame)
+{
+    FLEXCAN_Mb_Type response;
+    uint8_t ext = (frame->FORMAT == FLEXCAN_MbFormat_Extended);
+
+    if (frame->TYPE != FLEXCAN_MbType_Data)
+    {
+        return;
+    }
+
+    uint8_t data[8] = {
+        frame->BYTE0, frame->BYTE1, frame->BYTE2, frame->BYTE3,
+        frame->BYTE4, frame->BYTE5, frame->BYTE6, frame->BYTE7,
+    };
+
+    for (uint8_t i = 0; i < ECU_MAX_RULES; i++)
+    {
+        ecu_rule_t *r = &rules[i];
+        if (!r->enabled || !ecu_matches(r, frame, ext, data))
+            continue;
+
+        // A response dropped for a full queue does not use up a count
+        ecu_build(r, data, &response);
+        if (r->delay_us == 0 && pending_count == 0 && ecu_mb_free())
+        {
+            ecu_transmit(&response);
+            r->counter++;
+        } else if (ecu_defer(&response, timebase_us() + r->delay_us) == 0) {
+            r->counter++;
+        }
+        return;
+    }
+}
+
+// Load the responses which are due, one per mailbox transmission
+void timebase_ecu_cb(void)
+{
+    // The RX interrupt queues responses and uses the mailbox as well
+    NVIC_DisableIRQ(BOARD_FLEXCAN_IRQn);
+
+    while (pending_count > 0)
+    {
+        uint32_t now = timebase_us();
+
+        if (can_get_bus_state() != ON_BUS)
+        {
+            // Nobody is there to answer to any more
+            pending_count = 0;
+            break;
+        }
+        if ((int32_t)(now - pending[0].due_us) < 0)
+        {
+            timebase_ecu_set(pending[0].due_us);
+            break;
+        }
+        if (!ecu_mb_free())
+        {
+            // The previous response has not left yet, try again shortly
+            timebase_ecu_set(now + ECU_RETRY_US);
+            break;
+        }
+
+        ecu_transmit(&pending[0].frame);
+        pending_count--;
+        memmove(&pending[0], &pending[1], pending_count * sizeof(pending[0]));
+    }
+
+    NVIC_EnableIRQ(BOARD_FLEXCAN_IRQn);
+}
+
+// Add the responses sent since the last call to the bus load and report
+// those dropped for a full queue, on every pass of the main loop
+void ecu_account(void)
+{
+    ecu_lock();
+    uint32_t bits = sent_bits;
+    uint32_t frames = sent_frames;
+    uint32_t lost = dropped;
+    ecu_unlock();
+
+    if (frames != counted_frames)
+    {
+        busload_add_bits(bits - counted_bits, frames - counted_frames);
+        counted_bits = bits;
+        counted_frames = frames;
+    }
+    for (; counted_dropped != lost; counted_dropped++)
+    {
+        error_assert(ERR_FULLBUF_ECU);
+    }
+}
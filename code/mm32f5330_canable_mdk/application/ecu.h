@@ -0,0 +1,57 @@
+#ifndef _ECU_H
+#define _ECU_H
+
+#include "stdint.h"
+#include "hal_flexcan.h"
+
+// Number of request/response rules
+#define ECU_MAX_RULES       16u
+
+// Delayed responses waiting for their transmit time
+#define ECU_PENDING         8u
+
+// Retry interval while the mailbox still holds the previous response
+#define ECU_RETRY_US        20u
+
+// How each response byte is built, high nybble of its op byte; the low
+// nybble selects a request byte
+typedef enum ecu_op_
+{
+    ECU_OP_FIXED = 0,       // Template byte
+    ECU_OP_REQUEST = 1,     // Request byte plus template byte
+    ECU_OP_COUNTER = 2,     // Rule counter plus template byte
+} ecu_op_t;
+
+typedef struct ecu_rule_
+{
+    // Request pattern
+    uint32_t id;
+    uint32_t mask;
+    uint8_t data[8];
+    uint8_t data_mask[8];
+    uint8_t ext;
+
+    // Response template
+    uint8_t resp_ext;
+    uint8_t resp_dlc;
+    uint8_t counter;        // Incremented per response sent or queued
+    uint32_t resp_id;
+    uint8_t resp_data[8];
+    uint8_t ops[8];
+    uint16_t delay_us;      // Delay from reception to transmission
+
+    uint8_t enabled;
+    uint8_t reserved;
+} ecu_rule_t;
+
+// Prototypes
+void ecu_clear(void);
+uint8_t ecu_set_match(uint8_t rule, uint8_t ext, uint32_t id, uint32_t mask, uint16_t delay_us);
+uint8_t ecu_set_match_data(uint8_t rule, uint8_t *data, uint8_t is_mask);
+uint8_t ecu_set_response(uint8_t rule, uint8_t ext, uint32_t id, uint8_t dlc);
+uint8_t ecu_set_response_data(uint8_t rule, uint8_t *data, uint8_t is_ops);
+uint8_t ecu_enable(uint8_t rule, uint8_t enable);
+void ecu_rx_frame(FLEXCAN_Mb_Type *frame);
+void ecu_account(void);
+
+#endif // _ECU_H
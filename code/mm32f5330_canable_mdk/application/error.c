@@ -8,6 +8,7 @@
 // Private variables
 static uint32_t err_reg = 0;
 static uint32_t err_time[ERR_MAX] = {0};
+static uint32_t err_count[ERR_MAX] = {0};
 
 
 // Assert an error: sets err register bit and records timestamp
@@ -18,6 +19,7 @@ void error_assert(error_t err)
 
     //err_time[err] = HAL_GetTick();
     err_reg |= (1 << err);
+    err_count[err]++;
 }
 
 
@@ -30,6 +32,15 @@ uint32_t error_timestamp(error_t err)
     return err_time[err];
 }
 
+// Number of times an error has been asserted since boot
+uint32_t error_count(error_t err)
+{
+    if(err >= ERR_MAX)
+        return 0;
+
+    return err_count[err];
+}
+
 // Returns 1 if the error has occurred since boot
 uint8_t error_occurred(error_t err)
 {
@@ -11,6 +11,9 @@ typedef enum _error_t
     ERR_CANRXFIFO_OVERFLOW,
     ERR_FULLBUF_CANTX,
     ERR_FULLBUF_USBRX,
+    ERR_FLASH_WRITE,
+    ERR_FULLBUF_ECU,
+    ERR_FULLBUF_SUSPEND,
 
     ERR_MAX
 } error_t;
@@ -19,6 +22,7 @@ typedef enum _error_t
 // Prototypes
 void error_assert(error_t err);
 uint32_t error_timestamp(error_t err);
+uint32_t error_count(error_t err);
 uint8_t error_occurred(error_t err);
 uint32_t error_reg(void);
 
@@ -0,0 +1,138 @@
+//
+// hist: Count, min, max, mean and log2 histogram of a value, and their
+// dump to the host
+//
+// Shared by the profiler and the latency tracer. Updates are not masked,
+// callers recording from several interrupt levels mask around
+// hist_record(); copies are always taken with interrupts masked.
+//
+
+#include "hist.h"
+#include "board_init.h"
+#include "slcan.h"
+#include "tusb.h"
+
+
+// Clear count sets of statistics
+void hist_reset(hist_stats_t *s, uint8_t count)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        s[i].count = 0;
+        s[i].min = 0xFFFFFFFFu;
+        s[i].max = 0;
+        s[i].sum = 0;
+        for (uint8_t j = 0; j < HIST_BUCKETS; j++)
+        {
+            s[i].hist[j] = 0;
+        }
+    }
+
+    __set_PRIMASK(primask);
+}
+
+// Account one value into the first buckets of the histogram
+void hist_record(hist_stats_t *s, uint8_t buckets, uint32_t v)
+{
+    s->count++;
+    s->sum += v;
+    if (v < s->min)
+        s->min = v;
+    if (v > s->max)
+        s->max = v;
+
+    uint32_t bucket = (v == 0) ? 0 : (31u - __CLZ(v));
+    if (bucket >= buckets)
+        bucket = buckets - 1u;
+    s->hist[bucket]++;
+}
+
+// Take a consistent copy of a set, which may be updated from interrupts
+void hist_copy(const hist_stats_t *s, hist_stats_t *copy)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *copy = *s;
+    __set_PRIMASK(primask);
+}
+
+// Begin streaming count sets of statistics to the host
+void hist_dump_start(hist_dump_t *d, const hist_stats_t *sets, uint8_t count, uint8_t buckets, uint8_t tag)
+{
+    d->sets = sets;
+    d->count = count;
+    d->buckets = buckets;
+    d->tag = tag;
+    d->index = 0;
+    d->header = 1;
+    d->active = 1;
+}
+
+// Emit dump lines while there is room in the CDC TX FIFO. Output is:
+//   tag + set + count + min + max + mean       per set
+//   lower case tag + set + bucket + count      per non-empty bucket
+//   tag                                        end of dump
+void hist_dump_process(hist_dump_t *d)
+{
+    uint8_t line[HIST_LINE_LEN];
+    uint8_t pos;
+
+    if (!d->active)
+        return;
+
+    while (d->active && tud_cdc_write_available() >= HIST_LINE_LEN)
+    {
+        pos = 0;
+
+        if (d->index >= d->count)
+        {
+            // Terminator
+            line[pos++] = d->tag;
+            d->active = 0;
+        }
+        else if (d->header)
+        {
+            // Set summary
+            hist_copy(&d->sets[d->index], &d->snapshot);
+            uint32_t mean = d->snapshot.count ? (uint32_t)(d->snapshot.sum / d->snapshot.count) : 0;
+            uint32_t min = d->snapshot.count ? d->snapshot.min : 0;
+
+            line[pos++] = d->tag;
+            pos += slcan_put_hex(&line[pos], d->index, 1);
+            pos += slcan_put_hex(&line[pos], d->snapshot.count, 8);
+            pos += slcan_put_hex(&line[pos], min, 8);
+            pos += slcan_put_hex(&line[pos], d->snapshot.max, 8);
+            pos += slcan_put_hex(&line[pos], mean, 8);
+            d->header = 0;
+            d->bucket = 0;
+        }
+        else
+        {
+            // Next non-empty histogram bucket of the snapshot
+            while (d->bucket < d->buckets && d->snapshot.hist[d->bucket] == 0)
+            {
+                d->bucket++;
+            }
+            if (d->bucket >= d->buckets)
+            {
+                d->index++;
+                d->header = 1;
+                continue;
+            }
+
+            line[pos++] = d->tag | 0x20u;
+            pos += slcan_put_hex(&line[pos], d->index, 1);
+            pos += slcan_put_hex(&line[pos], d->bucket, 2);
+            pos += slcan_put_hex(&line[pos], d->snapshot.hist[d->bucket], 8);
+            d->bucket++;
+        }
+
+        line[pos++] = '\r';
+        tud_cdc_write(line, pos);
+    }
+
+    tud_cdc_write_flush();
+}
@@ -0,0 +1,44 @@
+#ifndef _HIST_H
+#define _HIST_H
+
+#include "stdint.h"
+
+// Room for log2 histogram buckets; bucket n counts values in
+// [2^n, 2^(n+1)), the top bucket in use also takes everything larger
+#define HIST_BUCKETS        24u
+
+// Longest line emitted while dumping
+#define HIST_LINE_LEN       36u
+
+typedef struct hist_stats_
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t hist[HIST_BUCKETS];
+} hist_stats_t;
+
+// Streams a set of statistics to the host, tag in the summary lines and
+// in lower case in the bucket lines
+typedef struct hist_dump_
+{
+    const hist_stats_t *sets;
+    uint8_t count;
+    uint8_t buckets;
+    uint8_t tag;
+    uint8_t active;
+    uint8_t index;
+    uint8_t bucket;
+    uint8_t header;
+    hist_stats_t snapshot;
+} hist_dump_t;
+
+// Prototypes
+void hist_reset(hist_stats_t *s, uint8_t count);
+void hist_record(hist_stats_t *s, uint8_t buckets, uint32_t v);
+void hist_copy(const hist_stats_t *s, hist_stats_t *copy);
+void hist_dump_start(hist_dump_t *d, const hist_stats_t *sets, uint8_t count, uint8_t buckets, uint8_t tag);
+void hist_dump_process(hist_dump_t *d);
+
+#endif // _HIST_H
@@ -0,0 +1,759 @@
+//
+// isotp: ISO 15765-2 segmentation and reassembly offload
+//
+// Single, first, consecutive and flow control frames are handled on the
+// device so that flow control is answered and STmin is honoured without a
+// USB round trip. Segments of a PDU from the host go out of a mailbox of
+// their own; consecutive frames are loaded from a timebase compare, STmin
+// after the previous one has left, and a transfer is reported complete
+// once its last frame has. Flow control frames take the same mailbox as
+// soon as it is free, ahead of the next segment and never behind the
+// host's frames in the TX queue. The host exchanges whole PDUs as single lines:
+//   'I' + pair (1) + length (3) + data (2 per byte)
+// in both directions. Only one PDU is reassembled and one is segmented at a
+// time, shared by all configured ID pairs.
+//
+
+#include <string.h>
+#include "isotp.h"
+#include "board_init.h"
+#include "busload.h"
+#include "can.h"
+#include "led.h"
+#include "slcan.h"
+#include "timebase.h"
+#include "tusb.h"
+
+// Protocol control information, high nybble of the first data byte
+#define ISOTP_PCI_SF        0x0u
+#define ISOTP_PCI_FF        0x1u
+#define ISOTP_PCI_CF        0x2u
+#define ISOTP_PCI_FC        0x3u
+
+// Flow status of a flow control frame
+#define ISOTP_FS_CTS        0x0u
+#define ISOTP_FS_WAIT       0x1u
+#define ISOTP_FS_OVFLW      0x2u
+
+// Status line: 'i' + pair (1) + direction (1) + result (2) + CR
+#define ISOTP_STATUS_LEN    6u
+#define ISOTP_STATUS_DEPTH  4u
+#define ISOTP_DIR_TX        0u
+#define ISOTP_DIR_RX        1u
+
+// Payload bytes converted to hex per tud_cdc_write() call
+#define ISOTP_CHUNK_LEN     16u
+
+// Polling interval while the mailbox still holds the previous segment
+#define ISOTP_RETRY_US      20u
+
+typedef enum isotp_tx_state_
+{
+    ISOTP_TX_IDLE = 0,
+    ISOTP_TX_START,         // PDU loaded, first frame not sent yet
+    ISOTP_TX_WAIT_FC,
+    ISOTP_TX_SENDING,       // Consecutive frames loaded from the interrupt
+    ISOTP_TX_FINISHING,     // Last frame loaded, waiting for it to leave
+} isotp_tx_state_t;
+
+typedef enum isotp_rx_state_
+{
+    ISOTP_RX_IDLE = 0,
+    ISOTP_RX_RECEIVING,
+    ISOTP_RX_DELIVERING,    // Complete, being streamed to the host
+} isotp_rx_state_t;
+
+typedef struct isotp_status_
+{
+    uint8_t pair;
+    uint8_t dir;
+    uint8_t result;
+} isotp_status_t;
+
+// Private variables
+static isotp_pair_t pairs[ISOTP_PAIRS];
+
+// Shared with the STmin interrupt while SENDING
+static uint8_t tx_buf[ISOTP_MAX_LEN];
+static volatile isotp_tx_state_t tx_state = ISOTP_TX_IDLE;
+static uint8_t tx_pair;
+static uint16_t tx_len;
+static uint16_t tx_cf_total;
+static volatile uint16_t tx_cf_loaded;
+static uint16_t tx_cf_counted;      // Loaded frames added to the bus load
+static uint8_t tx_bs;
+static uint8_t tx_bs_left;
+static uint8_t tx_in_flight;       // A segment was loaded since STmin last ran
+static uint8_t tx_wait_count;
+static uint32_t tx_st_us;
+static volatile uint32_t tx_tick;
+
+static uint8_t rx_buf[ISOTP_MAX_LEN];
+static isotp_rx_state_t rx_state = ISOTP_RX_IDLE;
+static uint8_t rx_pair;
+static uint16_t rx_len;
+static uint16_t rx_pos;
+static uint8_t rx_sn;
+static uint8_t rx_bs_left;
+static volatile uint8_t rx_fc_pending;  // Read by the STmin interrupt
+static uint32_t rx_tick;
+static uint8_t rx_line_active;
+static uint8_t mb_holds_fc;            // The mailbox holds flow control
+
+// PDU line from the host being parsed
+static uint8_t feed_pair;
+static uint16_t feed_len;
+static uint8_t feed_digits;
+static uint16_t feed_nybbles;
+static uint8_t feed_busy;
+static uint8_t feed_error;
+
+static isotp_status_t status_ring[ISOTP_STATUS_DEPTH];
+static uint8_t status_head = 0;
+static uint8_t status_count = 0;
+
+
+static void isotp_report(uint8_t pair, uint8_t dir, isotp_result_t result)
+{
+    if (status_count >= ISOTP_STATUS_DEPTH)
+    {
+        return;
+    }
+
+    isotp_status_t *s = &status_ring[(status_head + status_count) % ISOTP_STATUS_DEPTH];
+    s->pair = pair;
+    s->dir = dir;
+    s->result = result;
+    status_count++;
+}
+
+// STmin in microseconds; reserved values mean the longest valid one
+static uint32_t isotp_st_min_us(uint8_t st_min)
+{
+    if (st_min <= 0x7F)
+        return st_min * 1000u;
+    if (st_min >= 0xF1 && st_min <= 0xF9)
+        return (st_min - 0xF0) * 100u;
+    return 0x7Fu * 1000u;
+}
+
+static uint8_t isotp_nybble(uint8_t c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return 0xFF;
+}
+
+// Frame to the ECU of a pair, padded to 8 data bytes
+static void isotp_frame(isotp_pair_t *p, const uint8_t *data, uint8_t len, FLEXCAN_Mb_Type *frame)
+{
+    uint8_t bytes[8];
+
+    memset(bytes, ISOTP_PADDING, sizeof(bytes));
+    memcpy(bytes, data, len);
+
+    memset(frame, 0, sizeof(*frame));
+    frame->ID = p->tx_id;
+    frame->FORMAT = p->ext ? FLEXCAN_MbFormat_Extended : FLEXCAN_MbFormat_Standard;
+    frame->TYPE = FLEXCAN_MbType_Data;
+    frame->LENGTH = 8;
+    frame->BYTE0 = bytes[0];
+    frame->BYTE1 = bytes[1];
+    frame->BYTE2 = bytes[2];
+    frame->BYTE3 = bytes[3];
+    frame->BYTE4 = bytes[4];
+    frame->BYTE5 = bytes[5];
+    frame->BYTE6 = bytes[6];
+    frame->BYTE7 = bytes[7];
+}
+
+static uint8_t isotp_mb_free(void)
+{
+    uint32_t code = (BOARD_FLEXCAN_PORT->MB[BOARD_FLEXCAN_ISOTP_TX_MB_CH].CS & FLEXCAN_CS_CODE_MASK) >> FLEXCAN_CS_CODE_SHIFT;
+    return (code == FLEXCAN_MbCode_TxInactive) || (code == FLEXCAN_MbCode_RxInactive);
+}
+
+// Start a segment of the PDU being sent in its mailbox
+static void isotp_load(FLEXCAN_Mb_Type *frame)
+{
+    mb_holds_fc = 0;
+    FLEXCAN_ClearMbStatus(BOARD_FLEXCAN_PORT, 1u << BOARD_FLEXCAN_ISOTP_TX_MB_CH);
+    FLEXCAN_WriteTxMb(BOARD_FLEXCAN_PORT, BOARD_FLEXCAN_ISOTP_TX_MB_CH, frame);
+    FLEXCAN_SetMbCode(BOARD_FLEXCAN_PORT, BOARD_FLEXCAN_ISOTP_TX_MB_CH, FLEXCAN_MbCode_TxDataOrRemote);
+}
+
+// Consecutive frame number index (from 1) of the PDU being sent
+static void isotp_cf_frame(uint16_t index, FLEXCAN_Mb_Type *frame)
+{
+    uint8_t data[8];
+    uint16_t pos = 6u + 7u * (index - 1u);
+    uint16_t len = tx_len - pos;
+
+    if (len > 7)
+        len = 7;
+    data[0] = (ISOTP_PCI_CF << 4) | (index & 0x0F);
+    memcpy(&data[1], &tx_buf[pos], len);
+    isotp_frame(&pairs[tx_pair], data, len + 1, frame);
+}
+
+// Load a flow control frame into the mailbox if it is free. Returns 0 if
+// it still holds a segment, which leaves within one frame time
+static uint8_t isotp_send_fc(uint8_t pair, uint8_t fs)
+{
+    FLEXCAN_Mb_Type frame;
+    uint8_t data[3];
+    uint8_t loaded = 0;
+
+    data[0] = (ISOTP_PCI_FC << 4) | fs;
+    data[1] = pairs[pair].block_size;
+    data[2] = pairs[pair].st_min;
+    isotp_frame(&pairs[pair], data, sizeof(data), &frame);
+
+    // The STmin interrupt loads segments into the same mailbox
+    NVIC_DisableIRQ(BOARD_TIMEBASE_IRQn);
+    if (isotp_mb_free())
+    {
+        isotp_load(&frame);
+        mb_holds_fc = 1;
+        loaded = 1;
+    }
+    NVIC_EnableIRQ(BOARD_TIMEBASE_IRQn);
+
+    if (loaded)
+    {
+        busload_add_frame(&frame);
+    }
+    return loaded;
+}
+
+// Send the flow control frame owed to the current sender once the
+// mailbox is free; the STmin interrupt holds back segments meanwhile
+static void isotp_flush_fc(void)
+{
+    if (rx_fc_pending && isotp_send_fc(rx_pair, ISOTP_FS_CTS))
+    {
+        rx_fc_pending = 0;
+    }
+}
+
+
+// Handle a frame from the ECU of a pair while we are receiving
+static void isotp_rx_data(uint8_t pair, uint8_t *data, uint8_t dlc)
+{
+    uint8_t pci = data[0] >> 4;
+    uint16_t len;
+
+    switch (pci)
+    {
+        case ISOTP_PCI_SF:
+        case ISOTP_PCI_FF:
+            if (rx_state == ISOTP_RX_RECEIVING && rx_pair == pair)
+            {
+                // A new PDU from the same sender aborts the current one
+                isotp_report(pair, ISOTP_DIR_RX, ISOTP_UNEXP_PDU);
+                rx_state = ISOTP_RX_IDLE;
+                rx_fc_pending = 0;
+            }
+
+            if (pci == ISOTP_PCI_SF)
+            {
+                len = data[0] & 0x0F;
+                if (len == 0 || len > dlc - 1)
+                    return;
+            } else {
+                len = ((data[0] & 0x0F) << 8) | data[1];
+                if (dlc < 8 || len < 8)
+                    return;
+            }
+
+            if (rx_state != ISOTP_RX_IDLE)
+            {
+                // The reassembly buffer is taken by another PDU
+                if (pci == ISOTP_PCI_FF)
+                {
+                    isotp_send_fc(pair, ISOTP_FS_OVFLW);
+                }
+                isotp_report(pair, ISOTP_DIR_RX, ISOTP_OVERFLOW);
+                return;
+            }
+
+            rx_pair = pair;
+            rx_len = len;
+            if (pci == ISOTP_PCI_SF)
+            {
+                memcpy(rx_buf, &data[1], len);
+                rx_state = ISOTP_RX_DELIVERING;
+            } else {
+                memcpy(rx_buf, &data[2], 6);
+                rx_pos = 6;
+                rx_sn = 1;
+                rx_bs_left = pairs[pair].block_size;
+                rx_tick = uwTick;
+                rx_state = ISOTP_RX_RECEIVING;
+                rx_fc_pending = 1;
+                isotp_flush_fc();
+            }
+            return;
+
+        case ISOTP_PCI_CF:
+            if (rx_state != ISOTP_RX_RECEIVING || rx_pair != pair)
+                return;
+
+            if ((data[0] & 0x0F) != rx_sn)
+            {
+                isotp_report(pair, ISOTP_DIR_RX, ISOTP_WRONG_SN);
+                rx_state = ISOTP_RX_IDLE;
+                rx_fc_pending = 0;
+                return;
+            }
+
+            len = rx_len - rx_pos;
+            if (len > 7)
+                len = 7;
+            if (len > dlc - 1)
+                len = dlc - 1;
+            memcpy(&rx_buf[rx_pos], &data[1], len);
+            rx_pos += len;
+            rx_sn = (rx_sn + 1) & 0x0F;
+            rx_tick = uwTick;
+
+            if (rx_pos >= rx_len)
+            {
+                rx_state = ISOTP_RX_DELIVERING;
+            }
+            else if (pairs[pair].block_size && --rx_bs_left == 0)
+            {
+                rx_bs_left = pairs[pair].block_size;
+                rx_fc_pending = 1;
+                isotp_flush_fc();
+            }
+            return;
+
+        case ISOTP_PCI_FC:
+            if (tx_state != ISOTP_TX_WAIT_FC || tx_pair != pair || dlc < 3)
+                return;
+
+            switch (data[0] & 0x0F)
+            {
+                case ISOTP_FS_CTS:
+                    // The first frame of a block goes right away, the
+                    // interrupt takes it from there
+                    tx_bs = data[1];
+                    tx_bs_left = tx_bs;
+                    tx_st_us = isotp_st_min_us(data[2]);
+                    tx_in_flight = 0;
+                    tx_tick = uwTick;
+                    tx_state = ISOTP_TX_SENDING;
+                    timebase_stmin_set(timebase_us());
+                    break;
+                case ISOTP_FS_WAIT:
+                    if (++tx_wait_count > ISOTP_WFT_MAX)
+                    {
+                        isotp_report(pair, ISOTP_DIR_TX, ISOTP_WFT_OVRN);
+                        tx_state = ISOTP_TX_IDLE;
+                    }
+                    tx_tick = uwTick;
+                    break;
+                case ISOTP_FS_OVFLW:
+                    isotp_report(pair, ISOTP_DIR_TX, ISOTP_OVERFLOW);
+                    tx_state = ISOTP_TX_IDLE;
+                    break;
+                default:
+                    isotp_report(pair, ISOTP_DIR_TX, ISOTP_INVALID_FS);
+                    tx_state = ISOTP_TX_IDLE;
+                    break;
+            }
+            return;
+
+        default:
+            return;
+    }
+}
+
+// Load the first or single frame of the PDU into the mailbox
+static void isotp_tx_first(void)
+{
+    FLEXCAN_Mb_Type frame;
+    uint8_t data[8];
+
+    tx_tick = uwTick;
+    if (tx_len <= 7)
+    {
+        data[0] = (ISOTP_PCI_SF << 4) | tx_len;
+        memcpy(&data[1], tx_buf, tx_len);
+        isotp_frame(&pairs[tx_pair], data, tx_len + 1, &frame);
+        isotp_load(&frame);
+        busload_add_frame(&frame);
+        tx_state = ISOTP_TX_FINISHING;
+        return;
+    }
+
+    data[0] = (ISOTP_PCI_FF << 4) | (tx_len >> 8);
+    data[1] = tx_len & 0xFF;
+    memcpy(&data[2], tx_buf, 6);
+    isotp_frame(&pairs[tx_pair], data, 8, &frame);
+    isotp_load(&frame);
+    busload_add_frame(&frame);
+
+    tx_cf_total = (tx_len - 6u + 7u - 1u) / 7u;
+    tx_cf_loaded = 0;
+    tx_cf_counted = 0;
+    tx_wait_count = 0;
+    tx_state = ISOTP_TX_WAIT_FC;
+}
+
+// Count the consecutive frames the interrupt loaded in the bus load,
+// which is only ever updated from the main loop
+static void isotp_tx_account(void)
+{
+    FLEXCAN_Mb_Type frame;
+
+    while (tx_cf_counted != tx_cf_loaded)
+    {
+        tx_cf_counted++;
+        isotp_cf_frame(tx_cf_counted, &frame);
+        busload_add_frame(&frame);
+    }
+}
+
+// Give up the PDU being sent, taking back a segment not sent yet
+static void isotp_tx_abort(isotp_result_t result)
+{
+    NVIC_DisableIRQ(BOARD_TIMEBASE_IRQn);
+    timebase_stmin_cancel();
+    tx_state = ISOTP_TX_IDLE;
+    NVIC_EnableIRQ(BOARD_TIMEBASE_IRQn);
+
+    // Flow control owed to a sender is not ours to take back
+    if (!isotp_mb_free() && !mb_holds_fc)
+    {
+        FLEXCAN_SetMbCode(BOARD_FLEXCAN_PORT, BOARD_FLEXCAN_ISOTP_TX_MB_CH, FLEXCAN_MbCode_TxInactive);
+    }
+    isotp_report(tx_pair, ISOTP_DIR_TX, result);
+}
+
+// Load the next consecutive frame once STmin has passed since the previous
+// one left the mailbox; called from the timebase interrupt only
+void timebase_stmin_cb(void)
+{
+    uint32_t now = timebase_us();
+    FLEXCAN_Mb_Type frame;
+
+    if (tx_state != ISOTP_TX_SENDING)
+    {
+        return;
+    }
+
+    if (!isotp_mb_free() || rx_fc_pending || can_get_bus_state() == OFF_BUS)
+    {
+        // Still on its way, or flow control goes first; STmin counts
+        // from when it is gone
+        tx_in_flight = 1;
+        timebase_stmin_set(now + ISOTP_RETRY_US);
+        return;
+    }
+    if (tx_in_flight)
+    {
+        tx_in_flight = 0;
+        if (tx_st_us)
+        {
+            timebase_stmin_set(now + tx_st_us);
+            return;
+        }
+    }
+
+    isotp_cf_frame(tx_cf_loaded + 1u, &frame);
+    isotp_load(&frame);
+    tx_cf_loaded++;
+    tx_tick = uwTick;
+
+    if (tx_cf_loaded >= tx_cf_total)
+    {
+        tx_state = ISOTP_TX_FINISHING;
+    }
+    else if (tx_bs && --tx_bs_left == 0)
+    {
+        tx_state = ISOTP_TX_WAIT_FC;
+    }
+    else
+    {
+        // Next one once this one has left and STmin is over
+        tx_in_flight = 1;
+        timebase_stmin_set(now + ISOTP_RETRY_US);
+    }
+}
+
+// Stream the reassembled PDU to the host as one line
+static void isotp_deliver(void)
+{
+    uint8_t chunk[2 * ISOTP_CHUNK_LEN];
+    uint32_t n;
+
+    if (!rx_line_active)
+    {
+        if (tud_cdc_write_available() < 5 || !slcan_stream_claim(SLCAN_STREAM_ISOTP))
+            return;
+
+        chunk[0] = 'I';
+        slcan_put_hex(&chunk[1], rx_pair, 1);
+        slcan_put_hex(&chunk[2], rx_len, 3);
+        tud_cdc_write(chunk, 5);
+        rx_pos = 0;
+        rx_line_active = 1;
+    }
+
+    while (rx_pos < rx_len && (n = tud_cdc_write_available() / 2) > 0)
+    {
+        if (n > ISOTP_CHUNK_LEN)
+            n = ISOTP_CHUNK_LEN;
+        if (n > (uint32_t)(rx_len - rx_pos))
+            n = rx_len - rx_pos;
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            slcan_put_hex(&chunk[2 * i], rx_buf[rx_pos + i], 2);
+        }
+        tud_cdc_write(chunk, 2 * n);
+        rx_pos += n;
+    }
+
+    if (rx_pos >= rx_len && tud_cdc_write_available() > 0)
+    {
+        tud_cdc_write("\r", 1);
+        slcan_stream_release(SLCAN_STREAM_ISOTP);
+        rx_line_active = 0;
+        rx_state = ISOTP_RX_IDLE;
+    }
+}
+
+
+// Configure an ID pair; aborts transfers in progress on it
+uint8_t isotp_configure(uint8_t pair, uint32_t rx_id, uint32_t tx_id, uint8_t ext,
+                        uint8_t block_size, uint8_t st_min)
+{
+    uint32_t id_max = ext ? 0x1FFFFFFFu : 0x7FFu;
+
+    if (pair >= ISOTP_PAIRS || rx_id > id_max || tx_id > id_max)
+    {
+        return 1u;
+    }
+
+    isotp_disable(pair);
+
+    pairs[pair].rx_id = rx_id;
+    pairs[pair].tx_id = tx_id;
+    pairs[pair].ext = (ext != 0);
+    pairs[pair].block_size = block_size;
+    pairs[pair].st_min = st_min;
+    pairs[pair].enabled = 1;
+    return 0u;
+}
+
+void isotp_disable(uint8_t pair)
+{
+    if (pair >= ISOTP_PAIRS)
+        return;
+
+    pairs[pair].enabled = 0;
+    if (tx_state != ISOTP_TX_IDLE && tx_pair == pair)
+    {
+        NVIC_DisableIRQ(BOARD_TIMEBASE_IRQn);
+        timebase_stmin_cancel();
+        tx_state = ISOTP_TX_IDLE;
+        NVIC_EnableIRQ(BOARD_TIMEBASE_IRQn);
+    }
+    if (rx_state == ISOTP_RX_RECEIVING && rx_pair == pair)
+    {
+        rx_state = ISOTP_RX_IDLE;
+        rx_fc_pending = 0;
+    }
+}
+
+// Start of a PDU line from the host, called after the leading 'I'
+void isotp_host_begin(void)
+{
+    feed_pair = 0;
+    feed_len = 0;
+    feed_digits = 0;
+    feed_nybbles = 0;
+    feed_error = 0;
+
+    // The TX buffer must not change under a PDU still being segmented
+    feed_busy = (tx_state != ISOTP_TX_IDLE);
+}
+
+// Next character of a PDU line: pair and length digits, then data
+void isotp_host_char(uint8_t c)
+{
+    uint8_t n = isotp_nybble(c);
+
+    if (n > 0xF)
+    {
+        feed_error = 1;
+        return;
+    }
+
+    if (feed_digits < 4)
+    {
+        if (feed_digits == 0)
+            feed_pair = n;
+        else
+            feed_len = (feed_len << 4) | n;
+        feed_digits++;
+        return;
+    }
+
+    if (feed_nybbles >= 2 * ISOTP_MAX_LEN)
+    {
+        feed_error = 1;
+        return;
+    }
+
+    if (!feed_busy)
+    {
+        if (feed_nybbles & 1)
+            tx_buf[feed_nybbles / 2] |= n;
+        else
+            tx_buf[feed_nybbles / 2] = n << 4;
+    }
+    feed_nybbles++;
+}
+
+// End of a PDU line: start the transfer or report why it was refused
+void isotp_host_end(void)
+{
+    if (feed_error || feed_digits < 4 || feed_len == 0 || feed_len > ISOTP_MAX_LEN
+        || feed_nybbles != 2 * feed_len || feed_pair >= ISOTP_PAIRS || !pairs[feed_pair].enabled)
+    {
+        isotp_report(feed_pair, ISOTP_DIR_TX, ISOTP_BAD_REQUEST);
+        return;
+    }
+
+    if (feed_busy)
+    {
+        isotp_report(feed_pair, ISOTP_DIR_TX, ISOTP_BUSY);
+        return;
+    }
+
+    tx_pair = feed_pair;
+    tx_len = feed_len;
+    tx_state = ISOTP_TX_START;
+}
+
+// Handle a received frame, returns nonzero if it belongs to an ISO-TP pair
+// and must not be forwarded to the host as a raw frame
+uint8_t isotp_rx_frame(FLEXCAN_Mb_Type *frame)
+{
+    uint8_t ext = (frame->FORMAT == FLEXCAN_MbFormat_Extended);
+
+    if (frame->TYPE != FLEXCAN_MbType_Data || frame->LENGTH == 0)
+    {
+        return 0u;
+    }
+
+    for (uint8_t i = 0; i < ISOTP_PAIRS; i++)
+    {
+        if (pairs[i].enabled && pairs[i].rx_id == frame->ID && pairs[i].ext == ext)
+        {
+            uint8_t data[8] = {
+                frame->BYTE0, frame->BYTE1, frame->BYTE2, frame->BYTE3,
+                frame->BYTE4, frame->BYTE5, frame->BYTE6, frame->BYTE7,
+            };
+            isotp_rx_data(i, data, frame->LENGTH);
+            return 1u;
+        }
+    }
+    return 0u;
+}
+
+// Run the segmentation timing and timeouts and talk to the host. Output is
+//   'I' + pair + length + data        reassembled PDU
+//   'i' + pair + direction + result   transfer result, direction 0 = TX
+void isotp_process(void)
+{
+    uint32_t now = uwTick;
+
+    if (tx_state != ISOTP_TX_IDLE)
+    {
+        isotp_tx_account();
+    }
+
+    switch (tx_state)
+    {
+        case ISOTP_TX_START:
+            if (isotp_mb_free())
+            {
+                isotp_tx_first();
+            }
+            break;
+        case ISOTP_TX_WAIT_FC:
+            if ((now - tx_tick) > ISOTP_N_BS_MS)
+            {
+                isotp_tx_abort(ISOTP_TIMEOUT_BS);
+            }
+            break;
+        case ISOTP_TX_SENDING:
+            if ((now - tx_tick) > ISOTP_N_AS_MS)
+            {
+                isotp_tx_abort(ISOTP_TIMEOUT_AS);
+            }
+            break;
+        case ISOTP_TX_FINISHING:
+            // Complete once the last segment is on the bus
+            if (isotp_mb_free())
+            {
+                isotp_report(tx_pair, ISOTP_DIR_TX, ISOTP_OK);
+                tx_state = ISOTP_TX_IDLE;
+            }
+            else if ((now - tx_tick) > ISOTP_N_AS_MS)
+            {
+                isotp_tx_abort(ISOTP_TIMEOUT_AS);
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (rx_state == ISOTP_RX_RECEIVING)
+    {
+        isotp_flush_fc();
+        if ((now - rx_tick) > ISOTP_N_CR_MS)
+        {
+            isotp_report(rx_pair, ISOTP_DIR_RX, ISOTP_TIMEOUT_CR);
+            rx_state = ISOTP_RX_IDLE;
+            rx_fc_pending = 0;
+        }
+    }
+
+    if (rx_state != ISOTP_RX_DELIVERING && status_count == 0)
+    {
+        return;
+    }
+
+    if (rx_state == ISOTP_RX_DELIVERING)
+    {
+        isotp_deliver();
+    }
+
+    while (!slcan_stream_busy() && status_count > 0 && tud_cdc_write_available() >= ISOTP_STATUS_LEN)
+    {
+        isotp_status_t *s = &status_ring[status_head];
+        uint8_t line[ISOTP_STATUS_LEN];
+
+        line[0] = 'i';
+        slcan_put_hex(&line[1], s->pair, 1);
+        slcan_put_hex(&line[2], s->dir, 1);
+        slcan_put_hex(&line[3], s->result, 2);
+        line[5] = '\r';
+        tud_cdc_write(line, sizeof(line));
+
+        status_head = (status_head + 1) % ISOTP_STATUS_DEPTH;
+        status_count--;
+    }
+
+    tud_cdc_write_flush();
+}
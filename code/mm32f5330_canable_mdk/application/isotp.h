@@ -0,0 +1,60 @@
+#ifndef _ISOTP_H
+#define _ISOTP_H
+
+#include "stdint.h"
+#include "hal_flexcan.h"
+
+// Number of configurable RX/TX ID pairs
+#define ISOTP_PAIRS         4u
+
+// Largest PDU with a 12-bit first frame length
+#define ISOTP_MAX_LEN       4095u
+
+// Byte used to fill frames up to 8 data bytes
+#define ISOTP_PADDING       0xCCu
+
+// Timeouts (ms): our segment leaving the mailbox / waiting for a flow
+// control frame / for the next consecutive frame, and the number of FC
+// WAIT frames accepted in a row
+#define ISOTP_N_AS_MS       1000u
+#define ISOTP_N_BS_MS       1000u
+#define ISOTP_N_CR_MS       1000u
+#define ISOTP_WFT_MAX       16u
+
+// Transfer results reported to the host
+typedef enum isotp_result_
+{
+    ISOTP_OK = 0,
+    ISOTP_TIMEOUT_BS,       // No flow control frame from the receiver
+    ISOTP_TIMEOUT_CR,       // No consecutive frame from the sender
+    ISOTP_WRONG_SN,         // Consecutive frame out of sequence
+    ISOTP_OVERFLOW,         // Receiver reported overflow, or we could not accept
+    ISOTP_UNEXP_PDU,        // Reception aborted by a new single/first frame
+    ISOTP_WFT_OVRN,         // Too many FC WAIT frames
+    ISOTP_INVALID_FS,       // Flow control frame with a reserved flow status
+    ISOTP_BUSY,             // PDU from the host while a transfer is in progress
+    ISOTP_BAD_REQUEST,      // Malformed PDU line or pair not configured
+    ISOTP_TIMEOUT_AS,       // Our segment did not get onto the bus
+} isotp_result_t;
+
+typedef struct isotp_pair_
+{
+    uint32_t rx_id;         // ID of frames received from the ECU
+    uint32_t tx_id;         // ID of frames sent to the ECU
+    uint8_t ext;
+    uint8_t block_size;     // BS and STmin sent in our flow control frames
+    uint8_t st_min;
+    uint8_t enabled;
+} isotp_pair_t;
+
+// Prototypes
+uint8_t isotp_configure(uint8_t pair, uint32_t rx_id, uint32_t tx_id, uint8_t ext,
+                        uint8_t block_size, uint8_t st_min);
+void isotp_disable(uint8_t pair);
+void isotp_host_begin(void);
+void isotp_host_char(uint8_t c);
+void isotp_host_end(void);
+uint8_t isotp_rx_frame(FLEXCAN_Mb_Type *frame);
+void isotp_process(void);
+
+#endif // _ISOTP_H
@@ -0,0 +1,527 @@
+//
+// j1939: J1939-21 transport protocol reassembly
+//
+// BAM and RTS/CTS transfers of selected PGNs are collected on the device
+// and delivered to the host as one line instead of one line per TP.DT
+// packet. Transfers between other nodes are followed passively; transfers
+// addressed to the responder address are answered with CTS, retransmission
+// requests for lost packets and EndOfMsgAck.
+//
+
+#include <string.h>
+#include "j1939.h"
+#include "can.h"
+#include "led.h"
+#include "slcan.h"
+#include "tusb.h"
+
+// PDU format of the transport protocol frames
+#define J1939_PF_TP_DT      0xEBu
+#define J1939_PF_TP_CM      0xECu
+
+// TP.CM control bytes
+#define J1939_CM_RTS        16u
+#define J1939_CM_CTS        17u
+#define J1939_CM_EOMA       19u
+#define J1939_CM_BAM        32u
+#define J1939_CM_ABORT      255u
+
+// TP.CM frames we send: priority 7, PF 0xEC
+#define J1939_CM_ID         0x1CEC0000u
+
+#define J1939_GLOBAL        0xFFu
+
+// Abort line: 'j' + PGN (6) + SA (2) + DA (2) + reason (2) + CR
+#define J1939_ABORT_LINE_LEN 14u
+#define J1939_ABORT_DEPTH   4u
+
+// Message line header: 'J' + PGN (6) + SA (2) + DA (2) + size (3)
+#define J1939_HEADER_LEN    14u
+
+// Payload bytes converted to hex per tud_cdc_write() call
+#define J1939_CHUNK_LEN     16u
+
+typedef struct j1939_abort_
+{
+    uint32_t pgn;
+    uint8_t sa;
+    uint8_t da;
+    uint8_t reason;
+} j1939_abort_t;
+
+// Private variables
+static j1939_session_t sessions[J1939_SESSIONS];
+static uint32_t pgns[J1939_MAX_PGNS];
+static uint8_t pgn_count = 0;
+
+static uint8_t responder_enabled = 0;
+static uint8_t responder_address;
+static uint8_t responder_per_cts;
+
+static j1939_session_t *deliver = NULL;
+static uint16_t deliver_pos;
+
+static j1939_abort_t abort_ring[J1939_ABORT_DEPTH];
+static uint8_t abort_head = 0;
+static uint8_t abort_count = 0;
+
+
+static uint8_t j1939_selected(uint32_t pgn)
+{
+    for (uint8_t i = 0; i < pgn_count; i++)
+    {
+        if (pgns[i] == pgn)
+            return 1;
+    }
+    return 0;
+}
+
+// Session in progress between originator sa and destination da
+static j1939_session_t *j1939_find(uint8_t sa, uint8_t da)
+{
+    for (uint8_t i = 0; i < J1939_SESSIONS; i++)
+    {
+        j1939_session_t *s = &sessions[i];
+        if ((s->state == J1939_BAM || s->state == J1939_CMDT) && s->sa == sa && s->da == da)
+            return s;
+    }
+    return NULL;
+}
+
+static j1939_session_t *j1939_alloc(void)
+{
+    for (uint8_t i = 0; i < J1939_SESSIONS; i++)
+    {
+        if (sessions[i].state == J1939_IDLE)
+            return &sessions[i];
+    }
+    return NULL;
+}
+
+static void j1939_report(uint32_t pgn, uint8_t sa, uint8_t da, uint8_t reason)
+{
+    if (abort_count >= J1939_ABORT_DEPTH)
+    {
+        return;
+    }
+
+    j1939_abort_t *a = &abort_ring[(abort_head + abort_count) % J1939_ABORT_DEPTH];
+    a->pgn = pgn;
+    a->sa = sa;
+    a->da = da;
+    a->reason = reason;
+    abort_count++;
+}
+
+// Queue a TP.CM frame from the responder address to dst
+static void j1939_send_cm(uint8_t dst, uint8_t *data)
+{
+    FLEXCAN_Mb_Type frame;
+    uint8_t unused[8] = {0};
+
+    memset(&frame, 0, sizeof(frame));
+    frame.ID = J1939_CM_ID | ((uint32_t)dst << 8) | responder_address;
+    frame.FORMAT = FLEXCAN_MbFormat_Extended;
+    frame.TYPE = FLEXCAN_MbType_Data;
+    frame.LENGTH = 8;
+    frame.BYTE0 = data[0];
+    frame.BYTE1 = data[1];
+    frame.BYTE2 = data[2];
+    frame.BYTE3 = data[3];
+    frame.BYTE4 = data[4];
+    frame.BYTE5 = data[5];
+    frame.BYTE6 = data[6];
+    frame.BYTE7 = data[7];
+
+    can_tx(&frame, unused);
+}
+
+static void j1939_send_ctrl(j1939_session_t *s, uint8_t ctrl, uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4)
+{
+    uint8_t data[8] = {ctrl, b1, b2, b3, b4, s->pgn, s->pgn >> 8, s->pgn >> 16};
+    j1939_send_cm(s->sa, data);
+}
+
+static void j1939_abort(j1939_session_t *s, uint8_t reason)
+{
+    if (s->responder)
+    {
+        j1939_send_ctrl(s, J1939_CM_ABORT, reason, 0xFF, 0xFF, 0xFF);
+    }
+    j1939_report(s->pgn, s->sa, s->da, reason);
+    s->state = J1939_IDLE;
+}
+
+static void j1939_complete(j1939_session_t *s)
+{
+    if (s->responder)
+    {
+        j1939_send_ctrl(s, J1939_CM_EOMA, s->size, s->size >> 8, s->packets, 0xFF);
+    }
+    s->state = J1939_DONE;
+}
+
+// Responder: ask for the first missing packet and what follows it, or
+// acknowledge the message when nothing is missing
+static void j1939_request(j1939_session_t *s)
+{
+    uint16_t first = 1;
+    while (first <= s->packets && (s->seen[first >> 3] & (1u << (first & 7))))
+    {
+        first++;
+    }
+
+    if (first > s->packets)
+    {
+        j1939_complete(s);
+        return;
+    }
+
+    if (first <= s->requested && ++s->retries > J1939_MAX_RETRY)
+    {
+        j1939_abort(s, J1939_ABORT_RETRY);
+        return;
+    }
+
+    uint16_t count = s->packets - first + 1;
+    if (s->per_cts != 0xFF && count > s->per_cts)
+    {
+        count = s->per_cts;
+    }
+    if (responder_per_cts && count > responder_per_cts)
+    {
+        count = responder_per_cts;
+    }
+
+    s->next = first;
+    s->window = count;
+    s->window_left = count;
+    if (first + count - 1 > s->requested)
+    {
+        s->requested = first + count - 1;
+    }
+    s->tick = uwTick;
+
+    j1939_send_ctrl(s, J1939_CM_CTS, count, first, 0xFF, 0xFF);
+}
+
+// Start tracking a BAM or RTS announced by sa for da
+static uint8_t j1939_open(uint8_t ctrl, uint8_t sa, uint8_t da, uint8_t *data)
+{
+    uint32_t pgn = data[5] | ((uint32_t)data[6] << 8) | ((uint32_t)data[7] << 16);
+    uint16_t size = data[1] | (data[2] << 8);
+    uint8_t packets = data[3];
+
+    if (!j1939_selected(pgn) || size < 9 || size > J1939_MAX_LEN
+        || packets != (size + 6) / 7)
+    {
+        return 0u;
+    }
+
+    // A new announcement from the same originator replaces the old one
+    j1939_session_t *s = j1939_find(sa, da);
+    if (s != NULL)
+    {
+        j1939_report(s->pgn, s->sa, s->da, J1939_ABORT_BUSY);
+        s->state = J1939_IDLE;
+    }
+
+    s = j1939_alloc();
+    if (s == NULL)
+    {
+        if (ctrl == J1939_CM_RTS && responder_enabled && da == responder_address)
+        {
+            uint8_t abort[8] = {J1939_CM_ABORT, J1939_ABORT_RESOURCES, 0xFF, 0xFF, 0xFF,
+                                data[5], data[6], data[7]};
+            j1939_send_cm(sa, abort);
+        }
+        j1939_report(pgn, sa, da, J1939_ABORT_RESOURCES);
+        return 1u;
+    }
+
+    memset(s->seen, 0, sizeof(s->seen));
+    s->pgn = pgn;
+    s->size = size;
+    s->packets = packets;
+    s->received = 0;
+    s->sa = sa;
+    s->da = da;
+    s->per_cts = data[4];
+    s->requested = 0;
+    s->retries = 0;
+    s->window_left = 0;
+    s->tick = uwTick;
+    s->responder = (ctrl == J1939_CM_RTS && responder_enabled && da == responder_address);
+    s->state = (ctrl == J1939_CM_BAM) ? J1939_BAM : J1939_CMDT;
+
+    if (s->responder)
+    {
+        j1939_request(s);
+    }
+    return 1u;
+}
+
+static uint8_t j1939_rx_cm(uint8_t sa, uint8_t da, uint8_t *data)
+{
+    j1939_session_t *s;
+
+    switch (data[0])
+    {
+        case J1939_CM_RTS:
+            if (da == J1939_GLOBAL)
+                return 0u;
+            return j1939_open(J1939_CM_RTS, sa, da, data);
+
+        case J1939_CM_BAM:
+            if (da != J1939_GLOBAL)
+                return 0u;
+            return j1939_open(J1939_CM_BAM, sa, da, data);
+
+        case J1939_CM_CTS:
+        case J1939_CM_EOMA:
+            // Handshake of a transfer we follow, sent by its destination
+            s = j1939_find(da, sa);
+            if (s == NULL)
+                return 0u;
+            s->tick = uwTick;
+            return 1u;
+
+        case J1939_CM_ABORT:
+            s = j1939_find(sa, da);
+            if (s == NULL)
+                s = j1939_find(da, sa);
+            if (s == NULL)
+                return 0u;
+            j1939_report(s->pgn, s->sa, s->da, data[1]);
+            s->state = J1939_IDLE;
+            return 1u;
+
+        default:
+            return 0u;
+    }
+}
+
+static uint8_t j1939_rx_dt(uint8_t sa, uint8_t da, uint8_t *data)
+{
+    j1939_session_t *s = j1939_find(sa, da);
+    if (s == NULL)
+    {
+        return 0u;
+    }
+
+    uint8_t seq = data[0];
+    if (seq == 0 || seq > s->packets)
+    {
+        return 1u;
+    }
+    s->tick = uwTick;
+
+    // Packets may arrive out of order or twice; each is placed by its
+    // sequence number and counted once
+    if (!(s->seen[seq >> 3] & (1u << (seq & 7))))
+    {
+        uint16_t offset = (seq - 1) * 7u;
+        uint16_t len = s->size - offset;
+        if (len > 7)
+            len = 7;
+
+        memcpy(&s->data[offset], &data[1], len);
+        s->seen[seq >> 3] |= 1u << (seq & 7);
+        s->received++;
+    }
+
+    if (s->received == s->packets)
+    {
+        j1939_complete(s);
+    }
+    else if (s->responder && seq >= s->next && seq < s->next + s->window
+             && s->window_left && --s->window_left == 0)
+    {
+        j1939_request(s);
+    }
+    return 1u;
+}
+
+// Stream a completed message to the host as one line
+static void j1939_deliver(void)
+{
+    uint8_t chunk[2 * J1939_CHUNK_LEN];
+    uint32_t n;
+
+    if (deliver == NULL)
+    {
+        for (uint8_t i = 0; i < J1939_SESSIONS && deliver == NULL; i++)
+        {
+            if (sessions[i].state == J1939_DONE)
+                deliver = &sessions[i];
+        }
+        if (deliver == NULL || tud_cdc_write_available() < J1939_HEADER_LEN
+            || !slcan_stream_claim(SLCAN_STREAM_J1939))
+        {
+            deliver = NULL;
+            return;
+        }
+
+        chunk[0] = 'J';
+        slcan_put_hex(&chunk[1], deliver->pgn, 6);
+        slcan_put_hex(&chunk[7], deliver->sa, 2);
+        slcan_put_hex(&chunk[9], deliver->da, 2);
+        slcan_put_hex(&chunk[11], deliver->size, 3);
+        tud_cdc_write(chunk, J1939_HEADER_LEN);
+        deliver_pos = 0;
+    }
+
+    while (deliver_pos < deliver->size && (n = tud_cdc_write_available() / 2) > 0)
+    {
+        if (n > J1939_CHUNK_LEN)
+            n = J1939_CHUNK_LEN;
+        if (n > (uint32_t)(deliver->size - deliver_pos))
+            n = deliver->size - deliver_pos;
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            slcan_put_hex(&chunk[2 * i], deliver->data[deliver_pos + i], 2);
+        }
+        tud_cdc_write(chunk, 2 * n);
+        deliver_pos += n;
+    }
+
+    if (deliver_pos >= deliver->size && tud_cdc_write_available() > 0)
+    {
+        tud_cdc_write("\r", 1);
+        slcan_stream_release(SLCAN_STREAM_J1939);
+        deliver->state = J1939_IDLE;
+        deliver = NULL;
+    }
+}
+
+
+// Deselect all PGNs, turn the responder off and drop open sessions
+void j1939_clear(void)
+{
+    pgn_count = 0;
+    responder_enabled = 0;
+
+    for (uint8_t i = 0; i < J1939_SESSIONS; i++)
+    {
+        // A message already being streamed is finished first
+        if (&sessions[i] != deliver)
+        {
+            sessions[i].state = J1939_IDLE;
+        }
+    }
+}
+
+// Select a PGN for reassembly, returns nonzero if the table is full
+uint8_t j1939_add_pgn(uint32_t pgn)
+{
+    if (j1939_selected(pgn))
+    {
+        return 0u;
+    }
+    if (pgn_count >= J1939_MAX_PGNS || pgn > 0x3FFFFu)
+    {
+        return 1u;
+    }
+
+    pgns[pgn_count++] = pgn;
+    return 0u;
+}
+
+// Answer RTS frames sent to address with CTS; per_cts limits the packets
+// requested at once (0 = as many as the originator allows)
+void j1939_set_responder(uint8_t enable, uint8_t address, uint8_t per_cts)
+{
+    responder_enabled = (enable != 0);
+    responder_address = address;
+    responder_per_cts = per_cts;
+}
+
+// Handle a received frame, returns nonzero if it belongs to a transfer
+// being reassembled and must not be forwarded to the host as a raw frame
+uint8_t j1939_rx_frame(FLEXCAN_Mb_Type *frame)
+{
+    if (pgn_count == 0 || frame->FORMAT != FLEXCAN_MbFormat_Extended
+        || frame->TYPE != FLEXCAN_MbType_Data || frame->LENGTH != 8)
+    {
+        return 0u;
+    }
+
+    uint8_t pf = frame->ID >> 16;
+    uint8_t da = frame->ID >> 8;
+    uint8_t sa = frame->ID;
+    uint8_t data[8] = {
+        frame->BYTE0, frame->BYTE1, frame->BYTE2, frame->BYTE3,
+        frame->BYTE4, frame->BYTE5, frame->BYTE6, frame->BYTE7,
+    };
+
+    if (pf == J1939_PF_TP_CM)
+    {
+        return j1939_rx_cm(sa, da, data);
+    }
+    if (pf == J1939_PF_TP_DT)
+    {
+        return j1939_rx_dt(sa, da, data);
+    }
+    return 0u;
+}
+
+// Run the session timeouts and talk to the host. Output is
+//   'J' + PGN + SA + DA + size + data    reassembled message
+//   'j' + PGN + SA + DA + reason         transfer aborted
+void j1939_process(void)
+{
+    uint32_t now = uwTick;
+
+    for (uint8_t i = 0; i < J1939_SESSIONS; i++)
+    {
+        j1939_session_t *s = &sessions[i];
+        uint32_t elapsed = now - s->tick;
+
+        if (s->state == J1939_BAM && elapsed > J1939_T1_MS)
+        {
+            j1939_abort(s, J1939_ABORT_TIMEOUT);
+        }
+        else if (s->state == J1939_CMDT && s->responder && elapsed > J1939_T1_MS)
+        {
+            // Packets of the window went missing: ask again
+            j1939_request(s);
+        }
+        else if (s->state == J1939_CMDT && !s->responder && elapsed > J1939_T2_MS)
+        {
+            j1939_abort(s, J1939_ABORT_TIMEOUT);
+        }
+    }
+
+    if (deliver == NULL && abort_count == 0)
+    {
+        uint8_t done = 0;
+        for (uint8_t i = 0; i < J1939_SESSIONS; i++)
+        {
+            done |= (sessions[i].state == J1939_DONE);
+        }
+        if (!done)
+            return;
+    }
+
+    j1939_deliver();
+
+    while (!slcan_stream_busy() && abort_count > 0 && tud_cdc_write_available() >= J1939_ABORT_LINE_LEN)
+    {
+        j1939_abort_t *a = &abort_ring[abort_head];
+        uint8_t line[J1939_ABORT_LINE_LEN];
+
+        line[0] = 'j';
+        slcan_put_hex(&line[1], a->pgn, 6);
+        slcan_put_hex(&line[7], a->sa, 2);
+        slcan_put_hex(&line[9], a->da, 2);
+        slcan_put_hex(&line[11], a->reason, 2);
+        line[13] = '\r';
+        tud_cdc_write(line, sizeof(line));
+
+        abort_head = (abort_head + 1) % J1939_ABORT_DEPTH;
+        abort_count--;
+    }
+
+    tud_cdc_write_flush();
+}
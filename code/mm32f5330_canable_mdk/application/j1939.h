@@ -0,0 +1,65 @@
+#ifndef _J1939_H
+#define _J1939_H
+
+#include "stdint.h"
+#include "hal_flexcan.h"
+
+// Largest multi-packet message: 255 packets of 7 bytes
+#define J1939_MAX_LEN       1785u
+
+// Transfers reassembled at the same time
+#define J1939_SESSIONS      2u
+
+// Number of PGNs selected for reassembly
+#define J1939_MAX_PGNS      8u
+
+// J1939-21 timeouts (ms): between data packets, and after a CTS
+#define J1939_T1_MS         750u
+#define J1939_T2_MS         1250u
+
+// Retransmission requests per transfer before giving up
+#define J1939_MAX_RETRY     3u
+
+// Connection abort reasons, as defined by J1939-21
+#define J1939_ABORT_BUSY        1u      // Already in a session with this node
+#define J1939_ABORT_RESOURCES   2u      // No free session
+#define J1939_ABORT_TIMEOUT     3u
+#define J1939_ABORT_RETRY       5u      // Retransmit request limit reached
+
+typedef enum j1939_state_
+{
+    J1939_IDLE = 0,
+    J1939_BAM,              // Broadcast, no handshake
+    J1939_CMDT,             // Connection mode, RTS/CTS
+    J1939_DONE,             // Complete, waiting to be streamed to the host
+} j1939_state_t;
+
+typedef struct j1939_session_
+{
+    uint32_t pgn;
+    uint32_t tick;          // uwTick of the last packet or CTS
+    uint16_t size;
+    uint8_t packets;
+    uint8_t received;       // Distinct packets received
+    uint8_t sa;             // Originator
+    uint8_t da;             // Destination, 0xFF for BAM
+    uint8_t state;
+    uint8_t responder;      // We send CTS and EndOfMsgAck for this session
+    uint8_t per_cts;        // Packets per CTS allowed by the originator
+    uint8_t next;           // First packet of the current CTS window
+    uint8_t window;         // Packets requested by the current CTS
+    uint8_t window_left;    // Packets of the current window still due
+    uint8_t requested;      // Highest packet requested so far
+    uint8_t retries;
+    uint8_t seen[32];       // Bitmap of received sequence numbers
+    uint8_t data[J1939_MAX_LEN];
+} j1939_session_t;
+
+// Prototypes
+void j1939_clear(void);
+uint8_t j1939_add_pgn(uint32_t pgn);
+void j1939_set_responder(uint8_t enable, uint8_t address, uint8_t per_cts);
+uint8_t j1939_rx_frame(FLEXCAN_Mb_Type *frame);
+void j1939_process(void);
+
+#endif // _J1939_H
@@ -0,0 +1,192 @@
+//
+// latency: Time frames spend between the CAN bus and USB
+//
+// Frames forwarded to the host are stamped when read from the RX FIFO,
+// once encoded and once written into the CDC TX FIFO. The position of
+// their last byte in the IN stream is the number of bytes handed to the
+// IN endpoint so far plus the FIFO fill; the frame has left once IN
+// tokens have taken that many bytes. Frames from the host are timed from
+// the last OUT packet to their queueing, and from there to mailbox load.
+//
+
+#include "latency.h"
+
+#if APP_LATENCY_ENABLE
+
+#include "board_init.h"
+#include "mem_plan.h"
+#include "tusb.h"
+
+_Static_assert(LATENCY_HIST_BUCKETS <= HIST_BUCKETS, "latency histogram larger than hist_stats_t");
+
+typedef struct latency_trace_
+{
+    uint32_t rx;
+    uint32_t encode;
+    uint32_t queued;
+    uint32_t end;           // IN stream position just past the frame
+} latency_trace_t;
+
+// Private variables
+static latency_stats_t latency_stats[LATENCY_MAX];
+
+static latency_trace_t trace[LATENCY_TRACE_DEPTH];
+static uint8_t trace_head = 0;
+static uint8_t trace_count = 0;
+static uint32_t in_handed = 0;      // Bytes given to the IN endpoint
+static uint32_t in_taken = 0;       // Bytes taken by IN tokens
+
+static volatile uint32_t out_us = 0;
+static uint32_t tx_queued_us[MEM_CAN_TXQ_LEN];
+
+static hist_dump_t dump;
+
+
+// Account one latency, from the main loop or the USB interrupt
+static void latency_record(latency_stage_t stage, uint32_t us)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    hist_record(&latency_stats[stage], LATENCY_HIST_BUCKETS, us);
+
+    __set_PRIMASK(primask);
+}
+
+// Clear all statistics and forget the frames in flight
+void latency_reset(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    hist_reset(latency_stats, LATENCY_MAX);
+    trace_count = 0;
+
+    __set_PRIMASK(primask);
+}
+
+// A received frame's slcan line has been written into the CDC TX FIFO
+void latency_rx_queued(uint32_t rx_us, uint32_t encode_us)
+{
+    uint32_t now = timebase_us();
+
+    latency_record(LATENCY_RX_ENCODE, encode_us - rx_us);
+    latency_record(LATENCY_RX_ENQUEUE, now - encode_us);
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    // Lines the host never reads would hold their slot forever, so the
+    // oldest trace gives way to the newest
+    if (trace_count == LATENCY_TRACE_DEPTH)
+    {
+        trace_count--;
+    }
+
+    latency_trace_t *t = &trace[trace_head];
+    t->rx = rx_us;
+    t->encode = encode_us;
+    t->queued = now;
+    t->end = in_handed + (CFG_TUD_CDC_TX_BUFSIZE - tud_cdc_write_available());
+    trace_head = (trace_head + 1u) % LATENCY_TRACE_DEPTH;
+    trace_count++;
+
+    __set_PRIMASK(primask);
+}
+
+// A frame command from the host has been queued for the bus
+void latency_tx_parsed(void)
+{
+    latency_record(LATENCY_TX_PARSE, timebase_us() - out_us);
+}
+
+void latency_tx_queued(uint8_t slot)
+{
+    tx_queued_us[slot] = timebase_us();
+}
+
+void latency_tx_loaded(uint8_t slot)
+{
+    latency_record(LATENCY_TX_MAILBOX, timebase_us() - tx_queued_us[slot]);
+}
+
+// A transfer has been started on an endpoint, from dcd_edpt_xfer()
+void latency_usb_xfer(uint8_t ep_addr, uint32_t len)
+{
+    if (ep_addr != LATENCY_EP_IN)
+        return;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    in_handed += len;
+    __set_PRIMASK(primask);
+}
+
+// A packet has been moved by a token, from the USB interrupt
+void latency_usb_token(uint8_t ep_addr, uint32_t len)
+{
+    uint32_t now = timebase_us();
+
+    if (ep_addr == LATENCY_EP_OUT)
+    {
+        out_us = now;
+        return;
+    }
+    if (ep_addr != LATENCY_EP_IN)
+        return;
+
+    in_taken += len;
+
+    // Traces complete in the order their lines were written
+    while (trace_count)
+    {
+        latency_trace_t *t = &trace[(trace_head + LATENCY_TRACE_DEPTH - trace_count) % LATENCY_TRACE_DEPTH];
+        if ((int32_t)(in_taken - t->end) < 0)
+            break;
+
+        latency_record(LATENCY_RX_USB, now - t->queued);
+        latency_record(LATENCY_RX_TOTAL, now - t->rx);
+        trace_count--;
+    }
+}
+
+// A bus reset dropped the bytes handed to the IN endpoint but not yet
+// taken, from the USB interrupt. Lines still in the FIFO keep their place
+// behind them; the traces of lost lines are forgotten
+void latency_usb_reset(void)
+{
+    while (trace_count)
+    {
+        latency_trace_t *t = &trace[(trace_head + LATENCY_TRACE_DEPTH - trace_count) % LATENCY_TRACE_DEPTH];
+        if ((int32_t)(in_handed - t->end) < 0)
+            break;
+        trace_count--;
+    }
+    in_taken = in_handed;
+}
+
+// Take a consistent copy of a stage's statistics
+void latency_get_stats(latency_stage_t stage, latency_stats_t *stats)
+{
+    if (stage >= LATENCY_MAX)
+        return;
+
+    hist_copy(&latency_stats[stage], stats);
+}
+
+// Begin streaming all statistics to the host
+void latency_dump_start(void)
+{
+    hist_dump_start(&dump, latency_stats, LATENCY_MAX, LATENCY_HIST_BUCKETS, 'U');
+}
+
+// Emit dump lines while there is room in the CDC TX FIFO. Output is:
+//   'U' + stage + count + min + max + mean     per stage, in us
+//   'u' + stage + bucket + count               per non-empty bucket
+//   'U'                                        end of dump
+void latency_dump_process(void)
+{
+    hist_dump_process(&dump);
+}
+
+#endif // APP_LATENCY_ENABLE
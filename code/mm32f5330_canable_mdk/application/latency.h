@@ -0,0 +1,81 @@
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include "stdint.h"
+#include "hist.h"
+
+// Set to 1 (e.g. in the project defines) to trace how long frames take
+// between the bus and USB. When 0 the LATENCY_* macros expand to nothing
+// and no RAM is used.
+#ifndef APP_LATENCY_ENABLE
+#define APP_LATENCY_ENABLE  0
+#endif
+
+// Traced stages, all in microseconds of the timebase
+typedef enum _latency_stage_t
+{
+    LATENCY_RX_ENCODE = 0,  // Read from the RX FIFO to slcan line encoded
+    LATENCY_RX_ENQUEUE,     // Line encoded to written into the CDC TX FIFO
+    LATENCY_RX_USB,         // Written into the FIFO to its last byte taken by an IN token
+    LATENCY_RX_TOTAL,       // Read from the RX FIFO to taken by an IN token
+    LATENCY_TX_PARSE,       // Last OUT packet to frame command queued for the bus
+    LATENCY_TX_MAILBOX,     // Queued to loaded into the TX mailbox
+
+    LATENCY_MAX
+} latency_stage_t;
+
+// Log2 histogram buckets; bucket n counts latencies in [2^n, 2^(n+1)) us,
+// the last bucket also takes everything longer
+#define LATENCY_HIST_BUCKETS    20u
+
+// Frames between the CDC TX FIFO and the host traced at the same time
+#define LATENCY_TRACE_DEPTH     16u
+
+// slcan data endpoints, as declared in the configuration descriptor
+#define LATENCY_EP_IN           0x83u
+#define LATENCY_EP_OUT          0x02u
+
+#if APP_LATENCY_ENABLE
+
+#include "timebase.h"
+
+#define LATENCY_STAMP(name)         uint32_t latency_##name = timebase_us()
+#define LATENCY_STAMP_AT(name, us)  uint32_t latency_##name = (us)
+#define LATENCY_RX_QUEUED(rx, enc)  latency_rx_queued(latency_##rx, latency_##enc)
+#define LATENCY_TX_PARSED()         latency_tx_parsed()
+#define LATENCY_TX_QUEUED(slot)     latency_tx_queued(slot)
+#define LATENCY_TX_LOADED(slot)     latency_tx_loaded(slot)
+#define LATENCY_USB_XFER(ep, len)   latency_usb_xfer((ep), (len))
+#define LATENCY_USB_TOKEN(ep, len)  latency_usb_token((ep), (len))
+#define LATENCY_USB_RESET()         latency_usb_reset()
+
+typedef hist_stats_t latency_stats_t;
+
+// Prototypes
+void latency_reset(void);
+void latency_rx_queued(uint32_t rx_us, uint32_t encode_us);
+void latency_tx_parsed(void);
+void latency_tx_queued(uint8_t slot);
+void latency_tx_loaded(uint8_t slot);
+void latency_usb_xfer(uint8_t ep_addr, uint32_t len);
+void latency_usb_token(uint8_t ep_addr, uint32_t len);
+void latency_usb_reset(void);
+void latency_get_stats(latency_stage_t stage, latency_stats_t *stats);
+void latency_dump_start(void);
+void latency_dump_process(void);
+
+#else
+
+#define LATENCY_STAMP(name)
+#define LATENCY_STAMP_AT(name, us)
+#define LATENCY_RX_QUEUED(rx, enc)
+#define LATENCY_TX_PARSED()
+#define LATENCY_TX_QUEUED(slot)
+#define LATENCY_TX_LOADED(slot)
+#define LATENCY_USB_XFER(ep, len)
+#define LATENCY_USB_TOKEN(ep, len)
+#define LATENCY_USB_RESET()
+
+#endif // APP_LATENCY_ENABLE
+
+#endif // _LATENCY_H
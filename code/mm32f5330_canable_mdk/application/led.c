@@ -108,8 +108,10 @@ void HAL_Delay(uint32_t delay)
         wait += 1;
     }
 
+    // SysTick ends the sleep every millisecond
     while ((uwTick - tick_start) < wait)
     {
+        __WFI();
     }
 
 }
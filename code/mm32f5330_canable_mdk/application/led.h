@@ -8,6 +8,9 @@
 
 #define HAL_MAX_DELAY       0xFFFFFFFFu
 
+// Millisecond tick incremented by SysTick_Handler()
+extern volatile uint32_t uwTick;
+
 void led_init();
 void led_blink(uint8_t numblinks);
 void led_green_on(void);
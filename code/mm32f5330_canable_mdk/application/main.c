@@ -10,51 +10,196 @@
 #include <string.h>
 
 #include "board_init.h"
+#include "main.h"
 #include "can.h"
 #include "slcan.h"
 #include "led.h"
 #include "error.h"
+#include "busload.h"
+#include "profile.h"
+#include "bench.h"
+#include "capture.h"
+#include "dedup.h"
+#include "decimate.h"
+#include "isotp.h"
+#include "j1939.h"
+#include "remote.h"
+#include "ecu.h"
+#include "sched.h"
+#include "diag.h"
+#include "notify.h"
+#include "cannelloni.h"
+#include "suspend.h"
+#include "latency.h"
+#include "timebase.h"
 #include "tusb.h"
 
-void cdc_process(void);
-
 /*------------- MAIN -------------*/
 int main(void)
+{
+    app_init();
+
+    while (1)
+    {
+        app_process();
+    }
+}
+
+// Bring up the peripherals and the USB stack
+void app_init(void)
 {
     BOARD_Init();
 
-    can_init();
+    // The start-up blink blocks, it is over before the stored
+    // configuration may take the controller on-bus: nothing would drain
+    // the RX FIFO meanwhile
     led_init();
+    timebase_init();
+    busload_init();
+#if APP_PROFILE_ENABLE
+    profile_init();
+#endif
+#if APP_LATENCY_ENABLE
+    latency_reset();
+#endif
+    can_init();
     tusb_init();
+}
+
+// One pass of the main loop
+void app_process(void)
+{
+    PROFILE_ENTER(PROFILE_APP_PASS);
+
+    // Commands are parsed even while a long line owns the CDC stream,
+    // their replies are held until it is complete
+    PROFILE_ENTER(PROFILE_CDC_PROCESS);
+    cdc_process();
+    PROFILE_EXIT(PROFILE_CDC_PROCESS);
+
+    PROFILE_ENTER(PROFILE_LED_PROCESS);
+    led_process();
+    PROFILE_EXIT(PROFILE_LED_PROCESS);
+
+    PROFILE_ENTER(PROFILE_CAN_PROCESS);
+    can_process();
+    PROFILE_EXIT(PROFILE_CAN_PROCESS);
+
+    sched_account();
+    busload_process();
+    remote_process();
+    ecu_account();
+    isotp_process();
+    j1939_process();
 
+#if APP_NCM_ENABLE
+    // Network function, independent of the slcan stream
+    cannelloni_process();
+#else
+    // Own CDC interface, independent of the slcan stream
+    diag_process();
+#endif
+
+    // Interrupt endpoint, independent of the slcan stream
+    notify_process();
+
+    // While a PDU line is being streamed to the host it owns the CDC
+    // stream; everything else that may write to it waits for the CR
+    if (!slcan_stream_busy())
+    {
+        slcan_process();
+        bench_process();
+        capture_process();
+        dedup_process();
+        sched_process();
+        suspend_process();
+#if APP_PROFILE_ENABLE
+        profile_dump_process();
+#endif
+#if APP_LATENCY_ENABLE
+        latency_dump_process();
+#endif
+    }
+
+    // Frames received meanwhile wait in the suspend ring
+    can_rx_process();
+
+    PROFILE_EXIT(PROFILE_APP_PASS);
+}
+
+// Forward the frames taken from the CAN RX FIFO by its interrupt to the
+// host; simulated ECUs have already answered them there
+void can_rx_process(void)
+{
     // Storage for status and received message buffer
     FLEXCAN_Mb_Type rx_msg_header;
     uint8_t rx_msg_data[8] = {0};
     uint8_t msg_buf[SLCAN_MTU];
+    uint8_t received = 0;
 
-    while (1)
+    // The ring is always drained, whatever the state of the USB side, so
+    // that the device consumers see every frame; a host which does not
+    // keep up loses slcan lines, not frames in the controller
+    while ((received < CAN_RX_BURST) && (is_can_msg_pending() != 0u))
     {
-        cdc_process();
-        led_process();
-        can_process();
+        // If message received from bus, parse the frame
+        if (can_rx(&rx_msg_header, rx_msg_data) != true)
+        {
+            break;
+        }
+        received++;
+        LATENCY_STAMP_AT(rx, can_rx_time());
+
+        busload_add_frame(&rx_msg_header);
+        capture_frame(&rx_msg_header);
 
-        // If CAN message receive is pending, process the message
-        if (is_can_msg_pending() != 0u)
+        // Frames of configured ISO-TP pairs and of J1939 transport sessions
+        // for selected PGNs are handled on the device
+        if (isotp_rx_frame(&rx_msg_header) || j1939_rx_frame(&rx_msg_header))
         {
-            // If message received from bus, parse the frame
-            if (can_rx(&rx_msg_header, rx_msg_data) == true)
-            {
-                // Parse an incoming CAN frame into an outgoing slcan message
-                uint16_t msg_len = slcan_parse_frame((uint8_t *)&msg_buf, &rx_msg_header, rx_msg_data);
+            continue;
+        }
 
-                // Transmit message via USB-CDC
-                if(msg_len)
-                {
-                    tud_cdc_write(msg_buf, msg_len);
-                    tud_cdc_write_flush();
-                }
-            }
+        // Drop frames thinned out by the decimation rules, then repeated
+        // payloads when change-only reporting is on
+        if (!decimate_keep(&rx_msg_header) || !dedup_forward(&rx_msg_header))
+        {
+            continue;
+        }
+
+        // Once a cannelloni peer has reached us, frames go out over UDP or
+        // are dropped while the host takes no datagrams; while the host
+        // is away or a long line owns the stream they wait in a ring,
+        // which gives up its oldest frame when full
+        if (cannelloni_rx_frame(&rx_msg_header) || suspend_hold(&rx_msg_header))
+        {
+            continue;
+        }
+
+        // Parse an incoming CAN frame into an outgoing slcan message
+        PROFILE_ENTER(PROFILE_SLCAN_PARSE_FRAME);
+        uint16_t msg_len = slcan_parse_frame((uint8_t *)&msg_buf, &rx_msg_header, rx_msg_data);
+        PROFILE_EXIT(PROFILE_SLCAN_PARSE_FRAME);
+        LATENCY_STAMP(encode);
+
+        // Only complete lines go into the CDC TX FIFO
+        if (msg_len && tud_cdc_write_available() < msg_len)
+        {
+            error_assert(ERR_USBTX_BUSY);
         }
+        else if (msg_len)
+        {
+            tud_cdc_write(msg_buf, msg_len);
+            LATENCY_RX_QUEUED(rx, encode);
+            bench_rx_forwarded(msg_len);
+        }
+    }
+
+    // Transmit the batch via USB-CDC; TinyUSB keeps flushing from the
+    // transfer-complete callback until the FIFO is empty
+    if (received)
+    {
+        tud_cdc_write_flush();
     }
 }
 
@@ -66,6 +211,7 @@ int main(void)
 void tud_mount_cb(void)
 {
   //blink_interval_ms = BLINK_MOUNTED;
+  notify_reset();
 }
 
 // Invoked when device is unmounted
@@ -79,14 +225,15 @@ void tud_umount_cb(void)
 // Within 7ms, device must draw an average of current less than 2.5 mA from bus
 void tud_suspend_cb(bool remote_wakeup_en)
 {
-  (void) remote_wakeup_en;
   //blink_interval_ms = BLINK_SUSPENDED;
+  suspend_enter(remote_wakeup_en);
 }
 
 // Invoked when usb bus is resumed
 void tud_resume_cb(void)
 {
   //blink_interval_ms = BLINK_MOUNTED;
+  suspend_exit();
 }
 
 
@@ -94,6 +241,9 @@ void tud_resume_cb(void)
 // USB CDC
 //--------------------------------------------------------------------+
 
+// Set when the host opens the slcan port
+static volatile uint8_t cdc_opened = 0;
+
 // Invoked when received new data
 void tud_cdc_rx_cb(uint8_t itf)
 {
@@ -116,9 +266,15 @@ void tud_cdc_tx_complete_cb(uint8_t itf)
 // Invoked when line state DTR & RTS are changed via SET_CONTROL_LINE_STATE
 void tud_cdc_line_state_cb(uint8_t itf, bool dtr, bool rts)
 {
-    (void) itf;
-    (void) dtr;
     (void) rts;
+
+    // The slcan port has been opened: deliver the frames held since it
+    // was closed or the bus was reset, and start a fresh command line
+    if (itf == 0 && dtr)
+    {
+        suspend_port_open(1);
+        cdc_opened = 1;
+    }
 }
 
 // Invoked when line coding is change via SET_LINE_CODING
@@ -137,11 +293,24 @@ void tud_cdc_send_break_cb(uint8_t itf, uint16_t duration_ms)
 
 uint8_t slcan_str[30];
 uint32_t slcan_str_index = 0;
+uint8_t isotp_line = 0;
 
 // Process incoming USB-CDC messages from RX FIFO
 void cdc_process(void)
 {
-    __disable_irq();
+    // Everything from the timebase priority down is held off while the
+    // line is parsed; the FlexCAN RX interrupt above it stays live so that
+    // ECU rules keep answering
+    uint32_t basepri = __get_BASEPRI();
+    __set_BASEPRI(1u << (8u - __NVIC_PRIO_BITS));
+
+    // Part of a command sent before the port was closed is discarded
+    if (cdc_opened)
+    {
+        cdc_opened = 0;
+        slcan_str_index = 0;
+        isotp_line = 0;
+    }
 
     if ( tud_cdc_available() )
     {
@@ -149,9 +318,35 @@ void cdc_process(void)
         char buf[64];
         uint32_t buf_cnt = tud_cdc_read(buf, sizeof(buf));
 
+        // A host talking to the port without setting DTR never opens it
+        // as far as the line state goes; do not hold frames for it
+        if (buf_cnt && !tud_cdc_connected())
+        {
+            suspend_port_open(0);
+        }
+
         for (uint32_t i = 0; i < buf_cnt; i++)
         {
-            if (buf[i] == '\r')
+            // ISO-TP PDU lines are too long for slcan_str and go straight
+            // into the ISO-TP transmit buffer
+            if (slcan_str_index == 0 && !isotp_line && buf[i] == 'I')
+            {
+                isotp_line = 1;
+                isotp_host_begin();
+            }
+            else if (isotp_line)
+            {
+                if (buf[i] == '\r')
+                {
+                    isotp_line = 0;
+                    isotp_host_end();
+                }
+                else
+                {
+                    isotp_host_char(buf[i]);
+                }
+            }
+            else if (buf[i] == '\r')
             {
                 slcan_parse_str(slcan_str, slcan_str_index);
                 slcan_str_index = 0;
@@ -169,7 +364,7 @@ void cdc_process(void)
         }
     }
 
-    __enable_irq();
+    __set_BASEPRI(basepri);
 }
 
 /* EOF. */
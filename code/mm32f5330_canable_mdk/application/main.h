@@ -0,0 +1,10 @@
+#ifndef _MAIN_H
+#define _MAIN_H
+
+// Prototypes
+void app_init(void);
+void app_process(void);
+void cdc_process(void);
+void can_rx_process(void);
+
+#endif // _MAIN_H
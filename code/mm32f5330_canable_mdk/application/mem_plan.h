@@ -0,0 +1,77 @@
+#ifndef _MEM_PLAN_H
+#define _MEM_PLAN_H
+
+//
+// mem_plan: Build-time RAM budget
+//
+// Buffers whose size only trades RAM for burst tolerance share one pool,
+// split by the ratios below. Everything else is fixed size and counted in
+// MEM_FIXED_SIZE; the per-object RW/ZI sizes printed by the linker show
+// the actual figures, keep the estimate above them when adding buffers.
+//
+
+// SRAM of the MM32F5333 and the stack reserved by the scatter file
+#define MEM_RAM_SIZE        0x8000u
+#define MEM_STACK_SIZE      0x0800u
+
+// Set to 1 (e.g. in the project defines) for CAN over UDP on a CDC-NCM
+// network function in place of the diagnostics console. Its buffers are
+// fixed size, the pool shrinks to make room for them.
+#ifndef APP_NCM_ENABLE
+#define APP_NCM_ENABLE      0
+#endif
+
+// Static data outside the pool: ISO-TP 8 KB, J1939 3.7 KB, capture 2 KB,
+// decimation 2 KB, dedup, ECU, scheduler, suspend ring, CAN RX ring, USB BDT
+// and endpoint buffers, TinyUSB
+#define MEM_FIXED_SIZE      0x5F80u
+
+// NCM transfer blocks: two to the host, one from it holding a full
+// Ethernet frame, and the CAN frames batched into the next datagram
+#define MEM_NCM_IN_NTB      1024u
+#define MEM_NCM_OUT_NTB     1600u
+#define MEM_NCM_BATCH       512u
+#if APP_NCM_ENABLE
+#define MEM_NCM_SIZE        (2u * MEM_NCM_IN_NTB + MEM_NCM_OUT_NTB + MEM_NCM_BATCH)
+#else
+#define MEM_NCM_SIZE        0u
+#endif
+
+// RAM shared by the tunable buffers
+#if APP_NCM_ENABLE
+#define MEM_POOL_SIZE       0x0800u
+#else
+#define MEM_POOL_SIZE       0x1000u
+#endif
+
+// Share of the pool in percent: CDC TX FIFO, CDC RX FIFO, CAN TX queue
+#define MEM_SHARE_CDC_TX    50u
+#define MEM_SHARE_CDC_RX    25u
+#define MEM_SHARE_CAN_TXQ   25u
+
+// Number of CDC interfaces, each gets its part of the CDC shares
+#if APP_NCM_ENABLE
+#define MEM_CDC_INTERFACES  1u
+#else
+#define MEM_CDC_INTERFACES  2u
+#endif
+
+// Bytes per CAN TX queue entry: mailbox image plus data buffer
+#define MEM_CAN_TXQ_ITEM    (16u + 8u)
+
+// Derived sizes. CDC FIFOs are whole 64-byte packets.
+#define MEM_SHARE_BYTES(share)  ((MEM_POOL_SIZE * (share)) / 100u)
+#define MEM_CDC_TX_BUFSIZE  ((MEM_SHARE_BYTES(MEM_SHARE_CDC_TX) / MEM_CDC_INTERFACES) & ~63u)
+#define MEM_CDC_RX_BUFSIZE  ((MEM_SHARE_BYTES(MEM_SHARE_CDC_RX) / MEM_CDC_INTERFACES) & ~63u)
+#define MEM_CAN_TXQ_LEN     (MEM_SHARE_BYTES(MEM_SHARE_CAN_TXQ) / MEM_CAN_TXQ_ITEM)
+
+_Static_assert(MEM_SHARE_CDC_TX + MEM_SHARE_CDC_RX + MEM_SHARE_CAN_TXQ <= 100u,
+               "mem_plan: pool shares exceed 100 %");
+_Static_assert(MEM_FIXED_SIZE + MEM_NCM_SIZE + MEM_POOL_SIZE + MEM_STACK_SIZE <= MEM_RAM_SIZE,
+               "mem_plan: RAM budget exceeded");
+_Static_assert(MEM_CDC_TX_BUFSIZE >= 64u && MEM_CDC_RX_BUFSIZE >= 64u,
+               "mem_plan: CDC FIFOs must hold at least one packet");
+_Static_assert(MEM_CAN_TXQ_LEN >= 2u && MEM_CAN_TXQ_LEN <= 255u,
+               "mem_plan: CAN TX queue indices are 8 bit");
+
+#endif // _MEM_PLAN_H
@@ -0,0 +1,122 @@
+//
+// notify: Bus state notifications on the CDC interrupt endpoint
+//
+// The slcan interface reports bus state, error thresholds and dropped
+// frames as a standard SERIAL_STATE notification, so host drivers learn
+// about them without parsing the data stream. Only one notification is
+// in flight at a time: changes made meanwhile are merged into the next
+// one, which always carries the latest levels and every event latched
+// since the previous notification.
+//
+
+#include "notify.h"
+#include "can.h"
+#include "error.h"
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+
+// Endpoint declared by TUD_CDC_DESCRIPTOR for the slcan interface
+#define NOTIFY_EP           0x81u
+
+// Private variables
+static __ALIGNED(4u) uint8_t notify_buf[NOTIFY_LEN];
+static uint16_t sent_state = 0;     // UART state of the last notification
+static uint16_t latched = 0;        // Events not sent yet
+static uint32_t seen_drops = 0;     // Lost frame count already reported
+
+
+// Frames lost in either direction since boot
+static uint32_t notify_drops(void)
+{
+    return error_count(ERR_CANRXFIFO_OVERFLOW) + error_count(ERR_FULLBUF_CANTX)
+         + error_count(ERR_FULLBUF_USBRX) + error_count(ERR_USBTX_BUSY)
+         + error_count(ERR_FULLBUF_SUSPEND);
+}
+
+// Current levels and events of the CAN controller
+static uint16_t notify_sample(void)
+{
+    uint16_t state = 0;
+
+    if (can_get_bus_state() == ON_BUS)
+    {
+        state |= NOTIFY_ON_BUS;
+
+        // Fault confinement: 0 error active, 1 error passive, 2/3 bus off
+        uint32_t status = can_get_status();
+        uint32_t fltconf = (status >> 4) & 0x3u;
+        if (fltconf == 0u)
+        {
+            state |= NOTIFY_ACTIVE;
+        } else if (fltconf == 1u) {
+            state |= NOTIFY_PASSIVE;
+        } else {
+            state |= NOTIFY_BUS_OFF;
+        }
+        if (status & (FLEXCAN_STATUS_RXWRN | FLEXCAN_STATUS_TXWRN))
+        {
+            state |= NOTIFY_WARNING;
+        }
+    }
+
+    uint32_t drops = notify_drops();
+    if (drops != seen_drops)
+    {
+        state |= NOTIFY_OVERRUN;
+    }
+    seen_drops = drops;
+
+    return state;
+}
+
+// Forget what the host was told, e.g. after a new enumeration
+void notify_reset(void)
+{
+    sent_state = 0;
+    latched = 0;
+    seen_drops = notify_drops();
+}
+
+// Send a notification when the state has changed and the endpoint is free
+void notify_process(void)
+{
+    uint16_t state = notify_sample();
+
+    // An event held for a single pass must not be lost while the
+    // previous notification is still being polled by the host
+    latched |= state & NOTIFY_EVENTS;
+    state = (state & ~NOTIFY_EVENTS) | latched;
+
+    if (!tud_mounted() || state == sent_state)
+        return;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    // tud_task() runs in the USB interrupt and releases the endpoint
+    if (usbd_edpt_busy(BOARD_DEVICE_RHPORT_NUM, NOTIFY_EP)
+        || !usbd_edpt_claim(BOARD_DEVICE_RHPORT_NUM, NOTIFY_EP))
+    {
+        __set_PRIMASK(primask);
+        return;
+    }
+
+    notify_buf[0] = 0xA1u;                          // Class, interface, device to host
+    notify_buf[1] = CDC_NOTIF_SERIAL_STATE;
+    notify_buf[2] = 0u;                             // wValue
+    notify_buf[3] = 0u;
+    notify_buf[4] = NOTIFY_ITF * 2u;                // wIndex: communication interface
+    notify_buf[5] = 0u;
+    notify_buf[6] = 2u;                             // wLength
+    notify_buf[7] = 0u;
+    notify_buf[8] = state & 0xFFu;
+    notify_buf[9] = state >> 8;
+
+    if (usbd_edpt_xfer(BOARD_DEVICE_RHPORT_NUM, NOTIFY_EP, notify_buf, NOTIFY_LEN))
+    {
+        sent_state = state;
+        latched = 0;
+    }
+
+    __set_PRIMASK(primask);
+}
@@ -0,0 +1,28 @@
+#ifndef _NOTIFY_H
+#define _NOTIFY_H
+
+#include "stdint.h"
+
+// CDC interface whose notification endpoint carries the bus state
+#define NOTIFY_ITF          0u
+
+// CDC PSTN SERIAL_STATE notification: 8 byte header and 16-bit UART state
+#define NOTIFY_LEN          10u
+
+// UART state bits, as decoded by standard ACM host drivers
+#define NOTIFY_ON_BUS       (1u << 0)   // bRxCarrier (DCD): controller on bus
+#define NOTIFY_ACTIVE       (1u << 1)   // bTxCarrier (DSR): on bus and error active
+#define NOTIFY_BUS_OFF      (1u << 2)   // bBreak: bus off entered
+#define NOTIFY_WARNING      (1u << 3)   // bRingSignal: error counter reached 96
+#define NOTIFY_PASSIVE      (1u << 4)   // bFraming: error counter reached 128
+#define NOTIFY_OVERRUN      (1u << 6)   // bOverRun: a frame was dropped
+
+// Bits which report an event rather than a level. They are latched until
+// sent and cleared once the host has taken them
+#define NOTIFY_EVENTS       (NOTIFY_BUS_OFF | NOTIFY_WARNING | NOTIFY_PASSIVE | NOTIFY_OVERRUN)
+
+// Prototypes
+void notify_reset(void);
+void notify_process(void);
+
+#endif // _NOTIFY_H
@@ -0,0 +1,64 @@
+//
+// profile: Cycle-accurate hot-path profiler on the DWT cycle counter
+//
+
+#include "profile.h"
+
+#if APP_PROFILE_ENABLE
+
+// Private variables
+static profile_stats_t profile_stats[PROFILE_MAX];
+static hist_dump_t dump;
+
+
+// Start the cycle counter and clear all statistics
+void profile_init(void)
+{
+    DCB->DEMCR |= DCB_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    profile_reset();
+}
+
+// Clear all statistics
+void profile_reset(void)
+{
+    hist_reset(profile_stats, PROFILE_MAX);
+}
+
+// Account one execution of a section
+void profile_record(profile_section_t sec, uint32_t cycles)
+{
+    if (sec >= PROFILE_MAX)
+        return;
+
+    hist_record(&profile_stats[sec], PROFILE_HIST_BUCKETS, cycles);
+}
+
+// Take a consistent copy of a section's statistics
+void profile_get_stats(profile_section_t sec, profile_stats_t *stats)
+{
+    if (sec >= PROFILE_MAX)
+        return;
+
+    // The USB ISR section is updated from interrupt context
+    hist_copy(&profile_stats[sec], stats);
+}
+
+// Begin streaming all statistics to the host
+void profile_dump_start(void)
+{
+    hist_dump_start(&dump, profile_stats, PROFILE_MAX, PROFILE_HIST_BUCKETS, 'P');
+}
+
+// Emit dump lines while there is room in the CDC TX FIFO. Output is:
+//   'P' + section + count + min + max + mean    per section
+//   'p' + section + bucket + count              per non-empty bucket
+//   'P'                                         end of dump
+void profile_dump_process(void)
+{
+    hist_dump_process(&dump);
+}
+
+#endif // APP_PROFILE_ENABLE
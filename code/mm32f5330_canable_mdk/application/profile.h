@@ -0,0 +1,61 @@
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include "stdint.h"
+#include "hist.h"
+
+// Set to 1 (e.g. in the project defines) to build the hot-path profiler.
+// When 0 the PROFILE_* macros expand to nothing and no RAM is used.
+#ifndef APP_PROFILE_ENABLE
+#define APP_PROFILE_ENABLE  0
+#endif
+
+// Profiled sections
+typedef enum _profile_section_t
+{
+    PROFILE_CDC_PROCESS = 0,
+    PROFILE_LED_PROCESS,
+    PROFILE_CAN_PROCESS,
+    PROFILE_SLCAN_PARSE_FRAME,
+    PROFILE_USB_ISR,
+    PROFILE_E2E_PROTECT,
+    PROFILE_ECU_RX,
+    PROFILE_APP_PASS,
+
+    PROFILE_MAX
+} profile_section_t;
+
+// Number of log2 histogram buckets; bucket n counts durations in
+// [2^n, 2^(n+1)) cycles, the last bucket also takes everything longer
+#define PROFILE_HIST_BUCKETS    HIST_BUCKETS
+
+#if APP_PROFILE_ENABLE
+
+#include "board_init.h"
+
+// Free-running cycle counter, may be overridden for other time bases
+#ifndef PROFILE_CYCLES
+#define PROFILE_CYCLES()        (DWT->CYCCNT)
+#endif
+
+#define PROFILE_ENTER(sec)      uint32_t profile_start_##sec = PROFILE_CYCLES()
+#define PROFILE_EXIT(sec)       profile_record((sec), PROFILE_CYCLES() - profile_start_##sec)
+
+typedef hist_stats_t profile_stats_t;
+
+// Prototypes
+void profile_init(void);
+void profile_reset(void);
+void profile_record(profile_section_t sec, uint32_t cycles);
+void profile_get_stats(profile_section_t sec, profile_stats_t *stats);
+void profile_dump_start(void);
+void profile_dump_process(void);
+
+#else
+
+#define PROFILE_ENTER(sec)
+#define PROFILE_EXIT(sec)
+
+#endif // APP_PROFILE_ENABLE
+
+#endif // _PROFILE_H
@@ -0,0 +1,254 @@
+//
+// remote: Remote frame responses sent by the CAN controller
+//
+// Each entry occupies a mailbox in the remote answer state. With
+// CTRL2[RRS] cleared the controller matches incoming remote frames against
+// these mailboxes and transmits the stored data frame on its own, so the
+// response follows the request within one frame time instead of a USB
+// round trip. Remote frames that match no entry reach the host as before.
+// Answered requests never reach the RX FIFO, so both the request and the
+// answer are accounted here.
+//
+
+#include <string.h>
+#include "remote.h"
+#include "can.h"
+#include "busload.h"
+#include "capture.h"
+
+// Interrupt flags of the mailboxes used for responses
+#define REMOTE_MB_STATUS    ((1u << (BOARD_FLEXCAN_REMOTE_MB_LAST + 1u)) - (1u << BOARD_FLEXCAN_REMOTE_MB_FIRST))
+
+// Private variables
+static remote_entry_t table[REMOTE_MAX_ENTRIES];
+
+
+static uint32_t remote_mb_code(uint32_t channel)
+{
+    return (BOARD_FLEXCAN_PORT->MB[channel].CS & FLEXCAN_CS_CODE_MASK) >> FLEXCAN_CS_CODE_SHIFT;
+}
+
+// Answer frame of an entry
+static void remote_frame(remote_entry_t *e, FLEXCAN_Mb_Type *mb)
+{
+    memset(mb, 0, sizeof(*mb));
+    mb->ID = e->id;
+    mb->FORMAT = e->ext ? FLEXCAN_MbFormat_Extended : FLEXCAN_MbFormat_Standard;
+    mb->TYPE = FLEXCAN_MbType_Data;
+    mb->LENGTH = e->dlc;
+    mb->WORD0 = e->word0;
+    mb->WORD1 = e->word1;
+}
+
+// Write an entry into its mailbox, or release the mailbox if unused
+static void remote_load(uint8_t slot)
+{
+    uint32_t channel = BOARD_FLEXCAN_REMOTE_MB_FIRST + slot;
+    remote_entry_t *e = &table[slot];
+    FLEXCAN_Mb_Type mb;
+
+    // Deactivate first so that a half updated response is never sent
+    FLEXCAN_SetMbCode(BOARD_FLEXCAN_PORT, channel, FLEXCAN_MbCode_TxInactive);
+    if (!e->used)
+    {
+        return;
+    }
+
+    remote_frame(e, &mb);
+    FLEXCAN_WriteTxMb(BOARD_FLEXCAN_PORT, channel, &mb);
+    FLEXCAN_SetMbCode(BOARD_FLEXCAN_PORT, channel, FLEXCAN_MbCode_RxRanswer);
+}
+
+// Bus load and capture see the request and the answer sent for it. The
+// request is taken to ask for the answer's DLC, as the mailbox does not
+// keep what was received.
+static void remote_account(remote_entry_t *e)
+{
+    FLEXCAN_Mb_Type mb;
+
+    remote_frame(e, &mb);
+    mb.TYPE = FLEXCAN_MbType_Remote;
+    mb.WORD0 = 0;
+    mb.WORD1 = 0;
+    busload_add_frame(&mb);
+    capture_frame(&mb);
+
+    remote_frame(e, &mb);
+    busload_add_frame(&mb);
+    capture_frame(&mb);
+}
+
+// Let the controller answer remote frames: FLEXCAN_Init() always sets RRS
+static void remote_setup_controller(void)
+{
+    FLEXCAN_RxMbMaskConf_Type mask;
+
+    // Compare the full ID and IDE; RTR differs between request and answer
+    mask.MbType = FLEXCAN_MbType_Data;
+    mask.MbFormat = FLEXCAN_MbFormat_Extended;
+    mask.IdMask = 0x1FFFFFFFu;
+    FLEXCAN_SetGlobalMbMaskConf(BOARD_FLEXCAN_PORT, &mask);
+
+    // Mailboxes must be matched before the accept-all RX FIFO filter
+    FLEXCAN_EnableFreezeMode(BOARD_FLEXCAN_PORT, true);
+    BOARD_FLEXCAN_PORT->CTRL2 = (BOARD_FLEXCAN_PORT->CTRL2 & ~(FLEXCAN_CTRL2_RRS_MASK | FLEXCAN_CTRL2_MRP_MASK))
+                              | FLEXCAN_CTRL2_MRP(FLEXCAN_FifoPriority_MbFirst);
+    FLEXCAN_EnableFreezeMode(BOARD_FLEXCAN_PORT, false);
+}
+
+
+// Add or update the response to remote frames with this ID, returns
+// nonzero if all mailboxes are taken. Takes effect immediately on-bus.
+uint8_t remote_set(uint32_t id, uint8_t ext, uint8_t dlc, uint32_t word0, uint32_t word1)
+{
+    uint8_t slot = REMOTE_MAX_ENTRIES;
+
+    if (dlc > 8 || id > (ext ? 0x1FFFFFFFu : 0x7FFu))
+    {
+        return 1u;
+    }
+
+    ext = (ext != 0);
+    for (uint8_t i = 0; i < REMOTE_MAX_ENTRIES; i++)
+    {
+        if (table[i].used && table[i].id == id && table[i].ext == ext)
+        {
+            slot = i;
+            break;
+        }
+        if (!table[i].used && slot == REMOTE_MAX_ENTRIES)
+        {
+            slot = i;
+        }
+    }
+    if (slot == REMOTE_MAX_ENTRIES)
+    {
+        return 1u;
+    }
+
+    remote_entry_t *e = &table[slot];
+    if (!e->used)
+    {
+        e->responses = 0;
+    }
+    e->id = id;
+    e->ext = ext;
+    e->dlc = dlc;
+    e->word0 = word0;
+    e->word1 = word1;
+    e->used = 1;
+
+    if (can_get_bus_state() == ON_BUS)
+    {
+        if (BOARD_FLEXCAN_PORT->CTRL2 & FLEXCAN_CTRL2_RRS_MASK)
+        {
+            remote_setup_controller();
+        }
+        remote_load(slot);
+    }
+    return 0u;
+}
+
+// Stop answering remote frames with this ID, returns nonzero if unknown
+uint8_t remote_remove(uint32_t id, uint8_t ext)
+{
+    for (uint8_t i = 0; i < REMOTE_MAX_ENTRIES; i++)
+    {
+        if (table[i].used && table[i].id == id && table[i].ext == (ext != 0))
+        {
+            table[i].used = 0;
+            if (can_get_bus_state() == ON_BUS)
+            {
+                remote_load(i);
+            }
+            return 0u;
+        }
+    }
+    return 1u;
+}
+
+void remote_clear(void)
+{
+    for (uint8_t i = 0; i < REMOTE_MAX_ENTRIES; i++)
+    {
+        table[i].used = 0;
+        if (can_get_bus_state() == ON_BUS)
+        {
+            remote_load(i);
+        }
+    }
+}
+
+uint8_t remote_count(void)
+{
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < REMOTE_MAX_ENTRIES; i++)
+    {
+        count += table[i].used;
+    }
+    return count;
+}
+
+// Total responses sent by all entries
+uint32_t remote_responses(void)
+{
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < REMOTE_MAX_ENTRIES; i++)
+    {
+        if (table[i].used)
+        {
+            total += table[i].responses;
+        }
+    }
+    return total;
+}
+
+// Load the table into the controller, called whenever it has been
+// (re)initialised by can_enable()
+void remote_apply(void)
+{
+    if (remote_count() == 0)
+    {
+        return;
+    }
+
+    remote_setup_controller();
+    for (uint8_t i = 0; i < REMOTE_MAX_ENTRIES; i++)
+    {
+        remote_load(i);
+    }
+}
+
+// Count the responses sent and re-arm mailboxes the controller has
+// returned to the inactive state after answering
+void remote_process(void)
+{
+    if (can_get_bus_state() != ON_BUS)
+    {
+        return;
+    }
+
+    uint32_t flags = FLEXCAN_GetMbStatus(BOARD_FLEXCAN_PORT) & REMOTE_MB_STATUS;
+    if (flags)
+    {
+        FLEXCAN_ClearMbStatus(BOARD_FLEXCAN_PORT, flags);
+    }
+
+    for (uint8_t i = 0; i < REMOTE_MAX_ENTRIES; i++)
+    {
+        uint32_t channel = BOARD_FLEXCAN_REMOTE_MB_FIRST + i;
+
+        if (!table[i].used)
+            continue;
+
+        if (flags & (1u << channel))
+        {
+            table[i].responses++;
+            remote_account(&table[i]);
+        }
+        if (remote_mb_code(channel) == FLEXCAN_MbCode_TxInactive)
+        {
+            FLEXCAN_SetMbCode(BOARD_FLEXCAN_PORT, channel, FLEXCAN_MbCode_RxRanswer);
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef _REMOTE_H
+#define _REMOTE_H
+
+#include "stdint.h"
+#include "board_init.h"
+
+// One mailbox per remote frame ID answered by the controller
+#define REMOTE_MAX_ENTRIES  (BOARD_FLEXCAN_REMOTE_MB_LAST - BOARD_FLEXCAN_REMOTE_MB_FIRST + 1u)
+
+typedef struct remote_entry_
+{
+    uint32_t id;
+    uint32_t word0;         // Response payload, BYTE0 in the top byte
+    uint32_t word1;
+    uint32_t responses;     // Responses sent since the entry was loaded
+    uint8_t ext;
+    uint8_t dlc;
+    uint8_t used;
+    uint8_t reserved;
+} remote_entry_t;
+
+// Prototypes
+uint8_t remote_set(uint32_t id, uint8_t ext, uint8_t dlc, uint32_t word0, uint32_t word1);
+uint8_t remote_remove(uint32_t id, uint8_t ext);
+void remote_clear(void);
+uint8_t remote_count(void);
+uint32_t remote_responses(void);
+void remote_apply(void);
+void remote_process(void);
+
+#endif // _REMOTE_H
@@ -0,0 +1,205 @@
+//
+// sched: Transmission of frames at an absolute device time
+//
+// Frames are kept ordered by due time. The timebase alarm is set to the
+// earliest one and its interrupt writes the frame into a dedicated mailbox,
+// so the frame starts within microseconds of its due time regardless of
+// what the main loop is doing. E2E counters and CRCs are filled in there
+// too, in the order frames go out. Each frame produces a confirmation line
+// with the time it was actually loaded; bus load is counted apart from the
+// confirmations, which wait for the host.
+//
+
+#include <string.h>
+#include "sched.h"
+#include "can.h"
+#include "busload.h"
+#include "e2e.h"
+#include "slcan.h"
+#include "timebase.h"
+#include "tusb.h"
+
+// Confirmation line: 'z' + due + sent + result + CR
+#define SCHED_LINE_LEN      19u
+
+// Private variables
+static sched_entry_t queue[SCHED_QUEUE_LEN];      // Ordered by due time
+static volatile uint8_t queue_count = 0;
+static sched_confirm_t confirms[SCHED_CONFIRM_LEN];
+static volatile uint8_t confirm_head = 0;
+static volatile uint8_t confirm_tail = 0;
+static uint32_t confirms_lost = 0;
+
+// Written by the alarm interrupt, accounted to the bus load by the main loop
+static volatile uint32_t sent_bits = 0;
+static volatile uint32_t sent_frames = 0;
+static uint32_t counted_bits = 0;
+static uint32_t counted_frames = 0;
+
+
+static uint8_t sched_mb_free(void)
+{
+    uint32_t code = (BOARD_FLEXCAN_PORT->MB[BOARD_FLEXCAN_SCHED_TX_MB_CH].CS & FLEXCAN_CS_CODE_MASK) >> FLEXCAN_CS_CODE_SHIFT;
+    return (code == FLEXCAN_MbCode_TxInactive) || (code == FLEXCAN_MbCode_RxInactive);
+}
+
+// Called from the alarm interrupt only
+static void sched_confirm(sched_entry_t *e, uint32_t now, uint8_t result)
+{
+    uint8_t next = (confirm_head + 1u) % SCHED_CONFIRM_LEN;
+
+    if (next == confirm_tail)
+    {
+        confirms_lost++;
+        return;
+    }
+    confirms[confirm_head].due_us = e->due_us;
+    confirms[confirm_head].sent_us = now;
+    confirms[confirm_head].result = result;
+    confirm_head = next;
+}
+
+static void sched_pop(void)
+{
+    queue_count--;
+    memmove(&queue[0], &queue[1], queue_count * sizeof(queue[0]));
+}
+
+
+// Queue a frame for transmission at due_us. Returns nonzero if the queue
+// is full.
+uint8_t sched_add(FLEXCAN_Mb_Type *frame, uint32_t due_us, uint8_t policy)
+{
+    uint8_t pos;
+
+    NVIC_DisableIRQ(BOARD_TIMEBASE_IRQn);
+
+    if (queue_count >= SCHED_QUEUE_LEN)
+    {
+        NVIC_EnableIRQ(BOARD_TIMEBASE_IRQn);
+        return 1u;
+    }
+
+    // Behind frames due no later than this one
+    pos = queue_count;
+    while (pos > 0 && (int32_t)(queue[pos - 1].due_us - due_us) > 0)
+    {
+        queue[pos] = queue[pos - 1];
+        pos--;
+    }
+    queue[pos].due_us = due_us;
+    queue[pos].policy = policy;
+    queue[pos].frame = *frame;
+    queue_count++;
+
+    if (pos == 0)
+    {
+        timebase_alarm_set(due_us);
+    }
+
+    NVIC_EnableIRQ(BOARD_TIMEBASE_IRQn);
+    return 0u;
+}
+
+// Number of frames waiting
+uint8_t sched_count(void)
+{
+    return queue_count;
+}
+
+// Confirmations lost because the host did not collect them in time
+uint32_t sched_lost(void)
+{
+    return confirms_lost;
+}
+
+// Drop all frames not sent yet
+void sched_clear(void)
+{
+    NVIC_DisableIRQ(BOARD_TIMEBASE_IRQn);
+    timebase_alarm_cancel();
+    queue_count = 0;
+    NVIC_EnableIRQ(BOARD_TIMEBASE_IRQn);
+}
+
+// Load the frames which are due, one per mailbox transmission
+void timebase_alarm_cb(void)
+{
+    while (queue_count > 0)
+    {
+        sched_entry_t *e = &queue[0];
+        uint32_t now = timebase_us();
+        uint32_t late = now - e->due_us;
+
+        if ((int32_t)late < 0)
+        {
+            timebase_alarm_set(e->due_us);
+            return;
+        }
+
+        if (can_get_bus_state() == OFF_BUS)
+        {
+            sched_confirm(e, now, SCHED_DROPPED_OFF_BUS);
+        } else if (late > SCHED_LATE_US && e->policy == SCHED_LATE_DROP) {
+            sched_confirm(e, now, SCHED_DROPPED_LATE);
+        } else if (!sched_mb_free()) {
+            // The previous frame has not left yet, try again shortly
+            timebase_alarm_set(now + SCHED_RETRY_US);
+            return;
+        } else {
+            e2e_protect(&e->frame);
+            FLEXCAN_ClearMbStatus(BOARD_FLEXCAN_PORT, 1u << BOARD_FLEXCAN_SCHED_TX_MB_CH);
+            FLEXCAN_WriteTxMb(BOARD_FLEXCAN_PORT, BOARD_FLEXCAN_SCHED_TX_MB_CH, &e->frame);
+            FLEXCAN_SetMbCode(BOARD_FLEXCAN_PORT, BOARD_FLEXCAN_SCHED_TX_MB_CH, FLEXCAN_MbCode_TxDataOrRemote);
+            sent_bits += busload_frame_bits(&e->frame);
+            sent_frames++;
+            sched_confirm(e, now, (late > SCHED_LATE_US) ? SCHED_SENT_LATE : SCHED_SENT);
+        }
+        sched_pop();
+    }
+}
+
+// Add the frames loaded since the last call to the bus load, on every
+// pass of the main loop whether or not the host collects confirmations
+void sched_account(void)
+{
+    NVIC_DisableIRQ(BOARD_TIMEBASE_IRQn);
+    uint32_t bits = sent_bits;
+    uint32_t frames = sent_frames;
+    NVIC_EnableIRQ(BOARD_TIMEBASE_IRQn);
+
+    if (frames != counted_frames)
+    {
+        busload_add_bits(bits - counted_bits, frames - counted_frames);
+        counted_bits = bits;
+        counted_frames = frames;
+    }
+}
+
+// Report the outcome of each scheduled frame to the host:
+//   'z' + due time (8) + load time (8) + result (1)
+void sched_process(void)
+{
+    uint8_t line[SCHED_LINE_LEN];
+    uint8_t pos;
+
+    if (confirm_tail == confirm_head)
+        return;
+
+    while (confirm_tail != confirm_head && tud_cdc_write_available() >= sizeof(line))
+    {
+        sched_confirm_t *c = &confirms[confirm_tail];
+
+        pos = 0;
+        line[pos++] = 'z';
+        pos += slcan_put_hex(&line[pos], c->due_us, 8);
+        pos += slcan_put_hex(&line[pos], c->sent_us, 8);
+        pos += slcan_put_hex(&line[pos], c->result, 1);
+        line[pos++] = '\r';
+        tud_cdc_write(line, pos);
+
+        confirm_tail = (confirm_tail + 1u) % SCHED_CONFIRM_LEN;
+    }
+
+    tud_cdc_write_flush();
+}
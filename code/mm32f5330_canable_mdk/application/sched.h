@@ -0,0 +1,57 @@
+#ifndef _SCHED_H
+#define _SCHED_H
+
+#include "stdint.h"
+#include "hal_flexcan.h"
+
+// Frames waiting for their transmit time
+#define SCHED_QUEUE_LEN     16u
+
+// Confirmations waiting to be sent to the host
+#define SCHED_CONFIRM_LEN   8u
+
+// A frame loaded more than this after its due time counts as late
+#define SCHED_LATE_US       50u
+
+// Retry interval while the mailbox still holds the previous frame
+#define SCHED_RETRY_US      20u
+
+// What to do with a frame that can no longer go out on time
+typedef enum sched_policy_
+{
+    SCHED_LATE_SEND = 0,    // Send it anyway
+    SCHED_LATE_DROP,        // Discard it
+} sched_policy_t;
+
+// Outcome reported in the confirmation
+typedef enum sched_result_
+{
+    SCHED_SENT = 0,
+    SCHED_SENT_LATE,
+    SCHED_DROPPED_LATE,
+    SCHED_DROPPED_OFF_BUS,
+} sched_result_t;
+
+typedef struct sched_entry_
+{
+    uint32_t due_us;
+    uint8_t policy;
+    FLEXCAN_Mb_Type frame;
+} sched_entry_t;
+
+typedef struct sched_confirm_
+{
+    uint32_t due_us;
+    uint32_t sent_us;       // timebase_us() when the mailbox was loaded
+    uint8_t result;
+} sched_confirm_t;
+
+// Prototypes
+uint8_t sched_add(FLEXCAN_Mb_Type *frame, uint32_t due_us, uint8_t policy);
+uint8_t sched_count(void);
+uint32_t sched_lost(void);
+void sched_clear(void);
+void sched_account(void);
+void sched_process(void);
+
+#endif // _SCHED_H
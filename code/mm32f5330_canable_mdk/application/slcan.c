@@ -7,6 +7,118 @@
 #include "can.h"
 #include "error.h"
 #include "slcan.h"
+#include "busload.h"
+#include "profile.h"
+#include "latency.h"
+#include "bench.h"
+#include "capture.h"
+#include "dedup.h"
+#include "decimate.h"
+#include "isotp.h"
+#include "j1939.h"
+#include "remote.h"
+#include "ecu.h"
+#include "e2e.h"
+#include "sched.h"
+#include "timebase.h"
+#include "tusb.h"
+
+
+// Append value as a fixed number of uppercase hex digits, return digits written
+uint8_t slcan_put_hex(uint8_t *buf, uint32_t value, uint8_t digits)
+{
+    for (uint8_t j = digits; j > 0; j--)
+    {
+        uint8_t nybble = value & 0xF;
+        buf[j - 1] = (nybble < 0xA) ? (nybble + 0x30) : (nybble + 0x37);
+        value = value >> 4;
+    }
+    return digits;
+}
+
+// Assemble a value from already converted nybbles, most significant first
+static uint32_t slcan_get_hex(uint8_t *buf, uint8_t digits)
+{
+    uint32_t value = 0;
+    for (uint8_t j = 0; j < digits; j++)
+    {
+        value = (value << 4) | (buf[j] & 0xF);
+    }
+    return value;
+}
+
+// Writer currently owning the CDC stream, see SLCAN_STREAM_*
+static uint8_t stream_owner = SLCAN_STREAM_NONE;
+
+// Take the CDC stream for a long line, returns nonzero if owner holds it
+uint8_t slcan_stream_claim(uint8_t owner)
+{
+    if (stream_owner == SLCAN_STREAM_NONE)
+    {
+        stream_owner = owner;
+    }
+    return stream_owner == owner;
+}
+
+// Give the stream back after the CR of the line has been written
+void slcan_stream_release(uint8_t owner)
+{
+    if (stream_owner == owner)
+    {
+        stream_owner = SLCAN_STREAM_NONE;
+    }
+}
+
+// Nonzero while a long line is incomplete; nothing else may be written
+// to the CDC stream until it is
+uint8_t slcan_stream_busy(void)
+{
+    return stream_owner != SLCAN_STREAM_NONE;
+}
+
+// Due time and late policy of the next frame command, set by 'w'
+static uint8_t sched_next = 0;
+static uint32_t sched_due_us;
+static uint8_t sched_policy;
+
+// Replies to commands parsed while a long line owns the stream
+#define SLCAN_REPLY_HOLD_LEN    64u
+static uint8_t reply_hold[SLCAN_REPLY_HOLD_LEN];
+static uint8_t reply_hold_len = 0;
+
+// Send a command response to the host via USB-CDC
+static void slcan_reply(uint8_t *buf, uint8_t len)
+{
+    // Not into the middle of a long line, nor ahead of replies held
+    // during one
+    if (slcan_stream_busy() || reply_hold_len)
+    {
+        if (reply_hold_len + len > sizeof(reply_hold))
+        {
+            error_assert(ERR_USBTX_BUSY);
+            return;
+        }
+        memcpy(&reply_hold[reply_hold_len], buf, len);
+        reply_hold_len += len;
+        return;
+    }
+
+    tud_cdc_write(buf, len);
+    tud_cdc_write_flush();
+}
+
+// Send the replies held while the stream was taken, once it is free
+void slcan_process(void)
+{
+    if (reply_hold_len == 0 || slcan_stream_busy() || tud_cdc_write_available() < reply_hold_len)
+    {
+        return;
+    }
+
+    tud_cdc_write(reply_hold, reply_hold_len);
+    tud_cdc_write_flush();
+    reply_hold_len = 0;
+}
 
 
 // Parse an incoming CAN frame into an outgoing slcan message
@@ -120,6 +232,11 @@ int8_t slcan_parse_str(uint8_t *buf, uint8_t len)
             can_enable();
             return 0;
 
+        case 'L':
+            // Open channel in listen-only mode command
+            can_enable_listen_only();
+            return 0;
+
         case 'C':
             // Close channel command
             can_disable();
@@ -170,6 +287,385 @@ int8_t slcan_parse_str(uint8_t *buf, uint8_t len)
             return 0;
         }
 
+        case 'f':
+            // Set acceptance filter: 'f' + ext flag + 8 digit ID + 8 digit mask
+            if (len < 18)
+            {
+                return -1;
+            }
+            can_set_filter(slcan_get_hex(&buf[2], 8), slcan_get_hex(&buf[10], 8), buf[1]);
+            return 0;
+
+        case 'Q':
+            // Store configuration: Q0 no auto start, Q1 auto start, Q2 auto start listen-only
+            if (len < 2 || buf[1] > 2)
+            {
+                return -1;
+            }
+            return can_store_config(buf[1]) ? -1 : 0;
+
+        case 'B':
+        {
+            // Loopback benchmark: 'B' + first ID (3) + last ID (3) + min DLC (1)
+            // + max DLC (1) + frame count (8) + frames/s (4, 0 = max); 'B' aborts
+            if (len == 1)
+            {
+                bench_stop();
+                return 0;
+            }
+            if (len < 21)
+            {
+                return -1;
+            }
+
+            bench_params_t params;
+            params.id_first = slcan_get_hex(&buf[1], 3);
+            params.id_last = slcan_get_hex(&buf[4], 3);
+            params.dlc_min = buf[7];
+            params.dlc_max = buf[8];
+            params.count = slcan_get_hex(&buf[9], 8);
+            params.rate = slcan_get_hex(&buf[17], 4);
+            return bench_start(&params) ? -1 : 0;
+        }
+
+        case 'X':
+            // Capture: 'X' streams the snapshot, 'X0' disarms,
+            // 'X1' + ext (1) + ID (8) + mask (8) + pre (2) + post (2) arms on an ID,
+            // 'X2' + pre (2) + post (2) arms on an error frame,
+            // 'X3' + offset (1) + data (8) + mask (8) adds a payload condition
+            // to the next 'X1', so it is sent before it
+            if (len < 2)
+            {
+                return capture_stream() ? -1 : 0;
+            }
+            switch (buf[1])
+            {
+                case 0:
+                    capture_disarm();
+                    return 0;
+                case 1:
+                    if (len < 23)
+                        return -1;
+                    if (capture_set_id(slcan_get_hex(&buf[3], 8), slcan_get_hex(&buf[11], 8), buf[2]))
+                        return -1;
+                    return capture_arm(CAPTURE_TRIGGER_ID, slcan_get_hex(&buf[19], 2), slcan_get_hex(&buf[21], 2)) ? -1 : 0;
+                case 2:
+                    if (len < 6)
+                        return -1;
+                    return capture_arm(CAPTURE_TRIGGER_ERROR, slcan_get_hex(&buf[2], 2), slcan_get_hex(&buf[4], 2)) ? -1 : 0;
+                case 3:
+                    if (len < 19)
+                        return -1;
+                    return capture_set_payload(buf[2], slcan_get_hex(&buf[3], 8), slcan_get_hex(&buf[11], 8)) ? -1 : 0;
+                default:
+                    return -1;
+            }
+
+        case 'D':
+            // Change-only reporting: 'D0' off, 'D1' + heartbeat ms (4, 0 = none)
+            // on, 'D' streams the per-ID suppression counters
+            if (len < 2)
+            {
+                dedup_report_start();
+                return 0;
+            }
+            if (len == 2 && buf[1] == 0)
+            {
+                dedup_enable(0, 0);
+                return 0;
+            }
+            if (len != 6 || buf[1] != 1)
+            {
+                return -1;
+            }
+            dedup_enable(1, slcan_get_hex(&buf[2], 4));
+            return 0;
+
+        case 'K':
+            // Decimation rules: 'K0' clears, 'K1'/'K2' + ext (1) + ID (8) + mask (8)
+            // + N or T ms (4) keeps every Nth frame / one frame per T ms,
+            // 'K' replies with the number of rules
+            if (len < 2)
+            {
+                uint8_t reply[4];
+                reply[0] = 'K';
+                slcan_put_hex(&reply[1], decimate_count(), 2);
+                reply[3] = '\r';
+                slcan_reply(reply, sizeof(reply));
+                return 0;
+            }
+            if (buf[1] == 0)
+            {
+                decimate_clear();
+                return 0;
+            }
+            if (len < 23)
+            {
+                return -1;
+            }
+            return decimate_add(buf[1], slcan_get_hex(&buf[3], 8), slcan_get_hex(&buf[11], 8),
+                                buf[2], slcan_get_hex(&buf[19], 4)) ? -1 : 0;
+
+        case 'i':
+            // ISO-TP pair: 'i' + pair (1) + ext (1) + RX ID (8) + TX ID (8)
+            // + block size (2) + STmin (2) enables, 'i' + pair disables
+            if (len == 2)
+            {
+                isotp_disable(buf[1]);
+                return 0;
+            }
+            if (len < 23)
+            {
+                return -1;
+            }
+            return isotp_configure(buf[1], slcan_get_hex(&buf[3], 8), slcan_get_hex(&buf[11], 8), buf[2],
+                                   slcan_get_hex(&buf[19], 2), slcan_get_hex(&buf[21], 2)) ? -1 : 0;
+
+        case 'j':
+            // J1939 transport: 'j0' clears, 'j1' + PGN (6) selects a PGN,
+            // 'j2' + address (2) + packets per CTS (2) answers RTS sent to
+            // address, 'j3' stops answering
+            if (len < 2)
+            {
+                return -1;
+            }
+            switch (buf[1])
+            {
+                case 0:
+                    j1939_clear();
+                    return 0;
+                case 1:
+                    if (len < 8)
+                        return -1;
+                    return j1939_add_pgn(slcan_get_hex(&buf[2], 6)) ? -1 : 0;
+                case 2:
+                    if (len < 6)
+                        return -1;
+                    j1939_set_responder(1, slcan_get_hex(&buf[2], 2), slcan_get_hex(&buf[4], 2));
+                    return 0;
+                case 3:
+                    j1939_set_responder(0, 0, 0);
+                    return 0;
+                default:
+                    return -1;
+            }
+
+        case 'E':
+        {
+            // ECU simulation rules, uploaded in parts:
+            // 'E0' clears all rules
+            // 'E1' + rule (1) + ext (1) + ID (8) + mask (8) + delay us (4) starts a rule
+            // 'E2' / 'E3' + rule (1) + payload / payload mask (16) to match
+            // 'E4' + rule (1) + ext (1) + ID (8) + DLC (1) of the response
+            // 'E5' / 'E6' + rule (1) + template / byte ops (16) of the response
+            // 'E7' / 'E8' + rule (1) enables / disables a rule
+            uint8_t bytes[8];
+
+            if (len < 2)
+            {
+                return -1;
+            }
+            if (buf[1] == 0)
+            {
+                ecu_clear();
+                return 0;
+            }
+            if (len < 3)
+            {
+                return -1;
+            }
+            switch (buf[1])
+            {
+                case 1:
+                    if (len < 24)
+                        return -1;
+                    return ecu_set_match(buf[2], buf[3], slcan_get_hex(&buf[4], 8), slcan_get_hex(&buf[12], 8),
+                                         slcan_get_hex(&buf[20], 4)) ? -1 : 0;
+                case 2:
+                case 3:
+                case 5:
+                case 6:
+                    if (len < 19)
+                        return -1;
+                    for (uint8_t i = 0; i < 8; i++)
+                    {
+                        bytes[i] = slcan_get_hex(&buf[3 + 2 * i], 2);
+                    }
+                    if (buf[1] <= 3)
+                        return ecu_set_match_data(buf[2], bytes, buf[1] == 3) ? -1 : 0;
+                    return ecu_set_response_data(buf[2], bytes, buf[1] == 6) ? -1 : 0;
+                case 4:
+                    if (len < 13)
+                        return -1;
+                    return ecu_set_response(buf[2], buf[3], slcan_get_hex(&buf[4], 8), buf[12]) ? -1 : 0;
+                case 7:
+                case 8:
+                    return ecu_enable(buf[2], buf[1] == 7) ? -1 : 0;
+                default:
+                    return -1;
+            }
+        }
+
+        case 'w':
+            // Scheduled transmit: 'w' + due time (8) + late policy (1) sends
+            // the next frame command at that device time, 'w0' drops all
+            // scheduled frames, 'w' replies with the current device time,
+            // frames queued and confirmations lost; other lines are refused
+            if (len >= 10)
+            {
+                sched_due_us = slcan_get_hex(&buf[1], 8);
+                sched_policy = buf[9] ? SCHED_LATE_DROP : SCHED_LATE_SEND;
+                sched_next = 1;
+                return 0;
+            }
+            if (len == 2 && buf[1] == 0)
+            {
+                sched_clear();
+                sched_next = 0;
+                return 0;
+            }
+            if (len >= 2)
+            {
+                return -1;
+            }
+            {
+                uint8_t reply[20];
+                uint8_t pos = 0;
+                reply[pos++] = 'w';
+                pos += slcan_put_hex(&reply[pos], timebase_us(), 8);
+                pos += slcan_put_hex(&reply[pos], sched_count(), 2);
+                pos += slcan_put_hex(&reply[pos], sched_lost(), 8);
+                reply[pos++] = '\r';
+                slcan_reply(reply, pos);
+            }
+            return 0;
+
+        case 'e':
+            // E2E protection of transmitted frames: 'e0' clears all
+            // profiles, 'e1' + slot (1) + profile (1) + ext (1) + ID (8)
+            // + data ID (4) + CRC bit offset (2) + counter bit offset (2)
+            // sets one up; profile 0 frees the slot
+            if (len < 2)
+                return -1;
+            switch (buf[1])
+            {
+                case 0:
+                    e2e_clear();
+                    return 0;
+                case 1:
+                    if (len < 21)
+                        return -1;
+                    return e2e_set(buf[2], buf[3], slcan_get_hex(&buf[5], 8), buf[4],
+                                   slcan_get_hex(&buf[13], 4), slcan_get_hex(&buf[17], 2),
+                                   slcan_get_hex(&buf[19], 2)) ? -1 : 0;
+                default:
+                    return -1;
+            }
+
+        case 'y':
+            // Remote frame responses: 'y0' clears, 'y1' + ext (1) + ID (8)
+            // + DLC (1) + data (16) answers remote frames with this ID,
+            // 'y2' + ext (1) + ID (8) stops answering, 'y' replies with the
+            // number of entries and the responses sent
+            if (len < 2)
+            {
+                uint8_t reply[12];
+                uint8_t pos = 0;
+                reply[pos++] = 'y';
+                pos += slcan_put_hex(&reply[pos], remote_count(), 2);
+                pos += slcan_put_hex(&reply[pos], remote_responses(), 8);
+                reply[pos++] = '\r';
+                slcan_reply(reply, pos);
+                return 0;
+            }
+            switch (buf[1])
+            {
+                case 0:
+                    remote_clear();
+                    return 0;
+                case 1:
+                    if (len < 28)
+                        return -1;
+                    return remote_set(slcan_get_hex(&buf[3], 8), buf[2], buf[11],
+                                      slcan_get_hex(&buf[12], 8), slcan_get_hex(&buf[20], 8)) ? -1 : 0;
+                case 2:
+                    if (len < 11)
+                        return -1;
+                    return remote_remove(slcan_get_hex(&buf[3], 8), buf[2]) ? -1 : 0;
+                default:
+                    return -1;
+            }
+
+        case 'b':
+        {
+            // Bus load: 'b' reports, 'bxxxx' sets the window in ms (hex)
+            if (len >= 5)
+            {
+                busload_set_window(slcan_get_hex(&buf[1], 4));
+                return 0;
+            }
+
+            // Reply 'b' + last window load + peak load, 0.01 % units
+            busload_stats_t stats;
+            uint8_t reply[SLCAN_MTU];
+            uint8_t pos = 0;
+            busload_get_stats(&stats);
+            reply[pos++] = 'b';
+            pos += slcan_put_hex(&reply[pos], stats.load, 4);
+            pos += slcan_put_hex(&reply[pos], stats.peak, 4);
+            reply[pos++] = '\r';
+            slcan_reply(reply, pos);
+            return 0;
+        }
+
+        case 'G':
+        {
+            // USB event queue: 'G' reports depth, high-water mark, events
+            // and overflows, 'G0' clears all but the depth
+            if (len >= 2 && buf[1] == 0)
+            {
+                tud_queue_stats_reset();
+                return 0;
+            }
+
+            tud_queue_stats_t stats;
+            uint8_t reply[26];
+            uint8_t pos = 0;
+            tud_queue_stats(&stats);
+            reply[pos++] = 'G';
+            pos += slcan_put_hex(&reply[pos], stats.depth, 4);
+            pos += slcan_put_hex(&reply[pos], stats.high_water, 4);
+            pos += slcan_put_hex(&reply[pos], stats.events, 8);
+            pos += slcan_put_hex(&reply[pos], stats.overflows, 8);
+            reply[pos++] = '\r';
+            slcan_reply(reply, pos);
+            return 0;
+        }
+
+#if APP_LATENCY_ENABLE
+        case 'U':
+            // USB latency tracer: 'U' dumps histograms, 'U0' clears them
+            if (len >= 2 && buf[1] == 0)
+            {
+                latency_reset();
+            } else {
+                latency_dump_start();
+            }
+            return 0;
+#endif
+
+#if APP_PROFILE_ENABLE
+        case 'P':
+            // Profiler: 'P' dumps statistics, 'P0' clears them
+            if (len >= 2 && buf[1] == 0)
+            {
+                profile_reset();
+            } else {
+                profile_dump_start();
+            }
+            return 0;
+#endif
+
         case 'T':
             frame_header.FORMAT = FLEXCAN_MbFormat_Extended;
         case 't':
@@ -231,8 +727,14 @@ int8_t slcan_parse_str(uint8_t *buf, uint8_t len)
     frame_header.BYTE7 = (buf[msg_position] << 4) + buf[msg_position+1];
     msg_position += 2;
 
-    // Transmit the message
+    // Transmit the message, at its due time if one was given
+    if (sched_next)
+    {
+        sched_next = 0;
+        return sched_add(&frame_header, sched_due_us, sched_policy) ? -1 : 0;
+    }
     can_tx(&frame_header, frame_data);
+    LATENCY_TX_PARSED();
 
     return 0;
 }
@@ -6,10 +6,21 @@
 
 int8_t slcan_parse_frame(uint8_t *buf, FLEXCAN_Mb_Type *frame_header, uint8_t* frame_data);
 int8_t slcan_parse_str(uint8_t *buf, uint8_t len);
+uint8_t slcan_put_hex(uint8_t *buf, uint32_t value, uint8_t digits);
+uint8_t slcan_stream_claim(uint8_t owner);
+void slcan_stream_release(uint8_t owner);
+uint8_t slcan_stream_busy(void);
+void slcan_process(void);
 
 // maximum rx buffer len: extended CAN frame with timestamp
 #define SLCAN_MTU 30 // (sizeof("T1111222281122334455667788EA5F\r")+1)
 
+// Writers of lines too long for the CDC TX FIFO, which own the stream
+// from the first character up to the CR
+#define SLCAN_STREAM_NONE   0
+#define SLCAN_STREAM_ISOTP  1
+#define SLCAN_STREAM_J1939  2
+
 #define SLCAN_STD_ID_LEN 3
 #define SLCAN_EXT_ID_LEN 8
 
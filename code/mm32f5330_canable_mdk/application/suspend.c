@@ -0,0 +1,142 @@
+//
+// suspend: Hold received frames while the USB bus is suspended
+//
+// Nothing reaches the host while it has the bus suspended, so frames for
+// the slcan stream are kept in a ring instead. A frame arriving while
+// the host allows remote wakeup wakes it up. After resume the ring is
+// written to the CDC stream in order; until it is empty, newer frames
+// are queued behind it rather than overtaking it.
+//
+// Frames received while a long line (ISO-TP or J1939 PDU) owns the slcan
+// stream wait in the ring as well, and follow once its CR is out.
+//
+// The same ring carries frames across a bus reset or a closed port. Once
+// the host has opened the slcan port with DTR, frames are held whenever
+// it is not open, and delivered when DTR is set again. The CAN channel
+// and its settings are not touched by USB at all.
+//
+// A host that stays away longer than the ring lasts gets the newest
+// frames: the oldest one gives way and is counted as ERR_FULLBUF_SUSPEND,
+// so reception and the device consumers never stall on the ring.
+//
+
+#include "suspend.h"
+#include "can.h"
+#include "error.h"
+#include "slcan.h"
+#include "tusb.h"
+
+// Private variables
+static FLEXCAN_Mb_Type ring[SUSPEND_DEPTH];
+static uint8_t head = 0;        // Next slot to write
+static uint8_t count = 0;
+
+static volatile suspend_state_t state = SUSPEND_AWAKE;
+static volatile uint8_t wakeup_allowed = 0;
+static volatile uint8_t uses_dtr = 0;       // Host opens the port with DTR
+static volatile uint8_t reopened = 0;       // DTR set, flush what is pending
+
+
+// Whether the host is away: bus suspended, or port not open by a host
+// known to signal DTR
+static uint8_t suspend_away(void)
+{
+    return state != SUSPEND_AWAKE || (uses_dtr && !tud_cdc_connected());
+}
+
+// Frames go to the ring while the host is away or the stream is taken,
+// and until it is drained
+static uint8_t suspend_holding(void)
+{
+    return suspend_away() || slcan_stream_busy() || count != 0u;
+}
+
+// The host suspended the bus, called from tud_suspend_cb()
+void suspend_enter(uint8_t remote_wakeup_en)
+{
+    wakeup_allowed = remote_wakeup_en;
+    state = SUSPEND_ASLEEP;
+}
+
+// The bus has resumed, called from tud_resume_cb()
+void suspend_exit(void)
+{
+    state = SUSPEND_AWAKE;
+}
+
+// The slcan port has been opened with DTR, from tud_cdc_line_state_cb(),
+// or is used without it (dtr = 0); only hosts that signal DTR have their
+// frames held while the port is closed
+void suspend_port_open(uint8_t dtr)
+{
+    uses_dtr = dtr;
+    reopened = dtr;
+}
+
+// Keep a frame for the host if the ring is in use, dropping the oldest
+// one when it is full. Returns 0 if the frame can be written to the CDC
+// stream right away
+uint8_t suspend_hold(FLEXCAN_Mb_Type *frame)
+{
+    if (!suspend_holding())
+        return 0u;
+
+    if (count >= SUSPEND_DEPTH)
+    {
+        error_assert(ERR_FULLBUF_SUSPEND);
+        count--;
+    }
+
+    ring[head] = *frame;
+    head = (head + 1u) % SUSPEND_DEPTH;
+    count++;
+    return 1u;
+}
+
+// Wake the host on CAN activity, then drain the ring into the CDC stream
+void suspend_process(void)
+{
+    // A bus reset ends the suspend without a resume callback
+    if (state != SUSPEND_AWAKE && !tud_suspended())
+    {
+        state = SUSPEND_AWAKE;
+    }
+
+    if (state == SUSPEND_ASLEEP)
+    {
+        if (wakeup_allowed && (count != 0u || is_can_msg_pending()) && tud_remote_wakeup())
+        {
+            state = SUSPEND_WAKING;
+        }
+        return;
+    }
+
+    if (suspend_away())
+        return;
+
+    // Lines kept in the CDC TX FIFO over a bus reset go out first
+    if (reopened)
+    {
+        reopened = 0;
+        tud_cdc_write_flush();
+    }
+
+    if (count == 0u)
+        return;
+
+    uint8_t msg_buf[SLCAN_MTU];
+    uint8_t unused[8] = {0};
+
+    while (count != 0u && tud_cdc_write_available() >= SLCAN_MTU)
+    {
+        uint8_t tail = (head + SUSPEND_DEPTH - count) % SUSPEND_DEPTH;
+        int8_t msg_len = slcan_parse_frame(msg_buf, &ring[tail], unused);
+        count--;
+
+        if (msg_len > 0)
+        {
+            tud_cdc_write(msg_buf, msg_len);
+        }
+    }
+    tud_cdc_write_flush();
+}
@@ -0,0 +1,25 @@
+#ifndef _SUSPEND_H
+#define _SUSPEND_H
+
+#include "stdint.h"
+#include "hal_flexcan.h"
+
+// Received frames held while the host has the bus suspended or the port
+// closed
+#define SUSPEND_DEPTH       32u
+
+typedef enum suspend_state_
+{
+    SUSPEND_AWAKE = 0,
+    SUSPEND_ASLEEP,         // Bus suspended, frames are held
+    SUSPEND_WAKING,         // Remote wakeup signalled, waiting for resume
+} suspend_state_t;
+
+// Prototypes
+void suspend_enter(uint8_t remote_wakeup_en);
+void suspend_exit(void);
+void suspend_port_open(uint8_t dtr);
+uint8_t suspend_hold(FLEXCAN_Mb_Type *frame);
+void suspend_process(void);
+
+#endif // _SUSPEND_H
@@ -0,0 +1,194 @@
+//
+// timebase: Free-running microsecond counter
+//
+// The 32-bit BOARD_TIMEBASE_PORT timer counts at 1 MHz and wraps after
+// about 71 minutes; compare timestamps by subtraction only. Four compare
+// channels serve as one-shot alarms calling timebase_alarm_cb(),
+// timebase_wakeup_cb(), timebase_stmin_cb() and timebase_ecu_cb() from
+// the timer interrupt.
+//
+
+#include "timebase.h"
+#include "board_init.h"
+#include "hal_tim.h"
+
+// Interrupt enable and status bits of the compare channels
+#define TIMEBASE_ALARM_INT  (TIM_INT_CHN1_EVENT << BOARD_TIMEBASE_ALARM_CH)
+#define TIMEBASE_WAKEUP_INT (TIM_INT_CHN1_EVENT << BOARD_TIMEBASE_WAKEUP_CH)
+#define TIMEBASE_STMIN_INT  (TIM_INT_CHN1_EVENT << BOARD_TIMEBASE_STMIN_CH)
+#define TIMEBASE_ECU_INT    (TIM_INT_CHN1_EVENT << BOARD_TIMEBASE_ECU_CH)
+
+
+// DIER is shared by the four channels, which are armed from the main
+// loop, the USB and FlexCAN interrupts and the timer interrupt itself. Its read-modify-
+// write must not be split by another of them.
+static void timebase_int_enable(uint32_t interrupt, bool enable)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    TIM_EnableInterrupts(BOARD_TIMEBASE_PORT, interrupt, enable);
+    __set_PRIMASK(primask);
+}
+
+// Arm the one-shot of a compare channel
+static void timebase_oneshot_set(uint32_t channel, uint32_t interrupt, uint32_t at_us)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    TIM_EnableInterrupts(BOARD_TIMEBASE_PORT, interrupt, false);
+    TIM_PutChannelValue(BOARD_TIMEBASE_PORT, channel, at_us);
+    TIM_ClearInterruptStatus(BOARD_TIMEBASE_PORT, interrupt);
+    TIM_EnableInterrupts(BOARD_TIMEBASE_PORT, interrupt, true);
+
+    // A compare value the counter has just passed only matches after a wrap
+    if ((int32_t)(timebase_us() - at_us) >= 0)
+    {
+        NVIC_SetPendingIRQ(BOARD_TIMEBASE_IRQn);
+    }
+
+    __set_PRIMASK(primask);
+}
+
+
+// Start the counter
+void timebase_init(void)
+{
+    TIM_Init_Type tim_init;
+    TIM_OutputCompareConf_Type compare;
+
+    tim_init.ClockFreqHz = BOARD_TIMEBASE_FREQ;
+    tim_init.StepFreqHz = TIMEBASE_TICK_HZ;
+    tim_init.Period = 0xFFFFFFFFu;
+    tim_init.EnablePreloadPeriod = false;
+    tim_init.PeriodMode = TIM_PeriodMode_Continuous;
+    tim_init.CountMode = TIM_CountMode_Increasing;
+    TIM_Init(BOARD_TIMEBASE_PORT, &tim_init);
+
+    // The alarms only raise their flags, nothing is driven on a pin
+    compare.ChannelValue = 0;
+    compare.EnableFastOutput = false;
+    compare.EnablePreLoadChannelValue = false;
+    compare.RefOutMode = TIM_OutputCompareRefOut_None;
+    compare.ClearRefOutOnExtTrigger = false;
+    compare.PinPolarity = TIM_PinPolarity_Disabled;
+    TIM_EnableOutputCompare(BOARD_TIMEBASE_PORT, BOARD_TIMEBASE_ALARM_CH, &compare);
+    TIM_EnableOutputCompare(BOARD_TIMEBASE_PORT, BOARD_TIMEBASE_WAKEUP_CH, &compare);
+    TIM_EnableOutputCompare(BOARD_TIMEBASE_PORT, BOARD_TIMEBASE_STMIN_CH, &compare);
+    TIM_EnableOutputCompare(BOARD_TIMEBASE_PORT, BOARD_TIMEBASE_ECU_CH, &compare);
+
+    // Load the prescaler now rather than at the first overflow
+    TIM_DoSwTrigger(BOARD_TIMEBASE_PORT, TIM_SWTRG_UPDATE_PERIOD);
+    TIM_ClearInterruptStatus(BOARD_TIMEBASE_PORT,
+                             TIM_STATUS_UPDATE_PERIOD | TIMEBASE_ALARM_INT | TIMEBASE_WAKEUP_INT | TIMEBASE_STMIN_INT
+                             | TIMEBASE_ECU_INT);
+
+    // Above the USB interrupt so that scheduled frames go out on time
+    NVIC_SetPriority(BOARD_TIMEBASE_IRQn, 1u);
+    NVIC_EnableIRQ(BOARD_TIMEBASE_IRQn);
+
+    TIM_Start(BOARD_TIMEBASE_PORT);
+}
+
+// Current time in microseconds
+uint32_t timebase_us(void)
+{
+    return TIM_GetCounterValue(BOARD_TIMEBASE_PORT);
+}
+
+// Call timebase_alarm_cb() once the counter reaches at_us, or right away
+// if that time has already passed
+void timebase_alarm_set(uint32_t at_us)
+{
+    timebase_oneshot_set(BOARD_TIMEBASE_ALARM_CH, TIMEBASE_ALARM_INT, at_us);
+}
+
+void timebase_alarm_cancel(void)
+{
+    timebase_int_enable(TIMEBASE_ALARM_INT, false);
+}
+
+// Call timebase_wakeup_cb() once the counter reaches at_us
+void timebase_wakeup_set(uint32_t at_us)
+{
+    timebase_oneshot_set(BOARD_TIMEBASE_WAKEUP_CH, TIMEBASE_WAKEUP_INT, at_us);
+}
+
+// Call timebase_stmin_cb() once the counter reaches at_us, or right away
+// if that time has already passed
+void timebase_stmin_set(uint32_t at_us)
+{
+    timebase_oneshot_set(BOARD_TIMEBASE_STMIN_CH, TIMEBASE_STMIN_INT, at_us);
+}
+
+void timebase_stmin_cancel(void)
+{
+    timebase_int_enable(TIMEBASE_STMIN_INT, false);
+}
+
+// Call timebase_ecu_cb() once the counter reaches at_us, or right away if
+// that time has already passed
+void timebase_ecu_set(uint32_t at_us)
+{
+    timebase_oneshot_set(BOARD_TIMEBASE_ECU_CH, TIMEBASE_ECU_INT, at_us);
+}
+
+void timebase_ecu_cancel(void)
+{
+    timebase_int_enable(TIMEBASE_ECU_INT, false);
+}
+
+void BOARD_TIMEBASE_IRQHandler(void)
+{
+    uint32_t armed = BOARD_TIMEBASE_PORT->DIER
+                   & (TIMEBASE_ALARM_INT | TIMEBASE_WAKEUP_INT | TIMEBASE_STMIN_INT | TIMEBASE_ECU_INT);
+    uint32_t status = TIM_GetInterruptStatus(BOARD_TIMEBASE_PORT);
+
+    // The alarm is also pended by software, when its time has passed
+    if (armed & TIMEBASE_ALARM_INT)
+    {
+        // One shot: the callback sets the next alarm if it needs one
+        TIM_ClearInterruptStatus(BOARD_TIMEBASE_PORT, TIMEBASE_ALARM_INT);
+        if ((status & TIMEBASE_ALARM_INT)
+            || (int32_t)(timebase_us() - TIM_GetChannelValue(BOARD_TIMEBASE_PORT, BOARD_TIMEBASE_ALARM_CH)) >= 0)
+        {
+            TIM_EnableInterrupts(BOARD_TIMEBASE_PORT, TIMEBASE_ALARM_INT, false);
+            timebase_alarm_cb();
+        }
+    }
+
+    if (armed & TIMEBASE_WAKEUP_INT)
+    {
+        TIM_ClearInterruptStatus(BOARD_TIMEBASE_PORT, TIMEBASE_WAKEUP_INT);
+        if ((status & TIMEBASE_WAKEUP_INT)
+            || (int32_t)(timebase_us() - TIM_GetChannelValue(BOARD_TIMEBASE_PORT, BOARD_TIMEBASE_WAKEUP_CH)) >= 0)
+        {
+            TIM_EnableInterrupts(BOARD_TIMEBASE_PORT, TIMEBASE_WAKEUP_INT, false);
+            timebase_wakeup_cb();
+        }
+    }
+
+    // Also pended by software, like the alarm
+    if (armed & TIMEBASE_STMIN_INT)
+    {
+        TIM_ClearInterruptStatus(BOARD_TIMEBASE_PORT, TIMEBASE_STMIN_INT);
+        if ((status & TIMEBASE_STMIN_INT)
+            || (int32_t)(timebase_us() - TIM_GetChannelValue(BOARD_TIMEBASE_PORT, BOARD_TIMEBASE_STMIN_CH)) >= 0)
+        {
+            TIM_EnableInterrupts(BOARD_TIMEBASE_PORT, TIMEBASE_STMIN_INT, false);
+            timebase_stmin_cb();
+        }
+    }
+
+    // Also pended by software, like the alarm
+    if (armed & TIMEBASE_ECU_INT)
+    {
+        TIM_ClearInterruptStatus(BOARD_TIMEBASE_PORT, TIMEBASE_ECU_INT);
+        if ((status & TIMEBASE_ECU_INT)
+            || (int32_t)(timebase_us() - TIM_GetChannelValue(BOARD_TIMEBASE_PORT, BOARD_TIMEBASE_ECU_CH)) >= 0)
+        {
+            TIM_EnableInterrupts(BOARD_TIMEBASE_PORT, TIMEBASE_ECU_INT, false);
+            timebase_ecu_cb();
+        }
+    }
+}
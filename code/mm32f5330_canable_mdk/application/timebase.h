@@ -0,0 +1,26 @@
+#ifndef _TIMEBASE_H
+#define _TIMEBASE_H
+
+#include "stdint.h"
+
+// Resolution of the free-running counter
+#define TIMEBASE_TICK_HZ    1000000u
+
+// Prototypes
+void timebase_init(void);
+uint32_t timebase_us(void);
+void timebase_alarm_set(uint32_t at_us);
+void timebase_alarm_cancel(void);
+void timebase_wakeup_set(uint32_t at_us);
+void timebase_stmin_set(uint32_t at_us);
+void timebase_stmin_cancel(void);
+void timebase_ecu_set(uint32_t at_us);
+void timebase_ecu_cancel(void);
+
+// Called from the timer interrupt when the alarm times are reached
+void timebase_alarm_cb(void);
+void timebase_wakeup_cb(void);
+void timebase_stmin_cb(void);
+void timebase_ecu_cb(void);
+
+#endif // _TIMEBASE_H
@@ -19,13 +19,14 @@ tusb_desc_device_t const desc_device =
   .bLength            = sizeof(tusb_desc_device_t),
   .bDescriptorType    = TUSB_DESC_DEVICE,
   .bcdUSB             = USB_BCD,
-  .bDeviceClass       = 0x02,
-  .bDeviceSubClass    = 0x02,
-  .bDeviceProtocol    = 0x00,
+  // Composite device of a CDC ACM function and a CDC ACM or NCM one, each grouped by an IAD
+  .bDeviceClass       = TUSB_CLASS_MISC,
+  .bDeviceSubClass    = MISC_SUBCLASS_COMMON,
+  .bDeviceProtocol    = MISC_PROTOCOL_IAD,
   .bMaxPacketSize0    = CFG_TUD_ENDPOINT0_SIZE,
   .idVendor           = USB_VID,
   .idProduct          = USB_PID,
-  .bcdDevice          = 0x0110,
+  .bcdDevice          = 0x0121,
   .iManufacturer      = 0x01,
   .iProduct           = 0x02,
   .iSerialNumber      = 0x03,
@@ -47,14 +48,34 @@ enum
 {
   ITF_NUM_CDC = 0,
   ITF_NUM_CDC_DATA,
+#if CFG_TUD_NCM
+  ITF_NUM_NET,
+  ITF_NUM_NET_DATA,
+#else
+  ITF_NUM_DIAG,
+  ITF_NUM_DIAG_DATA,
+#endif
   ITF_NUM_TOTAL
 };
 
+// slcan
 #define EPNUM_CDC_NOTIF   0x81
 #define EPNUM_CDC_OUT     0x02
 #define EPNUM_CDC_IN      0x83
 
-#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN)
+// Diagnostics console, or the CAN over UDP network function in its place
+#define EPNUM_DIAG_NOTIF  0x84
+#define EPNUM_DIAG_OUT    0x05
+#define EPNUM_DIAG_IN     0x86
+
+#define EPNUM_NET_NOTIF   0x84
+#define EPNUM_NET_OUT     0x05
+#define EPNUM_NET_IN      0x86
+
+// String index of the host side MAC address
+#define STRID_MAC         7
+
+#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + CFG_TUD_CDC * TUD_CDC_DESC_LEN + CFG_TUD_NCM * TUD_CDC_NCM_DESC_LEN)
 
 // full speed configuration
 uint8_t const desc_fs_configuration[] =
@@ -63,9 +84,19 @@ uint8_t const desc_fs_configuration[] =
   TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 4, CONFIG_TOTAL_LEN, 0x00, 100),
 
   // Interface number, string index, EP notification address and size, EP data address (out, in) and size.
-  TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 5, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN, 64),
+  TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 5, EPNUM_CDC_NOTIF, 16, EPNUM_CDC_OUT, EPNUM_CDC_IN, 64),
+#if CFG_TUD_NCM
+  // Interface number, string index, MAC string index, EP notification address and size,
+  // EP data address (out, in) and size, max segment size.
+  TUD_CDC_NCM_DESCRIPTOR(ITF_NUM_NET, 6, STRID_MAC, EPNUM_NET_NOTIF, 16, EPNUM_NET_OUT, EPNUM_NET_IN, 64, CFG_TUD_NET_MTU),
+#else
+  TUD_CDC_DESCRIPTOR(ITF_NUM_DIAG, 6, EPNUM_DIAG_NOTIF, 8, EPNUM_DIAG_OUT, EPNUM_DIAG_IN, 64),
+#endif
 };
 
+TU_VERIFY_STATIC(sizeof(desc_fs_configuration) == CONFIG_TOTAL_LEN, "configuration descriptor length");
+TU_VERIFY_STATIC(ITF_NUM_TOTAL == 2 * (CFG_TUD_CDC + CFG_TUD_NCM), "two interfaces per function");
+
 // Invoked when received GET CONFIGURATION DESCRIPTOR
 // Application return pointer to descriptor
 // Descriptor contents must exist long enough for transfer to complete
@@ -86,8 +117,14 @@ char const* string_desc_arr [] =
   "MindMotion",                  // 1: Manufacturer
   "CANable",                     // 2: Product
   "123456",                      // 3: Serials, should use chip ID
-  "CDC Config"                   // 4: CDC Config
+  "CDC Config",                  // 4: CDC Config
   "CDC Interface",               // 5: CDC Interface
+#if CFG_TUD_NCM
+  "CAN over UDP",                // 6: Network function
+  NULL,                          // 7: MAC address, built from tud_network_mac_address
+#else
+  "Diagnostics",                 // 6: Diagnostics console
+#endif
 };
 
 static uint16_t _desc_str[32];
@@ -111,6 +148,21 @@ uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid)
 
     if ( !(index < sizeof(string_desc_arr)/sizeof(string_desc_arr[0])) ) return NULL;
 
+#if CFG_TUD_NCM
+    if ( index == STRID_MAC )
+    {
+      // Twelve hex digits, the address the host uses on its end of the link
+      chr_count = 0;
+      for(uint8_t i=0; i<sizeof(tud_network_mac_address); i++)
+      {
+        _desc_str[1+chr_count++] = "0123456789ABCDEF"[(tud_network_mac_address[i] >> 4) & 0xf];
+        _desc_str[1+chr_count++] = "0123456789ABCDEF"[tud_network_mac_address[i] & 0xf];
+      }
+      _desc_str[0] = (TUSB_DESC_STRING << 8 ) | (2*chr_count + 2);
+      return _desc_str;
+    }
+#endif
+
     const char* str = string_desc_arr[index];
 
     // Cap at max char
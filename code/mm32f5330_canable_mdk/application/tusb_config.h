@@ -78,16 +78,43 @@
 #define CFG_TUD_ENDPOINT0_SIZE    64
 #endif
 
+// Endpoint numbers the stack accepts. CFG_TUSB_MCU has no MM32F5 value
+// and its default limit of 5 would refuse the second function's
+// endpoints 4 to 6; the controller has 16 (USB_BDT_EP_NUM)
+#define CFG_TUD_ENDPPOINT_MAX     16
+
 //------------- CLASS -------------//
-#define CFG_TUD_CDC              1
+#include "mem_plan.h"
+
+#define CFG_TUD_CDC              MEM_CDC_INTERFACES
 #define CFG_TUD_MSC              0
 #define CFG_TUD_HID              0
 #define CFG_TUD_MIDI             0
 #define CFG_TUD_VENDOR           0
+#define CFG_TUD_NCM              APP_NCM_ENABLE
+
+// Depth of the device event queue, 12 bytes per event. tud_task() drains
+// it at the end of every USB interrupt; slcan 'G' reports the deepest
+// fill seen and any events dropped, size it from those under load
+#ifndef CFG_TUD_TASK_QUEUE_SZ
+#define CFG_TUD_TASK_QUEUE_SZ    16
+#endif
+
+// CDC FIFO size of TX and RX, from the RAM plan
+#define CFG_TUD_CDC_RX_BUFSIZE   MEM_CDC_RX_BUFSIZE
+#define CFG_TUD_CDC_TX_BUFSIZE   MEM_CDC_TX_BUFSIZE
+
+// Lines already queued for the host survive a bus reset, the frames
+// behind them wait in the suspend ring until the port is opened again
+#define CFG_TUD_CDC_PERSISTENT_TX 1
+
+// Poll the notification endpoint every frame, bus state changes are
+// reported on it
+#define CFG_TUD_CDC_NOTIF_INTERVAL 1
 
-// CDC FIFO size of TX and RX
-#define CFG_TUD_CDC_RX_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 64)
-#define CFG_TUD_CDC_TX_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 64)
+// NCM transfer blocks, from the RAM plan
+#define CFG_TUD_NCM_IN_NTB_MAX_SIZE   MEM_NCM_IN_NTB
+#define CFG_TUD_NCM_OUT_NTB_MAX_SIZE  MEM_NCM_OUT_NTB
 
 // CDC Endpoint transfer buffer size, more is faster
 #define CFG_TUD_CDC_EP_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 64)
@@ -31,9 +31,21 @@
 #define BOARD_USB_IRQn                  USB_FS_IRQn
 #define BOARD_USB_IRQHandler            USB_FS_IRQHandler
 
+/* TIMEBASE. 32-bit timer, APB1 timers run at twice the APB1 clock. */
+#define BOARD_TIMEBASE_PORT             ((TIM_Type *)TIM2)
+#define BOARD_TIMEBASE_FREQ             (CLOCK_APB1_FREQ * 2u)
+#define BOARD_TIMEBASE_IRQn             TIM2_IRQn
+#define BOARD_TIMEBASE_IRQHandler       TIM2_IRQHandler
+#define BOARD_TIMEBASE_ALARM_CH         TIM_CHN_1 /* Compare channel waking up scheduled transmissions. */
+#define BOARD_TIMEBASE_WAKEUP_CH        TIM_CHN_2 /* Compare channel ending the USB remote wakeup signalling. */
+#define BOARD_TIMEBASE_STMIN_CH         TIM_CHN_3 /* Compare channel loading ISO-TP consecutive frames STmin apart. */
+#define BOARD_TIMEBASE_ECU_CH           TIM_CHN_4 /* Compare channel sending delayed responses of the ECU simulation. */
+
 /* FLEXCAN. */
 #define BOARD_FLEXCAN_PORT              FLEXCAN1
 #define BOARD_FLEXCAN_CLOCK_FREQ        CLOCK_PLL1_FREQ
+#define BOARD_FLEXCAN_IRQn              FlexCAN1_IRQn
+#define BOARD_FLEXCAN_IRQHandler        FlexCAN1_IRQHandler
 #define BOARD_FLEXCAN_RX_MB_CH          0u
 #define BOARD_FLEXCAN_TX_MB_CH          15u
 #define BOARD_FLEXCAN_RX_MB_INT         FLEXCAN_INT_MB_0
@@ -41,6 +53,13 @@
 #define BOARD_FLEXCAN_RX_MB_STATUS      FLEXCAN_STATUS_MB_0
 #define BOARD_FLEXCAN_TX_MB_STATUS      FLEXCAN_STATUS_MB_15
 #define BOARD_FLEXCAN_RXFIFO_AVAIl_STATUS FLEXCAN_STATUS_MB_5
+#define BOARD_FLEXCAN_RXFIFO_OVERFLOW_STATUS FLEXCAN_STATUS_MB_7
+#define BOARD_FLEXCAN_RXFIFO_AVAIL_INT  FLEXCAN_INT_MB_5 /* Rx fifo frame available, drained by the flexcan interrupt. */
+#define BOARD_FLEXCAN_REMOTE_MB_FIRST   8u  /* Mbs after the rx fifo and its filters answer remote frames. */
+#define BOARD_FLEXCAN_REMOTE_MB_LAST    11u
+#define BOARD_FLEXCAN_ISOTP_TX_MB_CH    12u /* Tx mb for ISO-TP segments, loaded from the timebase stmin compare. */
+#define BOARD_FLEXCAN_SCHED_TX_MB_CH    13u /* Tx mb loaded from the timebase alarm for scheduled frames. */
+#define BOARD_FLEXCAN_ECU_TX_MB_CH      14u /* Tx mb for responses of the ECU simulation, bypassing the tx queue. */
 
 /* FLEXCAN Bit-timing under PLL1 clok. */
 #define BOARD_FLEXCAN_PHASEGLEN1        5u
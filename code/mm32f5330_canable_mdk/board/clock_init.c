@@ -30,6 +30,10 @@ void BOARD_InitBootClocks(void)
     RCC_EnableAPB1Periphs(RCC_APB1_PERIPH_FLEXCAN1, true);
     RCC_ResetAPB1Periphs(RCC_APB1_PERIPH_FLEXCAN1);
 
+    /* TIM2. */
+    RCC_EnableAPB1Periphs(RCC_APB1_PERIPH_TIM2, true);
+    RCC_ResetAPB1Periphs(RCC_APB1_PERIPH_TIM2);
+
     /* GPIOA. */
     RCC_EnableAHB1Periphs(RCC_AHB1_PERIPH_GPIOA, true);
     RCC_ResetAHB1Periphs(RCC_AHB1_PERIPH_GPIOA);
@@ -10,13 +10,33 @@
 #include "board_init.h"
 
 #include "tusb.h"
+#include "profile.h"
+#include "timebase.h"
+#include "latency.h"
 
 /* OTG_FS BufferDescriptorTable Buffer. */
 static __ALIGNED(512u) USB_BufDespTable_Type usb_bd_tbl = {0u}; /* usb_bufdesp_table */
-static uint8_t usb_ep0_buffer[CFG_TUD_ENDPOINT0_SIZE] = {0u};   /* usb_recv_buff. */
-static uint8_t usb_setup_buff[8u] = {0u};       /* usb_setup_buff. */
+static __ALIGNED(4u) uint8_t usb_ep0_buffer[CFG_TUD_ENDPOINT0_SIZE] = {0u};   /* usb_recv_buff. */
+static __ALIGNED(4u) uint8_t usb_setup_buff[8u] = {0u};       /* usb_setup_buff. */
 static uint8_t usb_device_addr = 0u;            /* usb_device_addr. */
 
+/* Bulk endpoints keep both the even and the odd BD armed, using packet buffers of their own. */
+#define USB_PINGPONG_NUM        (2u * CFG_TUD_CDC) /* bulk IN and OUT of every CDC interface. */
+#define USB_PINGPONG_PACKET     64u
+
+#define USB_RESUME_SIGNAL_US    10000u /* remote wakeup resume signalling time. */
+
+typedef struct
+{
+    uint8_t  buf[USB_BDT_BUF_NUM][USB_PINGPONG_PACKET]; /* packet of the even and the odd BD. */
+    uint16_t len[USB_BDT_BUF_NUM];      /* OUT: size of the packet received. */
+    bool     full[USB_BDT_BUF_NUM];     /* OUT: packet waits for tinyusb. IN: BD is armed. */
+    bool     data_n[USB_BDT_BUF_NUM];   /* DATA0 or DATA1 of the packets in this BD. */
+    uint8_t  head;                      /* OUT: BD to be consumed next. */
+    uint8_t  tail;                      /* IN: BD to be armed next. */
+    bool     used;
+} USB_PingPong_Type;
+
 typedef struct
 {
     uint8_t * xfer_buf;
@@ -26,9 +46,138 @@ typedef struct
     bool  odd_even;          /* EndPoint BD OddEven status. */
     bool  data_n;            /* next packet is DATA0 or DATA1. */
     bool  xfer_done;
+    bool  xfer_busy;         /* ping-pong EndPoint: tinyusb xfer not completed yet. */
+    USB_PingPong_Type * pp;  /* ping-pong buffers, NULL if the EndPoint arms one BD per packet. */
 } USB_EndPointManage_Type;
 
 static USB_EndPointManage_Type usb_epmng_tbl[16u][2u] = {0u}; /* EndPoint Manage Table. */
+static __ALIGNED(4u) USB_PingPong_Type usb_pp_tbl[USB_PINGPONG_NUM] = {0u};
+
+/* Copy packet data, a word at a time when both buffers are word aligned; tinyusb and
+ * the packet buffers here always are, so only odd sized tails go byte by byte. */
+static void USB_CopyPacket(uint8_t * dst, const uint8_t * src, uint32_t len)
+{
+    if (0u == (((uint32_t)dst | (uint32_t)src) & 3u))
+    {
+        uint32_t       * dst32 = (uint32_t *)dst;
+        const uint32_t * src32 = (const uint32_t *)src;
+        for (; len >= 4u; len -= 4u)
+        {
+            *dst32++ = *src32++;
+        }
+        dst = (uint8_t *)dst32;
+        src = (const uint8_t *)src32;
+    }
+    while (len--)
+    {
+        *dst++ = *src++;
+    }
+}
+
+/* Keep the BDs of a ping-pong OUT EndPoint armed and hand finished packets to tinyusb.
+ * A transfer ends with a short packet or when its buffer is full. */
+static void USB_PingPong_Out(uint8_t rhport, uint32_t ep_index)
+{
+    USB_EndPointManage_Type * epm = &usb_epmng_tbl[ep_index][USB_Direction_OUT];
+    USB_PingPong_Type * pp = epm->pp;
+
+    while (epm->xfer_busy && pp->full[pp->head])
+    {
+        uint32_t slot = pp->head;
+        uint32_t size = pp->len[slot];
+        if (size > epm->remaining) /* host sent more than asked for, the rest is lost. */
+        {
+            size = epm->remaining;
+        }
+        USB_CopyPacket(epm->xfer_buf + (epm->length - epm->remaining), pp->buf[slot], size);
+        epm->remaining -= size;
+
+        /* the BD takes the next packet of the same DATA0/1 as soon as it is emptied. */
+        pp->full[slot] = false;
+        pp->head = slot ^ 1u;
+        USB_BufDesp_Xfer(&usb_bd_tbl.Table[ep_index][USB_Direction_OUT][slot], pp->data_n[slot], pp->buf[slot], epm->max_packet_size);
+
+        if (0u == epm->remaining || pp->len[slot] < epm->max_packet_size)
+        {
+            epm->xfer_busy = false;
+            dcd_event_xfer_complete(rhport, ep_index, epm->length - epm->remaining, XFER_RESULT_SUCCESS, true);
+        }
+    }
+}
+
+/* Copy the pending transfer of a ping-pong IN EndPoint into free BDs. The transfer
+ * completes for tinyusb once its last packet is armed, so the next one can fill the other BD. */
+static void USB_PingPong_In(uint8_t rhport, uint32_t ep_index)
+{
+    USB_EndPointManage_Type * epm = &usb_epmng_tbl[ep_index][USB_Direction_IN];
+    USB_PingPong_Type * pp = epm->pp;
+
+    while (epm->xfer_busy && !pp->full[pp->tail])
+    {
+        uint32_t slot = pp->tail;
+        uint32_t size = epm->remaining;
+        if (size > epm->max_packet_size)
+        {
+            size = epm->max_packet_size;
+        }
+        USB_CopyPacket(pp->buf[slot], epm->xfer_buf + (epm->length - epm->remaining), size);
+        epm->remaining -= size;
+
+        pp->full[slot] = true;
+        pp->tail = slot ^ 1u;
+        USB_BufDesp_Xfer(&usb_bd_tbl.Table[ep_index][USB_Direction_IN][slot], pp->data_n[slot], pp->buf[slot], size);
+
+        if (0u == epm->remaining) /* a zero length transfer sends one empty packet. */
+        {
+            epm->xfer_busy = false;
+            dcd_event_xfer_complete(rhport, ep_index | TUSB_DIR_IN_MASK, epm->length, XFER_RESULT_SUCCESS, true);
+        }
+    }
+}
+
+/* Restart the data toggle at DATA0 with the BD the SIE uses next, and (re)arm the BDs
+ * which hold no packet. Only called while the EndPoint is disabled or halted. */
+static void USB_PingPong_Start(uint32_t ep_index, USB_Direction_Type ep_dir)
+{
+    USB_EndPointManage_Type * epm = &usb_epmng_tbl[ep_index][ep_dir];
+    USB_PingPong_Type * pp = epm->pp;
+    uint32_t next = epm->odd_even;
+
+    pp->data_n[next] = false;
+    pp->data_n[next ^ 1u] = true;
+    for (uint32_t slot = 0u; slot < USB_BDT_BUF_NUM; slot++)
+    {
+        USB_BufDesp_Type * bd = &usb_bd_tbl.Table[ep_index][ep_dir][slot];
+        if (USB_Direction_OUT == ep_dir && !pp->full[slot])
+        {
+            USB_BufDesp_Reset(bd);
+            USB_BufDesp_Xfer(bd, pp->data_n[slot], pp->buf[slot], epm->max_packet_size);
+        }
+        else if (USB_Direction_IN == ep_dir && pp->full[slot])
+        {
+            uint32_t size = USB_BufDesp_GetPacketSize(bd);
+            USB_BufDesp_Reset(bd);
+            USB_BufDesp_Xfer(bd, pp->data_n[slot], pp->buf[slot], size);
+        }
+    }
+}
+
+/* Give back the ping-pong buffers of an EndPoint. Its BDs are disarmed first, the SIE must
+ * not take packets into buffers the next EndPoint opened will own. */
+static void USB_PingPong_Release(uint32_t ep_index)
+{
+    for (uint32_t dir = 0u; dir < USB_BDT_DIRECTION_NUM; dir++)
+    {
+        if (NULL != usb_epmng_tbl[ep_index][dir].pp)
+        {
+            USB_BufDesp_Reset(&usb_bd_tbl.Table[ep_index][dir][USB_BufDesp_OddEven_Even]);
+            USB_BufDesp_Reset(&usb_bd_tbl.Table[ep_index][dir][USB_BufDesp_OddEven_Odd]);
+            usb_epmng_tbl[ep_index][dir].pp->used = false;
+            usb_epmng_tbl[ep_index][dir].pp = NULL;
+        }
+        usb_epmng_tbl[ep_index][dir].xfer_busy = false;
+    }
+}
 
 void USB_BusResetHandler(void)
 {
@@ -43,6 +192,10 @@ void USB_BusResetHandler(void)
         usb_epmng_tbl[i][USB_Direction_IN] = epm;
         usb_epmng_tbl[i][USB_Direction_OUT] = epm;
     }
+    for (uint32_t i = 0u; i < USB_PINGPONG_NUM; i++)
+    {
+        usb_pp_tbl[i].used = false;
+    }
 
     USB_EnableEndPoint(BOARD_USB_PORT, 0u, USB_EndPointMode_Control, true); /* enable EP0. */
     epm.max_packet_size = CFG_TUD_ENDPOINT0_SIZE;
@@ -68,15 +221,13 @@ void USB_TokenDoneHandler(uint8_t rhport) /* roothub port. */
     USB_BufDesp_Reset(bd);
     usb_epmng_tbl[ep_index][ep_dir].odd_even = !odd; /* toggle the bd odd_even flag. */
     USB_ClearInterruptStatus(BOARD_USB_PORT, USB_INT_TOKENDONE);/* clear interrupt status. */
+    LATENCY_USB_TOKEN(ep_index | ((USB_Direction_IN == ep_dir) ? TUSB_DIR_IN_MASK : 0u), size);
 
     if (0u == ep_index && USB_Direction_OUT == ep_dir ) /* ep0_out include setup packet & out_packet, need to special treatment */
     {
         if (USB_TokenPid_SETUP == token) /* setup packet. */
         {
-            for (uint32_t i = 0; i < 8u; i++)
-            {
-                usb_setup_buff[i] = usb_ep0_buffer[i];
-            }
+            USB_CopyPacket(usb_setup_buff, usb_ep0_buffer, sizeof(usb_setup_buff));
             dcd_event_setup_received(rhport, addr, true);
             USB_EnableSuspend(BOARD_USB_PORT, false);
             usb_epmng_tbl[0u][USB_Direction_IN].data_n = true; /* next in packet is DATA1 packet. */
@@ -91,10 +242,7 @@ void USB_TokenDoneHandler(uint8_t rhport) /* roothub port. */
                 USB_BufDesp_Xfer(&usb_bd_tbl.Table[0u][USB_Direction_OUT][!odd], 1u, usb_ep0_buffer, sizeof(usb_ep0_buffer));
                 return;
             }
-            for (uint32_t i = 0; i < size; i++)
-            {
-                usb_epmng_tbl[0u][USB_Direction_OUT].xfer_buf[i] = usb_ep0_buffer[i];
-            }
+            USB_CopyPacket(usb_epmng_tbl[0u][USB_Direction_OUT].xfer_buf, usb_ep0_buffer, size);
             dcd_event_xfer_complete(rhport, 0u, size, XFER_RESULT_SUCCESS, true);
             USB_BufDesp_Xfer(&usb_bd_tbl.Table[0u][USB_Direction_OUT][!odd], 1u, usb_ep0_buffer, sizeof(usb_ep0_buffer));
         }
@@ -104,6 +252,23 @@ void USB_TokenDoneHandler(uint8_t rhport) /* roothub port. */
         return;
     }
 
+    if (NULL != usb_epmng_tbl[ep_index][ep_dir].pp) /* ping-pong EndPoint, the BD just finished is armed again. */
+    {
+        USB_PingPong_Type * pp = usb_epmng_tbl[ep_index][ep_dir].pp;
+        if (USB_Direction_OUT == ep_dir)
+        {
+            pp->len[odd] = size;
+            pp->full[odd] = true;
+            USB_PingPong_Out(rhport, ep_index);
+        }
+        else
+        {
+            pp->full[odd] = false;
+            USB_PingPong_In(rhport, ep_index);
+        }
+        return;
+    }
+
     /* xfer next packet if data length more than max_packet_size when start xfer data. */
     uint16_t max_packet_size = usb_epmng_tbl[ep_index][ep_dir].max_packet_size;
     uint16_t          length = usb_epmng_tbl[ep_index][ep_dir].length;
@@ -167,6 +332,7 @@ void dcd_int_handler(uint8_t rhport)
     if (flag & USB_INT_TOKENDONE)
     {
         USB_TokenDoneHandler(rhport);
+        tud_task(); /* let the class drivers queue the next transfer while the other BD is busy. */
         return;
     }
 
@@ -174,6 +340,7 @@ void dcd_int_handler(uint8_t rhport)
     {
         USB_ClearInterruptStatus(BOARD_USB_PORT, USB_INT_RESET);
         USB_BusResetHandler();
+        LATENCY_USB_RESET();
 
         dcd_event_bus_reset(rhport, TUSB_SPEED_FULL, true);
     }
@@ -242,12 +409,14 @@ void dcd_set_address(uint8_t rhport, uint8_t dev_addr)
 void dcd_remote_wakeup(uint8_t rhport)
 {
     (void) rhport;
+    /* drive resume for 10ms (1ms to 15ms allowed), the timebase ends it. */
     USB_EnableResumeSignal(BOARD_USB_PORT, true);
-    uint32_t i = CLOCK_SYS_FREQ / 100; /* 10ms. */
-    while(i--)
-    {
-        __NOP();
-    }
+    timebase_wakeup_set(timebase_us() + USB_RESUME_SIGNAL_US);
+}
+
+/* resume signalling of a remote wakeup is over, the host takes over driving resume. */
+void timebase_wakeup_cb(void)
+{
     USB_EnableResumeSignal(BOARD_USB_PORT, false);
 }
 
@@ -298,6 +467,26 @@ bool dcd_edpt_open            (uint8_t rhport, tusb_desc_endpoint_t const * desc
     }
 
     usb_epmng_tbl[ep_index][ep_dir].max_packet_size = desc_ep->wMaxPacketSize;
+    usb_epmng_tbl[ep_index][ep_dir].xfer_busy = false;
+
+    /* bulk EndPoints small enough get ping-pong buffers, OUT ones accept packets right away. */
+    if (USB_EndPointMode_Bulk == ep_mode && desc_ep->wMaxPacketSize <= USB_PINGPONG_PACKET)
+    {
+        for (uint32_t i = 0u; i < USB_PINGPONG_NUM; i++)
+        {
+            if (!usb_pp_tbl[i].used)
+            {
+                usb_pp_tbl[i].used = true;
+                usb_pp_tbl[i].full[0u] = false;
+                usb_pp_tbl[i].full[1u] = false;
+                usb_pp_tbl[i].head = usb_epmng_tbl[ep_index][ep_dir].odd_even;
+                usb_pp_tbl[i].tail = usb_epmng_tbl[ep_index][ep_dir].odd_even;
+                usb_epmng_tbl[ep_index][ep_dir].pp = &usb_pp_tbl[i];
+                USB_PingPong_Start(ep_index, ep_dir);
+                break;
+            }
+        }
+    }
 
     USB_EnableEndPoint(BOARD_USB_PORT, ep_index, ep_mode, true);/* enable EPx. */
     return true;
@@ -315,6 +504,7 @@ void dcd_edpt_close_all       (uint8_t rhport)
         usb_epmng_tbl[i][USB_Direction_IN ].remaining       = 0;
         usb_epmng_tbl[i][USB_Direction_OUT].max_packet_size = 0;
         usb_epmng_tbl[i][USB_Direction_OUT].remaining       = 0;
+        USB_PingPong_Release(i);
     }
 }
 
@@ -328,6 +518,7 @@ void dcd_edpt_close           (uint8_t rhport, uint8_t ep_addr)
     usb_epmng_tbl[ep_addr & 0x0fu][USB_Direction_OUT].max_packet_size = 0;
     usb_epmng_tbl[ep_addr & 0x0fu][USB_Direction_OUT].remaining       = 0;
     USB_EnableEndPoint(BOARD_USB_PORT, ep_addr & 0x0fu, USB_EndPointMode_NULL, false);
+    USB_PingPong_Release(ep_addr & 0x0fu);
 }
 
 // Submit a transfer, When complete dcd_event_xfer_complete() is invoked to notify the stack
@@ -340,14 +531,12 @@ bool dcd_edpt_xfer            (uint8_t rhport, uint8_t ep_addr, uint8_t * buffer
     uint32_t    max_packet_size = usb_epmng_tbl[ep_index][ep_dir].max_packet_size;
     uint32_t             data_n = usb_epmng_tbl[ep_index][ep_dir].data_n;
 
+    LATENCY_USB_XFER(ep_addr, total_bytes);
     if (0u == ep_index && ep_dir == USB_Direction_OUT)
     {
         if (true == usb_epmng_tbl[0u][USB_Direction_OUT].xfer_done)
         {
-            for (uint32_t i = 0; i < total_bytes; i++)
-            {
-                buffer[i] = usb_ep0_buffer[i];
-            }
+            USB_CopyPacket(buffer, usb_ep0_buffer, total_bytes);
             dcd_event_xfer_complete(rhport, 0u, total_bytes, XFER_RESULT_SUCCESS, true);
             usb_epmng_tbl[0u][USB_Direction_OUT].xfer_done = false;
         }
@@ -358,6 +547,31 @@ bool dcd_edpt_xfer            (uint8_t rhport, uint8_t ep_addr, uint8_t * buffer
         return true;
     }
 
+    if (NULL != usb_epmng_tbl[ep_index][ep_dir].pp) /* ping-pong EndPoint, served from its own packet buffers. */
+    {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq(); /* the USB interrupt works on the same BDs. */
+        if (usb_epmng_tbl[ep_index][ep_dir].xfer_busy)
+        {
+            __set_PRIMASK(primask);
+            return false;
+        }
+        usb_epmng_tbl[ep_index][ep_dir].xfer_buf  = buffer;
+        usb_epmng_tbl[ep_index][ep_dir].length    = total_bytes;
+        usb_epmng_tbl[ep_index][ep_dir].remaining = total_bytes;
+        usb_epmng_tbl[ep_index][ep_dir].xfer_busy = true;
+        if (USB_Direction_OUT == ep_dir)
+        {
+            USB_PingPong_Out(rhport, ep_index);
+        }
+        else
+        {
+            USB_PingPong_In(rhport, ep_index);
+        }
+        __set_PRIMASK(primask);
+        return true;
+    }
+
     if ( USB_BufDesp_IsBusy(&usb_bd_tbl.Table[ep_index][ep_dir][odd]) ) /* BD.OWN not equal 0, mean BD owner is SIE, BD is busy. */
     {
         return false;
@@ -393,13 +607,40 @@ void dcd_edpt_clear_stall     (uint8_t rhport, uint8_t ep_addr)
 {
     (void) rhport;
     uint32_t ep_index = ep_addr & 0x0fu;
+    USB_Direction_Type ep_dir = (ep_addr & TUSB_DIR_IN_MASK) ? USB_Direction_IN : USB_Direction_OUT;
+    bool armed[USB_BDT_EP_NUM * USB_BDT_DIRECTION_NUM * USB_BDT_BUF_NUM];
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq(); /* the USB interrupt works on the same BDs. */
+    if (NULL != usb_epmng_tbl[ep_index][ep_dir].pp)
+    {
+        USB_PingPong_Start(ep_index, ep_dir); /* BDs are rearmed with the toggle restarted, while still halted. */
+    }
+
+    /* the driver clears the stall of every EndPoint and takes all BDs back from the SIE,
+     * so the BDs armed before are armed again afterwards. */
+    for (uint32_t i = 0u; i < USB_BDT_EP_NUM * USB_BDT_DIRECTION_NUM * USB_BDT_BUF_NUM; i++)
+    {
+        armed[i] = USB_BufDesp_IsBusy(&usb_bd_tbl.Index[i]);
+    }
     USB_EnableEndPointStall(BOARD_USB_PORT, 1u << ep_index, false);
+    for (uint32_t i = 0u; i < USB_BDT_EP_NUM * USB_BDT_DIRECTION_NUM * USB_BDT_BUF_NUM; i++)
+    {
+        USB_BufDesp_Type * bd = &usb_bd_tbl.Index[i];
+        if (armed[i])
+        {
+            USB_BufDesp_Xfer(bd, bd->DATA, (uint8_t *)USB_BufDesp_GetPacketAddr(bd), USB_BufDesp_GetPacketSize(bd));
+        }
+    }
+    __set_PRIMASK(primask);
 }
 
 /* USB IRQ. */
 void BOARD_USB_IRQHandler(void)
 {
+    PROFILE_ENTER(PROFILE_USB_ISR);
     dcd_int_handler(TUD_OPT_RHPORT);
+    PROFILE_EXIT(PROFILE_USB_ISR);
 }
 
 /* EOF. */
@@ -264,7 +264,9 @@ void cdcd_reset(uint8_t rhport)
 
     tu_memclr(p_cdc, ITF_MEM_RESET_SIZE);
     tu_fifo_clear(&p_cdc->rx_ff);
+#if !CFG_TUD_CDC_PERSISTENT_TX
     tu_fifo_clear(&p_cdc->tx_ff);
+#endif
     tu_fifo_set_overwritable(&p_cdc->tx_ff, true);
   }
 }
@@ -431,7 +433,7 @@ bool cdcd_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_
   for (itf = 0; itf < CFG_TUD_CDC; itf++)
   {
     p_cdc = &_cdcd_itf[itf];
-    if ( ( ep_addr == p_cdc->ep_out ) || ( ep_addr == p_cdc->ep_in ) ) break;
+    if ( ( ep_addr == p_cdc->ep_out ) || ( ep_addr == p_cdc->ep_in ) || ( ep_addr == p_cdc->ep_notif ) ) break;
   }
   TU_ASSERT(itf < CFG_TUD_CDC);
 
@@ -42,6 +42,12 @@
   #define CFG_TUD_CDC_EP_BUFSIZE    (TUD_OPT_HIGH_SPEED ? 512 : 64)
 #endif
 
+// Keep the TX FIFO contents over a bus reset, to be sent once the host
+// has enumerated the device again
+#ifndef CFG_TUD_CDC_PERSISTENT_TX
+  #define CFG_TUD_CDC_PERSISTENT_TX 0
+#endif
+
 #ifdef __cplusplus
  extern "C" {
 #endif
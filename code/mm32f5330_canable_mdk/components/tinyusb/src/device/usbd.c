@@ -272,6 +272,9 @@ static uint8_t _usbd_rhport = RHPORT_INVALID;
 OSAL_QUEUE_DEF(usbd_int_set, _usbd_qdef, CFG_TUD_TASK_QUEUE_SZ, dcd_event_t);
 static osal_queue_t _usbd_q;
 
+// Event queue statistics, updated with the USB interrupt masked or from the ISR
+static tud_queue_stats_t _usbd_qstats = { .depth = CFG_TUD_TASK_QUEUE_SZ };
+
 // Mutex for claiming endpoint, only needed when using with preempted RTOS
 #if CFG_TUSB_OS != OPT_OS_NONE
 static osal_mutex_def_t _ubsd_mutexdef;
@@ -1067,6 +1070,48 @@ static bool process_get_descriptor(uint8_t rhport, tusb_control_request_t const
 //--------------------------------------------------------------------+
 // DCD Event Handler
 //--------------------------------------------------------------------+
+
+// Queue an event for usbd task, accounting fill level and drops
+TU_ATTR_FAST_FUNC static void queue_event(dcd_event_t const * event, bool in_isr)
+{
+  // osal_queue_send() masks and unmasks the USB interrupt itself in thread
+  // context, so the statistics take their own masked section afterwards
+  bool const success = osal_queue_send(_usbd_q, event, in_isr);
+
+  if ( !in_isr ) usbd_int_set(false);
+
+  if ( success )
+  {
+    _usbd_qstats.events++;
+#if CFG_TUSB_OS == OPT_OS_NONE
+    uint16_t const count = tu_fifo_count(&_usbd_q->ff);
+    if ( count > _usbd_qstats.high_water ) _usbd_qstats.high_water = count;
+#endif
+  }
+  else
+  {
+    _usbd_qstats.overflows++;
+  }
+
+  if ( !in_isr ) usbd_int_set(true);
+}
+
+void tud_queue_stats(tud_queue_stats_t* stats)
+{
+  usbd_int_set(false);
+  *stats = _usbd_qstats;
+  usbd_int_set(true);
+}
+
+void tud_queue_stats_reset(void)
+{
+  usbd_int_set(false);
+  _usbd_qstats.high_water = 0;
+  _usbd_qstats.events     = 0;
+  _usbd_qstats.overflows  = 0;
+  usbd_int_set(true);
+}
+
 TU_ATTR_FAST_FUNC void dcd_event_handler(dcd_event_t const * event, bool in_isr)
 {
   switch (event->event_id)
@@ -1076,7 +1121,7 @@ TU_ATTR_FAST_FUNC void dcd_event_handler(dcd_event_t const * event, bool in_isr)
       _usbd_dev.addressed  = 0;
       _usbd_dev.cfg_num    = 0;
       _usbd_dev.suspended  = 0;
-      osal_queue_send(_usbd_q, event, in_isr);
+      queue_event(event, in_isr);
     break;
 
     case DCD_EVENT_SUSPEND:
@@ -1087,7 +1132,7 @@ TU_ATTR_FAST_FUNC void dcd_event_handler(dcd_event_t const * event, bool in_isr)
       if ( _usbd_dev.connected )
       {
         _usbd_dev.suspended = 1;
-        osal_queue_send(_usbd_q, event, in_isr);
+        queue_event(event, in_isr);
       }
     break;
 
@@ -1096,7 +1141,7 @@ TU_ATTR_FAST_FUNC void dcd_event_handler(dcd_event_t const * event, bool in_isr)
       if ( _usbd_dev.connected )
       {
         _usbd_dev.suspended = 0;
-        osal_queue_send(_usbd_q, event, in_isr);
+        queue_event(event, in_isr);
       }
     break;
 
@@ -1118,14 +1163,14 @@ TU_ATTR_FAST_FUNC void dcd_event_handler(dcd_event_t const * event, bool in_isr)
         _usbd_dev.suspended = 0;
 
         dcd_event_t const event_resume = { .rhport = event->rhport, .event_id = DCD_EVENT_RESUME };
-        osal_queue_send(_usbd_q, &event_resume, in_isr);
+        queue_event(&event_resume, in_isr);
       }
 
       // skip osal queue for SOF in usbd task
     break;
 
     default:
-      osal_queue_send(_usbd_q, event, in_isr);
+      queue_event(event, in_isr);
     break;
   }
 }
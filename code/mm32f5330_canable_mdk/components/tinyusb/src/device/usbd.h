@@ -88,6 +88,22 @@ bool tud_ready(void)
 // Remote wake up host, only if suspended and enabled by host
 bool tud_remote_wakeup(void);
 
+// Event queue statistics: configured depth, highest fill seen, events
+// queued and events dropped because the queue was full
+typedef struct
+{
+  uint16_t depth;
+  uint16_t high_water;
+  uint32_t events;
+  uint32_t overflows;
+} tud_queue_stats_t;
+
+// Take a copy of the event queue statistics
+void tud_queue_stats(tud_queue_stats_t* stats);
+
+// Clear the high-water mark and the counters
+void tud_queue_stats_reset(void);
+
 // Enable pull-up resistor on D+ D-
 // Return false on unsupported MCUs
 bool tud_disconnect(void);
@@ -208,6 +224,11 @@ TU_ATTR_WEAK bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb
 
 // CDC Descriptor Template
 // Interface number, string index, EP notification address and size, EP data address (out, in) and size.
+// Polling interval (ms) of the CDC notification endpoint
+#ifndef CFG_TUD_CDC_NOTIF_INTERVAL
+#define CFG_TUD_CDC_NOTIF_INTERVAL 16
+#endif
+
 #define TUD_CDC_DESCRIPTOR(_itfnum, _stridx, _ep_notif, _ep_notif_size, _epout, _epin, _epsize) \
   /* Interface Associate */\
   8, TUSB_DESC_INTERFACE_ASSOCIATION, _itfnum, 2, TUSB_CLASS_CDC, CDC_COMM_SUBCLASS_ABSTRACT_CONTROL_MODEL, CDC_COMM_PROTOCOL_NONE, 0,\
@@ -222,7 +243,7 @@ TU_ATTR_WEAK bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb
   /* CDC Union */\
   5, TUSB_DESC_CS_INTERFACE, CDC_FUNC_DESC_UNION, _itfnum, (uint8_t)((_itfnum) + 1),\
   /* Endpoint Notification */\
-  7, TUSB_DESC_ENDPOINT, _ep_notif, TUSB_XFER_INTERRUPT, U16_TO_U8S_LE(_ep_notif_size), 16,\
+  7, TUSB_DESC_ENDPOINT, _ep_notif, TUSB_XFER_INTERRUPT, U16_TO_U8S_LE(_ep_notif_size), CFG_TUD_CDC_NOTIF_INTERVAL,\
   /* CDC Data Interface */\
   9, TUSB_DESC_INTERFACE, (uint8_t)((_itfnum)+1), 0, 2, TUSB_CLASS_CDC_DATA, 0, 0, 0,\
   /* Endpoint Out */\
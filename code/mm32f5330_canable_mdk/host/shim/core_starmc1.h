@@ -0,0 +1,105 @@
+//
+// core_starmc1: Host stand-in for the STAR-MC1 CMSIS core header
+//
+// Provides the subset of the core API used by the application: PRIMASK,
+// BASEPRI, NVIC, SysTick, WFI and the DWT cycle counter. Interrupts are dispatched
+// by host_hw.c, see host_hw.h for the model.
+//
+
+#ifndef _HOST_CORE_STARMC1_H
+#define _HOST_CORE_STARMC1_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define __I     volatile const
+#define __O     volatile
+#define __IO    volatile
+#define __IM    volatile const
+#define __OM    volatile
+#define __IOM   volatile
+
+#ifndef __STATIC_INLINE
+#define __STATIC_INLINE     static inline
+#endif
+#ifndef __ALIGNED
+#define __ALIGNED(x)        __attribute__((aligned(x)))
+#endif
+#ifndef __WEAK
+#define __WEAK              __attribute__((weak))
+#endif
+#ifndef __PACKED
+#define __PACKED            __attribute__((packed))
+#endif
+#ifndef __INLINE
+#define __INLINE            inline
+#endif
+#ifndef __ASM
+#define __ASM               __asm
+#endif
+
+// PRIMASK, see host_hw.c
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+void __disable_irq(void);
+void __enable_irq(void);
+
+// BASEPRI, in the same left-aligned form as on the target
+uint32_t __get_BASEPRI(void);
+void __set_BASEPRI(uint32_t basepri);
+
+// Waits for the next interrupt: advances virtual time to the next event,
+// or sleeps until it in real-time mode
+void __WFI(void);
+
+#define __NOP()     do { } while (0)
+#define __DSB()     __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define __ISB()     __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define __DMB()     __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define __CLZ(x)    ((uint8_t)(((x) == 0u) ? 32u : (uint32_t)__builtin_clz(x)))
+#define __REV(x)    __builtin_bswap32(x)
+
+// NVIC
+void NVIC_EnableIRQ(IRQn_Type irqn);
+void NVIC_DisableIRQ(IRQn_Type irqn);
+void NVIC_SetPendingIRQ(IRQn_Type irqn);
+void NVIC_ClearPendingIRQ(IRQn_Type irqn);
+uint32_t NVIC_GetPendingIRQ(IRQn_Type irqn);
+uint32_t NVIC_GetEnableIRQ(IRQn_Type irqn);
+void NVIC_SetPriority(IRQn_Type irqn, uint32_t priority);
+
+// SysTick, always 1 kHz on the host whatever the reload value
+uint32_t SysTick_Config(uint32_t ticks);
+
+// Cycle counter, running at CLOCK_SYS_FREQ from the host clock
+typedef struct
+{
+    __IO uint32_t CTRL;
+    __IO uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct
+{
+    __IO uint32_t DEMCR;
+} DCB_Type;
+
+#define DWT_CTRL_CYCCNTENA_Msk  (1u << 0)
+#define DCB_DEMCR_TRCENA_Msk    (1u << 24)
+
+extern DWT_Type host_dwt;
+extern DCB_Type host_dcb;
+#define DWT     (&host_dwt)
+#define DCB     (&host_dcb)
+
+// Monotonic cycle count at CLOCK_SYS_FREQ, stands in for DWT->CYCCNT
+uint32_t host_cycles(void);
+#define PROFILE_CYCLES()    host_cycles()
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _HOST_CORE_STARMC1_H
@@ -0,0 +1,44 @@
+//
+// hal_device_registers: Host build of the device register header
+//
+// Pulls in the real register definitions, then points the peripherals the
+// application touches at register images in host memory. host_hw.c and
+// host_flexcan.c give them their behaviour.
+//
+
+#ifndef __HAL_DEVICE_REGISTER_H__
+#define __HAL_DEVICE_REGISTER_H__
+
+#include "mm32f5333d.h"
+#include "mm32f5333d_features.h"
+#include "system_mm32f5333d.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern FLEXCAN_Type host_flexcan1;
+extern TIM_Type host_tim2;
+extern GPIO_Type host_gpioa;
+extern GPIO_Type host_gpiob;
+extern FLASH_Type host_flash;
+extern USB_Type host_usb;
+
+#ifdef __cplusplus
+}
+#endif
+
+#undef FLEXCAN1
+#undef TIM2
+#undef GPIOA
+#undef GPIOB
+#undef FLASH
+#undef USB
+#define FLEXCAN1    (&host_flexcan1)
+#define TIM2        ((TIM2_Type *)&host_tim2)
+#define GPIOA       (&host_gpioa)
+#define GPIOB       (&host_gpiob)
+#define FLASH       (&host_flash)
+#define USB         (&host_usb)
+
+#endif /* __HAL_DEVICE_REGISTER_H__ */
@@ -0,0 +1,471 @@
+//
+// host_flexcan: FlexCAN driver API on a behavioural controller model
+//
+// The mailbox registers are kept in host_flexcan1 exactly as the driver
+// would leave them, so code reading MB[n].CS directly sees the codes it
+// expects. See host_hw.h for what the model covers.
+//
+
+#include <string.h>
+#include "hal_flexcan.h"
+#include "host_hw.h"
+
+FLEXCAN_Type host_flexcan1;
+
+// Private variables
+static host_can_frame_t fifo[HOST_CAN_FIFO_DEPTH];
+static uint32_t fifo_head;
+static uint32_t fifo_count;
+static bool fifo_overflow;
+static uint32_t iflag;
+
+static host_can_frame_t tx_log[HOST_CAN_TX_LOG];
+static uint32_t tx_head;
+static uint32_t tx_count;
+
+static bool enabled;
+static uint64_t enabled_us;
+static bool hold_tx;
+static FLEXCAN_WorkMode_Type work_mode;
+static bool self_reception;
+static FLEXCAN_RxFifoMaskConf_Type fifo_mask;
+static uint32_t fifo_filter;
+
+uint64_t host_hw_now_us(void);
+
+#define HOST_FIFO_AVAIL     (1u << 5)
+#define HOST_FIFO_OVERFLOW  (1u << 7)
+
+
+static uint32_t mb_code(uint32_t channel)
+{
+    return (host_flexcan1.MB[channel].CS & FLEXCAN_CS_CODE_MASK) >> FLEXCAN_CS_CODE_SHIFT;
+}
+
+static void mb_set_code(uint32_t channel, uint32_t code)
+{
+    host_flexcan1.MB[channel].CS = (host_flexcan1.MB[channel].CS & ~FLEXCAN_CS_CODE_MASK) | FLEXCAN_CS_CODE(code);
+}
+
+// Frame image of a transmit mailbox
+static void mb_to_frame(uint32_t channel, host_can_frame_t *frame)
+{
+    uint32_t cs = host_flexcan1.MB[channel].CS;
+    uint32_t words[2] = { host_flexcan1.MB[channel].WORD0, host_flexcan1.MB[channel].WORD1 };
+
+    memset(frame, 0, sizeof(*frame));
+    frame->ext = (cs & FLEXCAN_CS_IDE_MASK) != 0u;
+    frame->rtr = (cs & FLEXCAN_CS_RTR_MASK) != 0u;
+    frame->dlc = (cs & FLEXCAN_CS_DLC_MASK) >> FLEXCAN_CS_DLC_SHIFT;
+    frame->id = frame->ext ? (host_flexcan1.MB[channel].ID & 0x1FFFFFFFu)
+                           : ((host_flexcan1.MB[channel].ID & FLEXCAN_ID_STD_MASK) >> FLEXCAN_ID_STD_SHIFT);
+    // Byte i of the payload sits at byte (i ^ 3) of the little-endian words
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        frame->data[i] = ((const uint8_t *)words)[i ^ 3u];
+    }
+    frame->mb = (uint8_t)channel;
+    frame->time_us = host_hw_now_us();
+}
+
+static bool fifo_accepts(const host_can_frame_t *frame)
+{
+    uint32_t mask = fifo_mask.RxIdA;
+    uint32_t elem = fifo_filter;
+
+    if (mask == 0u)
+    {
+        return true;
+    }
+
+    // Filter element format A and the mask in extended layout
+    uint32_t id = frame->ext ? frame->id : (frame->id << 18);
+    uint32_t want = (elem & (1u << 30)) ? ((elem >> 1) & 0x1FFFFFFFu) : (((elem >> 19) & 0x7FFu) << 18);
+    bool want_ext = (elem & (1u << 30)) != 0u;
+
+    if (fifo_mask.MbFormat == FLEXCAN_MbFormat_Extended && want_ext != (frame->ext != 0))
+    {
+        return false;
+    }
+    return ((id ^ want) & mask) == 0u;
+}
+
+// The FIFO interrupt is level triggered on frames available
+static void fifo_irq(void)
+{
+    if (fifo_count && (host_flexcan1.IMASK1 & HOST_FIFO_AVAIL))
+    {
+        NVIC_SetPendingIRQ(FlexCAN1_IRQn);
+    }
+}
+
+// Into the RX FIFO, as a frame received from the bus
+static bool fifo_push(const host_can_frame_t *frame)
+{
+    if (!fifo_accepts(frame))
+    {
+        return true;
+    }
+    if (fifo_count >= HOST_CAN_FIFO_DEPTH)
+    {
+        fifo_overflow = true;
+        return false;
+    }
+    fifo[(fifo_head + fifo_count) % HOST_CAN_FIFO_DEPTH] = *frame;
+    fifo_count++;
+    fifo_irq();
+    return true;
+}
+
+static void tx_log_push(const host_can_frame_t *frame)
+{
+    tx_log[(tx_head + tx_count) % HOST_CAN_TX_LOG] = *frame;
+    if (tx_count < HOST_CAN_TX_LOG)
+    {
+        tx_count++;
+    }
+    else
+    {
+        tx_head = (tx_head + 1) % HOST_CAN_TX_LOG;
+    }
+}
+
+// A mailbox wins arbitration: frame on the bus, mailbox back to inactive
+static void mb_transmit(uint32_t channel)
+{
+    host_can_frame_t frame;
+
+    mb_to_frame(channel, &frame);
+    mb_set_code(channel, FLEXCAN_MbCode_TxInactive);
+    iflag |= 1u << channel;
+
+    if (work_mode == FLEXCAN_WorkMode_LoopBack || self_reception)
+    {
+        fifo_push(&frame);
+    }
+    if (work_mode != FLEXCAN_WorkMode_LoopBack)
+    {
+        tx_log_push(&frame);
+    }
+}
+
+static bool tx_pending(void)
+{
+    for (uint32_t ch = 0; ch < FLEXCAN_CHN_NUM; ch++)
+    {
+        if (mb_code(ch) == FLEXCAN_MbCode_TxDataOrRemote)
+            return true;
+    }
+    return false;
+}
+
+
+void host_flexcan_reset(void)
+{
+    memset(&host_flexcan1, 0, sizeof(host_flexcan1));
+    fifo_head = fifo_count = 0;
+    fifo_overflow = false;
+    iflag = 0;
+    tx_head = tx_count = 0;
+    enabled = false;
+    enabled_us = 0;
+    hold_tx = false;
+    work_mode = FLEXCAN_WorkMode_Normal;
+    self_reception = false;
+    memset(&fifo_mask, 0, sizeof(fifo_mask));
+    fifo_filter = 0;
+}
+
+bool host_can_inject(const host_can_frame_t *frame)
+{
+    if (!enabled)
+    {
+        return false;
+    }
+
+    // Remote requests are matched against answer mailboxes first
+    if (frame->rtr && !(host_flexcan1.CTRL2 & FLEXCAN_CTRL2_RRS_MASK))
+    {
+        for (uint32_t ch = 0; ch < FLEXCAN_CHN_NUM; ch++)
+        {
+            host_can_frame_t answer;
+
+            if (mb_code(ch) != FLEXCAN_MbCode_RxRanswer)
+                continue;
+            mb_to_frame(ch, &answer);
+            if (answer.id == frame->id && answer.ext == frame->ext)
+            {
+                // Answered on its own, the request is not stored
+                mb_transmit(ch);
+                return true;
+            }
+        }
+    }
+    return fifo_push(frame);
+}
+
+uint32_t host_can_rx_pending(void)
+{
+    return fifo_count;
+}
+
+bool host_can_enabled(void)
+{
+    return enabled;
+}
+
+uint64_t host_can_enabled_us(void)
+{
+    return enabled_us;
+}
+
+bool host_can_listen_only(void)
+{
+    return work_mode == FLEXCAN_WorkMode_ListenOnly;
+}
+
+bool host_can_loopback(void)
+{
+    return work_mode == FLEXCAN_WorkMode_LoopBack;
+}
+
+uint32_t host_can_tx_count(void)
+{
+    return tx_count;
+}
+
+bool host_can_tx_pop(host_can_frame_t *frame)
+{
+    if (tx_count == 0)
+    {
+        return false;
+    }
+    *frame = tx_log[tx_head];
+    tx_head = (tx_head + 1) % HOST_CAN_TX_LOG;
+    tx_count--;
+    return true;
+}
+
+void host_can_tx_clear(void)
+{
+    tx_head = tx_count = 0;
+}
+
+void host_can_hold_tx(bool hold)
+{
+    hold_tx = hold;
+}
+
+uint32_t host_can_release_tx(uint32_t max)
+{
+    uint32_t sent = 0;
+
+    while (sent < max)
+    {
+        uint32_t ch;
+        for (ch = 0; ch < FLEXCAN_CHN_NUM; ch++)
+        {
+            if (mb_code(ch) == FLEXCAN_MbCode_TxDataOrRemote)
+                break;
+        }
+        if (ch == FLEXCAN_CHN_NUM)
+            break;
+        mb_transmit(ch);
+        sent++;
+    }
+    return sent;
+}
+
+
+//
+// Driver API
+//
+
+bool FLEXCAN_Init(FLEXCAN_Type * FLEXCANx, FLEXCAN_Init_Type * init)
+{
+    (void)FLEXCANx;
+
+    // Soft reset: FIFO, flags and status go, mailbox RAM is kept
+    fifo_head = fifo_count = 0;
+    fifo_overflow = false;
+    iflag = 0;
+    host_flexcan1.ESR1 = 0;
+    host_flexcan1.IMASK1 = 0;
+    host_flexcan1.MCR = 0;
+    host_flexcan1.CTRL2 = FLEXCAN_CTRL2_RRS_MASK;
+    host_flexcan1.CTRL1 = ((init->WorkMode == FLEXCAN_WorkMode_LoopBack) ? FLEXCAN_CTRL1_LPB_MASK : 0u)
+                        | ((init->WorkMode == FLEXCAN_WorkMode_ListenOnly) ? FLEXCAN_CTRL1_LOM_MASK : 0u);
+    work_mode = init->WorkMode;
+    self_reception = init->EnableSelfReception && init->WorkMode != FLEXCAN_WorkMode_LoopBack;
+    enabled = true;
+    enabled_us = host_hw_now_us();
+
+    // Mailboxes left pending while the module was off go out now
+    for (uint32_t ch = 0; ch < FLEXCAN_CHN_NUM && !hold_tx && work_mode != FLEXCAN_WorkMode_ListenOnly; ch++)
+    {
+        if (mb_code(ch) == FLEXCAN_MbCode_TxDataOrRemote)
+            mb_transmit(ch);
+    }
+    return true;
+}
+
+void FLEXCAN_Enable(FLEXCAN_Type * FLEXCANx, bool enable)
+{
+    (void)FLEXCANx;
+    if (enable && !enabled)
+    {
+        enabled_us = host_hw_now_us();
+    }
+    enabled = enable;
+}
+
+void FLEXCAN_EnableFreezeMode(FLEXCAN_Type * FLEXCANx, bool enable)
+{
+    (void)FLEXCANx;
+    (void)enable;
+}
+
+void FLEXCAN_SetRxFifoGlobalMaskConf(FLEXCAN_Type * FLEXCANx, FLEXCAN_RxFifoMaskConf_Type * mask)
+{
+    (void)FLEXCANx;
+    fifo_mask = *mask;
+}
+
+void FLEXCAN_SetGlobalMbMaskConf(FLEXCAN_Type * FLEXCANx, FLEXCAN_RxMbMaskConf_Type * conf)
+{
+    (void)FLEXCANx;
+    host_flexcan1.RXMGMASK = conf->IdMask;
+}
+
+bool FLEXCAN_EnableRxFifo(FLEXCAN_Type * FLEXCANx, FLEXCAN_RxFifoConf_Type * conf)
+{
+    (void)FLEXCANx;
+    fifo_filter = (conf->IdFilterNum && conf->IdFilterTable) ? conf->IdFilterTable[0] : 0u;
+    host_flexcan1.MCR |= FLEXCAN_MCR_RFEN_MASK;
+    return true;
+}
+
+void FLEXCAN_EnableMbInterrupts(FLEXCAN_Type * FLEXCANx, uint32_t interrupts, bool enable)
+{
+    (void)FLEXCANx;
+    if (enable)
+    {
+        host_flexcan1.IMASK1 |= interrupts;
+        fifo_irq();
+    }
+    else
+    {
+        host_flexcan1.IMASK1 &= ~interrupts;
+    }
+}
+
+void FLEXCAN_ResetMb(FLEXCAN_Type * FLEXCANx, uint32_t channel)
+{
+    FLEXCANx->MB[channel].CS = 0u;
+    FLEXCANx->MB[channel].ID = 0u;
+    FLEXCANx->MB[channel].WORD0 = 0u;
+    FLEXCANx->MB[channel].WORD1 = 0u;
+}
+
+void FLEXCAN_SetMbCode(FLEXCAN_Type * FLEXCANx, uint32_t channel, FLEXCAN_MbCode_Type code)
+{
+    (void)FLEXCANx;
+    mb_set_code(channel, code);
+
+    if (code == FLEXCAN_MbCode_TxDataOrRemote && enabled && !hold_tx
+        && work_mode != FLEXCAN_WorkMode_ListenOnly)
+    {
+        mb_transmit(channel);
+    }
+}
+
+// Same register effect as the driver
+bool FLEXCAN_WriteTxMb(FLEXCAN_Type * FLEXCANx, uint32_t channel, FLEXCAN_Mb_Type * mb)
+{
+    if (FLEXCAN_CS_CODE(FLEXCAN_MbCode_TxDataOrRemote) == (FLEXCANx->MB[channel].CS & FLEXCAN_CS_CODE_MASK))
+    {
+        return false;
+    }
+
+    uint32_t cs = (FLEXCANx->MB[channel].CS & ~FLEXCAN_CS_CODE_MASK) | FLEXCAN_CS_CODE(FLEXCAN_MbCode_TxInactive);
+    if (mb->FORMAT == FLEXCAN_MbFormat_Extended)
+    {
+        FLEXCANx->MB[channel].ID = (mb->ID & (FLEXCAN_ID_STD_MASK | FLEXCAN_ID_EXT_MASK)) | FLEXCAN_ID_PRIO(mb->PRIORITY);
+        cs |= FLEXCAN_CS_SRR_MASK | FLEXCAN_CS_IDE_MASK;
+    }
+    else
+    {
+        FLEXCANx->MB[channel].ID = FLEXCAN_ID_STD(mb->ID) | FLEXCAN_ID_PRIO(mb->PRIORITY);
+        cs &= ~(FLEXCAN_CS_SRR_MASK | FLEXCAN_CS_IDE_MASK);
+    }
+    if (mb->TYPE == FLEXCAN_MbType_Remote)
+    {
+        cs |= FLEXCAN_CS_RTR_MASK;
+    }
+    else
+    {
+        cs &= ~FLEXCAN_CS_RTR_MASK;
+    }
+    cs &= ~FLEXCAN_CS_DLC_MASK;
+    cs |= FLEXCAN_CS_DLC(mb->LENGTH);
+    FLEXCANx->MB[channel].WORD0 = mb->WORD0;
+    FLEXCANx->MB[channel].WORD1 = mb->WORD1;
+    FLEXCANx->MB[channel].CS = cs;
+    return true;
+}
+
+// MB0 is the FIFO output; the frame is popped by clearing its flag
+bool FLEXCAN_ReadRxFifo(FLEXCAN_Type * FLEXCANx, FLEXCAN_Mb_Type * mb)
+{
+    (void)FLEXCANx;
+    if (fifo_count == 0u)
+    {
+        return false;
+    }
+
+    const host_can_frame_t *frame = &fifo[fifo_head];
+    uint32_t words[2];
+
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        ((uint8_t *)words)[i ^ 3u] = frame->data[i];
+    }
+    mb->ID = frame->id;
+    mb->FORMAT = frame->ext ? FLEXCAN_MbFormat_Extended : FLEXCAN_MbFormat_Standard;
+    mb->TYPE = frame->rtr ? FLEXCAN_MbType_Remote : FLEXCAN_MbType_Data;
+    mb->LENGTH = frame->dlc;
+    mb->TIMESTAMP = (uint16_t)frame->time_us;
+    mb->IDHIT = 0;
+    mb->PRIORITY = 0;
+    mb->WORD0 = words[0];
+    mb->WORD1 = words[1];
+    return true;
+}
+
+uint32_t FLEXCAN_GetMbStatus(FLEXCAN_Type * FLEXCANx)
+{
+    (void)FLEXCANx;
+    return iflag | (fifo_count ? HOST_FIFO_AVAIL : 0u) | (fifo_overflow ? HOST_FIFO_OVERFLOW : 0u);
+}
+
+void FLEXCAN_ClearMbStatus(FLEXCAN_Type * FLEXCANx, uint32_t mbs)
+{
+    (void)FLEXCANx;
+    if ((mbs & HOST_FIFO_AVAIL) && fifo_count)
+    {
+        fifo_head = (fifo_head + 1) % HOST_CAN_FIFO_DEPTH;
+        fifo_count--;
+    }
+    if (mbs & HOST_FIFO_OVERFLOW)
+    {
+        fifo_overflow = false;
+    }
+    iflag &= ~(mbs & ~(HOST_FIFO_AVAIL | HOST_FIFO_OVERFLOW | (1u << 6)));
+}
+
+// ESR1 as left by the tests, with TX set while a mailbox waits on the bus
+uint32_t FLEXCAN_GetStatus(FLEXCAN_Type * FLEXCANx)
+{
+    (void)FLEXCANx;
+    return host_flexcan1.ESR1 | (tx_pending() ? FLEXCAN_STATUS_TX : 0u);
+}
@@ -0,0 +1,571 @@
+//
+// host_hw: Clock, interrupt, timer, GPIO and flash models of the host build
+//
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "board_init.h"
+#include "hal_tim.h"
+#include "hal_gpio.h"
+#include "hal_flash.h"
+#include "config.h"
+#include "host_hw.h"
+
+TIM_Type host_tim2;
+GPIO_Type host_gpioa;
+GPIO_Type host_gpiob;
+FLASH_Type host_flash;
+USB_Type host_usb;
+DWT_Type host_dwt;
+DCB_Type host_dcb;
+
+// Handlers of the modelled interrupt sources, defined by the firmware
+__attribute__((weak)) void SysTick_Handler(void) {}
+__attribute__((weak)) void TIM2_IRQHandler(void) {}
+__attribute__((weak)) void USB_FS_IRQHandler(void) {}
+__attribute__((weak)) void FlexCAN1_IRQHandler(void) {}
+__attribute__((weak)) void host_tud_model_reset(void) {}
+__attribute__((weak)) void host_sie_reset(void) {}
+void host_flexcan_reset(void);
+
+#define HOST_IRQ_NUM        128u
+
+// Private variables
+static uint64_t now_us;
+static volatile uint32_t primask;
+static uint32_t basepri;
+static bool irq_enabled[HOST_IRQ_NUM];
+static bool irq_pending[HOST_IRQ_NUM];
+static uint8_t irq_prio[HOST_IRQ_NUM];
+static bool systick_on;
+static bool systick_pending;
+static bool in_handler;
+static bool realtime;
+static uint64_t realtime_base_ns;
+
+// Interrupt watched for the time it is held off
+static int watch_irqn = -1;
+static bool watch_blocked;
+static uint64_t watch_since_ns;
+static uint64_t watch_max_ns;
+
+// Flash page image and power cut state
+#define HOST_FLASH_MAP_ADDR (CONFIG_FLASH_ADDR & ~0xFFFu)
+#define HOST_FLASH_MAP_SIZE 0x1000u
+static uint8_t *flash_map;
+static bool flash_cut_armed;
+static uint32_t flash_cut_left;
+static uint32_t flash_steps;
+static bool flash_unlocked;
+
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t host_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// The emulated flash page sits where config.c expects it, the host build
+// is linked non-PIE so that this range is free
+__attribute__((constructor)) static void host_flash_map(void)
+{
+    void *p = mmap((void *)(uintptr_t)HOST_FLASH_MAP_ADDR, HOST_FLASH_MAP_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p != (void *)(uintptr_t)HOST_FLASH_MAP_ADDR)
+    {
+        fprintf(stderr, "host_hw: cannot map the flash page at 0x%08x\n", (unsigned)HOST_FLASH_MAP_ADDR);
+        abort();
+    }
+    flash_map = p;
+    memset(flash_map, 0xFF, HOST_FLASH_MAP_SIZE);
+}
+
+
+//
+// Interrupts
+//
+
+// By priority, as the firmware sets it
+static IRQn_Type const irq_order[] = { FlexCAN1_IRQn, TIM2_IRQn, USB_FS_IRQn };
+
+static void irq_call(IRQn_Type irqn)
+{
+    switch (irqn)
+    {
+        case FlexCAN1_IRQn: FlexCAN1_IRQHandler(); break;
+        case TIM2_IRQn:     TIM2_IRQHandler(); break;
+        case USB_FS_IRQn:   USB_FS_IRQHandler(); break;
+        default: break;
+    }
+}
+
+// Held off by BASEPRI; SysTick counts as the lowest priority
+static bool irq_basepri_masked(int irqn)
+{
+    if (basepri == 0u)
+    {
+        return false;
+    }
+    uint32_t prio = (irqn < 0) ? 0xFFu : ((uint32_t)irq_prio[irqn] << (8u - __NVIC_PRIO_BITS));
+    return prio >= basepri;
+}
+
+// Track the windows in which the watched interrupt could not be taken.
+// It is assumed to have priority over every handler, so those do not count.
+static void irq_watch_update(void)
+{
+    if (watch_irqn < 0)
+    {
+        return;
+    }
+
+    bool blocked = primask || !irq_enabled[watch_irqn] || irq_basepri_masked(watch_irqn);
+    if (blocked != watch_blocked)
+    {
+        uint64_t now = host_cpu_ns();
+        if (watch_blocked && now - watch_since_ns > watch_max_ns)
+        {
+            watch_max_ns = now - watch_since_ns;
+        }
+        watch_since_ns = now;
+        watch_blocked = blocked;
+    }
+}
+
+// Timer interrupt line: any enabled flag raised
+static void irq_levels(void)
+{
+    if (host_tim2.SR & host_tim2.DIER & 0x1Fu)
+    {
+        irq_pending[TIM2_IRQn] = true;
+    }
+}
+
+// Take pending interrupts unless masked or already in a handler
+static void irq_dispatch(void)
+{
+    if (primask || in_handler)
+    {
+        return;
+    }
+
+    bool taken;
+    do
+    {
+        taken = false;
+        irq_levels();
+        for (uint32_t i = 0; i < sizeof(irq_order) / sizeof(irq_order[0]); i++)
+        {
+            IRQn_Type irqn = irq_order[i];
+            if (irq_pending[irqn] && irq_enabled[irqn] && !irq_basepri_masked(irqn))
+            {
+                irq_pending[irqn] = false;
+                in_handler = true;
+                irq_call(irqn);
+                in_handler = false;
+                taken = true;
+                break;
+            }
+        }
+        if (!taken && systick_pending && !irq_basepri_masked(-1))
+        {
+            systick_pending = false;
+            in_handler = true;
+            SysTick_Handler();
+            in_handler = false;
+            taken = true;
+        }
+    } while (taken && !primask);
+}
+
+uint32_t __get_PRIMASK(void)
+{
+    return primask;
+}
+
+void __set_PRIMASK(uint32_t value)
+{
+    primask = value & 1u;
+    irq_watch_update();
+    irq_dispatch();
+}
+
+void __disable_irq(void)
+{
+    primask = 1;
+    irq_watch_update();
+}
+
+void __enable_irq(void)
+{
+    primask = 0;
+    irq_watch_update();
+    irq_dispatch();
+}
+
+uint32_t __get_BASEPRI(void)
+{
+    return basepri;
+}
+
+void __set_BASEPRI(uint32_t value)
+{
+    basepri = value & 0xFFu;
+    irq_watch_update();
+    irq_dispatch();
+}
+
+bool host_irq_masked(void)
+{
+    return primask != 0;
+}
+
+void host_irq_watch(int irqn)
+{
+    watch_irqn = -1;
+    watch_blocked = false;
+    watch_max_ns = 0;
+    watch_irqn = irqn;
+    irq_watch_update();
+}
+
+uint64_t host_irq_blocked_max_ns(void)
+{
+    uint64_t max = watch_max_ns;
+    if (watch_irqn >= 0 && watch_blocked && host_cpu_ns() - watch_since_ns > max)
+    {
+        max = host_cpu_ns() - watch_since_ns;
+    }
+    return max;
+}
+
+void NVIC_EnableIRQ(IRQn_Type irqn)
+{
+    irq_enabled[irqn] = true;
+    irq_watch_update();
+    irq_dispatch();
+}
+
+void NVIC_DisableIRQ(IRQn_Type irqn)
+{
+    irq_enabled[irqn] = false;
+    irq_watch_update();
+}
+
+void NVIC_SetPendingIRQ(IRQn_Type irqn)
+{
+    irq_pending[irqn] = true;
+    irq_dispatch();
+}
+
+void NVIC_ClearPendingIRQ(IRQn_Type irqn)
+{
+    irq_pending[irqn] = false;
+}
+
+uint32_t NVIC_GetPendingIRQ(IRQn_Type irqn)
+{
+    return irq_pending[irqn];
+}
+
+uint32_t NVIC_GetEnableIRQ(IRQn_Type irqn)
+{
+    return irq_enabled[irqn];
+}
+
+void NVIC_SetPriority(IRQn_Type irqn, uint32_t priority)
+{
+    if (irqn >= 0)
+    {
+        irq_prio[irqn] = (uint8_t)(priority & ((1u << __NVIC_PRIO_BITS) - 1u));
+    }
+}
+
+uint32_t SysTick_Config(uint32_t ticks)
+{
+    (void)ticks;
+    systick_on = true;
+    return 0;
+}
+
+uint32_t host_cycles(void)
+{
+    return (uint32_t)((monotonic_ns() * (CLOCK_SYS_FREQ / 1000000u)) / 1000u);
+}
+
+
+//
+// Time
+//
+
+uint64_t host_hw_now_us(void)
+{
+    return now_us;
+}
+
+uint64_t host_time_us(void)
+{
+    return now_us;
+}
+
+// Compare flags of the channels the counter passes from c0 to c1
+static void tim_step(uint32_t c0, uint32_t c1)
+{
+    if (!(host_tim2.CR1 & TIM_CR1_CEN_MASK))
+    {
+        return;
+    }
+    host_tim2.CNT = c1;
+    for (uint32_t ch = 0; ch < 4; ch++)
+    {
+        if ((uint32_t)(host_tim2.CCR[ch] - c0 - 1u) < (uint32_t)(c1 - c0))
+        {
+            host_tim2.SR |= TIM_STATUS_CHN1_EVENT << ch;
+        }
+    }
+}
+
+// Move time forward in steps ending on every millisecond tick, so that
+// SysTick and compare matches are taken in order
+void host_advance_us(uint64_t us)
+{
+    uint64_t end = now_us + us;
+
+    // Software generated compare events
+    if (host_tim2.EGR)
+    {
+        host_tim2.SR |= host_tim2.EGR & 0x1Eu;
+        host_tim2.EGR = 0;
+    }
+
+    while (now_us < end)
+    {
+        uint64_t next = (now_us / 1000u + 1u) * 1000u;
+        if (next > end)
+        {
+            next = end;
+        }
+        tim_step((uint32_t)now_us, (uint32_t)next);
+        now_us = next;
+        if (systick_on && (now_us % 1000u) == 0u)
+        {
+            systick_pending = true;
+        }
+        irq_dispatch();
+    }
+    irq_dispatch();
+}
+
+void host_realtime(bool enable)
+{
+    realtime = enable;
+    realtime_base_ns = monotonic_ns() - now_us * 1000u;
+}
+
+void host_poll(void)
+{
+    if (realtime)
+    {
+        uint64_t target = (monotonic_ns() - realtime_base_ns) / 1000u;
+        if (target > now_us)
+        {
+            host_advance_us(target - now_us);
+        }
+    }
+    else
+    {
+        irq_dispatch();
+    }
+}
+
+// Sleep until the next interrupt: the next millisecond tick at the latest
+void __WFI(void)
+{
+    if (realtime)
+    {
+        uint64_t wait_ns = (1000u - (now_us % 1000u)) * 1000u;
+        struct timespec ts = { 0, (long)wait_ns };
+        nanosleep(&ts, NULL);
+        host_poll();
+    }
+    else
+    {
+        host_advance_us(1000u - (now_us % 1000u));
+    }
+}
+
+
+//
+// Board
+//
+
+void BOARD_Init(void)
+{
+}
+
+void GPIO_WriteBit(GPIO_Type * GPIOx, uint16_t pins, uint16_t val)
+{
+    if (val)
+    {
+        GPIOx->ODR |= pins;
+    }
+    else
+    {
+        GPIOx->ODR &= ~(uint32_t)pins;
+    }
+}
+
+bool host_gpio_get(void *port, uint16_t pin)
+{
+    return (((GPIO_Type *)port)->ODR & pin) != 0u;
+}
+
+
+//
+// Flash
+//
+
+static bool flash_step(void)
+{
+    flash_steps++;
+    if (!flash_cut_armed)
+    {
+        return true;
+    }
+    if (flash_cut_left == 0u)
+    {
+        return false;
+    }
+    flash_cut_left--;
+    return true;
+}
+
+static uint8_t *flash_ptr(uint32_t addr)
+{
+    if (addr < HOST_FLASH_MAP_ADDR || addr >= HOST_FLASH_MAP_ADDR + HOST_FLASH_MAP_SIZE)
+    {
+        fprintf(stderr, "host_hw: flash access outside the emulated page: 0x%08x\n", (unsigned)addr);
+        abort();
+    }
+    return flash_map + (addr - HOST_FLASH_MAP_ADDR);
+}
+
+void FLASH_Unlock(FLASH_Type * FLASHx)
+{
+    (void)FLASHx;
+    flash_unlocked = true;
+}
+
+void FLASH_Lock(FLASH_Type * FLASHx)
+{
+    (void)FLASHx;
+    flash_unlocked = false;
+}
+
+void FLASH_ClearStatus(FLASH_Type * FLASHx, uint32_t flags)
+{
+    FLASHx->SR &= ~flags;
+}
+
+void FLASH_SetCmd(FLASH_Type * FLASHx, uint32_t cmd)
+{
+    FLASHx->CR |= cmd;
+
+    if ((cmd & FLASH_CMD_START_ERASE) && (FLASHx->CR & FLASH_CMD_ERASE_PAGE) && flash_unlocked)
+    {
+        if (flash_step())
+        {
+            memset(flash_ptr(FLASHx->AR & ~(FLASH_PAGE_SIZE - 1u)), 0xFF, FLASH_PAGE_SIZE);
+        }
+    }
+}
+
+void FLASH_ClearCmd(FLASH_Type * FLASHx)
+{
+    FLASHx->CR &= ~FLASH_CMD_ALL;
+}
+
+void FLASH_SetAddr(FLASH_Type * FLASHx, uint32_t addr)
+{
+    FLASHx->AR = addr;
+}
+
+// NOR programming only clears bits
+void FLASH_SetData16b(uint32_t addr, uint16_t val)
+{
+    if (!(host_flash.CR & FLASH_CMD_PROGRAM) || !flash_unlocked)
+    {
+        host_flash.SR |= FLASH_STATUS_PROGRAM_ERR;
+        return;
+    }
+    if (flash_step())
+    {
+        uint16_t *p = (uint16_t *)flash_ptr(addr);
+        *p &= val;
+    }
+}
+
+bool FLASH_WaitDone(FLASH_Type * FLASHx, uint32_t timeout)
+{
+    (void)FLASHx;
+    (void)timeout;
+    return true;
+}
+
+void host_flash_erase_all(void)
+{
+    memset(flash_map, 0xFF, HOST_FLASH_MAP_SIZE);
+}
+
+void host_flash_power_cut_after(uint32_t steps)
+{
+    flash_cut_armed = true;
+    flash_cut_left = steps;
+}
+
+void host_flash_power_on(void)
+{
+    flash_cut_armed = false;
+}
+
+uint32_t host_flash_steps(void)
+{
+    return flash_steps;
+}
+
+
+void host_reset(void)
+{
+    now_us = 0;
+    primask = 0;
+    basepri = 0;
+    memset(irq_enabled, 0, sizeof(irq_enabled));
+    memset(irq_pending, 0, sizeof(irq_pending));
+    memset(irq_prio, 0, sizeof(irq_prio));
+    watch_irqn = -1;
+    systick_on = false;
+    systick_pending = false;
+    in_handler = false;
+    realtime = false;
+    memset(&host_tim2, 0, sizeof(host_tim2));
+    memset(&host_gpioa, 0, sizeof(host_gpioa));
+    memset(&host_gpiob, 0, sizeof(host_gpiob));
+    memset(&host_flash, 0, sizeof(host_flash));
+    flash_cut_armed = false;
+    flash_unlocked = false;
+    host_flexcan_reset();
+    host_tud_model_reset();
+    host_sie_reset();
+}
@@ -0,0 +1,109 @@
+//
+// host_hw: Peripheral models behind the host build
+//
+// The application and the unmodified TIM driver run against register
+// images in host memory. Time is virtual: it only moves when a test calls
+// host_advance_us() or the firmware waits in __WFI(), so runs are
+// repeatable. In real-time mode it follows CLOCK_MONOTONIC instead and
+// host_poll() catches it up.
+//
+// Interrupts are taken between calls into the firmware: when time moves,
+// when an enabled interrupt is pended from thread code and when PRIMASK
+// or BASEPRI is lowered, highest priority first. They never preempt
+// firmware code halfway, nor one another.
+//
+// FlexCAN is modelled at the driver API: a 6-deep RX FIFO behind MB0
+// raising the FlexCAN interrupt while it holds frames and MB5 is unmasked,
+// transmit mailboxes which go on the bus when their code is set to
+// TxDataOrRemote (or when released while held), and remote answer
+// mailboxes replying to matching remote requests.
+//
+
+#ifndef _HOST_HW_H
+#define _HOST_HW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Depth of the FlexCAN RX FIFO
+#define HOST_CAN_FIFO_DEPTH     6u
+
+// Frames kept in the log of transmitted frames
+#define HOST_CAN_TX_LOG         4096u
+
+// One frame on the modelled bus
+typedef struct host_can_frame_
+{
+    uint32_t id;
+    uint8_t ext;
+    uint8_t rtr;
+    uint8_t dlc;
+    uint8_t data[8];
+    uint8_t mb;             // Mailbox which sent it, transmitted frames only
+    uint64_t time_us;       // Time it went on the bus
+} host_can_frame_t;
+
+// All models back to their power-on state, virtual time back to 0.
+// Flash contents survive, like on the target.
+void host_reset(void);
+
+// Time
+uint64_t host_time_us(void);
+void host_advance_us(uint64_t us);
+void host_realtime(bool enable);
+void host_poll(void);
+
+// Interrupts currently masked by PRIMASK
+bool host_irq_masked(void);
+
+// Longest window, in thread CPU time since host_irq_watch(), in which the
+// interrupt irqn would not have been taken: PRIMASK set, the interrupt
+// disabled or masked by BASEPRI. Handlers do not count, the interrupt is
+// taken to preempt them all.
+void host_irq_watch(int irqn);
+uint64_t host_irq_blocked_max_ns(void);
+
+// CPU time of the calling thread, which host preemption does not add to
+uint64_t host_cpu_ns(void);
+
+// FlexCAN: a frame from another node, returns false if the controller
+// is off-bus or the RX FIFO overflowed
+bool host_can_inject(const host_can_frame_t *frame);
+uint32_t host_can_rx_pending(void);
+bool host_can_enabled(void);
+// Time the controller last went on-bus
+uint64_t host_can_enabled_us(void);
+bool host_can_listen_only(void);
+bool host_can_loopback(void);
+
+// FlexCAN: frames transmitted by the controller, oldest first
+uint32_t host_can_tx_count(void);
+bool host_can_tx_pop(host_can_frame_t *frame);
+void host_can_tx_clear(void);
+
+// FlexCAN: while held, loaded mailboxes stay pending on the bus until
+// released; release sends up to max of them, lowest mailbox first
+void host_can_hold_tx(bool hold);
+uint32_t host_can_release_tx(uint32_t max);
+
+// GPIO output level of a pin, e.g. host_gpio_get(LED_BLUE)
+bool host_gpio_get(void *port, uint16_t pin);
+
+// Flash: the emulated page at CONFIG_FLASH_ADDR programs like NOR flash,
+// bits only go from 1 to 0 until the page is erased. After a power cut
+// the next n program or erase steps complete, everything after them is
+// lost until host_flash_power_on().
+void host_flash_erase_all(void);
+void host_flash_power_cut_after(uint32_t steps);
+void host_flash_power_on(void);
+uint32_t host_flash_steps(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _HOST_HW_H
@@ -0,0 +1,372 @@
+//
+// host_sie: USB-FS controller model behind the DCD port
+//
+
+#include <string.h>
+#include "board_init.h"
+#include "hal_usb.h"
+#include "host_sie.h"
+
+#define SIE_BD_NUM      (USB_BDT_EP_NUM * USB_BDT_DIRECTION_NUM * USB_BDT_BUF_NUM)
+
+// Private variables
+static USB_BufDespTable_Type *bdt;
+static uint32_t int_status;
+static uint32_t int_enabled;
+static uint32_t stat_fifo[HOST_SIE_STAT_DEPTH];
+static uint32_t stat_head;
+static uint32_t stat_count;
+static USB_EndPointMode_Type ep_mode[USB_BDT_EP_NUM];
+static bool ep_stall[USB_BDT_EP_NUM];
+static uint8_t sie_odd[USB_BDT_EP_NUM][USB_BDT_DIRECTION_NUM];
+static uint8_t host_toggle[USB_BDT_EP_NUM][USB_BDT_DIRECTION_NUM];
+static uint8_t device_addr;
+static uint32_t toggle_errors;
+static uint32_t bd_errors;
+
+
+// Level triggered, like the target's interrupt line
+static void sie_irq(void)
+{
+    if (int_status & int_enabled)
+    {
+        NVIC_SetPendingIRQ(USB_FS_IRQn);
+    }
+}
+
+static void sie_token_done(uint32_t ep, uint32_t dir, uint32_t odd)
+{
+    stat_fifo[(stat_head + stat_count) % HOST_SIE_STAT_DEPTH] =
+        USB_FSSTAT_ENDP(ep) | USB_FSSTAT_TX(dir) | USB_FSSTAT_ODD(odd);
+    stat_count++;
+    sie_odd[ep][dir] ^= 1u;
+    int_status |= USB_INT_TOKENDONE;
+    sie_irq();
+}
+
+// BD the next transaction on this endpoint uses, NULL if the SIE answers
+// with a handshake of its own
+static USB_BufDesp_Type *sie_bd(uint32_t ep, uint32_t dir, host_sie_handshake_t *hs)
+{
+    *hs = HOST_SIE_NAK;
+    if (bdt == NULL || ep >= USB_BDT_EP_NUM || ep_mode[ep] == USB_EndPointMode_NULL)
+    {
+        return NULL;
+    }
+    if (ep_stall[ep])
+    {
+        *hs = HOST_SIE_STALL;
+        return NULL;
+    }
+    if (stat_count >= HOST_SIE_STAT_DEPTH)
+    {
+        return NULL;
+    }
+
+    USB_BufDesp_Type *bd = &bdt->Table[ep][dir][sie_odd[ep][dir]];
+    if (!bd->OWN)
+    {
+        return NULL;
+    }
+    if (bd->BDT_STALL)
+    {
+        *hs = HOST_SIE_STALL;
+        return NULL;
+    }
+    *hs = HOST_SIE_ACK;
+    return bd;
+}
+
+
+//
+// Host side
+//
+
+void host_sie_reset(void)
+{
+    bdt = NULL;
+    int_status = 0;
+    int_enabled = 0;
+    stat_head = 0;
+    stat_count = 0;
+    memset(ep_mode, 0, sizeof(ep_mode));
+    memset(ep_stall, 0, sizeof(ep_stall));
+    memset(sie_odd, 0, sizeof(sie_odd));
+    memset(host_toggle, 0, sizeof(host_toggle));
+    device_addr = 0;
+    toggle_errors = 0;
+    bd_errors = 0;
+}
+
+void host_sie_bus_reset(void)
+{
+    stat_head = 0;
+    stat_count = 0;
+    int_status &= ~USB_INT_TOKENDONE;
+    memset(host_toggle, 0, sizeof(host_toggle));
+    int_status |= USB_INT_RESET;
+    sie_irq();
+}
+
+host_sie_handshake_t host_sie_out(uint8_t ep, const uint8_t *data, uint32_t len)
+{
+    host_sie_handshake_t hs;
+    USB_BufDesp_Type *bd = sie_bd(ep, USB_Direction_OUT, &hs);
+
+    if (bd == NULL)
+    {
+        return hs;
+    }
+    if (bd->DATA != host_toggle[ep][USB_Direction_OUT])
+    {
+        toggle_errors++;
+    }
+    host_toggle[ep][USB_Direction_OUT] ^= 1u;
+
+    // A packet larger than the BD overruns it, the SIE keeps what fits
+    uint32_t n = (len < bd->BC) ? len : bd->BC;
+    memcpy((void *)(uintptr_t)bd->ADDR, data, n);
+    uint32_t odd = sie_odd[ep][USB_Direction_OUT];
+    bd->HEAD = 0u;
+    bd->BC = n;
+    bd->TOK_PID = USB_TokenPid_OUT;
+    sie_token_done(ep, USB_Direction_OUT, odd);
+    return HOST_SIE_ACK;
+}
+
+host_sie_handshake_t host_sie_in(uint8_t ep, uint8_t *data, uint32_t *len)
+{
+    host_sie_handshake_t hs;
+    USB_BufDesp_Type *bd = sie_bd(ep & 0x0Fu, USB_Direction_IN, &hs);
+
+    *len = 0;
+    if (bd == NULL)
+    {
+        return hs;
+    }
+    ep &= 0x0Fu;
+
+    // The host drops a packet with the wrong PID but still ACKs it
+    if (bd->DATA != host_toggle[ep][USB_Direction_IN])
+    {
+        toggle_errors++;
+    }
+    else
+    {
+        host_toggle[ep][USB_Direction_IN] ^= 1u;
+    }
+    *len = bd->BC;
+    memcpy(data, (const void *)(uintptr_t)bd->ADDR, bd->BC);
+    uint32_t odd = sie_odd[ep][USB_Direction_IN];
+    uint32_t bc = bd->BC;
+    bd->HEAD = 0u;
+    bd->BC = bc;
+    bd->TOK_PID = USB_TokenPid_IN;
+    sie_token_done(ep, USB_Direction_IN, odd);
+    return HOST_SIE_ACK;
+}
+
+void host_sie_clear_toggle(uint8_t ep_addr)
+{
+    host_toggle[ep_addr & 0x0Fu][(ep_addr & 0x80u) ? USB_Direction_IN : USB_Direction_OUT] = 0;
+}
+
+bool host_sie_bd_owned(uint8_t ep_addr, uint8_t odd)
+{
+    return bdt->Table[ep_addr & 0x0Fu][(ep_addr & 0x80u) ? USB_Direction_IN : USB_Direction_OUT][odd & 1u].OWN;
+}
+
+uint8_t host_sie_bd_data(uint8_t ep_addr, uint8_t odd)
+{
+    return bdt->Table[ep_addr & 0x0Fu][(ep_addr & 0x80u) ? USB_Direction_IN : USB_Direction_OUT][odd & 1u].DATA;
+}
+
+uint32_t host_sie_toggle_errors(void)
+{
+    return toggle_errors;
+}
+
+uint32_t host_sie_bd_errors(void)
+{
+    return bd_errors;
+}
+
+
+//
+// hal_usb, the calls the DCD port makes
+//
+
+void USB_InitDevice(USB_Type * USBx, USB_Device_Init_Type * init)
+{
+    (void)USBx;
+    bdt = (USB_BufDespTable_Type *)(uintptr_t)init->BufDespTable_Addr;
+}
+
+void USB_Enable(USB_Type * USBx, bool enable)
+{
+    (void)USBx;
+    (void)enable;
+}
+
+void USB_EnableInterrupts(USB_Type * USBx, uint32_t interrupts, bool enable)
+{
+    (void)USBx;
+    if (enable)
+    {
+        int_enabled |= interrupts;
+        sie_irq();
+    }
+    else
+    {
+        int_enabled &= ~interrupts;
+    }
+}
+
+uint32_t USB_GetInterruptStatus(USB_Type * USBx)
+{
+    (void)USBx;
+    return int_status;
+}
+
+// Clearing token done moves the status FIFO on to the next token
+void USB_ClearInterruptStatus(USB_Type * USBx, uint32_t interrupts)
+{
+    (void)USBx;
+    int_status &= ~interrupts;
+    if ((interrupts & USB_INT_TOKENDONE) && stat_count > 0)
+    {
+        stat_head = (stat_head + 1u) % HOST_SIE_STAT_DEPTH;
+        stat_count--;
+        if (stat_count > 0)
+        {
+            int_status |= USB_INT_TOKENDONE;
+        }
+    }
+    sie_irq();
+}
+
+void USB_EnableOddEvenReset(USB_Type * USBx, bool enable)
+{
+    (void)USBx;
+    if (enable)
+    {
+        memset(sie_odd, 0, sizeof(sie_odd));
+    }
+}
+
+void USB_EnableResumeSignal(USB_Type * USBx, bool enable)
+{
+    (void)USBx;
+    (void)enable;
+}
+
+void USB_EnableSuspend(USB_Type * USBx, bool enable)
+{
+    (void)USBx;
+    (void)enable;
+}
+
+void USB_SetDeviceAddr(USB_Type * USBx, uint8_t addr)
+{
+    (void)USBx;
+    device_addr = addr;
+}
+
+USB_BufDesp_Type * USB_GetBufDesp(USB_Type * USBx)
+{
+    (void)USBx;
+    return &bdt->Index[stat_fifo[stat_head] >> 2];
+}
+
+USB_TokenPid_Type USB_BufDesp_GetTokenPid(USB_BufDesp_Type * bd)
+{
+    return (USB_TokenPid_Type)bd->TOK_PID;
+}
+
+uint32_t USB_BufDesp_GetPacketAddr(USB_BufDesp_Type * bd)
+{
+    return bd->ADDR;
+}
+
+uint32_t USB_BufDesp_GetPacketSize(USB_BufDesp_Type * bd)
+{
+    return bd->BC;
+}
+
+void USB_BufDesp_Reset(USB_BufDesp_Type * bd)
+{
+    bd->HEAD = 0u;
+}
+
+bool USB_BufDesp_IsBusy(USB_BufDesp_Type * bd)
+{
+    return 1u == bd->OWN;
+}
+
+// Arming a BD the SIE owns is refused by the driver and counted here
+bool USB_BufDesp_Xfer(USB_BufDesp_Type * bd, uint32_t data_n, uint8_t * buffer, uint32_t len)
+{
+    if (1u == bd->OWN)
+    {
+        bd_errors++;
+        return false;
+    }
+    bd->ADDR = (uint32_t)(uintptr_t)buffer;
+    bd->DATA = data_n;
+    bd->BC   = len;
+    bd->OWN  = 1u;
+    return true;
+}
+
+uint32_t USB_GetEndPointIndex(USB_Type * USBx)
+{
+    (void)USBx;
+    return (stat_fifo[stat_head] & USB_FSSTAT_ENDP_MASK) >> USB_FSSTAT_ENDP_SHIFT;
+}
+
+USB_Direction_Type USB_GetXferDirection(USB_Type * USBx)
+{
+    (void)USBx;
+    return (USB_Direction_Type)((stat_fifo[stat_head] & USB_FSSTAT_TX_MASK) >> USB_FSSTAT_TX_SHIFT);
+}
+
+USB_BufDesp_OddEven_Type USB_GetBufDespOddEven(USB_Type * USBx)
+{
+    (void)USBx;
+    return (USB_BufDesp_OddEven_Type)((stat_fifo[stat_head] & USB_FSSTAT_ODD_MASK) >> USB_FSSTAT_ODD_SHIFT);
+}
+
+// As the driver: disabling an endpoint takes its four BDs back
+void USB_EnableEndPoint(USB_Type * USBx, uint32_t index, USB_EndPointMode_Type mode, bool enable)
+{
+    (void)USBx;
+    ep_mode[index] = enable ? mode : USB_EndPointMode_NULL;
+    if (!enable && bdt != NULL)
+    {
+        bdt->Table[index][0u][0u].HEAD = 0u;
+        bdt->Table[index][0u][1u].HEAD = 0u;
+        bdt->Table[index][1u][0u].HEAD = 0u;
+        bdt->Table[index][1u][1u].HEAD = 0u;
+    }
+}
+
+// As the driver: the stall of every endpoint is set or cleared, whatever
+// the index, and clearing takes every BD back from the SIE
+void USB_EnableEndPointStall(USB_Type * USBx, uint32_t index, bool enable)
+{
+    (void)USBx;
+    (void)index;
+    for (uint32_t i = 0; i < USB_BDT_EP_NUM; i++)
+    {
+        ep_stall[i] = enable;
+        for (uint32_t b = 0; b < USB_BDT_DIRECTION_NUM * USB_BDT_BUF_NUM; b++)
+        {
+            USB_BufDesp_Type *bd = &bdt->Table[i][b >> 1][b & 1u];
+            bd->BDT_STALL = enable;
+            if (!enable)
+            {
+                bd->OWN = 0u;
+            }
+        }
+    }
+}
@@ -0,0 +1,59 @@
+//
+// host_sie: USB-FS controller model behind the DCD port
+//
+// The hal_usb driver calls board/tud_dcd_port.c makes are modelled on the
+// buffer descriptor table the port sets up, so the port runs unmodified.
+// host_sie_out() and host_sie_in() are transactions of the USB host on a
+// device endpoint: the SIE takes the BD its odd/even pointer selects,
+// NAKs unless the BD is owned, and hands it back to the CPU with a token
+// done interrupt. Completed tokens queue in a 4-deep status FIFO like on
+// the target, so while the interrupt is masked up to four of them are
+// ACKed before the SIE NAKs.
+//
+// The host keeps a DATA0/1 toggle per endpoint and checks it against the
+// BD's DATA bit on every transaction, as if DTS were set. Mismatches and
+// BDs armed while the SIE owns them are counted, not fixed up.
+//
+
+#ifndef _HOST_SIE_H
+#define _HOST_SIE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HOST_SIE_STAT_DEPTH     4u
+
+typedef enum
+{
+    HOST_SIE_ACK = 0,
+    HOST_SIE_NAK,
+    HOST_SIE_STALL,
+} host_sie_handshake_t;
+
+void host_sie_reset(void);
+
+// Bus reset from the host, all toggles back to DATA0
+void host_sie_bus_reset(void);
+
+// OUT and IN transactions; *len is the packet received from the device
+host_sie_handshake_t host_sie_out(uint8_t ep, const uint8_t *data, uint32_t len);
+host_sie_handshake_t host_sie_in(uint8_t ep, uint8_t *data, uint32_t *len);
+
+// Host side of CLEAR_FEATURE(ENDPOINT_HALT) and SET_CONFIGURATION
+void host_sie_clear_toggle(uint8_t ep_addr);
+
+// BD ownership as the SIE sees it, and the errors counted
+bool host_sie_bd_owned(uint8_t ep_addr, uint8_t odd);
+uint8_t host_sie_bd_data(uint8_t ep_addr, uint8_t odd);
+uint32_t host_sie_toggle_errors(void);
+uint32_t host_sie_bd_errors(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _HOST_SIE_H
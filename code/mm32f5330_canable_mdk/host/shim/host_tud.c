@@ -0,0 +1,476 @@
+//
+// host_tud: TinyUSB device stack stand-in of the host build
+//
+
+#include <string.h>
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+#include "host_tud.h"
+#include "latency.h"
+
+#define HOST_EP_NUM         16u
+#define HOST_EP_PACKET      64u
+#define HOST_NET_FRAME_MAX  1600u
+
+typedef struct
+{
+    tu_fifo_t rx_ff;
+    tu_fifo_t tx_ff;
+    uint8_t rx_buf[CFG_TUD_CDC_RX_BUFSIZE];
+    uint8_t tx_buf[CFG_TUD_CDC_TX_BUFSIZE];
+    uint8_t line_state;
+    // Bulk IN packet taken from tx_ff and not yet polled by the host
+    uint8_t in_buf[HOST_EP_PACKET];
+    uint16_t in_len;
+} host_cdc_t;
+
+// Private variables
+static host_cdc_t cdc[CFG_TUD_CDC];
+static bool mounted;
+static bool suspended;
+static bool wakeup_allowed;
+static uint32_t wakeup_requests;
+
+static bool ep_claimed[HOST_EP_NUM];
+static uint8_t *ep_buf[HOST_EP_NUM];
+static uint16_t ep_len[HOST_EP_NUM];
+static bool ep_busy[HOST_EP_NUM];
+
+// FIFO depths in use, at most the buffers' sizes
+static uint16_t cdc_tx_size = CFG_TUD_CDC_TX_BUFSIZE;
+static uint16_t cdc_rx_size = CFG_TUD_CDC_RX_BUFSIZE;
+
+#if CFG_TUD_NCM
+// The driver's OUT and IN transfer blocks, one Ethernet frame each
+static bool net_recv_ready = true;
+static uint8_t net_out[HOST_NET_FRAME_MAX];
+static uint8_t net_in[HOST_NET_FRAME_MAX];
+static uint16_t net_in_len;
+#endif
+
+
+void host_tud_model_reset(void)
+{
+    memset(cdc, 0, sizeof(cdc));
+    for (uint8_t i = 0; i < CFG_TUD_CDC; i++)
+    {
+        tu_fifo_config(&cdc[i].rx_ff, cdc[i].rx_buf, cdc_rx_size, 1, false);
+        tu_fifo_config(&cdc[i].tx_ff, cdc[i].tx_buf, cdc_tx_size, 1, true);
+    }
+    mounted = false;
+    suspended = false;
+    wakeup_allowed = false;
+    wakeup_requests = 0;
+    memset(ep_claimed, 0, sizeof(ep_claimed));
+    memset(ep_busy, 0, sizeof(ep_busy));
+#if CFG_TUD_NCM
+    net_recv_ready = true;
+    net_in_len = 0;
+#endif
+}
+
+// Smaller FIFOs than the build's, from the next host_reset() on; 0 keeps
+// the build's size
+void host_cdc_fifo_size(uint16_t tx, uint16_t rx)
+{
+    cdc_tx_size = (tx && tx < CFG_TUD_CDC_TX_BUFSIZE) ? tx : CFG_TUD_CDC_TX_BUFSIZE;
+    cdc_rx_size = (rx && rx < CFG_TUD_CDC_RX_BUFSIZE) ? rx : CFG_TUD_CDC_RX_BUFSIZE;
+}
+
+__attribute__((constructor)) static void host_tud_construct(void)
+{
+    host_tud_model_reset();
+}
+
+bool tusb_init(void)
+{
+    return true;
+}
+
+
+//
+// Device state
+//
+
+bool tud_mounted(void)
+{
+    return mounted;
+}
+
+bool tud_suspended(void)
+{
+    return suspended;
+}
+
+bool tud_connected(void)
+{
+    return mounted;
+}
+
+bool tud_remote_wakeup(void)
+{
+    if (!suspended || !wakeup_allowed)
+    {
+        return false;
+    }
+    wakeup_requests++;
+    return true;
+}
+
+void tud_queue_stats(tud_queue_stats_t* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void tud_queue_stats_reset(void)
+{
+}
+
+TU_ATTR_WEAK void tud_mount_cb(void) {}
+TU_ATTR_WEAK void tud_umount_cb(void) {}
+TU_ATTR_WEAK void tud_suspend_cb(bool remote_wakeup_en) { (void)remote_wakeup_en; }
+TU_ATTR_WEAK void tud_resume_cb(void) {}
+TU_ATTR_WEAK void tud_cdc_line_state_cb(uint8_t itf, bool dtr, bool rts) { (void)itf; (void)dtr; (void)rts; }
+TU_ATTR_WEAK void tud_cdc_tx_complete_cb(uint8_t itf) { (void)itf; }
+
+void host_usb_mount(bool state)
+{
+    if (state == mounted)
+    {
+        return;
+    }
+    mounted = state;
+    suspended = false;
+    if (mounted)
+    {
+        tud_mount_cb();
+    }
+    else
+    {
+        tud_umount_cb();
+    }
+}
+
+// Port reset by the host: the interfaces are closed, frames still queued
+// for the host survive with CFG_TUD_CDC_PERSISTENT_TX
+void host_usb_bus_reset(void)
+{
+    for (uint8_t i = 0; i < CFG_TUD_CDC; i++)
+    {
+        cdc[i].line_state = 0;
+        cdc[i].in_len = 0;
+        tu_fifo_clear(&cdc[i].rx_ff);
+#if !CFG_TUD_CDC_PERSISTENT_TX
+        tu_fifo_clear(&cdc[i].tx_ff);
+#endif
+        tu_fifo_set_overwritable(&cdc[i].tx_ff, true);
+    }
+    LATENCY_USB_RESET();
+    memset(ep_claimed, 0, sizeof(ep_claimed));
+    memset(ep_busy, 0, sizeof(ep_busy));
+    if (mounted)
+    {
+        mounted = false;
+        tud_umount_cb();
+    }
+    suspended = false;
+}
+
+void host_usb_suspend(bool remote_wakeup_en)
+{
+    if (!mounted || suspended)
+    {
+        return;
+    }
+    suspended = true;
+    wakeup_allowed = remote_wakeup_en;
+    tud_suspend_cb(remote_wakeup_en);
+}
+
+void host_usb_resume(void)
+{
+    if (!suspended)
+    {
+        return;
+    }
+    suspended = false;
+    tud_resume_cb();
+}
+
+// End of the resume signalling started by dcd_remote_wakeup()
+void timebase_wakeup_cb(void)
+{
+}
+
+uint32_t host_usb_wakeup_requests(void)
+{
+    return wakeup_requests;
+}
+
+
+//
+// CDC
+//
+
+// Start the next bulk IN packet, as the class driver does on flush and
+// on transfer completion
+static void cdc_start_in(host_cdc_t *p)
+{
+    if (!mounted || suspended || p->in_len)
+    {
+        return;
+    }
+    p->in_len = tu_fifo_read_n(&p->tx_ff, p->in_buf, HOST_EP_PACKET);
+    if (p == &cdc[0] && p->in_len)
+    {
+        LATENCY_USB_XFER(LATENCY_EP_IN, p->in_len);
+    }
+}
+
+uint32_t tud_cdc_n_available(uint8_t itf)
+{
+    return tu_fifo_count(&cdc[itf].rx_ff);
+}
+
+uint32_t tud_cdc_n_read(uint8_t itf, void* buffer, uint32_t bufsize)
+{
+    return tu_fifo_read_n(&cdc[itf].rx_ff, buffer, (uint16_t)bufsize);
+}
+
+void tud_cdc_n_read_flush(uint8_t itf)
+{
+    tu_fifo_clear(&cdc[itf].rx_ff);
+}
+
+bool tud_cdc_n_peek(uint8_t itf, uint8_t* chr)
+{
+    return tu_fifo_peek_n(&cdc[itf].rx_ff, chr, 1) == 1;
+}
+
+bool tud_cdc_n_connected(uint8_t itf)
+{
+    return tud_ready() && (cdc[itf].line_state & 1u);
+}
+
+uint8_t tud_cdc_n_get_line_state(uint8_t itf)
+{
+    return cdc[itf].line_state;
+}
+
+uint32_t tud_cdc_n_write(uint8_t itf, void const* buffer, uint32_t bufsize)
+{
+    uint16_t ret = tu_fifo_write_n(&cdc[itf].tx_ff, buffer, (uint16_t)bufsize);
+
+    if (tu_fifo_count(&cdc[itf].tx_ff) >= HOST_EP_PACKET)
+    {
+        tud_cdc_n_write_flush(itf);
+    }
+    return ret;
+}
+
+uint32_t tud_cdc_n_write_flush(uint8_t itf)
+{
+    host_cdc_t *p = &cdc[itf];
+
+    if (!tud_ready() || p->in_len)
+    {
+        return 0;
+    }
+    cdc_start_in(p);
+    return p->in_len;
+}
+
+uint32_t tud_cdc_n_write_available(uint8_t itf)
+{
+    return tu_fifo_remaining(&cdc[itf].tx_ff);
+}
+
+bool tud_cdc_n_write_clear(uint8_t itf)
+{
+    return tu_fifo_clear(&cdc[itf].tx_ff);
+}
+
+void host_cdc_set_dtr(uint8_t itf, bool dtr)
+{
+    cdc[itf].line_state = dtr ? 0x03u : 0x00u;
+    tu_fifo_set_overwritable(&cdc[itf].tx_ff, !dtr);
+    tud_cdc_line_state_cb(itf, dtr, dtr);
+}
+
+uint32_t host_cdc_send(uint8_t itf, const void *buf, uint32_t len)
+{
+    if (!mounted)
+    {
+        return 0;
+    }
+    if (itf == 0)
+    {
+        LATENCY_USB_TOKEN(LATENCY_EP_OUT, len);
+    }
+    return tu_fifo_write_n(&cdc[itf].rx_ff, buf, (uint16_t)len);
+}
+
+uint32_t host_cdc_send_str(uint8_t itf, const char *str)
+{
+    return host_cdc_send(itf, str, (uint32_t)strlen(str));
+}
+
+// Poll the bulk IN endpoint until len bytes or a short packet
+uint32_t host_cdc_recv(uint8_t itf, void *buf, uint32_t len)
+{
+    host_cdc_t *p = &cdc[itf];
+    uint32_t got = 0;
+
+    while (got < len && p->in_len)
+    {
+        uint32_t n = p->in_len;
+        if (n > len - got)
+        {
+            // A packet is only consumed whole
+            break;
+        }
+        memcpy((uint8_t *)buf + got, p->in_buf, n);
+        got += n;
+        p->in_len = 0;
+        if (itf == 0)
+        {
+            LATENCY_USB_TOKEN(LATENCY_EP_IN, n);
+        }
+        tud_cdc_tx_complete_cb(itf);
+
+        // Completion keeps the FIFO draining, a short packet ends it
+        if (tu_fifo_count(&p->tx_ff))
+        {
+            cdc_start_in(p);
+        }
+        if (n < HOST_EP_PACKET)
+        {
+            break;
+        }
+    }
+    return got;
+}
+
+uint32_t host_cdc_tx_queued(uint8_t itf)
+{
+    return tu_fifo_count(&cdc[itf].tx_ff) + cdc[itf].in_len;
+}
+
+uint32_t host_cdc_rx_queued(uint8_t itf)
+{
+    return tu_fifo_count(&cdc[itf].rx_ff);
+}
+
+
+//
+// Endpoints used directly by the application
+//
+
+bool usbd_edpt_claim(uint8_t rhport, uint8_t ep_addr)
+{
+    (void)rhport;
+    uint8_t n = tu_edpt_number(ep_addr);
+    if (ep_claimed[n] || ep_busy[n])
+    {
+        return false;
+    }
+    ep_claimed[n] = true;
+    return true;
+}
+
+bool usbd_edpt_release(uint8_t rhport, uint8_t ep_addr)
+{
+    (void)rhport;
+    ep_claimed[tu_edpt_number(ep_addr)] = false;
+    return true;
+}
+
+bool usbd_edpt_busy(uint8_t rhport, uint8_t ep_addr)
+{
+    (void)rhport;
+    return ep_busy[tu_edpt_number(ep_addr)];
+}
+
+bool usbd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t * buffer, uint16_t total_bytes)
+{
+    (void)rhport;
+    uint8_t n = tu_edpt_number(ep_addr);
+    if (!mounted || ep_busy[n])
+    {
+        return false;
+    }
+    ep_buf[n] = buffer;
+    ep_len[n] = total_bytes;
+    ep_busy[n] = true;
+    ep_claimed[n] = false;
+    return true;
+}
+
+uint32_t host_usb_ep_poll(uint8_t ep_addr, uint8_t *buf, uint32_t len)
+{
+    uint8_t n = tu_edpt_number(ep_addr);
+    if (!ep_busy[n])
+    {
+        return 0;
+    }
+    uint32_t got = (ep_len[n] < len) ? ep_len[n] : len;
+    memcpy(buf, ep_buf[n], got);
+    ep_busy[n] = false;
+    return got;
+}
+
+
+//
+// CDC-NCM
+//
+
+#if CFG_TUD_NCM
+void tud_network_recv_renew(void)
+{
+    net_recv_ready = true;
+}
+
+bool tud_network_can_xmit(uint16_t size)
+{
+    return mounted && net_in_len == 0 && size <= sizeof(net_in);
+}
+
+void tud_network_xmit(void *ref, uint16_t arg)
+{
+    if (net_in_len == 0)
+    {
+        net_in_len = tud_network_xmit_cb(net_in, ref, arg);
+    }
+}
+
+// The frame is copied into the OUT block, which the firmware owns until
+// it renews it
+bool host_net_send(const uint8_t *frame, uint16_t len)
+{
+    if (!mounted || !net_recv_ready || len > sizeof(net_out))
+    {
+        return false;
+    }
+    net_recv_ready = false;
+    memcpy(net_out, frame, len);
+    if (!tud_network_recv_cb(net_out, len))
+    {
+        net_recv_ready = true;
+        return false;
+    }
+    return true;
+}
+
+uint32_t host_net_recv(uint8_t *frame, uint32_t len)
+{
+    uint32_t got = (net_in_len < len) ? net_in_len : len;
+    memcpy(frame, net_in, got);
+    net_in_len = 0;
+    return got;
+}
+
+void host_net_link(bool up)
+{
+    tud_network_link_state_cb(up);
+}
+#endif
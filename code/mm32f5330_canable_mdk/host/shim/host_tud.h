@@ -0,0 +1,56 @@
+//
+// host_tud: TinyUSB device stack stand-in of the host build
+//
+// Implements the tud_cdc_n_*, device state, endpoint and network calls the
+// application makes, on top of the real tu_fifo. The host_* functions act
+// as the USB host: enumeration, line state, and the data it sends and
+// polls. Bytes written by the firmware reach the host once flushed, and
+// only while the host keeps reading them; otherwise the TX FIFO fills up
+// as it does when the host stops polling the bulk IN endpoint.
+//
+
+#ifndef _HOST_TUD_H
+#define _HOST_TUD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void host_tud_model_reset(void);
+
+// Device state as set by the host
+void host_usb_mount(bool mounted);
+void host_usb_bus_reset(void);
+void host_usb_suspend(bool remote_wakeup_en);
+void host_usb_resume(void);
+uint32_t host_usb_wakeup_requests(void);
+
+// CDC interfaces
+void host_cdc_set_dtr(uint8_t itf, bool dtr);
+uint32_t host_cdc_send(uint8_t itf, const void *buf, uint32_t len);
+uint32_t host_cdc_send_str(uint8_t itf, const char *str);
+uint32_t host_cdc_recv(uint8_t itf, void *buf, uint32_t len);
+uint32_t host_cdc_tx_queued(uint8_t itf);
+uint32_t host_cdc_rx_queued(uint8_t itf);
+
+// CDC FIFO depths from the next host_reset() on, for comparing sizes
+// below the build's; 0 keeps the build's size
+void host_cdc_fifo_size(uint16_t tx, uint16_t rx);
+
+// Other IN endpoints: the host polls a finished transfer, which completes
+// it and frees the endpoint. Returns the transfer length, 0 if none.
+uint32_t host_usb_ep_poll(uint8_t ep_addr, uint8_t *buf, uint32_t len);
+
+// CDC-NCM: Ethernet frames to and from the device
+bool host_net_send(const uint8_t *frame, uint16_t len);
+uint32_t host_net_recv(uint8_t *frame, uint32_t len);
+void host_net_link(bool up);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _HOST_TUD_H
@@ -0,0 +1,123 @@
+//
+// test: Firmware drivers shared by the host tests
+//
+
+#include <stdlib.h>
+#include "main.h"
+#include "slcan.h"
+#include "test.h"
+
+int test_failures = 0;
+
+static char recv_buf[65536];
+static char cmd_buf[4096];
+static char pop_buf[40];
+
+
+void test_app_boot(void)
+{
+    host_reset();
+    app_init();
+    host_usb_mount(true);
+    host_cdc_set_dtr(0, true);
+    test_app_run(2);
+    test_app_recv();
+}
+
+void test_app_run(uint32_t passes)
+{
+    for (uint32_t i = 0; i < passes; i++)
+    {
+        app_process();
+        host_advance_us(10);
+    }
+}
+
+const char *test_app_recv(void)
+{
+    uint32_t len = 0;
+    uint32_t n;
+
+    while (len < sizeof(recv_buf) - 1
+           && (n = host_cdc_recv(0, recv_buf + len, sizeof(recv_buf) - 1 - len)) > 0)
+    {
+        len += n;
+    }
+    recv_buf[len] = '\0';
+    return recv_buf;
+}
+
+const char *test_app_cmd(const char *line)
+{
+    host_cdc_send_str(0, line);
+    host_cdc_send_str(0, "\r");
+    test_app_run(4);
+    strncpy(cmd_buf, test_app_recv(), sizeof(cmd_buf) - 1);
+    cmd_buf[sizeof(cmd_buf) - 1] = '\0';
+    return cmd_buf;
+}
+
+int8_t test_slcan_parse(const char *line)
+{
+    uint8_t buf[SLCAN_MTU];
+    size_t len = strlen(line);
+
+    if (len > sizeof(buf))
+        return -1;
+    memcpy(buf, line, len);
+    return slcan_parse_str(buf, (uint8_t)len);
+}
+
+static uint8_t hex_nibble(char c)
+{
+    return (c >= 'a') ? (c - 'a' + 10) : (c >= 'A') ? (c - 'A' + 10) : (c - '0');
+}
+
+bool test_can_inject(uint32_t id, bool ext, const char *hex)
+{
+    host_can_frame_t frame;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.id = id;
+    frame.ext = ext;
+    frame.dlc = (uint8_t)(strlen(hex) / 2);
+    for (uint8_t i = 0; i < frame.dlc && i < 8; i++)
+    {
+        frame.data[i] = (uint8_t)(hex_nibble(hex[2 * i]) << 4 | hex_nibble(hex[2 * i + 1]));
+    }
+    frame.time_us = host_time_us();
+    return host_can_inject(&frame);
+}
+
+bool test_can_inject_remote(uint32_t id, bool ext, uint8_t dlc)
+{
+    host_can_frame_t frame;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.id = id;
+    frame.ext = ext;
+    frame.rtr = 1;
+    frame.dlc = dlc;
+    frame.time_us = host_time_us();
+    return host_can_inject(&frame);
+}
+
+const char *test_can_pop(void)
+{
+    host_can_frame_t frame;
+    int pos;
+
+    if (!host_can_tx_pop(&frame))
+    {
+        return "";
+    }
+    if (frame.ext)
+        pos = snprintf(pop_buf, sizeof(pop_buf), "%c%08X%u", frame.rtr ? 'R' : 'T', (unsigned)frame.id, frame.dlc);
+    else
+        pos = snprintf(pop_buf, sizeof(pop_buf), "%c%03X%u", frame.rtr ? 'r' : 't', (unsigned)frame.id, frame.dlc);
+    for (uint8_t i = 0; i < frame.dlc && !frame.rtr; i++)
+    {
+        pos += snprintf(pop_buf + pos, sizeof(pop_buf) - pos, "%02X", frame.data[i]);
+    }
+    return pop_buf;
+}
@@ -0,0 +1,81 @@
+//
+// test: Minimal checks and firmware drivers shared by the host tests
+//
+// Each test is its own executable linked with one firmware library; it
+// returns nonzero if any check failed. test_app_*() run the firmware the
+// way the USB host and the bus would.
+//
+
+#ifndef _TEST_H
+#define _TEST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "host_hw.h"
+#include "host_tud.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int test_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) do { \
+        long long check_a_ = (long long)(a), check_b_ = (long long)(b); \
+        if (check_a_ != check_b_) { \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", \
+                    __FILE__, __LINE__, #a, #b, check_a_, check_b_); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_STR(a, b) do { \
+        const char *check_a_ = (a), *check_b_ = (b); \
+        if (strcmp(check_a_, check_b_) != 0) { \
+            fprintf(stderr, "%s:%d: CHECK_STR(%s, %s) failed: \"%s\" != \"%s\"\n", \
+                    __FILE__, __LINE__, #a, #b, check_a_, check_b_); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define TEST_RESULT() (test_failures ? (fprintf(stderr, "%d check(s) failed\n", test_failures), 1) : 0)
+
+// Power up the firmware, enumerate and open the slcan port with DTR
+void test_app_boot(void);
+
+// Run the main loop n times
+void test_app_run(uint32_t passes);
+
+// Send a command line (CR appended) and run the loop until it is handled.
+// Returns what the device wrote back meanwhile, CR shown as '\r'.
+const char *test_app_cmd(const char *line);
+
+// Hand one command line (no CR) straight to the parser, for its status:
+// 0 accepted, -1 rejected
+int8_t test_slcan_parse(const char *line);
+
+// Everything the device has sent on the slcan interface, NUL-terminated;
+// the buffer is reused by the next call
+const char *test_app_recv(void);
+
+// A data frame from another node, payload given as hex digits
+bool test_can_inject(uint32_t id, bool ext, const char *hex);
+bool test_can_inject_remote(uint32_t id, bool ext, uint8_t dlc);
+
+// Next frame the device put on the bus as slcan text, "" if none
+const char *test_can_pop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TEST_H
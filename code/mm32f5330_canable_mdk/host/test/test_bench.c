@@ -0,0 +1,65 @@
+//
+// test_bench: 'B' command parsing and the loopback benchmark run
+//
+// A short or malformed 'B' line is rejected and leaves a running
+// benchmark alone; only a bare 'B' aborts it.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "bench.h"
+#include "can.h"
+
+int main(void)
+{
+    bench_result_t res;
+
+    test_app_boot();
+    test_app_cmd("S8");
+
+    // 1000 frames at 1000 frames/s, so the run lasts a second
+    test_app_cmd("B10010F88000003E803E8");
+    CHECK(bench_running());
+    CHECK(host_can_loopback());
+
+    // Malformed lines do not stop it
+    test_app_cmd("B12");
+    CHECK(bench_running());
+    test_app_cmd("B10010F880000");
+    CHECK(bench_running());
+
+    // A bare 'B' aborts and reports what was measured so far
+    for (uint32_t i = 0; i < 100; i++)
+    {
+        test_app_run(1);
+        test_app_recv();
+        host_advance_us(1000);
+    }
+    const char *rx = test_app_cmd("B");
+    CHECK(!bench_running());
+    CHECK(!host_can_enabled());
+    const char *line = strrchr(rx, 'B');
+    CHECK(line != NULL && strlen(line) == 34);
+    bench_get_result(&res);
+    CHECK(res.frames > 50 && res.frames < 200);
+    // Frames still queued for transmission at the abort count as dropped
+    CHECK(res.drops < TXQUEUE_LEN);
+    CHECK(res.frames_per_s > 800 && res.frames_per_s < 1200);
+    // t1xx8 + 16 digits + CR per frame
+    CHECK_EQ(res.cdc_bytes_per_s, res.frames_per_s * 22);
+
+    // A full run at maximum rate forwards everything
+    test_app_cmd("B10010F88000001F40000");
+    for (uint32_t i = 0; i < 2000 && bench_running(); i++)
+    {
+        test_app_run(1);
+        test_app_recv();
+        host_advance_us(100);
+    }
+    CHECK(!bench_running());
+    bench_get_result(&res);
+    CHECK_EQ(res.frames, 500);
+    CHECK_EQ(res.drops, 0);
+
+    return TEST_RESULT();
+}
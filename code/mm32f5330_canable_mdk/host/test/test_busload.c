@@ -0,0 +1,209 @@
+//
+// test_busload: Stuffed frame length and the 'b' / 'L' commands
+//
+// busload_frame_bits() is checked against a reference which builds the
+// whole frame as a bit string, computes the CRC-15 over it and counts the
+// stuff bits by scanning it, and against the bounds of ISO 11898-1: an
+// unstuffed frame is 47 + 8 * n bits (standard) or 67 + 8 * n bits
+// (extended), stuffing adds at most (stuffable bits - 1) / 4.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "busload.h"
+
+#define REF_MAX_BITS    160u
+
+static FLEXCAN_Mb_Type make_frame(uint32_t id, bool ext, bool rtr, uint8_t dlc, const uint8_t *data)
+{
+    FLEXCAN_Mb_Type frame;
+    uint8_t d[8] = {0};
+
+    memset(&frame, 0, sizeof(frame));
+    frame.ID = id;
+    frame.FORMAT = ext ? FLEXCAN_MbFormat_Extended : FLEXCAN_MbFormat_Standard;
+    frame.TYPE = rtr ? FLEXCAN_MbType_Remote : FLEXCAN_MbType_Data;
+    frame.LENGTH = dlc;
+    if (data)
+        memcpy(d, data, dlc > 8 ? 8 : dlc);
+    frame.BYTE0 = d[0]; frame.BYTE1 = d[1]; frame.BYTE2 = d[2]; frame.BYTE3 = d[3];
+    frame.BYTE4 = d[4]; frame.BYTE5 = d[5]; frame.BYTE6 = d[6]; frame.BYTE7 = d[7];
+    return frame;
+}
+
+static uint32_t ref_put(uint8_t *bits, uint32_t n, uint32_t value, uint8_t width)
+{
+    while (width--)
+        bits[n++] = (value >> width) & 1u;
+    return n;
+}
+
+// Frame bits from SOF to the end of the data field, unstuffed
+static uint32_t ref_bits(uint8_t *bits, uint32_t id, bool ext, bool rtr, uint8_t dlc, const uint8_t *data)
+{
+    uint32_t n = 0;
+
+    n = ref_put(bits, n, 0, 1);
+    if (ext)
+    {
+        n = ref_put(bits, n, id >> 18, 11);
+        n = ref_put(bits, n, 1, 1);             // SRR
+        n = ref_put(bits, n, 1, 1);             // IDE
+        n = ref_put(bits, n, id & 0x3FFFFu, 18);
+        n = ref_put(bits, n, rtr, 1);
+        n = ref_put(bits, n, 0, 2);             // r1, r0
+    } else {
+        n = ref_put(bits, n, id, 11);
+        n = ref_put(bits, n, rtr, 1);
+        n = ref_put(bits, n, 0, 1);             // IDE
+        n = ref_put(bits, n, 0, 1);             // r0
+    }
+    n = ref_put(bits, n, dlc, 4);
+    for (uint8_t i = 0; !rtr && i < dlc && i < 8; i++)
+        n = ref_put(bits, n, data[i], 8);
+    return n;
+}
+
+static uint16_t ref_crc15(const uint8_t *bits, uint32_t n)
+{
+    uint16_t crc = 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        uint16_t top = (crc >> 14) & 1u;
+        crc = (uint16_t)((crc << 1) & 0x7FFFu);
+        if (bits[i] ^ top)
+            crc ^= 0x4599u;
+    }
+    return crc;
+}
+
+// Bit times on the wire: SOF..CRC stuffed, then the fixed trailer
+static uint32_t ref_frame_bits(uint32_t id, bool ext, bool rtr, uint8_t dlc, const uint8_t *data, uint16_t *crc_out)
+{
+    uint8_t bits[REF_MAX_BITS];
+    uint32_t n = ref_bits(bits, id, ext, rtr, dlc, data);
+    uint16_t crc = ref_crc15(bits, n);
+    n = ref_put(bits, n, crc, 15);
+
+    uint32_t stuff = 0, run = 1;
+    uint8_t level = bits[0];
+    for (uint32_t i = 1; i < n; i++)
+    {
+        if (bits[i] == level)
+        {
+            if (++run == 5)
+            {
+                // The stuff bit has the opposite level and starts a new run
+                stuff++;
+                level = !level;
+                run = 1;
+            }
+        } else {
+            level = bits[i];
+            run = 1;
+        }
+    }
+    if (crc_out)
+        *crc_out = crc;
+    return n + stuff + BUSLOAD_TRAILER_BITS;
+}
+
+static void check_frame(uint32_t id, bool ext, bool rtr, uint8_t dlc, const uint8_t *data)
+{
+    FLEXCAN_Mb_Type frame = make_frame(id, ext, rtr, dlc, data);
+    uint16_t crc;
+    uint32_t ref = ref_frame_bits(id, ext, rtr, dlc, data, &crc);
+    uint32_t payload = rtr ? 0u : 8u * (dlc > 8 ? 8 : dlc);
+    // SOF up to and including the CRC sequence
+    uint32_t stuffable = (ext ? 54u : 34u) + payload;
+    uint32_t min = stuffable + BUSLOAD_TRAILER_BITS;
+
+    CHECK_EQ(busload_crc15(&frame), crc);
+    CHECK_EQ(busload_frame_bits(&frame), ref);
+    CHECK(ref >= min);
+    CHECK(ref <= min + (stuffable - 1u) / 4u);
+}
+
+int main(void)
+{
+    static const uint8_t zeros[8] = {0};
+    static const uint8_t ones[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    static const uint8_t alt[8] = {0x55, 0xAA, 0x55, 0xAA, 0x55, 0xAA, 0x55, 0xAA};
+    static const uint8_t seq[8] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF};
+
+    // Pinned lengths of 8-byte standard frames (111 bits unstuffed): all
+    // zeros stuffs one bit per five, ID 0x555 with 0x55/0xAA not at all
+    FLEXCAN_Mb_Type f = make_frame(0x000, false, false, 8, zeros);
+    CHECK_EQ(busload_frame_bits(&f), 127);
+    f = make_frame(0x555, false, false, 8, alt);
+    CHECK_EQ(busload_crc15(&f), 0x09B6);
+    CHECK_EQ(busload_frame_bits(&f), 111);
+
+    // Fixed patterns, all lengths, both formats, data and remote
+    for (uint8_t dlc = 0; dlc <= 8; dlc++)
+    {
+        check_frame(0x000, false, false, dlc, zeros);
+        check_frame(0x7FF, false, false, dlc, ones);
+        check_frame(0x555, false, false, dlc, alt);
+        check_frame(0x123, false, false, dlc, seq);
+        check_frame(0x123, false, true, dlc, NULL);
+        check_frame(0x00000000, true, false, dlc, zeros);
+        check_frame(0x1FFFFFFF, true, false, dlc, ones);
+        check_frame(0x15555555, true, false, dlc, alt);
+        check_frame(0x18DAF110, true, false, dlc, seq);
+        check_frame(0x18DAF110, true, true, dlc, NULL);
+    }
+
+    // Random frames
+    srand(26);
+    for (uint32_t i = 0; i < 20000; i++)
+    {
+        uint8_t data[8];
+        bool ext = rand() & 1;
+        for (uint8_t j = 0; j < 8; j++)
+            data[j] = (uint8_t)rand();
+        uint32_t id = (uint32_t)rand() & (ext ? 0x1FFFFFFFu : 0x7FFu);
+        check_frame(id, ext, (rand() & 7) == 0, (uint8_t)(rand() % 9), data);
+    }
+
+    // 'L' opens listen-only just for this session, 'O' then opens normal
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("L");
+    CHECK(host_can_enabled());
+    CHECK(host_can_listen_only());
+    test_app_cmd("C");
+    CHECK(!host_can_enabled());
+    test_app_cmd("O");
+    CHECK(host_can_enabled());
+    CHECK(!host_can_listen_only());
+    test_app_cmd("C");
+
+    // Silent mode stays in force for 'O' after an 'L' session
+    test_app_cmd("M1");
+    test_app_cmd("L");
+    test_app_cmd("C");
+    test_app_cmd("O");
+    CHECK(host_can_listen_only());
+    test_app_cmd("C");
+    test_app_cmd("M0");
+
+    // 'b' reports the load, 'bxxxx' sets the window
+    test_app_cmd("O");
+    test_app_cmd("b0064");
+    for (uint32_t i = 0; i < 100; i++)
+    {
+        CHECK(test_can_inject(0x100, false, "0011223344556677"));
+        test_app_run(1);
+        host_advance_us(1000);
+    }
+    test_app_recv();
+    const char *reply = test_app_cmd("b");
+    CHECK_EQ(strlen(reply), 10);
+    CHECK(reply[0] == 'b');
+    unsigned load = (unsigned)strtoul((char[5]){reply[1], reply[2], reply[3], reply[4], 0}, NULL, 16);
+    // One frame of about 125 bits per ms at 1 Mbit/s
+    CHECK(load > 1000 && load < 1500);
+
+    return TEST_RESULT();
+}
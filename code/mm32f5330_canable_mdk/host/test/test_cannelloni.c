@@ -0,0 +1,354 @@
+//
+// test_cannelloni: CAN over UDP on the NCM network function
+//
+// The test is the host end of the USB Ethernet link: it builds ARP
+// requests and cannelloni datagrams as Linux and cannelloni would send
+// them, and takes apart what the device sends back, checking every
+// header field and checksum. Frames of a datagram go on the bus, and the
+// datagram is held until they fit into the TX queue. Once the peer is
+// known, received frames reach it batched into datagrams, never slcan;
+// while the host takes no datagrams they are dropped and counted.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "can.h"
+#include "cannelloni.h"
+#include "error.h"
+
+#define HOST_PORT       43000u
+
+// cannelloni frame as the test describes it
+typedef struct
+{
+    uint32_t id;            // With the EFF/RTR/ERR flags of the wire format
+    uint8_t len;            // FD flag included
+    uint8_t data[8];
+} cnl_frame_t;
+
+static const uint8_t host_ip[4] = {192, 168, 7, 1};
+static const uint8_t device_ip[4] = CANNELLONI_IP;
+extern const uint8_t tud_network_mac_address[6];
+
+static uint8_t *put16(uint8_t *p, uint16_t v)
+{
+    *p++ = v >> 8;
+    *p++ = v & 0xFFu;
+    return p;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint16_t ip_checksum(const uint8_t *hdr, uint16_t len)
+{
+    uint32_t sum = 0;
+    for (uint16_t i = 0; i < len; i += 2)
+        sum += get16(&hdr[i]);
+    while (sum >> 16)
+        sum = (sum & 0xFFFFu) + (sum >> 16);
+    return ~sum & 0xFFFFu;
+}
+
+static void device_mac(uint8_t *mac)
+{
+    memcpy(mac, tud_network_mac_address, 6);
+    mac[5] ^= 0x01u;
+}
+
+static uint8_t *eth_header(uint8_t *p, uint16_t type)
+{
+    device_mac(p);
+    memcpy(p + 6, tud_network_mac_address, 6);
+    return put16(p + 12, type);
+}
+
+static uint16_t arp_request(uint8_t *buf, const uint8_t *target_ip)
+{
+    uint8_t *p = eth_header(buf, 0x0806);
+    p = put16(p, 1);
+    p = put16(p, 0x0800);
+    *p++ = 6;
+    *p++ = 4;
+    p = put16(p, 1);
+    memcpy(p, tud_network_mac_address, 6);
+    memcpy(p + 6, host_ip, 4);
+    memset(p + 10, 0, 6);
+    memcpy(p + 16, target_ip, 4);
+    return (uint16_t)(p + 20 - buf);
+}
+
+static uint16_t datagram(uint8_t *buf, uint16_t port, const cnl_frame_t *frames, uint16_t count)
+{
+    uint8_t *p = eth_header(buf, 0x0800);
+    uint8_t *ip = p;
+    uint8_t *cnl = ip + 28;
+
+    cnl[0] = 2;
+    cnl[1] = 0;
+    cnl[2] = 0;
+    p = put16(&cnl[3], count);
+    for (uint16_t i = 0; i < count; i++)
+    {
+        p = put16(p, frames[i].id >> 16);
+        p = put16(p, frames[i].id & 0xFFFFu);
+        *p++ = frames[i].len;
+        uint8_t size = frames[i].len & 0x7Fu;
+        if (frames[i].len & 0x80u)
+            *p++ = 0;
+        else if (frames[i].id & 0x40000000u)
+            size = 0;
+        memcpy(p, frames[i].data, size);
+        p += size;
+    }
+    uint16_t udp_len = (uint16_t)(p - (ip + 20));
+
+    memset(ip, 0, 20);
+    ip[0] = 0x45;
+    put16(&ip[2], 20 + udp_len);
+    put16(&ip[6], 0x4000);
+    ip[8] = 64;
+    ip[9] = 17;
+    memcpy(&ip[12], host_ip, 4);
+    memcpy(&ip[16], device_ip, 4);
+    put16(&ip[10], ip_checksum(ip, 20));
+    put16(&ip[20], HOST_PORT);
+    put16(&ip[22], port);
+    put16(&ip[24], udp_len);
+    put16(&ip[26], 0);
+    return (uint16_t)(p - buf);
+}
+
+static bool send(const uint8_t *frame, uint16_t len)
+{
+    bool ok = host_net_send(frame, len);
+    test_app_run(2);
+    return ok;
+}
+
+// Frames of a datagram from the device after checking its headers,
+// -1 if none was sent
+static int recv_datagram(cnl_frame_t *frames, int max)
+{
+    uint8_t buf[1600];
+    uint8_t mac[6];
+    uint32_t len = host_net_recv(buf, sizeof(buf));
+
+    if (len == 0)
+        return -1;
+    device_mac(mac);
+    CHECK(len >= 14 + 20 + 8 + 5);
+    CHECK(memcmp(&buf[0], tud_network_mac_address, 6) == 0);
+    CHECK(memcmp(&buf[6], mac, 6) == 0);
+    CHECK_EQ(get16(&buf[12]), 0x0800);
+
+    const uint8_t *ip = &buf[14];
+    CHECK_EQ(ip[0], 0x45);
+    CHECK_EQ(get16(&ip[2]), len - 14);
+    CHECK_EQ(ip[9], 17);
+    CHECK_EQ(ip_checksum(ip, 20), 0);
+    CHECK(memcmp(&ip[12], device_ip, 4) == 0);
+    CHECK(memcmp(&ip[16], host_ip, 4) == 0);
+
+    const uint8_t *udp = ip + 20;
+    CHECK_EQ(get16(&udp[0]), CANNELLONI_PORT);
+    CHECK_EQ(get16(&udp[2]), HOST_PORT);
+    CHECK_EQ(get16(&udp[4]), len - 34);
+
+    const uint8_t *cnl = udp + 8;
+    CHECK_EQ(cnl[0], 2);
+    CHECK_EQ(cnl[1], 0);
+    int count = get16(&cnl[3]);
+    const uint8_t *p = cnl + 5;
+    for (int i = 0; i < count; i++)
+    {
+        cnl_frame_t f;
+        memset(&f, 0, sizeof(f));
+        f.id = (uint32_t)get16(p) << 16 | get16(p + 2);
+        f.len = p[4];
+        p += 5;
+        uint8_t size = (f.id & 0x40000000u) ? 0 : f.len;
+        memcpy(f.data, p, size);
+        p += size;
+        if (i < max)
+            frames[i] = f;
+    }
+    CHECK_EQ(p - buf, len);
+    return count;
+}
+
+static void run_ms(uint32_t ms)
+{
+    test_app_run(ms * 100u);
+}
+
+int main(void)
+{
+    uint8_t buf[1600], reply[1600];
+    uint16_t len;
+    cnl_frame_t frames[64];
+
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    host_net_link(true);
+
+    //
+    // ARP: our address only
+    //
+
+    uint8_t other_ip[4] = {192, 168, 7, 9};
+    CHECK(send(buf, arp_request(buf, other_ip)));
+    CHECK_EQ(host_net_recv(reply, sizeof(reply)), 0);
+    CHECK(send(buf, arp_request(buf, device_ip)));
+    CHECK_EQ(host_net_recv(reply, sizeof(reply)), 42);
+    uint8_t mac[6];
+    device_mac(mac);
+    CHECK(memcmp(&reply[0], tud_network_mac_address, 6) == 0);
+    CHECK(memcmp(&reply[6], mac, 6) == 0);
+    CHECK_EQ(get16(&reply[12]), 0x0806);
+    CHECK_EQ(get16(&reply[20]), 2);
+    CHECK(memcmp(&reply[22], mac, 6) == 0);
+    CHECK(memcmp(&reply[28], device_ip, 4) == 0);
+    CHECK(memcmp(&reply[32], tud_network_mac_address, 6) == 0);
+    CHECK(memcmp(&reply[38], host_ip, 4) == 0);
+
+    // Without a peer, received frames stay on slcan
+    CHECK(test_can_inject(0x123, false, "11"));
+    run_ms(2);
+    CHECK_STR(test_app_recv(), "t12311100000000000000\r");
+    CHECK_EQ(host_net_recv(reply, sizeof(reply)), 0);
+
+    //
+    // Datagrams to the bus
+    //
+
+    memset(frames, 0, sizeof(frames));
+    frames[0] = (cnl_frame_t){ 0x123, 2, {0xAA, 0xBB} };
+    frames[1] = (cnl_frame_t){ 0x80000000u | 0x1234567, 8, {1, 2, 3, 4, 5, 6, 7, 8} };
+    frames[2] = (cnl_frame_t){ 0x40000000u | 0x321, 4, {0} };
+    frames[3] = (cnl_frame_t){ 0x456, 0x80 | 3, {1, 2, 3} };      // CAN FD, skipped
+    frames[4] = (cnl_frame_t){ 0x20000000u | 0x4, 8, {0} };       // Error frame, skipped
+    frames[5] = (cnl_frame_t){ 0x7FF, 0, {0} };
+    host_can_tx_clear();
+    CHECK(send(buf, datagram(buf, CANNELLONI_PORT, frames, 6)));
+    test_app_run(10);
+    CHECK_STR(test_can_pop(), "t1232AABB");
+    CHECK_STR(test_can_pop(), "T0123456780102030405060708");
+    CHECK_STR(test_can_pop(), "r3214");
+    CHECK_STR(test_can_pop(), "t7FF0");
+    CHECK_STR(test_can_pop(), "");
+
+    // Other port, broken IP checksum: ignored
+    len = datagram(buf, CANNELLONI_PORT + 1, frames, 1);
+    CHECK(send(buf, len));
+    len = datagram(buf, CANNELLONI_PORT, frames, 1);
+    buf[14 + 10] ^= 0x01u;
+    CHECK(send(buf, len));
+    test_app_run(10);
+    CHECK_STR(test_can_pop(), "");
+
+    // A datagram waits for room in the TX queue, the next one with it
+    host_can_hold_tx(true);
+    for (uint16_t i = 0; i < 40; i++)
+        frames[i] = (cnl_frame_t){ 0x600 + i, 1, {(uint8_t)i} };
+    CHECK(send(buf, datagram(buf, CANNELLONI_PORT, frames, 20)));
+    CHECK(send(buf, datagram(buf, CANNELLONI_PORT, frames + 20, 20)));
+    CHECK(!send(buf, datagram(buf, CANNELLONI_PORT, frames, 1)));
+    host_can_hold_tx(false);
+    for (uint16_t i = 0; i < 40; i++)
+    {
+        host_can_release_tx(1);
+        test_app_run(2);
+    }
+    test_app_run(10);
+    for (uint16_t i = 0; i < 40; i++)
+    {
+        char line[16];
+        snprintf(line, sizeof(line), "t%03X1%02X", 0x600 + i, i);
+        CHECK_STR(test_can_pop(), line);
+    }
+    CHECK_STR(test_can_pop(), "");
+    CHECK(send(buf, datagram(buf, CANNELLONI_PORT, frames, 1)));
+    test_app_run(10);
+    CHECK_STR(test_can_pop(), "t6001" "00");
+    test_app_recv();
+
+    //
+    // Received frames to the peer, batched
+    //
+
+    CHECK(test_can_inject(0x100, false, "0102"));
+    CHECK(test_can_inject(0x1ABCDEF0, true, "0102030405060708"));
+    CHECK(test_can_inject_remote(0x200, false, 3));
+    test_app_run(10);
+    CHECK_EQ(recv_datagram(frames, 64), -1);
+    run_ms(2);
+    CHECK_EQ(recv_datagram(frames, 64), 3);
+    CHECK_EQ(frames[0].id, 0x100);
+    CHECK_EQ(frames[0].len, 2);
+    CHECK_EQ(frames[0].data[1], 0x02);
+    CHECK_EQ(frames[1].id, 0x80000000u | 0x1ABCDEF0);
+    CHECK_EQ(frames[1].data[7], 0x08);
+    CHECK_EQ(frames[2].id, 0x40000000u | 0x200);
+    CHECK_EQ(frames[2].len, 3);
+    CHECK_STR(test_app_recv(), "");
+
+    //
+    // The host takes no datagrams: one in the IN block, one batch full,
+    // the rest dropped and counted, none on slcan
+    //
+
+    uint32_t dropped = error_count(ERR_USBTX_BUSY);
+    uint32_t injected = 0;
+    for (uint32_t i = 0; i < 200; i++)
+    {
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016X", (unsigned)i);
+        CHECK(test_can_inject(0x300, false, hex));
+        injected++;
+        test_app_run(20);
+    }
+    run_ms(2);
+    CHECK_STR(test_app_recv(), "");
+    int first = recv_datagram(frames, 64);
+    run_ms(2);
+    int second = recv_datagram(frames, 64);
+    run_ms(2);
+    CHECK_EQ(recv_datagram(frames, 64), -1);
+    CHECK(first > 0 && second > 0);
+    CHECK_EQ(first + second + (error_count(ERR_USBTX_BUSY) - dropped), injected);
+    CHECK(error_count(ERR_USBTX_BUSY) > dropped);
+
+    // Flowing again once the host reads
+    CHECK(test_can_inject(0x301, false, "55"));
+    run_ms(2);
+    CHECK_EQ(recv_datagram(frames, 64), 1);
+    CHECK_EQ(frames[0].id, 0x301);
+
+    //
+    // Closed bus: datagrams are released, not held
+    //
+
+    test_app_cmd("C");
+    host_can_tx_clear();
+    CHECK(send(buf, datagram(buf, CANNELLONI_PORT, frames, 1)));
+    CHECK(send(buf, datagram(buf, CANNELLONI_PORT, frames, 1)));
+    CHECK_STR(test_can_pop(), "");
+    test_app_cmd("O");
+
+    //
+    // Link down: the peer is forgotten, frames go to slcan again
+    //
+
+    host_net_link(false);
+    host_net_link(true);
+    CHECK(test_can_inject(0x124, false, "22"));
+    run_ms(2);
+    CHECK_STR(test_app_recv(), "t12412200000000000000\r");
+    CHECK_EQ(recv_datagram(frames, 64), -1);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,108 @@
+//
+// test_capture: Arming order and snapshots of the triggered capture
+//
+// Payload conditions ('X3') are staged before the 'X1' which arms with
+// them, cannot change while recording, and do not outlive the capture.
+//
+
+#include <stdlib.h>
+#include "test.h"
+
+// Frames of the snapshot streamed by 'X': payload bytes 0..1 of each
+// 'x' line as a number, -1 terminated; returns the count of the 'X' line
+static int stream(int *seq, int max)
+{
+    host_cdc_send_str(0, "X\r");
+    test_app_run(20);
+    const char *p = test_app_recv();
+    int n = 0, total = -1;
+
+    while (*p)
+    {
+        const char *cr = strchr(p, '\r');
+        if (!cr)
+            break;
+        if (p[0] == 'x' && n < max)
+        {
+            // 'x' + tick (8) + 't' + ID (3) + DLC (1) + data
+            char b[5] = { p[14], p[15], p[16], p[17], 0 };
+            seq[n++] = (int)strtol(b, NULL, 16);
+        }
+        else if (p[0] == 'X')
+        {
+            char b[5] = { p[1], p[2], p[3], p[4], 0 };
+            total = (int)strtol(b, NULL, 16);
+        }
+        p = cr + 1;
+    }
+    seq[n] = -1;
+    CHECK_EQ(n, total);
+    return total;
+}
+
+static void frame(uint32_t id, uint16_t seq, uint8_t b2)
+{
+    char hex[7];
+    snprintf(hex, sizeof(hex), "%04X%02X", seq, b2);
+    CHECK(test_can_inject(id, false, hex));
+    test_app_run(2);
+    test_app_recv();
+}
+
+int main(void)
+{
+    int seq[128];
+
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+
+    // Payload staged first: ID 0x200 with byte 2 == 0xAA triggers, 2 pre, 2 post
+    test_app_cmd("X300000AA000000FF00");
+    test_app_cmd("X1000000200000007FF0202");
+    frame(0x100, 1, 0x00);
+    frame(0x200, 2, 0x55);      // ID matches, payload does not
+    frame(0x100, 3, 0x00);
+    frame(0x200, 4, 0xAA);      // Trigger
+    frame(0x100, 5, 0x00);
+    frame(0x100, 6, 0x00);
+    frame(0x100, 7, 0x00);      // After the snapshot
+    CHECK_EQ(stream(seq, 127), 5);
+    CHECK(seq[0] == 2 && seq[1] == 3 && seq[2] == 4 && seq[3] == 5 && seq[4] == 6);
+
+    // The payload condition went with that capture: ID alone triggers now
+    test_app_cmd("X1000000200000007FF0001");
+    frame(0x200, 8, 0x55);
+    frame(0x100, 9, 0x00);
+    CHECK_EQ(stream(seq, 127), 2);
+    CHECK(seq[0] == 8 && seq[1] == 9);
+
+    // No condition can change while recording
+    test_app_cmd("X1000000300000007FF0000");
+    test_app_cmd("X300000AA000000FF00");
+    test_app_cmd("X1000000400000007FF0000");
+    frame(0x400, 10, 0x00);
+    frame(0x300, 11, 0x00);
+    CHECK_EQ(stream(seq, 127), 1);
+    CHECK(seq[0] == 11);
+
+    // 'X0' disarms and drops staged conditions
+    test_app_cmd("X300000AA000000FF00");
+    test_app_cmd("X0");
+    test_app_cmd("X1000000500000007FF0000");
+    frame(0x500, 12, 0x00);
+    CHECK_EQ(stream(seq, 127), 1);
+    CHECK(seq[0] == 12);
+
+    // Both payload words, pre-trigger history limited by 'pre'
+    test_app_cmd("X3000100000FFFF0000");
+    test_app_cmd("X340000000000000000");
+    test_app_cmd("X1000000600000007FF0300");
+    for (uint16_t i = 20; i < 30; i++)
+        frame(0x600, i, 0x00);
+    frame(0x600, 0x0010, 0x00);
+    CHECK_EQ(stream(seq, 127), 4);
+    CHECK(seq[0] == 27 && seq[3] == 0x10);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,206 @@
+//
+// test_config: Wear-levelled configuration page on the flash model
+//
+// Records are appended, carry a CRC-16/CCITT the firmware and the
+// reference below agree on, and a power cut at any program or erase step
+// leaves either the previous or the new configuration. The only window
+// with neither is after the page erase of a roll-over and before the new
+// record is complete, when the page holds no record at all. The CPU
+// would be off after the cut, so what the interrupted save returns is not
+// checked, only what the next power-up finds.
+//
+
+#include "test.h"
+#include "config.h"
+#include "can.h"
+#include "error.h"
+
+#define RECORD_STEPS    (CONFIG_RECORD_SIZE / 2u)
+
+static uint16_t ref_crc16(const uint8_t *data, uint32_t len)
+{
+    uint16_t crc = 0xFFFFu;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        for (int8_t b = 7; b >= 0; b--)
+        {
+            uint16_t in = (data[i] >> b) & 1u;
+            uint16_t top = (crc >> 15) & 1u;
+            crc = (uint16_t)(crc << 1);
+            if (in ^ top)
+                crc ^= 0x1021u;
+        }
+    }
+    return crc;
+}
+
+static config_t make_config(uint32_t n)
+{
+    config_t c;
+    memset(&c, 0, sizeof(c));
+    c.bitrate = (uint8_t)(n % CAN_BITRATE_INVALID);
+    c.autoretransmit = 1;
+    c.filter_id = 0x10000u + n;
+    c.filter_mask = n;
+    return c;
+}
+
+static bool config_equal(const config_t *a, const config_t *b)
+{
+    return memcmp(a, b, sizeof(*a)) == 0;
+}
+
+static const config_record_t *slot(uint32_t i)
+{
+    return (const config_record_t *)(uintptr_t)(CONFIG_FLASH_ADDR + i * CONFIG_RECORD_SIZE);
+}
+
+static uint32_t used_slots(void)
+{
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < CONFIG_RECORD_NUM; i++)
+    {
+        if (slot(i)->magic != 0xFFFFu)
+            used = i + 1;
+    }
+    return used;
+}
+
+// Fresh page holding exactly the given number of records, the last one n
+static void fill_page(uint32_t records, uint32_t n)
+{
+    host_flash_erase_all();
+    for (uint32_t i = 0; i < records; i++)
+    {
+        config_t c = make_config(n - records + 1 + i);
+        CHECK(config_save(&c));
+    }
+    CHECK_EQ(used_slots(), records);
+}
+
+int main(void)
+{
+    config_t c, loaded;
+
+    host_reset();
+
+    // Reference CRC check value
+    CHECK_EQ(ref_crc16((const uint8_t *)"123456789", 9), 0x29B1);
+
+    // Blank page: nothing stored
+    host_flash_erase_all();
+    CHECK(!config_load(&loaded));
+
+    // Appends go to consecutive slots with increasing seq, the page is
+    // erased once full and the newest record always wins
+    for (uint32_t n = 0; n < 2 * CONFIG_RECORD_NUM + 3; n++)
+    {
+        uint32_t steps = host_flash_steps();
+        c = make_config(n);
+        CHECK(config_save(&c));
+        uint32_t rolled = (n > 0 && n % CONFIG_RECORD_NUM == 0) ? 1u : 0u;
+        CHECK_EQ(host_flash_steps() - steps, RECORD_STEPS + rolled);
+
+        const config_record_t *rec = slot(n % CONFIG_RECORD_NUM);
+        CHECK_EQ(rec->magic, CONFIG_RECORD_MAGIC);
+        CHECK_EQ(rec->seq, n);
+        CHECK_EQ(rec->crc, ref_crc16((const uint8_t *)rec, CONFIG_RECORD_SIZE - 2));
+        CHECK_EQ(used_slots(), n % CONFIG_RECORD_NUM + 1);
+        CHECK(config_load(&loaded));
+        CHECK(config_equal(&loaded, &c));
+    }
+
+    // A corrupted newest record falls back to the one before
+    fill_page(3, 102);
+    ((uint8_t *)(uintptr_t)slot(2))[8] ^= 0x01;
+    CHECK(config_load(&loaded));
+    c = make_config(101);
+    CHECK(config_equal(&loaded, &c));
+    // and the next save goes behind the damaged slot
+    c = make_config(103);
+    CHECK(config_save(&c));
+    CHECK_EQ(used_slots(), 4);
+    CHECK(config_load(&loaded));
+    CHECK(config_equal(&loaded, &c));
+
+    // Power cut while appending: the old record or the new one, never
+    // anything else, and the next save works
+    for (uint32_t k = 0; k <= RECORD_STEPS; k++)
+    {
+        fill_page(5, 200);
+        c = make_config(201);
+        host_flash_power_cut_after(k);
+        config_save(&c);
+        host_flash_power_on();
+
+        config_t expect = (k >= RECORD_STEPS) ? make_config(201) : make_config(200);
+        CHECK(config_load(&loaded));
+        CHECK(config_equal(&loaded, &expect));
+
+        c = make_config(300 + k);
+        CHECK(config_save(&c));
+        CHECK(config_load(&loaded));
+        CHECK(config_equal(&loaded, &c));
+    }
+
+    // Power cut during a roll-over: step 0 is the page erase
+    for (uint32_t k = 0; k <= RECORD_STEPS + 1; k++)
+    {
+        fill_page(CONFIG_RECORD_NUM, 400);
+        c = make_config(401);
+        host_flash_power_cut_after(k);
+        config_save(&c);
+        host_flash_power_on();
+
+        bool found = config_load(&loaded);
+        if (k == 0)
+        {
+            // Erase lost, the full page still holds the old record
+            config_t expect = make_config(400);
+            CHECK(found && config_equal(&loaded, &expect));
+        }
+        else if (k <= RECORD_STEPS)
+        {
+            // Erased, new record torn: defaults are used
+            CHECK(!found);
+        }
+        else
+        {
+            CHECK(found && config_equal(&loaded, &c));
+        }
+
+        c = make_config(500 + k);
+        CHECK(config_save(&c));
+        CHECK(config_load(&loaded));
+        CHECK(config_equal(&loaded, &c));
+    }
+
+    // Through the firmware: 'Q1' stores, the next power-up opens the channel
+    host_flash_erase_all();
+    test_app_boot();
+    CHECK(!host_can_enabled());
+    test_app_cmd("S6");
+    test_app_cmd("Q1");
+    test_app_boot();
+    CHECK(host_can_enabled());
+    // On-bus only once the blocking start-up is over, right before the
+    // main loop starts draining the RX FIFO
+    CHECK(host_time_us() >= 400000u);
+    CHECK(host_time_us() - host_can_enabled_us() < 10000u);
+    CHECK_EQ(error_count(ERR_CANRXFIFO_OVERFLOW), 0);
+    CHECK(!host_can_listen_only());
+    CHECK_EQ(can_get_bitrate(), 500000);
+
+    // 'Q2' opens listen-only, 'Q0' stays off-bus
+    test_app_cmd("C");
+    test_app_cmd("Q2");
+    test_app_boot();
+    CHECK(host_can_enabled());
+    CHECK(host_can_listen_only());
+    test_app_cmd("C");
+    test_app_cmd("Q0");
+    test_app_boot();
+    CHECK(!host_can_enabled());
+
+    return TEST_RESULT();
+}
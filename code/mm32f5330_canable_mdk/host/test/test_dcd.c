@@ -0,0 +1,396 @@
+//
+// test_dcd: BD ownership and DATA0/1 of the ping-pong bulk endpoints
+//
+// board/tud_dcd_port.c runs on the USB controller model, with the class
+// driver side played by this test. Every sequence of SEQ_LEN steps
+// out of host OUT packets, host IN polls, transfers queued by the class,
+// a masked USB interrupt, endpoint halts and a reconfiguration is run
+// from a fresh enumeration and then drained. Throughout, no BD may be
+// armed while the SIE owns it and the host never sees a wrong toggle; with
+// the interrupt taken, an OUT endpoint keeps both BDs armed or holding a
+// packet; at the end every byte has arrived once and in order.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "host_sie.h"
+#include "device/dcd.h"
+#include "hal_usb.h"
+#include "board_init.h"
+
+#define SEQ_LEN         6u
+#define EP_OUT          0x02u
+#define EP_IN           0x81u
+#define PACKET          64u
+#define OUT_XFER        128u
+#define STREAM_MAX      4096u
+
+typedef enum
+{
+    STEP_OUT_FULL = 0,  // Host sends a 64 byte packet
+    STEP_OUT_SHORT,     // Host sends a 10 byte packet
+    STEP_OUT_XFER,      // Class queues a 128 byte OUT transfer
+    STEP_IN_POLL,       // Host polls IN
+    STEP_IN_LONG,       // Class queues a 100 byte IN transfer
+    STEP_IN_SHORT,      // Class queues a 20 byte IN transfer
+    STEP_MASK,          // USB interrupt masked / taken again
+    STEP_HALT_OUT,      // Halt set and cleared on OUT
+    STEP_HALT_IN,       // Halt set and cleared on IN
+    STEP_RECONFIG,      // Endpoints closed and opened again
+    STEP_NUM
+} step_t;
+
+int test_failures = 0;
+
+// Class side
+static uint8_t out_buf[OUT_XFER];
+static bool out_busy;
+static uint8_t in_buf[128];
+static uint16_t in_len;
+static bool in_busy;
+static bool masked;
+
+// Byte streams in both directions, as sent and as received
+static uint8_t host_sent[STREAM_MAX];
+static uint32_t host_sent_len;
+static uint8_t class_got[STREAM_MAX];
+static uint32_t class_got_len;
+static uint8_t class_sent[STREAM_MAX];
+static uint32_t class_sent_len;
+static uint8_t host_got[STREAM_MAX];
+static uint32_t host_got_len;
+
+// OUT packets ACKed by the device, and those handed to the class
+static uint8_t out_packets[64];
+static uint32_t out_acked;
+static uint32_t out_done;
+
+static uint32_t seq_errors;
+static uint8_t pattern;
+
+uint32_t timebase_us(void)
+{
+    return (uint32_t)host_time_us();
+}
+
+void timebase_wakeup_set(uint32_t at_us)
+{
+    (void)at_us;
+}
+
+void tud_task_ext(uint32_t timeout_ms, bool in_isr)
+{
+    (void)timeout_ms;
+    (void)in_isr;
+}
+
+// Completed transfers as the class driver sees them
+void dcd_event_handler(dcd_event_t const * event, bool in_isr)
+{
+    (void)in_isr;
+    if (event->event_id != DCD_EVENT_XFER_COMPLETE)
+    {
+        return;
+    }
+
+    uint32_t len = event->xfer_complete.len;
+    if (event->xfer_complete.ep_addr == EP_OUT)
+    {
+        // A transfer ends with a short packet or a full buffer
+        uint32_t sum = 0;
+        uint8_t p;
+        do
+        {
+            p = (out_done < out_acked) ? out_packets[out_done++ % 64] : 0u;
+            sum += p;
+        } while (p == PACKET && sum < OUT_XFER);
+        if (!out_busy || sum != len || class_got_len + len > STREAM_MAX)
+        {
+            seq_errors++;
+            return;
+        }
+        memcpy(&class_got[class_got_len], out_buf, len);
+        class_got_len += len;
+        out_busy = false;
+    }
+    else if (event->xfer_complete.ep_addr == EP_IN)
+    {
+        if (!in_busy || len != in_len)
+        {
+            seq_errors++;
+        }
+        in_busy = false;
+    }
+}
+
+static void open_endpoints(void)
+{
+    tusb_desc_endpoint_t desc;
+
+    memset(&desc, 0, sizeof(desc));
+    desc.bLength = sizeof(desc);
+    desc.bDescriptorType = TUSB_DESC_ENDPOINT;
+    desc.bmAttributes.xfer = TUSB_XFER_BULK;
+    desc.wMaxPacketSize = PACKET;
+    desc.bEndpointAddress = EP_OUT;
+    dcd_edpt_open(0, &desc);
+    desc.bEndpointAddress = EP_IN;
+    dcd_edpt_open(0, &desc);
+}
+
+static void enumerate(void)
+{
+    host_reset();
+    dcd_init(0);
+    dcd_int_enable(0);
+    host_sie_bus_reset();
+    open_endpoints();
+
+    out_busy = in_busy = masked = false;
+    host_sent_len = class_got_len = class_sent_len = host_got_len = 0;
+    out_acked = out_done = 0;
+    seq_errors = 0;
+}
+
+static void host_out(uint32_t len)
+{
+    uint8_t data[PACKET];
+
+    if (host_sent_len + len > STREAM_MAX)
+        return;
+    for (uint32_t i = 0; i < len; i++)
+        data[i] = pattern++;
+
+    // Accounted up front, the transfer may complete before the ACK returns
+    memcpy(&host_sent[host_sent_len], data, len);
+    host_sent_len += len;
+    out_packets[out_acked++ % 64] = (uint8_t)len;
+    if (host_sie_out(EP_OUT, data, len) != HOST_SIE_ACK)
+    {
+        host_sent_len -= len;
+        out_acked--;
+    }
+}
+
+static bool host_in(void)
+{
+    uint8_t data[PACKET];
+    uint32_t len;
+
+    if (host_sie_in(EP_IN, data, &len) != HOST_SIE_ACK)
+        return false;
+    if (len > PACKET || host_got_len + len > STREAM_MAX)
+    {
+        seq_errors++;
+        return false;
+    }
+    memcpy(&host_got[host_got_len], data, len);
+    host_got_len += len;
+    return true;
+}
+
+static void class_out(void)
+{
+    if (out_busy)
+        return;
+    out_busy = true;
+    if (!dcd_edpt_xfer(0, EP_OUT, out_buf, OUT_XFER))
+        seq_errors++;
+}
+
+static void class_in(uint16_t len)
+{
+    if (in_busy || class_sent_len + len > STREAM_MAX)
+        return;
+    for (uint16_t i = 0; i < len; i++)
+        in_buf[i] = pattern++;
+    memcpy(&class_sent[class_sent_len], in_buf, len);
+    class_sent_len += len;
+    in_len = len;
+    in_busy = true;
+    if (!dcd_edpt_xfer(0, EP_IN, in_buf, len))
+        seq_errors++;
+}
+
+static void mask(bool on)
+{
+    masked = on;
+    if (on)
+        __disable_irq();
+    else
+        __enable_irq();
+}
+
+// Control requests are handled from the USB interrupt, after the tokens
+// ahead of them
+static void control(step_t step)
+{
+    bool was_masked = masked;
+
+    mask(false);
+    if (step == STEP_HALT_OUT || step == STEP_HALT_IN)
+    {
+        uint8_t ep = (step == STEP_HALT_OUT) ? EP_OUT : EP_IN;
+        dcd_edpt_stall(0, ep);
+        dcd_edpt_clear_stall(0, ep);
+        host_sie_clear_toggle(ep);
+    }
+    else
+    {
+        dcd_edpt_close_all(0);
+        for (uint8_t odd = 0; odd < 2; odd++)
+        {
+            if (host_sie_bd_owned(EP_OUT, odd) || host_sie_bd_owned(EP_IN, odd))
+                seq_errors++;
+        }
+
+        // Whatever was in flight is gone, the class starts over
+        host_sent_len = class_got_len;
+        class_sent_len = host_got_len;
+        out_done = out_acked;
+        out_busy = in_busy = false;
+        host_sie_clear_toggle(EP_OUT);
+        host_sie_clear_toggle(EP_IN);
+        open_endpoints();
+    }
+    mask(was_masked);
+}
+
+// With the interrupt taken, OUT BDs are armed unless they hold a packet
+// the class has not asked for yet
+static void check_armed(void)
+{
+    if (masked)
+        return;
+    uint32_t owned = host_sie_bd_owned(EP_OUT, 0) + host_sie_bd_owned(EP_OUT, 1);
+    uint32_t held = out_busy ? 0u : out_acked - out_done;
+    if (owned + held != 2u)
+        seq_errors++;
+}
+
+static void step(step_t s)
+{
+    switch (s)
+    {
+        case STEP_OUT_FULL:  host_out(PACKET); break;
+        case STEP_OUT_SHORT: host_out(10); break;
+        case STEP_OUT_XFER:  class_out(); break;
+        case STEP_IN_POLL:   host_in(); break;
+        case STEP_IN_LONG:   class_in(100); break;
+        case STEP_IN_SHORT:  class_in(20); break;
+        case STEP_MASK:      mask(!masked); break;
+        default:             control(s); break;
+    }
+    check_armed();
+}
+
+// Everything queued reaches the other side: the host ends the last OUT
+// transfer with a zero length packet and polls IN until it NAKs
+static void drain(void)
+{
+    mask(false);
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        class_out();
+        host_out(0);
+        while (host_in())
+            ;
+    }
+    check_armed();
+    if (in_busy || class_got_len != host_sent_len || host_got_len != class_sent_len
+        || memcmp(class_got, host_sent, class_got_len) != 0 || memcmp(host_got, class_sent, host_got_len) != 0)
+    {
+        seq_errors++;
+    }
+}
+
+static bool run_sequence(const uint8_t *seq, uint32_t n)
+{
+    enumerate();
+    for (uint32_t i = 0; i < n; i++)
+        step((step_t)seq[i]);
+    drain();
+    return seq_errors == 0 && host_sie_toggle_errors() == 0 && host_sie_bd_errors() == 0;
+}
+
+int main(void)
+{
+    uint8_t seq[SEQ_LEN];
+    uint32_t failed = 0;
+    uint8_t data[PACKET];
+    uint32_t len;
+
+    // Both OUT BDs armed at open, DATA0 on the one the SIE takes first
+    enumerate();
+    CHECK(host_sie_bd_owned(EP_OUT, 0) && host_sie_bd_owned(EP_OUT, 1));
+    CHECK_EQ(host_sie_bd_data(EP_OUT, 0), 0);
+    CHECK_EQ(host_sie_bd_data(EP_OUT, 1), 1);
+    CHECK(!host_sie_bd_owned(EP_IN, 0) && !host_sie_bd_owned(EP_IN, 1));
+
+    // Back to back: two OUT packets ACKed before the interrupt is taken,
+    // the third NAKed until a BD is free again
+    mask(true);
+    host_out(PACKET);
+    host_out(PACKET);
+    CHECK_EQ(out_acked, 2);
+    memset(data, 0x55, sizeof(data));
+    CHECK_EQ(host_sie_out(EP_OUT, data, PACKET), HOST_SIE_NAK);
+    mask(false);
+    CHECK_EQ(host_sie_out(EP_OUT, data, PACKET), HOST_SIE_NAK);
+    class_out();
+    CHECK(!out_busy);
+    CHECK_EQ(class_got_len, 2 * PACKET);
+    CHECK(host_sie_bd_owned(EP_OUT, 0) && host_sie_bd_owned(EP_OUT, 1));
+    host_out(PACKET);
+    CHECK_EQ(out_acked, 3);
+
+    // Two IN transfers armed at once go out in consecutive transactions
+    enumerate();
+    class_in(20);
+    CHECK(!in_busy);
+    class_in(20);
+    CHECK(!in_busy);
+    mask(true);
+    CHECK_EQ(host_sie_in(EP_IN, data, &len), HOST_SIE_ACK);
+    CHECK_EQ(len, 20);
+    CHECK_EQ(host_sie_in(EP_IN, data, &len), HOST_SIE_ACK);
+    CHECK_EQ(len, 20);
+    CHECK_EQ(host_sie_in(EP_IN, data, &len), HOST_SIE_NAK);
+    mask(false);
+    CHECK_EQ(host_sie_toggle_errors(), 0);
+
+    // Closing disarms the BDs, nothing is taken until the endpoint is open
+    enumerate();
+    dcd_edpt_close_all(0);
+    CHECK(!host_sie_bd_owned(EP_OUT, 0) && !host_sie_bd_owned(EP_OUT, 1));
+    CHECK_EQ(host_sie_out(EP_OUT, data, PACKET), HOST_SIE_NAK);
+    open_endpoints();
+    dcd_edpt_close(0, EP_OUT);
+    CHECK(!host_sie_bd_owned(EP_OUT, 0) && !host_sie_bd_owned(EP_OUT, 1));
+
+    // Every sequence of SEQ_LEN steps
+    uint32_t total = 1;
+    for (uint32_t i = 0; i < SEQ_LEN; i++)
+        total *= STEP_NUM;
+    for (uint32_t k = 0; k < total; k++)
+    {
+        uint32_t v = k;
+        for (uint32_t i = 0; i < SEQ_LEN; i++)
+        {
+            seq[i] = (uint8_t)(v % STEP_NUM);
+            v /= STEP_NUM;
+        }
+        if (!run_sequence(seq, SEQ_LEN) && failed++ < 5)
+        {
+            fprintf(stderr, "sequence failed:");
+            for (uint32_t i = 0; i < SEQ_LEN; i++)
+                fprintf(stderr, " %u", seq[i]);
+            fprintf(stderr, " (errors %u, toggle %u, bd %u)\n", (unsigned)seq_errors,
+                    (unsigned)host_sie_toggle_errors(), (unsigned)host_sie_bd_errors());
+        }
+    }
+    printf("%u sequences of %u steps, %u failed\n", (unsigned)total, SEQ_LEN, (unsigned)failed);
+    CHECK_EQ(failed, 0);
+
+    return TEST_RESULT();
+}
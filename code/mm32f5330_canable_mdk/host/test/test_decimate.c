@@ -0,0 +1,137 @@
+//
+// test_decimate: Per-ID decimation under mask rules
+//
+// A mask rule covering several IDs thins each of them out on its own: the
+// every-Nth counter and the minimum interval belong to the ID, not the
+// rule, so interleaved IDs do not starve each other. The first matching
+// rule decides, the format is part of the match, IDs beyond the state
+// table are kept, and the 'K' commands drive it over slcan.
+//
+
+#include "test.h"
+#include "decimate.h"
+#include "led.h"
+
+static FLEXCAN_Mb_Type make_frame(uint32_t id, bool ext)
+{
+    FLEXCAN_Mb_Type f;
+    memset(&f, 0, sizeof(f));
+    f.ID = id;
+    f.FORMAT = ext ? FLEXCAN_MbFormat_Extended : FLEXCAN_MbFormat_Standard;
+    f.TYPE = FLEXCAN_MbType_Data;
+    f.LENGTH = 8;
+    return f;
+}
+
+static uint8_t keep(uint32_t id, bool ext)
+{
+    FLEXCAN_Mb_Type f = make_frame(id, ext);
+    return decimate_keep(&f);
+}
+
+int main(void)
+{
+    test_app_boot();
+
+    // Every 3rd frame of each ID in 0x100..0x10F, four IDs interleaved
+    decimate_clear();
+    CHECK_EQ(decimate_add(DECIMATE_EVERY_NTH, 0x100, 0x7F0, 0, 3), 0);
+    uint32_t kept[4] = { 0 };
+    for (uint32_t n = 0; n < 30; n++)
+    {
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            uint8_t k = keep(0x100 + i, false);
+            CHECK_EQ(k, n % 3 == 0);
+            kept[i] += k;
+        }
+    }
+    for (uint32_t i = 0; i < 4; i++)
+        CHECK_EQ(kept[i], 10);
+
+    // Unmatched IDs and the other format always pass
+    for (uint32_t n = 0; n < 5; n++)
+    {
+        CHECK(keep(0x200, false));
+        CHECK(keep(0x100, true));
+    }
+
+    // N of 1 keeps everything
+    decimate_clear();
+    CHECK_EQ(decimate_add(DECIMATE_EVERY_NTH, 0x100, 0x7FF, 0, 1), 0);
+    for (uint32_t n = 0; n < 5; n++)
+        CHECK(keep(0x100, false));
+
+    // One frame per 100 ms for each extended ID 0x18FExx00, sent every 10 ms
+    decimate_clear();
+    CHECK_EQ(decimate_add(DECIMATE_MIN_INTERVAL, 0x18FE0000, 0x1FFF00FF, 1, 100), 0);
+    for (uint32_t i = 0; i < 3; i++)
+        kept[i] = 0;
+    for (uint32_t ms = 0; ms < 1000; ms += 10)
+    {
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            uint8_t k = keep(0x18FE0000 | (i << 8), true);
+            CHECK_EQ(k, ms % 100 == 0);
+            kept[i] += k;
+        }
+        host_advance_us(10000);
+    }
+    for (uint32_t i = 0; i < 3; i++)
+        CHECK_EQ(kept[i], 10);
+
+    // The first matching rule decides
+    decimate_clear();
+    CHECK_EQ(decimate_add(DECIMATE_EVERY_NTH, 0x123, 0x7FF, 0, 2), 0);
+    CHECK_EQ(decimate_add(DECIMATE_EVERY_NTH, 0x100, 0x700, 0, 4), 0);
+    CHECK(keep(0x123, false) && !keep(0x123, false) && keep(0x123, false));
+    CHECK(keep(0x124, false) && !keep(0x124, false) && !keep(0x124, false)
+          && !keep(0x124, false) && keep(0x124, false));
+
+    // IDs beyond the state table are kept and counted
+    decimate_clear();
+    CHECK_EQ(decimate_add(DECIMATE_EVERY_NTH, 0, 0, 0, 1000), 0);
+    for (uint32_t i = 0; i < DECIMATE_TABLE_SIZE; i++)
+    {
+        CHECK(keep(i, false));
+        CHECK(!keep(i, false));
+    }
+    CHECK(keep(DECIMATE_TABLE_SIZE, false));
+    CHECK(keep(DECIMATE_TABLE_SIZE, false));
+    CHECK_EQ(decimate_untracked(), 2);
+
+    // Rule table limits and invalid rules
+    decimate_clear();
+    for (uint32_t i = 0; i < DECIMATE_MAX_RULES; i++)
+        CHECK_EQ(decimate_add(DECIMATE_EVERY_NTH, i, 0x7FF, 0, 2), 0);
+    CHECK(decimate_add(DECIMATE_EVERY_NTH, 0x7FF, 0x7FF, 0, 2) != 0);
+    CHECK_EQ(decimate_count(), DECIMATE_MAX_RULES);
+    CHECK(keep(DECIMATE_MAX_RULES - 1, false) && !keep(DECIMATE_MAX_RULES - 1, false));
+    decimate_clear();
+    CHECK(decimate_add(DECIMATE_EVERY_NTH, 0x100, 0x7FF, 0, 0) != 0);
+    CHECK(decimate_add(3, 0x100, 0x7FF, 0, 2) != 0);
+    CHECK_EQ(decimate_count(), 0);
+
+    // Over slcan: every 2nd frame of 0x300..0x30F, each ID on its own
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    test_app_cmd("K1000000300000007F00002");
+    CHECK_STR(test_app_cmd("K"), "K01\r");
+    for (uint32_t n = 0; n < 4; n++)
+    {
+        CHECK(test_can_inject(0x301, false, "11"));
+        CHECK(test_can_inject(0x302, false, "22"));
+        test_app_run(2);
+    }
+    CHECK_STR(test_app_recv(), "t30111100000000000000\rt30212200000000000000\r"
+                               "t30111100000000000000\rt30212200000000000000\r");
+
+    test_app_cmd("K0");
+    CHECK_STR(test_app_cmd("K"), "K00\r");
+    CHECK(test_can_inject(0x301, false, "11"));
+    CHECK(test_can_inject(0x301, false, "11"));
+    test_app_run(2);
+    CHECK_STR(test_app_recv(), "t30111100000000000000\rt30111100000000000000\r");
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,214 @@
+//
+// test_dedup: Change-only reporting replayed over a recorded-style trace
+//
+// A ten second trace of periodic IDs, as a vehicle bus carries them, goes
+// through dedup_forward() and through a reference model kept in the test.
+// Both must forward the same frames. Some IDs hold their payload, some
+// carry a rolling counter, some change now and then, and the short ones
+// have garbage beyond their DLC that must not count as a change. The
+// slcan path is checked with 'D1', the 'd'/'D' report and 'D0'.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "dedup.h"
+#include "led.h"
+
+#define TRACE_IDS       48u
+#define TRACE_MS        10000u
+#define HEARTBEAT_MS    500u
+
+typedef struct
+{
+    uint32_t id;
+    uint8_t ext;
+    uint8_t dlc;
+    uint16_t period_ms;
+    uint8_t kind;           // 0 constant, 1 counter, 2 changes every 50th frame
+    uint32_t sent;
+} trace_id_t;
+
+typedef struct
+{
+    uint8_t valid;
+    uint8_t dlc;
+    uint8_t data[8];
+    uint32_t tick;
+    uint32_t suppressed;
+} ref_entry_t;
+
+static trace_id_t ids[TRACE_IDS];
+static ref_entry_t ref[TRACE_IDS];
+
+static FLEXCAN_Mb_Type make_frame(const trace_id_t *t, uint8_t *data)
+{
+    FLEXCAN_Mb_Type f;
+    memset(&f, 0, sizeof(f));
+    f.ID = t->id;
+    f.FORMAT = t->ext ? FLEXCAN_MbFormat_Extended : FLEXCAN_MbFormat_Standard;
+    f.TYPE = FLEXCAN_MbType_Data;
+    f.LENGTH = t->dlc;
+    f.BYTE0 = data[0]; f.BYTE1 = data[1]; f.BYTE2 = data[2]; f.BYTE3 = data[3];
+    f.BYTE4 = data[4]; f.BYTE5 = data[5]; f.BYTE6 = data[6]; f.BYTE7 = data[7];
+    return f;
+}
+
+static void trace_payload(trace_id_t *t, uint8_t *data)
+{
+    memset(data, 0x11, 8);
+    data[1] = (uint8_t)t->id;
+    if (t->kind == 1)
+        data[0] = (uint8_t)t->sent;
+    else if (t->kind == 2)
+        data[2] = (uint8_t)(t->sent / 50u);
+    // Beyond the DLC: whatever the controller left there
+    for (uint8_t i = t->dlc; i < 8; i++)
+        data[i] = (uint8_t)rand();
+}
+
+static uint8_t ref_forward(uint32_t n, const uint8_t *data, uint8_t dlc, uint32_t now, uint16_t heartbeat)
+{
+    ref_entry_t *e = &ref[n];
+    if (e->valid && e->dlc == dlc && memcmp(e->data, data, dlc) == 0
+        && (heartbeat == 0 || (now - e->tick) < heartbeat))
+    {
+        e->suppressed++;
+        return 0;
+    }
+    e->valid = 1;
+    e->dlc = dlc;
+    memcpy(e->data, data, dlc);
+    e->tick = now;
+    return 1;
+}
+
+static void trace_init(void)
+{
+    srand(33);
+    for (uint32_t i = 0; i < TRACE_IDS; i++)
+    {
+        ids[i].ext = (i % 4) == 3;
+        ids[i].id = ids[i].ext ? (0x18FF0000u | (i << 8) | 0x21u) : (0x100u + 0x10u * i);
+        ids[i].dlc = (i % 5 == 0) ? (uint8_t)(2 + i % 6) : 8;
+        static const uint16_t periods[] = { 10, 20, 50, 100, 1000 };
+        ids[i].period_ms = periods[i % 5];
+        ids[i].kind = (uint8_t)(i % 3);
+        ids[i].sent = 0;
+    }
+    memset(ref, 0, sizeof(ref));
+}
+
+// Replay the trace through dedup_forward(), counting the differences
+static uint32_t replay(uint16_t heartbeat, uint32_t *forwarded, uint32_t *total)
+{
+    uint32_t mismatches = 0;
+    uint8_t data[8];
+
+    trace_init();
+    dedup_enable(1, heartbeat);
+    *forwarded = 0;
+    *total = 0;
+    for (uint32_t ms = 0; ms < TRACE_MS; ms++)
+    {
+        for (uint32_t i = 0; i < TRACE_IDS; i++)
+        {
+            if (ms % ids[i].period_ms)
+                continue;
+            trace_payload(&ids[i], data);
+            FLEXCAN_Mb_Type f = make_frame(&ids[i], data);
+            uint8_t got = dedup_forward(&f);
+            uint8_t want = ref_forward(i, data, ids[i].dlc, uwTick, heartbeat);
+            if (got != want)
+                mismatches++;
+            *forwarded += got;
+            (*total)++;
+            ids[i].sent++;
+        }
+        host_advance_us(1000);
+    }
+    return mismatches;
+}
+
+int main(void)
+{
+    uint32_t forwarded, total;
+
+    test_app_boot();
+
+    // Without a heartbeat only changes go out
+    CHECK_EQ(replay(0, &forwarded, &total), 0);
+    CHECK(forwarded < total / 2);
+    printf("no heartbeat: %u of %u frames forwarded\n", (unsigned)forwarded, (unsigned)total);
+
+    // With a heartbeat every ID shows up at least that often
+    CHECK_EQ(replay(HEARTBEAT_MS, &forwarded, &total), 0);
+    printf("%u ms heartbeat: %u of %u frames forwarded\n", HEARTBEAT_MS, (unsigned)forwarded, (unsigned)total);
+
+    // Remote frames always pass, disabled means everything passes
+    FLEXCAN_Mb_Type f;
+    memset(&f, 0, sizeof(f));
+    f.ID = 0x123;
+    f.TYPE = FLEXCAN_MbType_Remote;
+    CHECK(dedup_forward(&f));
+    CHECK(dedup_forward(&f));
+    f.TYPE = FLEXCAN_MbType_Data;
+    dedup_enable(0, 0);
+    CHECK(dedup_forward(&f));
+    CHECK(dedup_forward(&f));
+
+    // A standard and an extended frame with the same ID are different IDs
+    dedup_enable(1, 0);
+    CHECK(dedup_forward(&f));
+    f.FORMAT = FLEXCAN_MbFormat_Extended;
+    CHECK(dedup_forward(&f));
+    CHECK(!dedup_forward(&f));
+
+    // Once the table is full, new IDs are forwarded untracked
+    dedup_enable(1, 0);
+    f.FORMAT = FLEXCAN_MbFormat_Standard;
+    for (uint32_t i = 0; i < DEDUP_TABLE_SIZE; i++)
+    {
+        f.ID = i;
+        CHECK(dedup_forward(&f));
+        CHECK(!dedup_forward(&f));
+    }
+    f.ID = DEDUP_TABLE_SIZE;
+    CHECK(dedup_forward(&f));
+    CHECK(dedup_forward(&f));
+
+    // Over slcan: repeats are not sent, the report counts them
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    test_app_cmd("D10000");
+    for (uint32_t i = 0; i < 10; i++)
+    {
+        CHECK(test_can_inject(0x321, false, "0102030405060708"));
+        CHECK(test_can_inject(0x654, false, i < 5 ? "AA" : "BB"));
+        test_app_run(2);
+    }
+    const char *rx = test_app_recv();
+    CHECK_STR(rx, "t32180102030405060708\rt6541AA00000000000000\rt6541BB00000000000000\r");
+
+    rx = test_app_cmd("D");
+    CHECK(strstr(rx, "d0000032100000009\r") != NULL);
+    CHECK(strstr(rx, "d0000065400000008\r") != NULL);
+    CHECK(strstr(rx, "D000000030000001100000000\r") != NULL);
+
+    // Malformed lines are refused and leave reporting on
+    CHECK_EQ(test_slcan_parse("D2"), -1);
+    CHECK_EQ(test_slcan_parse("DF"), -1);
+    CHECK_EQ(test_slcan_parse("D1"), -1);
+    CHECK_EQ(test_slcan_parse("D100"), -1);
+    CHECK_EQ(test_slcan_parse("D00"), -1);
+    CHECK_EQ(test_slcan_parse("D100000"), -1);
+    CHECK(test_can_inject(0x321, false, "0102030405060708"));
+    test_app_run(2);
+    CHECK_STR(test_app_recv(), "");
+
+    test_app_cmd("D0");
+    CHECK(test_can_inject(0x321, false, "0102030405060708"));
+    test_app_run(2);
+    CHECK_STR(test_app_recv(), "t32180102030405060708\r");
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,239 @@
+//
+// test_descriptors: USB descriptors of the composite device
+//
+// The configuration descriptor is walked as a host would enumerate it:
+// lengths add up to wTotalLength, every function is grouped by an IAD
+// covering its two interfaces, the CDC functional descriptors name the
+// right interfaces, endpoint addresses are unique and fit the full speed
+// controller, and every string index resolves. The data path is then run
+// with a diagnostics terminal that never reads, which must not hold up
+// slcan traffic on the first interface.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "diag.h"
+#include "tusb.h"
+#include "device/dcd.h"
+
+#define MAX_FUNCTIONS   4u
+#define MAX_ENDPOINTS   16u
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+// ASCII contents of a string descriptor, NULL if it does not resolve
+static const char *string_of(uint8_t index)
+{
+    static char str[40];
+    const uint16_t *desc = tud_descriptor_string_cb(index, 0x0409);
+
+    if (desc == NULL)
+        return NULL;
+    uint8_t len = desc[0] & 0xFFu;
+    CHECK_EQ(desc[0] >> 8, TUSB_DESC_STRING);
+    CHECK(len >= 2 && (len & 1u) == 0 && len <= 64);
+    uint8_t chars = (uint8_t)((len - 2) / 2);
+    for (uint8_t i = 0; i < chars && i < sizeof(str) - 1; i++)
+    {
+        CHECK(desc[1 + i] >= 0x20 && desc[1 + i] < 0x7F);
+        str[i] = (char)desc[1 + i];
+    }
+    str[chars < sizeof(str) - 1 ? chars : sizeof(str) - 1] = '\0';
+    return str;
+}
+
+static void check_device(void)
+{
+    const uint8_t *d = tud_descriptor_device_cb();
+
+    CHECK_EQ(d[0], sizeof(tusb_desc_device_t));
+    CHECK_EQ(d[1], TUSB_DESC_DEVICE);
+    CHECK_EQ(get16(&d[2]), 0x0110);
+    // IADs need the composite device class triple
+    CHECK_EQ(d[4], TUSB_CLASS_MISC);
+    CHECK_EQ(d[5], MISC_SUBCLASS_COMMON);
+    CHECK_EQ(d[6], MISC_PROTOCOL_IAD);
+    CHECK_EQ(d[7], 64);
+    CHECK_EQ(d[17], 1);
+    for (uint8_t i = 14; i <= 16; i++)
+        CHECK(d[i] != 0 && string_of(d[i]) != NULL);
+    CHECK_STR(string_of(d[15]), "CANable");
+}
+
+static void check_strings(void)
+{
+    const uint16_t *lang = tud_descriptor_string_cb(0, 0);
+
+    CHECK(lang != NULL);
+    CHECK_EQ(lang[0], (TUSB_DESC_STRING << 8) | 4);
+    CHECK_EQ(lang[1], 0x0409);
+    CHECK(tud_descriptor_string_cb(0xEE, 0x0409) == NULL);
+    CHECK(tud_descriptor_string_cb(0x40, 0x0409) == NULL);
+}
+
+static void check_configuration(void)
+{
+    const uint8_t *c = tud_descriptor_configuration_cb(0);
+    uint16_t total = get16(&c[2]);
+    uint8_t iad_first[MAX_FUNCTIONS], iad_count[MAX_FUNCTIONS];
+    uint8_t iad_num = 0;
+    uint8_t ep_addr[MAX_ENDPOINTS];
+    uint8_t ep_num = 0;
+    uint32_t itf_seen = 0;
+    int itf = -1;
+    uint8_t eps_declared = 0, eps_found = 0;
+
+    CHECK_EQ(c[0], 9);
+    CHECK_EQ(c[1], TUSB_DESC_CONFIGURATION);
+    CHECK_EQ(c[5], 1);
+    CHECK(c[7] & 0x80u);
+    CHECK(c[8] <= 50);
+    CHECK(string_of(c[6]) != NULL);
+
+    uint16_t pos = 9;
+    while (pos < total)
+    {
+        const uint8_t *d = &c[pos];
+        CHECK(d[0] >= 2);
+        if (d[0] < 2 || pos + d[0] > total)
+        {
+            fprintf(stderr, "descriptor at %u overruns wTotalLength %u\n", pos, total);
+            test_failures++;
+            return;
+        }
+
+        switch (d[1])
+        {
+            case TUSB_DESC_INTERFACE_ASSOCIATION:
+                CHECK_EQ(d[0], 8);
+                CHECK(iad_num < MAX_FUNCTIONS);
+                if (iad_num >= MAX_FUNCTIONS)
+                    return;
+                // Functions follow each other without a gap
+                CHECK_EQ(d[2], iad_num ? iad_first[iad_num - 1] + iad_count[iad_num - 1] : 0);
+                CHECK_EQ(d[3], 2);
+                CHECK_EQ(d[4], TUSB_CLASS_CDC);
+                iad_first[iad_num] = d[2];
+                iad_count[iad_num] = d[3];
+                iad_num++;
+                break;
+
+            case TUSB_DESC_INTERFACE:
+                CHECK_EQ(d[0], 9);
+                CHECK_EQ(eps_found, eps_declared);
+                // Every interface belongs to the function opened last
+                CHECK(iad_num > 0);
+                if (iad_num > 0)
+                    CHECK(d[2] >= iad_first[iad_num - 1] && d[2] < iad_first[iad_num - 1] + iad_count[iad_num - 1]);
+                if (d[3] == 0)
+                {
+                    CHECK((itf_seen & (1u << d[2])) == 0);
+                    itf_seen |= 1u << d[2];
+                }
+                else
+                {
+                    CHECK_EQ(d[2], itf);
+                }
+                CHECK_EQ(d[5], (d[2] == iad_first[iad_num - 1]) ? TUSB_CLASS_CDC : TUSB_CLASS_CDC_DATA);
+                CHECK(d[8] == 0 || string_of(d[8]) != NULL);
+                itf = d[2];
+                eps_declared = d[4];
+                eps_found = 0;
+                break;
+
+            case TUSB_DESC_CS_INTERFACE:
+                if (d[2] == CDC_FUNC_DESC_CALL_MANAGEMENT)
+                    CHECK_EQ(d[4], itf + 1);
+                else if (d[2] == CDC_FUNC_DESC_UNION)
+                {
+                    CHECK_EQ(d[3], itf);
+                    CHECK_EQ(d[4], itf + 1);
+                }
+                else if (d[2] == CDC_FUNC_DESC_ETHERNET_NETWORKING)
+                {
+                    // The MAC address string is twelve hex digits
+                    const char *mac = string_of(d[3]);
+                    CHECK(mac != NULL && strlen(mac) == 12 && strspn(mac, "0123456789ABCDEF") == 12);
+                }
+                break;
+
+            case TUSB_DESC_ENDPOINT:
+                CHECK_EQ(d[0], 7);
+                eps_found++;
+                CHECK((d[2] & 0x0Fu) != 0 && (d[2] & 0x70u) == 0);
+                // The stack refuses to open endpoints beyond its limit
+                CHECK((d[2] & 0x0Fu) < CFG_TUD_ENDPPOINT_MAX);
+                CHECK(get16(&d[4]) <= 64);
+                if ((d[3] & 0x03u) == TUSB_XFER_BULK)
+                    CHECK_EQ(get16(&d[4]), 64);
+                else
+                    CHECK((d[3] & 0x03u) == TUSB_XFER_INTERRUPT && d[6] >= 1);
+                for (uint8_t i = 0; i < ep_num; i++)
+                    CHECK(ep_addr[i] != d[2]);
+                if (ep_num < MAX_ENDPOINTS)
+                    ep_addr[ep_num++] = d[2];
+                break;
+
+            default:
+                fprintf(stderr, "unexpected descriptor type 0x%02X at %u\n", d[1], pos);
+                test_failures++;
+                break;
+        }
+        pos += d[0];
+    }
+    CHECK_EQ(pos, total);
+    CHECK_EQ(eps_found, eps_declared);
+
+    // bNumInterfaces counts interfaces 0..n-1, two per function
+    CHECK_EQ(iad_num, CFG_TUD_CDC + CFG_TUD_NCM);
+    CHECK_EQ(c[4], 2 * iad_num);
+    CHECK_EQ(itf_seen, (1u << c[4]) - 1u);
+    CHECK_EQ(ep_num, 3 * iad_num);
+}
+
+// A terminal on the diagnostics interface that asks for reports and never
+// reads them
+static void check_diag_never_blocks(void)
+{
+#if !CFG_TUD_NCM
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    host_cdc_set_dtr(DIAG_ITF, true);
+
+    uint32_t lines = 0;
+    for (uint32_t i = 0; i < 500; i++)
+    {
+        host_cdc_send_str(DIAG_ITF, "s");
+        CHECK(test_can_inject(0x100 + (i & 0xFF), false, "0011223344556677"));
+        test_app_run(2);
+        const char *rx = test_app_recv();
+        while ((rx = strchr(rx, '\r')) != NULL)
+        {
+            lines++;
+            rx++;
+        }
+    }
+    CHECK_EQ(lines, 500);
+    CHECK(host_cdc_tx_queued(DIAG_ITF) > 0);
+
+    // Once the terminal reads, the report comes through
+    char buf[256];
+    uint32_t n = host_cdc_recv(DIAG_ITF, buf, sizeof(buf) - 1);
+    buf[n] = '\0';
+    CHECK(n > 0 && strstr(buf, "\r\n") != NULL);
+    host_cdc_set_dtr(DIAG_ITF, false);
+#endif
+}
+
+int main(void)
+{
+    check_device();
+    check_strings();
+    check_configuration();
+    check_diag_never_blocks();
+    return TEST_RESULT();
+}
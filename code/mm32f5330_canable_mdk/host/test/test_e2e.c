@@ -0,0 +1,213 @@
+//
+// test_e2e: E2E profile 1 and 2 protection against AUTOSAR references
+//
+// The CRC tables are checked against the check values of the AUTOSAR CRC
+// library specification. Protected frames are checked against a bitwise
+// model that follows the E2E library's call sequence literally, including
+// its IsFirstCall start value and final XOR handling, over random payloads,
+// DLCs and CRC/counter positions, and across counter wrap-around.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "e2e.h"
+
+typedef struct
+{
+    const char *data;
+    uint8_t j1850;
+    uint8_t h2f;
+} crc_vector_t;
+
+// SWS CRC Library, 7.2.1.1 and 7.2.1.2
+static const crc_vector_t crc_vectors[] =
+{
+    { "00000000",           0x59, 0x12 },
+    { "F20183",             0x37, 0xC2 },
+    { "0FAA0055",           0x79, 0xC6 },
+    { "00FF5511",           0xB8, 0x77 },
+    { "332255AABBCCDDEEFF", 0xCB, 0x11 },
+    { "926B55",             0x8C, 0x33 },
+    { "FFFFFFFF",           0x74, 0x6C },
+};
+
+static uint8_t from_hex(const char *hex, uint8_t *out)
+{
+    uint8_t n = 0;
+    for (; hex[0] && hex[1]; hex += 2)
+    {
+        char b[3] = { hex[0], hex[1], 0 };
+        out[n++] = (uint8_t)strtoul(b, NULL, 16);
+    }
+    return n;
+}
+
+// Crc_CalculateCRC8 / Crc_CalculateCRC8H2F, bit by bit
+static uint8_t ref_crc8(uint8_t poly, const uint8_t *data, uint32_t len, uint8_t start, bool first)
+{
+    uint8_t crc = first ? 0xFFu : (start ^ 0xFFu);
+
+    while (len--)
+    {
+        crc ^= *data++;
+        for (uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc & 0x80u) ? (uint8_t)((crc << 1) ^ poly) : (uint8_t)(crc << 1);
+    }
+    return crc ^ 0xFFu;
+}
+
+// E2E_P01Protect(), data ID mode BOTH
+static void ref_p01(uint8_t *data, uint8_t len, uint16_t data_id, uint8_t crc_offset, uint8_t counter_offset, uint8_t counter)
+{
+    uint8_t crc_pos = crc_offset >> 3;
+    uint8_t lo = (uint8_t)data_id, hi = (uint8_t)(data_id >> 8);
+    uint8_t shift = counter_offset & 4u;
+
+    data[counter_offset >> 3] = (data[counter_offset >> 3] & ~(0x0Fu << shift)) | (counter << shift);
+    uint8_t crc = ref_crc8(0x1D, &lo, 1, 0xFF, false);
+    crc = ref_crc8(0x1D, &hi, 1, crc, false);
+    if (crc_pos > 0)
+        crc = ref_crc8(0x1D, data, crc_pos, crc, false);
+    if (crc_pos < len - 1)
+        crc = ref_crc8(0x1D, &data[crc_pos + 1], len - 1 - crc_pos, crc, false);
+    data[crc_pos] = crc ^ 0xFFu;
+}
+
+// E2E_P02Protect(), every data ID list entry the same
+static void ref_p02(uint8_t *data, uint8_t len, uint8_t data_id, uint8_t crc_offset, uint8_t counter_offset, uint8_t counter)
+{
+    uint8_t crc_pos = crc_offset >> 3;
+    uint8_t shift = counter_offset & 4u;
+    uint8_t crc = 0xFF;
+    bool first = true;
+
+    data[counter_offset >> 3] = (data[counter_offset >> 3] & ~(0x0Fu << shift)) | (counter << shift);
+    if (crc_pos > 0)
+    {
+        crc = ref_crc8(0x2F, data, crc_pos, crc, first);
+        first = false;
+    }
+    if (crc_pos < len - 1)
+    {
+        crc = ref_crc8(0x2F, &data[crc_pos + 1], len - 1 - crc_pos, crc, first);
+        first = false;
+    }
+    data[crc_pos] = ref_crc8(0x2F, &data_id, 1, crc, first);
+}
+
+static FLEXCAN_Mb_Type make_frame(uint32_t id, const uint8_t *data, uint8_t len)
+{
+    FLEXCAN_Mb_Type f;
+    uint8_t d[8] = {0};
+
+    memcpy(d, data, len);
+    memset(&f, 0, sizeof(f));
+    f.ID = id;
+    f.FORMAT = FLEXCAN_MbFormat_Standard;
+    f.TYPE = FLEXCAN_MbType_Data;
+    f.LENGTH = len;
+    f.BYTE0 = d[0]; f.BYTE1 = d[1]; f.BYTE2 = d[2]; f.BYTE3 = d[3];
+    f.BYTE4 = d[4]; f.BYTE5 = d[5]; f.BYTE6 = d[6]; f.BYTE7 = d[7];
+    return f;
+}
+
+static bool frame_equals(FLEXCAN_Mb_Type *f, const uint8_t *data, uint8_t len)
+{
+    uint8_t d[8] = { f->BYTE0, f->BYTE1, f->BYTE2, f->BYTE3, f->BYTE4, f->BYTE5, f->BYTE6, f->BYTE7 };
+    return memcmp(d, data, len) == 0;
+}
+
+int main(void)
+{
+    uint8_t data[16];
+
+    test_app_boot();
+
+    // CRC library check values
+    for (uint32_t i = 0; i < sizeof(crc_vectors) / sizeof(crc_vectors[0]); i++)
+    {
+        uint8_t n = from_hex(crc_vectors[i].data, data);
+        CHECK_EQ(e2e_crc8_j1850(data, n), crc_vectors[i].j1850);
+        CHECK_EQ(e2e_crc8_h2f(data, n), crc_vectors[i].h2f);
+        CHECK_EQ(ref_crc8(0x1D, data, n, 0, true), crc_vectors[i].j1850);
+        CHECK_EQ(ref_crc8(0x2F, data, n, 0, true), crc_vectors[i].h2f);
+    }
+    CHECK_EQ(e2e_crc8_j1850((const uint8_t *)"123456789", 9), 0x4B);
+    CHECK_EQ(e2e_crc8_h2f((const uint8_t *)"123456789", 9), 0xDF);
+
+    // Random payloads, lengths and layouts, 40 frames each so that both
+    // counters wrap twice
+    srand(39);
+    for (uint32_t round = 0; round < 200; round++)
+    {
+        uint8_t type = (round & 1) ? E2E_P02 : E2E_P01;
+        uint8_t len = 2 + (uint8_t)(rand() % 7);
+        uint8_t crc_offset = 8 * (uint8_t)(rand() % len);
+        uint8_t counter_offset;
+        do
+            counter_offset = 4 * (uint8_t)(rand() % (2 * len));
+        while ((counter_offset >> 3) == (crc_offset >> 3));
+        uint16_t data_id = (uint16_t)rand();
+
+        CHECK_EQ(e2e_set(0, type, 0x200 + round, 0, data_id, crc_offset, counter_offset), 0);
+        for (uint32_t n = 0; n < 40; n++)
+        {
+            for (uint8_t i = 0; i < len; i++)
+                data[i] = (uint8_t)rand();
+            FLEXCAN_Mb_Type f = make_frame(0x200 + round, data, len);
+            e2e_protect(&f);
+            if (type == E2E_P01)
+                ref_p01(data, len, data_id, crc_offset, counter_offset, n % 15u);
+            else
+                ref_p02(data, len, (uint8_t)data_id, crc_offset, counter_offset, (n + 1u) % 16u);
+            CHECK(frame_equals(&f, data, len));
+        }
+    }
+
+    // Frames too short for the layout, other IDs and remote frames pass
+    // untouched and do not advance the counter
+    e2e_clear();
+    CHECK_EQ(e2e_set(0, E2E_P01, 0x123, 0, 0x0123, 0, 8), 0);
+    static const uint8_t plain[8] = { 0x00, 0x00, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77 };
+    FLEXCAN_Mb_Type f = make_frame(0x123, plain, 1);
+    e2e_protect(&f);
+    CHECK(frame_equals(&f, plain, 1));
+    f = make_frame(0x124, plain, 8);
+    e2e_protect(&f);
+    CHECK(frame_equals(&f, plain, 8));
+    f = make_frame(0x123, plain, 8);
+    f.TYPE = FLEXCAN_MbType_Remote;
+    e2e_protect(&f);
+    CHECK(frame_equals(&f, plain, 8));
+    static const uint8_t first[8] = { 0xF2, 0x00, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77 };
+    f = make_frame(0x123, plain, 8);
+    e2e_protect(&f);
+    CHECK(frame_equals(&f, first, 8));
+
+    // Invalid layouts are refused
+    CHECK(e2e_set(0, E2E_P01, 0x123, 0, 0, 4, 8) != 0);
+    CHECK(e2e_set(0, E2E_P01, 0x123, 0, 0, 0, 2) != 0);
+    CHECK(e2e_set(0, E2E_P01, 0x123, 0, 0, 8, 12) != 0);
+    CHECK(e2e_set(0, E2E_P02 + 1, 0x123, 0, 0, 0, 8) != 0);
+    CHECK(e2e_set(E2E_MAX_PROFILES, E2E_P01, 0x123, 0, 0, 0, 8) != 0);
+
+    // Over slcan, as loaded into the TX mailbox
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    test_app_cmd("e0");
+    test_app_cmd("e101000000123" "0123" "00" "08");
+    test_app_cmd("e112000000124" "0037" "00" "08");
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        test_app_cmd("t12380000223344556677");
+        test_app_cmd("t12480000223344556677");
+    }
+    CHECK_STR(test_can_pop(), "t1238F200223344556677");
+    CHECK_STR(test_can_pop(), "t1248EE01223344556677");
+    CHECK_STR(test_can_pop(), "t1238AF01223344556677");
+    CHECK_STR(test_can_pop(), "t12484202223344556677");
+    CHECK_STR(test_can_pop(), "t12384802223344556677");
+    CHECK_STR(test_can_pop(), "t12482603223344556677");
+
+    return TEST_RESULT();
+}
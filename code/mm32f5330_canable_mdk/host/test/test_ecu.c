@@ -0,0 +1,249 @@
+//
+// test_ecu: Rules answer every received frame, whatever the USB side does
+//
+// ecu_rx_frame() runs in the FlexCAN RX interrupt on each frame as it
+// leaves the FIFO, before any filtering or gating towards the host: while
+// a long line owns the CDC stream, with the suspend ring full, with
+// change-only reporting and with the port closed. Responses are on the
+// bus before the main loop runs again, delayed ones at their due time
+// without it. Under load, every request's interrupt time plus the longest
+// window the interrupt was held off must stay within the response bound,
+// in the host's CPU time.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "error.h"
+#include "profile.h"
+#include "slcan.h"
+#include "board_init.h"
+#include "clock_init.h"
+
+#define RESPONSE_BOUND_US   200u
+#define LOAD_REQUESTS       2000u
+#define LOAD_RUNS           3u
+
+// Response to "t70020201": 0x708 with the request's second byte plus 0x40
+#define RESPONSE    "t70833041AA"
+
+// 0x700 with byte 0 == 02 -> 0x708, 3 bytes: 0x30, request byte 1 + 0x40,
+// 0xAA; delay in us as 4 hex digits
+static void rule(const char *delay)
+{
+    char line[32];
+
+    snprintf(line, sizeof(line), "E10000000700000007FF%s", delay);
+    test_app_cmd(line);
+    test_app_cmd("E200200000000000000");
+    test_app_cmd("E30FF00000000000000");
+    test_app_cmd("E400000007083");
+    test_app_cmd("E503040AA0000000000");
+    test_app_cmd("E600011000000000000");
+    test_app_cmd("E70");
+}
+
+static void request(void)
+{
+    CHECK(test_can_inject(0x700, false, "0201"));
+    test_app_run(1);
+}
+
+// Answered by the interrupt, before the main loop sees the request
+static void answered(void)
+{
+    CHECK(test_can_inject(0x700, false, "0201"));
+    CHECK_STR(test_can_pop(), RESPONSE);
+    test_app_run(1);
+}
+
+// Rule 1: 0x701 -> 0x709 after 1000 us, 1 byte: the rule counter
+static void counter_rule(void)
+{
+    test_app_cmd("E11000000701000007FF03E8");
+    test_app_cmd("E210000000000000000");
+    test_app_cmd("E310000000000000000");
+    test_app_cmd("E410000007091");
+    test_app_cmd("E510000000000000000");
+    test_app_cmd("E612000000000000000");
+    test_app_cmd("E71");
+}
+
+// Keep the CDC stream busy with a J1939 line longer than the TX FIFO
+static void stream_long_line(void)
+{
+    test_app_cmd("j1012345");
+    CHECK(test_can_inject(0x18ECFF00, true, "20F906FFFF452301"));
+    test_app_run(1);
+    for (uint32_t seq = 1; seq <= 255; seq++)
+    {
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%02X00000000000000", (unsigned)seq);
+        CHECK(test_can_inject(0x18EBFF00, true, hex));
+        test_app_run(1);
+    }
+}
+
+static double cycles_us(uint32_t cycles)
+{
+    return cycles * 1e6 / CLOCK_SYS_FREQ;
+}
+
+static uint64_t isr_ns[LOAD_REQUESTS];     // Least of the runs, per request
+
+int main(void)
+{
+    profile_stats_t stats;
+    char expect[16];
+
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+
+    rule("0000");
+
+    // Answered as the request arrives, which is then forwarded too
+    answered();
+    test_app_run(1);
+    CHECK_STR(test_app_recv(), "t70020201000000000000\r");
+    CHECK(test_can_inject(0x700, false, "0301"));
+    test_app_run(1);
+    CHECK_STR(test_can_pop(), "");
+    test_app_recv();
+
+    // Change-only reporting drops the repeats, the rule still sees them
+    test_app_cmd("D10000");
+    for (uint32_t i = 0; i < 3; i++)
+        answered();
+    test_app_run(2);
+    CHECK_STR(test_app_recv(), "t70020201000000000000\r");
+    test_app_cmd("D0");
+
+    // While a long line owns the stream, and once the ring behind it is full
+    stream_long_line();
+    test_app_run(4);
+    CHECK(slcan_stream_busy());
+    host_can_tx_clear();
+    uint32_t full_before = error_count(ERR_FULLBUF_SUSPEND);
+    for (uint32_t i = 0; i < 40; i++)
+        answered();
+    CHECK(slcan_stream_busy());
+    CHECK(error_count(ERR_FULLBUF_SUSPEND) > full_before);
+    CHECK_EQ(host_can_rx_pending(), 0);
+    for (uint32_t i = 0; i < 400 && slcan_stream_busy(); i++)
+    {
+        test_app_run(1);
+        test_app_recv();
+    }
+    CHECK(!slcan_stream_busy());
+
+    // With the port closed
+    host_cdc_set_dtr(0, false);
+    test_app_run(2);
+    answered();
+    host_cdc_set_dtr(0, true);
+    test_app_run(2);
+    test_app_recv();
+
+    // Delayed responses go out from the timebase compare at their due
+    // time, with no main loop pass in between; the ninth does not fit and
+    // has its own error
+    rule("03E8");
+    uint32_t cantx_before = error_count(ERR_FULLBUF_CANTX);
+    uint32_t ecu_before = error_count(ERR_FULLBUF_ECU);
+    uint64_t h0 = host_time_us();
+    for (uint32_t i = 0; i < 9; i++)
+        CHECK(test_can_inject(0x700, false, "0201"));
+    host_advance_us(999);
+    CHECK_EQ(host_can_tx_count(), 0);
+    host_advance_us(1);
+    CHECK_EQ(host_can_tx_count(), 8);
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        host_can_frame_t frame;
+        CHECK(host_can_tx_pop(&frame));
+        CHECK_EQ(frame.id, 0x708);
+        CHECK_EQ(frame.time_us, h0 + 1000);
+    }
+    test_app_run(2);
+    CHECK_EQ(error_count(ERR_FULLBUF_ECU), ecu_before + 1);
+    CHECK_EQ(error_count(ERR_FULLBUF_CANTX), cantx_before);
+    test_app_recv();
+    rule("0000");
+
+    // A response dropped for the full queue does not skip a counter value
+    counter_rule();
+    for (uint32_t i = 0; i < 9; i++)
+        CHECK(test_can_inject(0x701, false, "00"));
+    host_advance_us(1000);
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        snprintf(expect, sizeof(expect), "t7091%02X", (unsigned)i);
+        CHECK_STR(test_can_pop(), expect);
+    }
+    CHECK_STR(test_can_pop(), "");
+    CHECK(test_can_inject(0x701, false, "00"));
+    host_advance_us(1000);
+    CHECK_STR(test_can_pop(), "t709108");
+    test_app_run(2);
+    CHECK_EQ(error_count(ERR_FULLBUF_ECU), ecu_before + 2);
+    test_app_cmd("E81");
+    test_app_recv();
+
+    // Worst case under load: requests among frames for the host, 't'
+    // commands and a long line. Each request is answered by the time the
+    // interrupt returns; its time in the interrupt plus the longest the
+    // interrupt was held off anywhere must stay within the bound. Host
+    // interrupts add to any window, the least of a few identical runs
+    // stands for each.
+    profile_reset();
+    uint64_t blocked_ns = UINT64_MAX;
+    for (uint32_t run = 0; run < LOAD_RUNS; run++)
+    {
+        host_irq_watch(BOARD_FLEXCAN_IRQn);
+        stream_long_line();
+        for (uint32_t i = 0; i < LOAD_REQUESTS; i++)
+        {
+            CHECK(test_can_inject(0x100 + (i & 0xFF), false, "1122334455667788"));
+            if (i % 4 == 0)
+                host_cdc_send_str(0, "t3218AABBCCDDEEFF0011\r");
+            test_app_run(1);
+            host_can_tx_clear();
+
+            uint64_t t0 = host_cpu_ns();
+            CHECK(test_can_inject(0x700, false, "0201"));
+            uint64_t t = host_cpu_ns() - t0;
+            if (run == 0 || t < isr_ns[i])
+                isr_ns[i] = t;
+            CHECK_STR(test_can_pop(), RESPONSE);
+            CHECK_STR(test_can_pop(), "");
+            test_app_run(1);
+            test_app_recv();
+        }
+        if (host_irq_blocked_max_ns() < blocked_ns)
+            blocked_ns = host_irq_blocked_max_ns();
+        for (uint32_t i = 0; i < 400 && slcan_stream_busy(); i++)
+        {
+            test_app_run(1);
+            test_app_recv();
+        }
+    }
+
+    uint64_t worst_ns = 0;
+    uint32_t over = 0;
+    for (uint32_t i = 0; i < LOAD_REQUESTS; i++)
+    {
+        if (isr_ns[i] > worst_ns)
+            worst_ns = isr_ns[i];
+        over += (isr_ns[i] + blocked_ns > RESPONSE_BOUND_US * 1000ull);
+    }
+    printf("FlexCAN interrupt held off at most %.2f us, request to response at most %.2f us\n",
+           blocked_ns / 1000.0, worst_ns / 1000.0);
+    CHECK_EQ(over, 0);
+
+    profile_get_stats(PROFILE_ECU_RX, &stats);
+    CHECK(stats.count >= LOAD_RUNS * LOAD_REQUESTS);
+    printf("ecu_rx_frame: n %u, mean %.2f us, max %.2f us\n", (unsigned)stats.count,
+           cycles_us((uint32_t)(stats.sum / stats.count)), cycles_us(stats.max));
+
+    return TEST_RESULT();
+}
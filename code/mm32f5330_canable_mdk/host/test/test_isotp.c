@@ -0,0 +1,408 @@
+//
+// test_isotp: Segmentation, reassembly and timing of the ISO-TP offload
+//
+// The tester is the ECU at the other end: it answers first frames with
+// flow control, sends segmented responses and checks what the device puts
+// on the bus and when. Consecutive frames must be at least STmin apart
+// measured from when the previous one actually left the mailbox, and a
+// transfer is only reported complete once its last frame is on the bus.
+// Flow control owed to a sender goes out ahead of the host's queued
+// frames and of our next segment. A long 'I' line to the host must
+// neither stop the RX path nor command parsing, and nothing may be
+// written into the middle of it.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "error.h"
+#include "isotp.h"
+#include "can.h"
+
+#define ECU_RX      0x7E0u      // Frames from the device
+#define ECU_TX      0x7E8u      // Frames to the device
+
+static char all_buf[16384];
+
+// Everything the device sends over the next passes, until it goes quiet
+static const char *recv_all(uint32_t passes)
+{
+    uint32_t len = 0;
+
+    for (uint32_t i = 0; i < passes; i++)
+    {
+        test_app_run(1);
+        const char *rx = test_app_recv();
+        uint32_t n = (uint32_t)strlen(rx);
+        if (len + n >= sizeof(all_buf))
+            n = sizeof(all_buf) - 1 - len;
+        memcpy(all_buf + len, rx, n);
+        len += n;
+    }
+    all_buf[len] = '\0';
+    return all_buf;
+}
+
+// Host PDU line of n bytes counting up from first
+static void send_pdu(uint32_t n, uint8_t first)
+{
+    static char line[2 * ISOTP_MAX_LEN + 8];
+    int pos = snprintf(line, sizeof(line), "I0%03X", (unsigned)n);
+    for (uint32_t i = 0; i < n; i++)
+        pos += snprintf(line + pos, sizeof(line) - pos, "%02X", (uint8_t)(first + i));
+    line[pos++] = '\r';
+    line[pos] = '\0';
+    host_cdc_send_str(0, line);
+}
+
+static bool pop(host_can_frame_t *f)
+{
+    return host_can_tx_pop(f) && f->id == ECU_RX;
+}
+
+// Consecutive frame index of the PDU from send_pdu(n, 0)
+static bool is_cf(const host_can_frame_t *f, uint32_t index, uint32_t n)
+{
+    if (f->dlc != 8 || f->data[0] != (0x20 | (index & 0x0F)))
+        return false;
+    for (uint32_t i = 0; i < 7; i++)
+    {
+        uint32_t pos = 6 + 7 * (index - 1) + i;
+        if (f->data[1 + i] != (pos < n ? (uint8_t)pos : ISOTP_PADDING))
+            return false;
+    }
+    return true;
+}
+
+// Same for a frame popped as slcan text
+static bool is_cf_line(const char *line, uint32_t index)
+{
+    host_can_frame_t f;
+
+    if (strlen(line) != 21 || strncmp(line, "t7E08", 5) != 0)
+        return false;
+    memset(&f, 0, sizeof(f));
+    f.dlc = 8;
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        char b[3] = { line[5 + 2 * i], line[6 + 2 * i], 0 };
+        f.data[i] = (uint8_t)strtoul(b, NULL, 16);
+    }
+    return is_cf(&f, index, 20);
+}
+
+static void flow_control(uint8_t fs, uint8_t bs, uint8_t st_min)
+{
+    char hex[7];
+    snprintf(hex, sizeof(hex), "3%X%02X%02X", fs, bs, st_min);
+    CHECK(test_can_inject(ECU_TX, false, hex));
+}
+
+// Frame gaps of a PDU of n bytes sent with STmin, returns the smallest
+static uint64_t send_timed(uint32_t n, uint8_t st_min, uint64_t *largest)
+{
+    host_can_frame_t f;
+    uint64_t last = 0, smallest = UINT64_MAX;
+    uint32_t cfs = (n - 6 + 6) / 7;
+
+    send_pdu(n, 0);
+    test_app_run(4);
+    CHECK(pop(&f) && f.data[0] == (0x10 | (n >> 8)) && f.data[1] == (uint8_t)n);
+    flow_control(0, 0, st_min);
+    *largest = 0;
+    for (uint32_t i = 1; i <= cfs; i++)
+    {
+        for (uint32_t w = 0; w < 20000 && host_can_tx_count() == 0; w++)
+            test_app_run(1);
+        CHECK(pop(&f) && is_cf(&f, i, n));
+        if (i > 1)
+        {
+            uint64_t gap = f.time_us - last;
+            if (gap < smallest)
+                smallest = gap;
+            if (gap > *largest)
+                *largest = gap;
+        }
+        last = f.time_us;
+    }
+    CHECK_STR(recv_all(4), "i0000\r");
+    return smallest;
+}
+
+int main(void)
+{
+    host_can_frame_t f;
+    uint64_t largest;
+
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    // Pair 0: RX 0x7E8, TX 0x7E0, block size 0, STmin 0
+    test_app_cmd("i00000007E8000007E00000");
+
+    //
+    // Transmit
+    //
+
+    // Single frame, complete only once it is on the bus
+    host_can_hold_tx(true);
+    send_pdu(3, 0xAA);
+    CHECK_STR(recv_all(4), "");
+    CHECK_EQ(host_can_release_tx(4), 1);
+    host_can_hold_tx(false);
+    CHECK_STR(recv_all(4), "i0000\r");
+    CHECK_STR(test_can_pop(), "t7E0803AAABACCCCCCCCC");
+
+    // First frame, flow control, two consecutive frames
+    send_pdu(20, 0);
+    test_app_run(4);
+    CHECK_STR(test_can_pop(), "t7E081014000102030405");
+    CHECK_STR(test_can_pop(), "");
+    flow_control(0, 0, 0);
+    test_app_run(10);
+    CHECK_STR(test_can_pop(), "t7E0821060708090A0B0C");
+    CHECK_STR(test_can_pop(), "t7E08220D0E0F10111213");
+    CHECK_STR(recv_all(4), "i0000\r");
+
+    // The last consecutive frame held on the bus delays the report
+    send_pdu(20, 0);
+    test_app_run(4);
+    host_can_tx_clear();
+    host_can_hold_tx(true);
+    flow_control(0, 0, 0);
+    CHECK_STR(recv_all(20), "");
+    CHECK_EQ(host_can_release_tx(1), 1);
+    CHECK_STR(recv_all(20), "");
+    CHECK_EQ(host_can_release_tx(1), 1);
+    host_can_hold_tx(false);
+    CHECK_STR(recv_all(4), "i0000\r");
+    host_can_tx_clear();
+
+    // STmin in milliseconds and in 100 us steps
+    CHECK(send_timed(100, 0x05, &largest) >= 5000);
+    CHECK(largest < 5000 + 100);
+    CHECK(send_timed(100, 0xF3, &largest) >= 300);
+    CHECK(largest < 300 + 100);
+    CHECK(send_timed(100, 0x00, &largest) > 0);
+
+    // STmin counts from when the previous frame left, not when it was loaded
+    send_pdu(20, 0);
+    test_app_run(4);
+    host_can_tx_clear();
+    host_can_hold_tx(true);
+    flow_control(0, 0, 0x02);
+    test_app_run(1);
+    host_advance_us(3000);
+    test_app_run(1);
+    uint64_t released = host_time_us();
+    CHECK_EQ(host_can_release_tx(1), 1);
+    host_can_hold_tx(false);
+    for (uint32_t w = 0; w < 1000 && host_can_tx_count() < 2; w++)
+        test_app_run(1);
+    CHECK(pop(&f) && is_cf(&f, 1, 20));
+    CHECK(pop(&f) && is_cf(&f, 2, 20));
+    CHECK(f.time_us >= released + 2000);
+    CHECK_STR(recv_all(4), "i0000\r");
+
+    // Block size 2: five consecutive frames in three blocks
+    send_pdu(40, 0);
+    test_app_run(4);
+    host_can_tx_clear();
+    for (uint32_t block = 0; block < 3; block++)
+    {
+        flow_control(0, 2, 0);
+        test_app_run(20);
+        uint32_t expect = (block < 2) ? 2 : 1;
+        for (uint32_t i = 0; i < expect; i++)
+            CHECK(pop(&f) && is_cf(&f, 2 * block + i + 1, 40));
+        CHECK_EQ(host_can_tx_count(), 0);
+    }
+    CHECK_STR(recv_all(4), "i0000\r");
+
+    // FC WAIT keeps the sender waiting, then CTS releases it
+    send_pdu(20, 0);
+    test_app_run(4);
+    host_can_tx_clear();
+    flow_control(1, 0, 0);
+    test_app_run(20);
+    CHECK_EQ(host_can_tx_count(), 0);
+    flow_control(0, 0, 0);
+    test_app_run(20);
+    CHECK_EQ(host_can_tx_count(), 2);
+    host_can_tx_clear();
+    CHECK_STR(recv_all(4), "i0000\r");
+
+    // Receiver overflow, reserved flow status, no flow control at all
+    send_pdu(20, 0);
+    test_app_run(4);
+    flow_control(2, 0, 0);
+    CHECK_STR(recv_all(4), "i0004\r");
+    send_pdu(20, 0);
+    test_app_run(4);
+    flow_control(5, 0, 0);
+    CHECK_STR(recv_all(4), "i0007\r");
+    send_pdu(20, 0);
+    test_app_run(4);
+    host_advance_us((ISOTP_N_BS_MS + 2) * 1000u);
+    CHECK_STR(recv_all(4), "i0001\r");
+    host_can_tx_clear();
+
+    // A frame that never gets onto the bus times out and is taken back
+    host_can_hold_tx(true);
+    send_pdu(3, 0);
+    test_app_run(4);
+    host_advance_us((ISOTP_N_AS_MS + 2) * 1000u);
+    CHECK_STR(recv_all(4), "i000A\r");
+    CHECK_EQ(host_can_release_tx(4), 0);
+    host_can_hold_tx(false);
+
+    // A second PDU while one is in progress is refused
+    send_pdu(20, 0);
+    test_app_run(4);
+    send_pdu(3, 0);
+    CHECK_STR(recv_all(4), "i0008\r");
+    flow_control(0, 0, 0);
+    CHECK_STR(recv_all(10), "i0000\r");
+    host_can_tx_clear();
+
+    //
+    // Receive
+    //
+
+    CHECK(test_can_inject(ECU_TX, false, "03AABBCC"));
+    CHECK_STR(recv_all(4), "I0003AABBCC\r");
+
+    CHECK(test_can_inject(ECU_TX, false, "100A010203040506"));
+    test_app_run(2);
+    CHECK_STR(test_can_pop(), "t7E08300000CCCCCCCCCC");
+    CHECK(test_can_inject(ECU_TX, false, "210708090A"));
+    CHECK_STR(recv_all(4), "I000A0102030405060708090A\r");
+
+    // Wrong sequence number, then a sender going quiet
+    CHECK(test_can_inject(ECU_TX, false, "1014010203040506"));
+    test_app_run(2);
+    CHECK(test_can_inject(ECU_TX, false, "2207080900000000"));
+    CHECK_STR(recv_all(4), "i0103\r");
+    CHECK(test_can_inject(ECU_TX, false, "1014010203040506"));
+    test_app_run(2);
+    host_advance_us((ISOTP_N_CR_MS + 2) * 1000u);
+    CHECK_STR(recv_all(4), "i0102\r");
+    host_can_tx_clear();
+
+    // Flow control takes the ISO-TP mailbox, ahead of a TX queue full of
+    // the host's frames
+    host_can_hold_tx(true);
+    for (uint32_t i = 0; i < TXQUEUE_LEN + 2; i++)
+        host_cdc_send_str(0, "t1231AA\r");
+    test_app_run(8);
+    CHECK_EQ(can_tx_free(), 0);
+    CHECK(test_can_inject(ECU_TX, false, "1014010203040506"));
+    test_app_run(2);
+    CHECK_EQ(host_can_release_tx(1), 1);
+    CHECK_STR(test_can_pop(), "t7E08300000CCCCCCCCCC");
+    host_can_hold_tx(false);
+    for (uint32_t i = 0; i < TXQUEUE_LEN; i++)
+    {
+        host_can_release_tx(1);
+        test_app_run(1);
+    }
+    CHECK_EQ(can_tx_free(), TXQUEUE_LEN - 1);
+    test_app_cmd("i00000007E8000007E00000");
+    recv_all(4);
+    host_can_tx_clear();
+
+    // While a segment of ours is in the mailbox, flow control waits for it
+    // and goes before the next one
+    send_pdu(20, 0);
+    test_app_run(4);
+    CHECK_STR(test_can_pop(), "t7E081014000102030405");
+    host_can_hold_tx(true);
+    flow_control(0, 0, 0);
+    test_app_run(2);
+    CHECK(test_can_inject(ECU_TX, false, "1014010203040506"));
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        test_app_run(2);
+        CHECK_EQ(host_can_release_tx(1), 1);
+    }
+    host_can_hold_tx(false);
+    CHECK(is_cf_line(test_can_pop(), 1));
+    CHECK_STR(test_can_pop(), "t7E08300000CCCCCCCCCC");
+    CHECK(is_cf_line(test_can_pop(), 2));
+    CHECK_STR(recv_all(4), "i0000\r");
+    test_app_cmd("i00000007E8000007E00000");
+    recv_all(4);
+    host_can_tx_clear();
+
+    // Our block size: flow control after every two consecutive frames
+    test_app_cmd("i00000007E8000007E00200");
+    CHECK(test_can_inject(ECU_TX, false, "101B000102030405"));
+    test_app_run(2);
+    CHECK_STR(test_can_pop(), "t7E08300200CCCCCCCCCC");
+    CHECK(test_can_inject(ECU_TX, false, "21060708090A0B0C"));
+    CHECK(test_can_inject(ECU_TX, false, "220D0E0F10111213"));
+    test_app_run(2);
+    CHECK_STR(test_can_pop(), "t7E08300200CCCCCCCCCC");
+    CHECK(test_can_inject(ECU_TX, false, "231415161718191A"));
+    const char *rx = recv_all(4);
+    CHECK(strncmp(rx, "I001B000102", 11) == 0);
+    test_app_cmd("i00000007E8000007E00000");
+    host_can_tx_clear();
+
+    // A truncated configuration is refused and keeps the pair, only 'i' +
+    // pair disables it
+    CHECK_EQ(test_slcan_parse("i00000007E8"), -1);
+    CHECK_EQ(test_slcan_parse("i000"), -1);
+    CHECK_EQ(test_slcan_parse("i"), -1);
+    CHECK(test_can_inject(ECU_TX, false, "0111"));
+    CHECK_STR(recv_all(4), "I000111\r");
+    CHECK_EQ(test_slcan_parse("i0"), 0);
+    CHECK(test_can_inject(ECU_TX, false, "0111"));
+    CHECK_STR(recv_all(4), "t7E820111000000000000\r");
+    test_app_cmd("i00000007E8000007E00000");
+
+    //
+    // A long line to a host which does not read
+    //
+
+    // The full 4095 byte PDU, the CDC FIFO takes only part of its line
+    CHECK(test_can_inject(ECU_TX, false, "1FFF000102030405"));
+    test_app_run(2);
+    host_can_tx_clear();
+    for (uint32_t i = 1; i <= (ISOTP_MAX_LEN - 6 + 6) / 7; i++)
+    {
+        char hex[17];
+        int pos = snprintf(hex, sizeof(hex), "2%X", (unsigned)(i & 0x0F));
+        for (uint32_t b = 0; b < 7; b++)
+            pos += snprintf(hex + pos, sizeof(hex) - pos, "%02X", (uint8_t)(6 + 7 * (i - 1) + b));
+        CHECK(test_can_inject(ECU_TX, false, hex));
+        test_app_run(1);
+    }
+    test_app_run(4);
+    CHECK(host_cdc_tx_queued(0) > 0);
+
+    // Meanwhile frames are still taken from the controller, commands are
+    // parsed and acted on, and their replies wait for the CR
+    for (uint32_t i = 0; i < 3; i++)
+        CHECK(test_can_inject(0x123, false, "55"));
+    host_cdc_send_str(0, "K\rt3211AB\r");
+    test_app_run(4);
+    CHECK_EQ(host_can_rx_pending(), 0);
+    CHECK_STR(test_can_pop(), "t3211AB");
+
+    // Then the whole line, followed by what was held back
+    rx = recv_all(200);
+    CHECK_EQ(strncmp(rx, "I0FFF", 5), 0);
+    bool intact = true;
+    for (uint32_t i = 0; i < ISOTP_MAX_LEN && intact; i++)
+    {
+        char b[3];
+        snprintf(b, sizeof(b), "%02X", (uint8_t)i);
+        intact = (rx[5 + 2 * i] == b[0] && rx[6 + 2 * i] == b[1]);
+    }
+    CHECK(intact);
+    CHECK_STR(rx + 5 + 2 * ISOTP_MAX_LEN,
+              "\rK00\rt12315500000000000000\rt12315500000000000000\rt12315500000000000000\r");
+    CHECK_EQ(error_count(ERR_USBTX_BUSY), 0);
+
+    return TEST_RESULT();
+}
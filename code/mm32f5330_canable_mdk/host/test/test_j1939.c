@@ -0,0 +1,234 @@
+//
+// test_j1939: Transport protocol reassembly replayed from bus recordings
+//
+// The traces are candump-style lines of an engine ECU (SA 0x00) sending
+// DM1 by BAM and its software identification to a service tool (SA 0xF9)
+// by RTS/CTS. They are replayed in order, with packets lost, repeated or
+// out of order, both with the device only following the transfer and with
+// it answering as the service tool. A long 'J' line to a host which does
+// not read must neither stop the RX path nor command parsing.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "error.h"
+#include "j1939.h"
+
+// DM1, 19 bytes in 3 packets, BAM at 50 ms packet spacing
+static const char *const bam_trace[] = {
+    "18ECFF00#20130003FFCAFE00",
+    "18EBFF00#0104FF00000000F0",
+    "18EBFF00#0201BE0000000000",
+    "18EBFF00#0364000102FFFFFF",
+};
+
+// Software identification, 26 bytes in 4 packets, to the service tool
+static const char *const cmdt_trace[] = {
+    "1CECF900#101A0004FFDAFE00",    // RTS
+    "1CEC00F9#110401FFFFDAFE00",    // CTS: 4 packets from 1
+    "1CEBF900#01024D4D33322A46",
+    "1CEBF900#0235333333332A43",
+    "1CEBF900#03414E41424C452A",
+    "1CEBF900#04322E302A2AFFFF",
+    "1CEC00F9#131A0004FFDAFE00",    // EndOfMsgAck
+};
+
+#define DM1_LINE    "J00FECA00FF01304FF00000000F001BE000000000064000102FF\r"
+#define SOFT_LINE   "J00FEDA00F901A024D4D33322A4635333333332A43414E41424C452A322E302A2A\r"
+
+// The EndOfMsgAck of a passively followed transfer comes after the
+// message is complete and is forwarded like any other frame
+#define SOFT_EOMA   "T1CEC00F98131A0004FFDAFE00\r"
+
+static char all_buf[8192];
+
+static void inject(const char *line)
+{
+    const char *hash = strchr(line, '#');
+    uint32_t id = (uint32_t)strtoul(line, NULL, 16);
+    CHECK(test_can_inject(id, (hash - line) > 3, hash + 1));
+    // Handled in one pass, what it queued goes on the bus in the next
+    test_app_run(2);
+    host_advance_us(50000);
+}
+
+static const char *recv_all(uint32_t passes)
+{
+    uint32_t len = 0;
+
+    for (uint32_t i = 0; i < passes; i++)
+    {
+        test_app_run(1);
+        const char *rx = test_app_recv();
+        uint32_t n = (uint32_t)strlen(rx);
+        if (len + n >= sizeof(all_buf))
+            n = sizeof(all_buf) - 1 - len;
+        memcpy(all_buf + len, rx, n);
+        len += n;
+    }
+    all_buf[len] = '\0';
+    return all_buf;
+}
+
+// Replay the trace in the given packet order, 0 terminated, after the
+// announcement; trace entries are 1-based, CTS/EOMA lines included
+static void replay(const char *const *trace, const uint8_t *order)
+{
+    inject(trace[0]);
+    for (; *order; order++)
+        inject(trace[*order]);
+}
+
+int main(void)
+{
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    test_app_cmd("j100FECA");
+    test_app_cmd("j100FEDA");
+
+    //
+    // BAM
+    //
+
+    // In order, in reverse, and with a packet repeated
+    static const uint8_t bam_in_order[] = { 1, 2, 3, 0 };
+    static const uint8_t bam_reversed[] = { 3, 2, 1, 0 };
+    static const uint8_t bam_repeated[] = { 1, 1, 2, 2, 3, 0 };
+    replay(bam_trace, bam_in_order);
+    CHECK_STR(recv_all(4), DM1_LINE);
+    replay(bam_trace, bam_reversed);
+    CHECK_STR(recv_all(4), DM1_LINE);
+    replay(bam_trace, bam_repeated);
+    CHECK_STR(recv_all(4), DM1_LINE);
+
+    // A lost packet: the transfer times out after T1
+    static const uint8_t bam_lost[] = { 1, 3, 0 };
+    replay(bam_trace, bam_lost);
+    CHECK_STR(recv_all(4), "");
+    host_advance_us((J1939_T1_MS + 1) * 1000u);
+    CHECK_STR(recv_all(4), "j00FECA00FF03\r");
+
+    // A new BAM from the same originator replaces an incomplete one
+    static const uint8_t bam_first[] = { 1, 0 };
+    replay(bam_trace, bam_first);
+    replay(bam_trace, bam_in_order);
+    CHECK_STR(recv_all(4), "j00FECA00FF01\r" DM1_LINE);
+
+    // Not selected: raw frames
+    test_app_cmd("j0");
+    test_app_cmd("j100FEDA");
+    inject(bam_trace[0]);
+    CHECK_STR(recv_all(2), "T18ECFF00820130003FFCAFE00\r");
+    test_app_cmd("j100FECA");
+
+    //
+    // RTS/CTS between other nodes, followed passively
+    //
+
+    static const uint8_t cmdt_in_order[] = { 1, 2, 3, 4, 5, 6, 0 };
+    static const uint8_t cmdt_shuffled[] = { 1, 4, 2, 5, 3, 6, 0 };
+    replay(cmdt_trace, cmdt_in_order);
+    CHECK_STR(recv_all(4), SOFT_LINE SOFT_EOMA);
+    replay(cmdt_trace, cmdt_shuffled);
+    CHECK_STR(recv_all(4), SOFT_LINE SOFT_EOMA);
+    CHECK_EQ(host_can_tx_count(), 0);
+
+    // A lost packet: the originator gives up after T2 without an EOMA
+    static const uint8_t cmdt_lost[] = { 1, 2, 3, 5, 0 };
+    replay(cmdt_trace, cmdt_lost);
+    host_advance_us((J1939_T2_MS + 1) * 1000u);
+    CHECK_STR(recv_all(4), "j00FEDA00F903\r");
+
+    //
+    // RTS/CTS to the device as service tool, two packets per CTS
+    //
+
+    test_app_cmd("j2F902");
+    inject(cmdt_trace[0]);
+    CHECK_STR(test_can_pop(), "T1CEC00F98110201FFFFDAFE00");
+    inject(cmdt_trace[2]);
+    inject(cmdt_trace[3]);
+    CHECK_STR(test_can_pop(), "T1CEC00F98110203FFFFDAFE00");
+    inject(cmdt_trace[4]);
+    inject(cmdt_trace[5]);
+    CHECK_STR(test_can_pop(), "T1CEC00F98131A0004FFDAFE00");
+    CHECK_STR(recv_all(4), SOFT_LINE);
+
+    // Packet 2 lost: after T1 it is asked for again, the repeat of packet 3
+    // is counted once and only packet 4 is left for the last CTS
+    inject(cmdt_trace[0]);
+    CHECK_STR(test_can_pop(), "T1CEC00F98110201FFFFDAFE00");
+    inject(cmdt_trace[2]);
+    inject(cmdt_trace[4]);
+    CHECK_STR(test_can_pop(), "");
+    host_advance_us((J1939_T1_MS + 1) * 1000u);
+    test_app_run(2);
+    CHECK_STR(test_can_pop(), "T1CEC00F98110202FFFFDAFE00");
+    inject(cmdt_trace[3]);
+    inject(cmdt_trace[4]);
+    CHECK_STR(test_can_pop(), "T1CEC00F98110104FFFFDAFE00");
+    inject(cmdt_trace[5]);
+    CHECK_STR(test_can_pop(), "T1CEC00F98131A0004FFDAFE00");
+    CHECK_STR(recv_all(4), SOFT_LINE);
+
+    // A packet that never comes: given up after J1939_MAX_RETRY requests
+    inject(cmdt_trace[0]);
+    CHECK_STR(test_can_pop(), "T1CEC00F98110201FFFFDAFE00");
+    inject(cmdt_trace[2]);
+    for (uint32_t i = 0; i < J1939_MAX_RETRY; i++)
+    {
+        host_advance_us((J1939_T1_MS + 1) * 1000u);
+        test_app_run(2);
+        CHECK_STR(test_can_pop(), "T1CEC00F98110202FFFFDAFE00");
+    }
+    host_advance_us((J1939_T1_MS + 1) * 1000u);
+    test_app_run(2);
+    CHECK_STR(test_can_pop(), "T1CEC00F98FF05FFFFFFDAFE00");
+    CHECK_STR(recv_all(4), "j00FEDA00F905\r");
+    test_app_cmd("j3");
+
+    //
+    // A long line to a host which does not read
+    //
+
+    // The largest BAM message, the CDC FIFO takes only part of its line
+    test_app_cmd("j1012345");
+    CHECK(test_can_inject(0x18ECFF00, true, "20F906FFFF452301"));
+    test_app_run(1);
+    for (uint32_t seq = 1; seq <= 255; seq++)
+    {
+        char hex[17];
+        int pos = snprintf(hex, sizeof(hex), "%02X", (unsigned)seq);
+        for (uint32_t b = 0; b < 7; b++)
+            pos += snprintf(hex + pos, sizeof(hex) - pos, "%02X", (uint8_t)(7 * (seq - 1) + b));
+        CHECK(test_can_inject(0x18EBFF00, true, hex));
+        test_app_run(1);
+    }
+    test_app_run(4);
+    CHECK(host_cdc_tx_queued(0) > 0);
+
+    // Meanwhile frames are taken from the controller and commands handled
+    for (uint32_t i = 0; i < 3; i++)
+        CHECK(test_can_inject(0x123, false, "55"));
+    host_cdc_send_str(0, "K\rt3211AB\r");
+    test_app_run(4);
+    CHECK_EQ(host_can_rx_pending(), 0);
+    CHECK_STR(test_can_pop(), "t3211AB");
+
+    const char *rx = recv_all(200);
+    CHECK_EQ(strncmp(rx, "J01234500FF6F9", 14), 0);
+    bool intact = true;
+    for (uint32_t i = 0; i < J1939_MAX_LEN && intact; i++)
+    {
+        char b[3];
+        snprintf(b, sizeof(b), "%02X", (uint8_t)i);
+        intact = (rx[14 + 2 * i] == b[0] && rx[15 + 2 * i] == b[1]);
+    }
+    CHECK(intact);
+    CHECK_STR(rx + 14 + 2 * J1939_MAX_LEN,
+              "\rK00\rt12315500000000000000\rt12315500000000000000\rt12315500000000000000\r");
+    CHECK_EQ(error_count(ERR_USBTX_BUSY), 0);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,311 @@
+//
+// test_latency: Histograms of the USB latency tracer and its 'U' dump
+//
+// Linked with the instrumented firmware. The host model calls the token,
+// transfer and bus reset hooks where the DCD port does, so a frame's time
+// to the host is the time the test lets pass before polling the bulk IN
+// endpoint. Latencies go to log2 buckets as in the profiler, frames lost
+// in the packet dropped by a bus reset are never counted, and the dump
+// adds up to the statistics it reports.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "latency.h"
+
+static uint32_t hex_field(const char *p, uint8_t digits)
+{
+    char buf[9];
+    memcpy(buf, p, digits);
+    buf[digits] = '\0';
+    return (uint32_t)strtoul(buf, NULL, 16);
+}
+
+static uint32_t count_lines(const char *rx)
+{
+    uint32_t lines = 0;
+
+    while ((rx = strchr(rx, '\r')) != NULL)
+    {
+        lines++;
+        rx++;
+    }
+    return lines;
+}
+
+// Bucket n holds [2^n, 2^(n+1)), 0 goes with 1, the last bucket is open
+static void check_buckets(void)
+{
+    static const uint32_t samples[] = { 0, 1, 2, 3, 4, 7, 8, 1000, 1u << 19, 1u << 22 };
+    static const uint8_t buckets[] = { 0, 0, 1, 1, 2, 2, 3, 9, 19, 19 };
+    latency_stats_t stats;
+    uint64_t sum = 0;
+
+    test_app_boot();
+    latency_reset();
+    for (uint32_t i = 0; i < sizeof(samples) / sizeof(samples[0]); i++)
+    {
+        latency_tx_queued(0);
+        host_advance_us(samples[i]);
+        latency_tx_loaded(0);
+        sum += samples[i];
+    }
+    latency_get_stats(LATENCY_TX_MAILBOX, &stats);
+    CHECK_EQ(stats.count, 10);
+    CHECK_EQ(stats.min, 0);
+    CHECK_EQ(stats.max, 1u << 22);
+    CHECK(stats.sum == sum);
+    uint32_t expect[LATENCY_HIST_BUCKETS] = {0};
+    for (uint32_t i = 0; i < sizeof(buckets); i++)
+        expect[buckets[i]]++;
+    for (uint32_t b = 0; b < LATENCY_HIST_BUCKETS; b++)
+        CHECK_EQ(stats.hist[b], expect[b]);
+
+    // Other stages are untouched, out of range ones ignored
+    latency_get_stats(LATENCY_RX_TOTAL, &stats);
+    CHECK_EQ(stats.count, 0);
+    stats.count = 1234;
+    latency_get_stats(LATENCY_MAX, &stats);
+    CHECK_EQ(stats.count, 1234);
+}
+
+// Frames to the host: the time until the host polls is the USB stage
+static void check_rx_path(void)
+{
+    latency_stats_t stats;
+
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    test_app_cmd("U0");
+
+    // One frame at a time, polled 500 us after it was written
+    for (uint32_t i = 0; i < 20; i++)
+    {
+        CHECK(test_can_inject(0x100 + i, false, "1122334455667788"));
+        test_app_run(1);
+        host_advance_us(500);
+        CHECK_EQ(count_lines(test_app_recv()), 1);
+    }
+    latency_get_stats(LATENCY_RX_USB, &stats);
+    CHECK_EQ(stats.count, 20);
+    CHECK(stats.min >= 500 && stats.max <= 520);
+    CHECK_EQ(stats.hist[8], 20);
+    latency_get_stats(LATENCY_RX_TOTAL, &stats);
+    CHECK_EQ(stats.count, 20);
+    CHECK(stats.min >= 500 && stats.max <= 520);
+    latency_get_stats(LATENCY_RX_ENCODE, &stats);
+    CHECK_EQ(stats.count, 20);
+    CHECK(stats.max < 16);
+    latency_get_stats(LATENCY_RX_ENQUEUE, &stats);
+    CHECK_EQ(stats.count, 20);
+
+    // A burst leaves in 64-byte packets; each line is done when the packet
+    // holding its last byte is taken
+    test_app_cmd("U0");
+    for (uint32_t i = 0; i < 12; i++)
+    {
+        CHECK(test_can_inject(0x200 + i, false, "1122334455667788"));
+        if (i % 4 == 3)
+            test_app_run(2);
+    }
+    test_app_run(10);
+    host_advance_us(2000);
+    CHECK_EQ(count_lines(test_app_recv()), 12);
+    latency_get_stats(LATENCY_RX_USB, &stats);
+    CHECK_EQ(stats.count, 12);
+    CHECK(stats.min >= 2000 && stats.max <= 2200);
+    latency_get_stats(LATENCY_RX_TOTAL, &stats);
+    CHECK_EQ(stats.count, 12);
+
+    // A host that stops polling: the oldest traces give way, what the
+    // host finally takes is still timed
+    test_app_cmd("U0");
+    for (uint32_t i = 0; i < 2 * LATENCY_TRACE_DEPTH + 8; i++)
+    {
+        CHECK(test_can_inject(0x300, false, "1122334455667788"));
+        test_app_run(2);
+    }
+    host_advance_us(1000);
+    CHECK_EQ(count_lines(test_app_recv()), 2 * LATENCY_TRACE_DEPTH + 8);
+    latency_get_stats(LATENCY_RX_USB, &stats);
+    CHECK(stats.count >= LATENCY_TRACE_DEPTH - 1 && stats.count <= LATENCY_TRACE_DEPTH);
+    CHECK(stats.min >= 1000);
+    latency_get_stats(LATENCY_RX_ENCODE, &stats);
+    CHECK_EQ(stats.count, 2 * LATENCY_TRACE_DEPTH + 8);
+}
+
+// Lines in the packet a bus reset drops are forgotten, the ones behind
+// them in the kept FIFO are timed when they arrive after re-enumeration
+static void check_bus_reset(void)
+{
+    latency_stats_t stats;
+
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    test_app_cmd("U0");
+
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        CHECK(test_can_inject(0x400 + i, false, "1122334455667788"));
+        test_app_run(1);
+    }
+    uint32_t queued = host_cdc_tx_queued(0);
+    CHECK(queued > 64);
+    host_usb_bus_reset();
+    uint32_t kept = host_cdc_tx_queued(0);
+    CHECK(kept < queued);
+    host_usb_mount(true);
+    host_cdc_set_dtr(0, true);
+    test_app_run(4);
+    host_advance_us(300);
+    const char *rx = test_app_recv();
+    CHECK_EQ(strlen(rx), kept);
+
+    // Every trace left is a line that arrived, none of them timed from
+    // before the reset as if the dropped bytes had been delivered
+    latency_get_stats(LATENCY_RX_USB, &stats);
+    CHECK(stats.count >= 4 && stats.count <= count_lines(rx));
+    CHECK(stats.min >= 300);
+
+    // Later frames are timed as before
+    test_app_cmd("U0");
+    CHECK(test_can_inject(0x500, false, "01"));
+    test_app_run(1);
+    host_advance_us(100);
+    CHECK_EQ(count_lines(test_app_recv()), 1);
+    latency_get_stats(LATENCY_RX_USB, &stats);
+    CHECK_EQ(stats.count, 1);
+    CHECK(stats.min >= 100 && stats.max <= 120);
+}
+
+// Frames from the host: parse after the OUT packet, then the mailbox
+static void check_tx_path(void)
+{
+    latency_stats_t stats;
+
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    test_app_cmd("U0");
+    for (uint32_t i = 0; i < 30; i++)
+    {
+        test_app_cmd("t1238112233445566778");
+        CHECK(test_can_pop()[0] != '\0');
+    }
+    latency_get_stats(LATENCY_TX_PARSE, &stats);
+    CHECK_EQ(stats.count, 30);
+    CHECK(stats.max < 64);
+    latency_get_stats(LATENCY_TX_MAILBOX, &stats);
+    CHECK_EQ(stats.count, 30);
+
+    // Frames wait in the queue while the mailbox is busy on the bus
+    test_app_cmd("U0");
+    host_can_hold_tx(true);
+    for (uint32_t i = 0; i < 4; i++)
+        host_cdc_send_str(0, "t1238112233445566778\r");
+    test_app_run(4);
+    host_advance_us(1000);
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        host_can_release_tx(1);
+        test_app_run(1);
+    }
+    host_can_hold_tx(false);
+    test_app_recv();
+    latency_get_stats(LATENCY_TX_MAILBOX, &stats);
+    CHECK_EQ(stats.count, 4);
+    CHECK(stats.max >= 1000);
+}
+
+// 'U' dumps a summary per stage, its non-empty buckets, then 'U'
+static void check_dump(void)
+{
+    latency_stats_t stats[LATENCY_MAX];
+
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    test_app_cmd("U0");
+    for (uint32_t i = 0; i < 50; i++)
+    {
+        test_app_cmd("t1238112233445566778");
+        CHECK(test_can_inject(0x321, false, "01"));
+        test_app_run(1 + i % 7);
+        host_advance_us(i * 37);
+        test_app_recv();
+    }
+    for (uint8_t s = 0; s < LATENCY_MAX; s++)
+        latency_get_stats(s, &stats[s]);
+
+    host_cdc_send_str(0, "U\r");
+    test_app_run(200);
+    const char *rx = test_app_recv();
+    int32_t stage = -1;
+    uint32_t count = 0, hist_sum = 0;
+    int32_t last_bucket = -1;
+    uint8_t done = 0;
+    for (const char *p = rx; *p && !done; )
+    {
+        const char *cr = strchr(p, '\r');
+        CHECK(cr != NULL);
+        if (!cr)
+            break;
+        size_t len = (size_t)(cr - p);
+        if (p[0] == 'U' && len == 1)
+        {
+            done = 1;
+        }
+        else if (p[0] == 'U')
+        {
+            CHECK_EQ(len, 34);
+            if (stage >= 0)
+                CHECK_EQ(hist_sum, count);
+            CHECK_EQ(hex_field(p + 1, 1), stage + 1);
+            stage = (int32_t)hex_field(p + 1, 1);
+            if (stage >= LATENCY_MAX)
+                break;
+            const latency_stats_t *s = &stats[stage];
+            count = hex_field(p + 2, 8);
+            CHECK_EQ(count, s->count);
+            CHECK_EQ(hex_field(p + 10, 8), s->count ? s->min : 0);
+            CHECK_EQ(hex_field(p + 18, 8), s->max);
+            CHECK_EQ(hex_field(p + 26, 8), s->count ? s->sum / s->count : 0);
+            hist_sum = 0;
+            last_bucket = -1;
+        }
+        else if (p[0] == 'u')
+        {
+            CHECK_EQ(len, 12);
+            CHECK_EQ(hex_field(p + 1, 1), stage);
+            int32_t bucket = (int32_t)hex_field(p + 2, 2);
+            CHECK(bucket > last_bucket && bucket < (int32_t)LATENCY_HIST_BUCKETS);
+            if (stage >= 0 && bucket < (int32_t)LATENCY_HIST_BUCKETS)
+                CHECK_EQ(hex_field(p + 4, 8), stats[stage].hist[bucket]);
+            last_bucket = bucket;
+            hist_sum += hex_field(p + 4, 8);
+        }
+        p = cr + 1;
+    }
+    CHECK(done);
+    CHECK_EQ(stage, LATENCY_MAX - 1);
+    CHECK_EQ(hist_sum, count);
+    CHECK(stats[LATENCY_RX_TOTAL].count == 50 && stats[LATENCY_TX_MAILBOX].count == 50);
+
+    // 'U0' clears everything
+    test_app_cmd("U0");
+    latency_get_stats(LATENCY_RX_TOTAL, &stats[0]);
+    CHECK_EQ(stats[0].count, 0);
+    CHECK_EQ(stats[0].hist[0], 0);
+}
+
+int main(void)
+{
+    check_buckets();
+    check_rx_path();
+    check_bus_reset();
+    check_tx_path();
+    check_dump();
+    return TEST_RESULT();
+}
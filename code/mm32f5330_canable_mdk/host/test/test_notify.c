@@ -0,0 +1,170 @@
+//
+// test_notify: Coalescing of bus state notifications
+//
+// One SERIAL_STATE notification is in flight at a time. While the host
+// has not polled it, error state flapping and overruns on every pass must
+// merge into a single next notification carrying the latest levels and
+// every event since, so that a storm costs one packet per poll and no
+// event is lost, however briefly it was raised. Events are cleared in the
+// notification after the one which reported them.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "board_init.h"
+#include "can.h"
+#include "error.h"
+#include "notify.h"
+
+#define NOTIFY_EP       0x81u
+
+// UART state of the notification the host polls, -1 if none is pending
+static int32_t poll(void)
+{
+    uint8_t buf[16];
+    uint32_t n = host_usb_ep_poll(NOTIFY_EP, buf, sizeof(buf));
+
+    if (n == 0)
+        return -1;
+    CHECK_EQ(n, NOTIFY_LEN);
+    CHECK_EQ(buf[0], 0xA1);
+    CHECK_EQ(buf[1], 0x20);
+    CHECK_EQ(buf[4], NOTIFY_ITF * 2);
+    CHECK_EQ(buf[6], 2);
+    return buf[8] | buf[9] << 8;
+}
+
+// Error active, warning, passive or bus off in the FlexCAN status
+static void set_fltconf(uint32_t fltconf, bool warning)
+{
+    BOARD_FLEXCAN_PORT->ESR1 = (fltconf << 4) | (warning ? FLEXCAN_STATUS_RXWRN : 0u);
+}
+
+int main(void)
+{
+    int32_t state;
+
+    test_app_boot();
+    test_app_run(4);
+    CHECK_EQ(poll(), -1);
+
+    // Going on bus is reported once
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    CHECK_EQ(poll(), NOTIFY_ON_BUS | NOTIFY_ACTIVE);
+    test_app_run(100);
+    CHECK_EQ(poll(), -1);
+
+    //
+    // Storm while the host does not poll: one packet in flight, then one
+    // carrying everything since
+    //
+
+    set_fltconf(0, true);
+    test_app_run(1);
+    for (uint32_t i = 0; i < 1000; i++)
+    {
+        set_fltconf(i % 3 == 2 ? 1 : 0, i % 3 == 1);
+        error_assert(ERR_FULLBUF_CANTX);
+        test_app_run(1);
+    }
+    set_fltconf(0, false);
+    test_app_run(4);
+    CHECK_EQ(poll(), NOTIFY_ON_BUS | NOTIFY_ACTIVE | NOTIFY_WARNING);
+    test_app_run(1);
+    CHECK_EQ(poll(), NOTIFY_ON_BUS | NOTIFY_ACTIVE | NOTIFY_WARNING | NOTIFY_PASSIVE | NOTIFY_OVERRUN);
+    CHECK_EQ(poll(), -1);
+
+    // Events go once reported, the levels stay
+    test_app_run(1);
+    CHECK_EQ(poll(), NOTIFY_ON_BUS | NOTIFY_ACTIVE);
+    test_app_run(100);
+    CHECK_EQ(poll(), -1);
+
+    //
+    // A single pass of bus off while a notification is in flight
+    //
+
+    error_assert(ERR_USBTX_BUSY);
+    test_app_run(1);
+    set_fltconf(2, false);
+    test_app_run(1);
+    set_fltconf(0, false);
+    test_app_run(10);
+    CHECK_EQ(poll(), NOTIFY_ON_BUS | NOTIFY_ACTIVE | NOTIFY_OVERRUN);
+    test_app_run(1);
+    CHECK_EQ(poll(), NOTIFY_ON_BUS | NOTIFY_ACTIVE | NOTIFY_BUS_OFF);
+    test_app_run(1);
+    CHECK_EQ(poll(), NOTIFY_ON_BUS | NOTIFY_ACTIVE);
+
+    //
+    // Host polling every 1 ms frame under a random storm: one packet per
+    // poll at most, each event seen within two frames of being raised
+    //
+
+    srand(45);
+    uint32_t packets = 0, polls = 0;
+    uint64_t raised_at[16] = {0};
+    uint64_t worst = 0;
+    for (uint32_t ms = 0; ms < 2000; ms++)
+    {
+        for (uint32_t t = 0; t < 100; t++)
+        {
+            uint32_t r = (uint32_t)rand();
+            uint16_t raised = 0;
+            if ((r & 0xFu) == 0)
+            {
+                uint32_t fltconf = (r >> 4) % 4u;
+                set_fltconf(fltconf == 3 ? 0 : fltconf, (r >> 8) & 1u);
+                raised |= (fltconf == 1) ? NOTIFY_PASSIVE : (fltconf == 2) ? NOTIFY_BUS_OFF : 0u;
+                raised |= ((r >> 8) & 1u) ? NOTIFY_WARNING : 0u;
+            }
+            if ((r & 0xFF0u) == 0x100u)
+            {
+                error_assert(ERR_FULLBUF_USBRX);
+                raised |= NOTIFY_OVERRUN;
+            }
+            // The oldest event not reported yet counts
+            for (uint32_t b = 0; b < 16; b++)
+            {
+                if ((raised & (1u << b)) && raised_at[b] == 0)
+                    raised_at[b] = host_time_us();
+            }
+            test_app_run(1);
+        }
+        polls++;
+        state = poll();
+        if (state < 0)
+            continue;
+        packets++;
+        for (uint32_t b = 0; b < 16; b++)
+        {
+            if ((state & (1u << b)) && raised_at[b])
+            {
+                if (host_time_us() - raised_at[b] > worst)
+                    worst = host_time_us() - raised_at[b];
+                raised_at[b] = 0;
+            }
+        }
+    }
+    CHECK(packets <= polls);
+    CHECK(packets > 100);
+    CHECK(worst <= 2000);
+    set_fltconf(0, false);
+
+    //
+    // A new enumeration reports the state again
+    //
+
+    test_app_run(2);
+    poll();
+    test_app_run(2);
+    poll();
+    host_usb_bus_reset();
+    host_usb_mount(true);
+    host_cdc_set_dtr(0, true);
+    test_app_run(2);
+    CHECK_EQ(poll(), NOTIFY_ON_BUS | NOTIFY_ACTIVE);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,130 @@
+//
+// test_profile: Histogram of the hot-path profiler and its 'P' dump
+//
+// Linked with the instrumented firmware, where PROFILE_CYCLES() reads the
+// host's monotonic clock scaled to CLOCK_SYS_FREQ.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "profile.h"
+
+static uint32_t hex_field(const char *p, uint8_t digits)
+{
+    char buf[9];
+    memcpy(buf, p, digits);
+    buf[digits] = '\0';
+    return (uint32_t)strtoul(buf, NULL, 16);
+}
+
+int main(void)
+{
+    profile_stats_t stats;
+
+    test_app_boot();
+
+    // Bucket n holds [2^n, 2^(n+1)), 0 goes with 1, the last bucket is open
+    profile_reset();
+    static const uint32_t samples[] = { 0, 1, 2, 3, 4, 7, 8, 1000, 1u << 23, 0xFFFFFFFFu };
+    static const uint8_t buckets[] = { 0, 0, 1, 1, 2, 2, 3, 9, 23, 23 };
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < sizeof(samples) / sizeof(samples[0]); i++)
+    {
+        profile_record(PROFILE_E2E_PROTECT, samples[i]);
+        sum += samples[i];
+    }
+    profile_get_stats(PROFILE_E2E_PROTECT, &stats);
+    CHECK_EQ(stats.count, 10);
+    CHECK_EQ(stats.min, 0);
+    CHECK_EQ(stats.max, 0xFFFFFFFFu);
+    CHECK(stats.sum == sum);
+    uint32_t expect[PROFILE_HIST_BUCKETS] = {0};
+    for (uint32_t i = 0; i < sizeof(buckets); i++)
+        expect[buckets[i]]++;
+    for (uint32_t b = 0; b < PROFILE_HIST_BUCKETS; b++)
+        CHECK_EQ(stats.hist[b], expect[b]);
+
+    // Out of range sections are ignored
+    profile_record(PROFILE_MAX, 5);
+
+    // The cycle clock never runs backwards
+    uint32_t last = PROFILE_CYCLES();
+    for (uint32_t i = 0; i < 100000; i++)
+    {
+        uint32_t now = PROFILE_CYCLES();
+        CHECK((int32_t)(now - last) >= 0);
+        last = now;
+    }
+
+    // The main loop sections are measured
+    test_app_cmd("P0");
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    for (uint32_t i = 0; i < 50; i++)
+    {
+        test_app_cmd("t1238112233445566778");
+        test_can_inject(0x321, false, "01");
+        test_app_run(2);
+    }
+    test_app_recv();
+    profile_section_t measured[] = { PROFILE_CDC_PROCESS, PROFILE_LED_PROCESS, PROFILE_CAN_PROCESS, PROFILE_SLCAN_PARSE_FRAME };
+    for (uint32_t i = 0; i < sizeof(measured) / sizeof(measured[0]); i++)
+    {
+        profile_get_stats(measured[i], &stats);
+        CHECK(stats.count > 0);
+        CHECK(stats.min <= stats.max);
+        CHECK(stats.sum >= (uint64_t)stats.min * stats.count);
+        CHECK(stats.sum <= (uint64_t)stats.max * stats.count);
+    }
+    profile_get_stats(PROFILE_SLCAN_PARSE_FRAME, &stats);
+    CHECK_EQ(stats.count, 50);
+
+    // 'P' dumps a summary per section, its non-empty buckets, then 'P'
+    host_cdc_send_str(0, "P\r");
+    test_app_run(200);
+    const char *rx = test_app_recv();
+    int32_t sec = -1;
+    uint32_t count = 0, hist_sum = 0;
+    uint8_t done = 0;
+    for (const char *p = rx; *p && !done; )
+    {
+        const char *cr = strchr(p, '\r');
+        CHECK(cr != NULL);
+        if (!cr)
+            break;
+        size_t len = (size_t)(cr - p);
+        if (p[0] == 'P' && len == 1)
+        {
+            done = 1;
+        }
+        else if (p[0] == 'P')
+        {
+            CHECK_EQ(len, 34);
+            if (sec >= 0)
+                CHECK_EQ(hist_sum, count);
+            CHECK_EQ(hex_field(p + 1, 1), sec + 1);
+            sec = (int32_t)hex_field(p + 1, 1);
+            count = hex_field(p + 2, 8);
+            hist_sum = 0;
+        }
+        else if (p[0] == 'p')
+        {
+            CHECK_EQ(len, 12);
+            CHECK_EQ(hex_field(p + 1, 1), sec);
+            CHECK(hex_field(p + 2, 2) < PROFILE_HIST_BUCKETS);
+            hist_sum += hex_field(p + 4, 8);
+        }
+        p = cr + 1;
+    }
+    CHECK(done);
+    CHECK_EQ(sec, PROFILE_MAX - 1);
+    CHECK_EQ(hist_sum, count);
+
+    // 'P0' clears everything
+    test_app_cmd("P0");
+    profile_get_stats(PROFILE_SLCAN_PARSE_FRAME, &stats);
+    CHECK_EQ(stats.count, 0);
+    CHECK_EQ(stats.hist[0], 0);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,312 @@
+//
+// test_reconnect: CAN state and received frames across host reconnects
+//
+// The sequences a host goes through when slcand restarts or the port is
+// reset: the port closed and opened again with DTR, a bus reset with
+// re-enumeration, a half-sent command line cut off, and an outage longer
+// than the suspend ring lasts. The channel stays open with its settings
+// and statistics throughout, reception never stalls, and the host gets
+// the frames in order once it opens the port again. The only gaps are
+// the oldest frames the full ring gave up, each counted as
+// ERR_FULLBUF_SUSPEND, lines with no room left in the CDC TX FIFO of a
+// host that is not reading, counted as ERR_USBTX_BUSY, and the lines of
+// the packet in flight at a bus reset. A random walk through these
+// sequences follows.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "error.h"
+#include "notify.h"
+#include "suspend.h"
+
+#define FRAME_ID        0x100u
+#define NOTIFY_EP       0x81u
+
+// Host side
+static uint32_t next_seq;       // Sequence number of the next frame sent
+static uint32_t expect_seq;     // Next one the host expects
+static uint32_t resets;         // Bus resets so far
+static uint32_t drops_before;   // Lines given up before the sequence began
+static uint32_t lost;
+static char partial[64];
+static uint32_t partial_len;
+static bool resync;             // Skip a line cut short by a bus reset
+
+static void inject(void)
+{
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%08X00000000", (unsigned)next_seq);
+    // The controller is drained whatever the host does
+    CHECK(test_can_inject(FRAME_ID, false, hex));
+    next_seq++;
+}
+
+static uint32_t drops(void);
+
+// Read what the device sent, checking the order of the frames
+static uint32_t receive(void)
+{
+    char buf[1024];
+    uint32_t n, lines = 0;
+
+    while ((n = host_cdc_recv(0, buf, sizeof(buf))) > 0)
+    {
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if (buf[i] != '\r')
+            {
+                if (partial_len < sizeof(partial) - 1)
+                    partial[partial_len++] = buf[i];
+                continue;
+            }
+            partial[partial_len] = '\0';
+            partial_len = 0;
+            bool whole = strncmp(partial, "t1008", 5) == 0 && strlen(partial) == 21;
+            if (resync)
+            {
+                resync = false;
+                if (!whole)
+                    continue;
+            }
+            lines++;
+            CHECK(whole);
+            char seq_hex[9] = {0};
+            memcpy(seq_hex, partial + 5, 8);
+            uint32_t seq = (uint32_t)strtoul(seq_hex, NULL, 16);
+            // Gaps only for frames given up on the way or taken by a bus
+            // reset, which may have happened before older lines arrived
+            CHECK(seq >= expect_seq);
+            if (seq > expect_seq)
+            {
+                lost += seq - expect_seq;
+                CHECK(lost <= (drops() - drops_before) + 4 * resets);
+            }
+            expect_seq = seq + 1;
+        }
+    }
+    return lines;
+}
+
+static void bus_reset(void)
+{
+    host_usb_bus_reset();
+    resets++;
+    partial_len = 0;
+    resync = true;
+}
+
+// The channel is still open with its settings: a frame from the host
+// goes on the bus without configuring it again
+static void check_channel_open(void)
+{
+    CHECK(host_can_enabled());
+    test_app_cmd("t3212AABB");
+    CHECK_STR(test_can_pop(), "t3212AABB");
+}
+
+// slcan lines given up: frames the full ring dropped, and lines that did
+// not fit the CDC TX FIFO of a host which is not reading
+static uint32_t drops(void)
+{
+    return error_count(ERR_FULLBUF_SUSPEND) + error_count(ERR_USBTX_BUSY);
+}
+
+// Events of the notifications pending on the interrupt endpoint
+static uint32_t poll_notifications(void)
+{
+    uint8_t buf[16];
+    uint32_t state = 0;
+
+    test_app_run(2);
+    while (host_usb_ep_poll(NOTIFY_EP, buf, sizeof(buf)) == NOTIFY_LEN)
+    {
+        state |= buf[8] | buf[9] << 8;
+        test_app_run(2);
+    }
+    return state;
+}
+
+static void directed(void)
+{
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    poll_notifications();
+    drops_before = drops();
+
+    // slcand restart: port closed and opened again, nothing lost
+    host_cdc_set_dtr(0, false);
+    for (uint32_t i = 0; i < 10; i++)
+    {
+        inject();
+        test_app_run(2);
+    }
+    CHECK_EQ(host_cdc_tx_queued(0), 0);
+    host_cdc_set_dtr(0, true);
+    test_app_run(4);
+    CHECK_EQ(receive(), 10);
+    CHECK_EQ(expect_seq, next_seq);
+    check_channel_open();
+
+    // A command line cut off by the close is not completed by the first
+    // line after the open
+    host_cdc_send_str(0, "t12");
+    test_app_run(2);
+    host_cdc_set_dtr(0, false);
+    test_app_run(2);
+    host_cdc_set_dtr(0, true);
+    check_channel_open();
+    CHECK_STR(test_can_pop(), "");
+
+    // An outage longer than the ring: reception goes on, the oldest
+    // frames give way and are counted, the newest arrive in order
+    uint32_t full_before = error_count(ERR_FULLBUF_SUSPEND);
+    host_cdc_set_dtr(0, false);
+    for (uint32_t i = 0; i < 100; i++)
+    {
+        inject();
+        test_app_run(2);
+    }
+    CHECK_EQ(host_can_rx_pending(), 0);
+    CHECK_EQ(error_count(ERR_FULLBUF_SUSPEND) - full_before, 100 - SUSPEND_DEPTH);
+    host_cdc_set_dtr(0, true);
+    test_app_run(10);
+    CHECK_EQ(receive(), SUSPEND_DEPTH);
+    CHECK_EQ(expect_seq, next_seq);
+    CHECK_EQ(lost, 100 - SUSPEND_DEPTH);
+    CHECK(poll_notifications() & NOTIFY_OVERRUN);
+    lost = 0;
+
+    // Port reset with lines still queued for the host: they come first
+    // once the port is open again, then the frames held meanwhile
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        inject();
+        test_app_run(1);
+    }
+    uint32_t errors = error_reg();
+    uint32_t full = error_count(ERR_FULLBUF_SUSPEND);
+    bus_reset();
+    uint32_t kept = host_cdc_tx_queued(0);
+    CHECK(kept > 0);
+    for (uint32_t i = 0; i < 5; i++)
+    {
+        inject();
+        test_app_run(2);
+    }
+    host_usb_mount(true);
+    for (uint32_t i = 0; i < 5; i++)
+    {
+        inject();
+        test_app_run(2);
+    }
+    // Held until the port is open, not queued behind the kept lines
+    CHECK(host_cdc_tx_queued(0) <= kept);
+    host_cdc_set_dtr(0, true);
+    test_app_run(4);
+    CHECK(receive() >= 14);
+    CHECK_EQ(expect_seq, next_seq);
+    CHECK(lost <= 4);
+    CHECK_EQ(error_reg(), errors);
+    CHECK_EQ(error_count(ERR_FULLBUF_SUSPEND), full);
+    check_channel_open();
+    CHECK_EQ(poll_notifications() & NOTIFY_ON_BUS, NOTIFY_ON_BUS);
+}
+
+static void random_walk(uint32_t steps)
+{
+    bool suspended = false, dtr = true, mounted = true;
+
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    next_seq = expect_seq = lost = resets = 0;
+    drops_before = drops();
+    partial_len = 0;
+    resync = false;
+
+    srand(50);
+    for (uint32_t step = 0; step < steps; step++)
+    {
+        uint32_t r = (uint32_t)rand() % 100u;
+
+        if (r < 50)
+        {
+            // Bursts as well as single frames, beyond what the ring holds
+            uint32_t burst = (r < 5) ? 1u + (uint32_t)rand() % 6u : 1u;
+            for (uint32_t i = 0; i < burst; i++)
+                inject();
+        }
+        else if (r < 75)
+        {
+            if (mounted && dtr && !suspended)
+                receive();
+        }
+        else if (r < 80)
+        {
+            if (mounted && !suspended)
+            {
+                host_usb_suspend(rand() & 1);
+                suspended = true;
+            }
+        }
+        else if (r < 85)
+        {
+            if (suspended)
+            {
+                host_usb_resume();
+                suspended = false;
+            }
+        }
+        else if (r < 88)
+        {
+            bus_reset();
+            suspended = false;
+            mounted = false;
+            dtr = false;
+        }
+        else if (r < 92)
+        {
+            if (!mounted)
+            {
+                host_usb_mount(true);
+                mounted = true;
+            }
+        }
+        else
+        {
+            if (mounted && !suspended)
+            {
+                dtr = !dtr;
+                host_cdc_set_dtr(0, dtr);
+            }
+        }
+        test_app_run(2);
+        CHECK_EQ(host_can_rx_pending(), 0);
+    }
+
+    // Back to an open port: everything still pending arrives, and the
+    // channel was never touched
+    if (suspended)
+        host_usb_resume();
+    if (!mounted)
+        host_usb_mount(true);
+    host_cdc_set_dtr(0, true);
+    for (uint32_t i = 0; i < 20; i++)
+    {
+        test_app_run(10);
+        receive();
+    }
+    CHECK_EQ(expect_seq, next_seq);
+    check_channel_open();
+    printf("%u frames, %u lost, %u given up by the ring\n", (unsigned)next_seq, (unsigned)lost,
+           (unsigned)error_count(ERR_FULLBUF_SUSPEND));
+}
+
+int main(void)
+{
+    directed();
+    random_walk(100000);
+    return TEST_RESULT();
+}
@@ -0,0 +1,123 @@
+//
+// test_remote: Mailbox allocation of the remote frame responses
+//
+// The four entries take MB8-11 and answer on their own, a fifth is
+// refused until one is removed. Answered requests never reach the RX
+// FIFO: the host does not see them, bus load and capture count the
+// request and the answer from remote_process().
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "remote.h"
+#include "busload.h"
+
+// Answer the request and pop the answer, "" if there was none
+static const char *request(uint32_t id, bool ext, uint8_t dlc, uint8_t *mb)
+{
+    host_can_frame_t frame;
+    static char line[40];
+
+    CHECK(test_can_inject_remote(id, ext, dlc));
+    test_app_run(2);
+    if (!host_can_tx_pop(&frame))
+        return "";
+    *mb = frame.mb;
+    int pos = snprintf(line, sizeof(line), ext ? "T%08X%u" : "t%03X%u", (unsigned)frame.id, frame.dlc);
+    for (uint8_t i = 0; i < frame.dlc; i++)
+        pos += snprintf(line + pos, sizeof(line) - pos, "%02X", frame.data[i]);
+    return line;
+}
+
+int main(void)
+{
+    uint8_t mb = 0;
+
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    CHECK_EQ(REMOTE_MAX_ENTRIES, 4);
+
+    // One mailbox per entry, in order, a fifth does not fit
+    CHECK_STR(test_app_cmd("y1000000100" "2" "1111000000000000"), "");
+    CHECK_STR(test_app_cmd("y1000000101" "2" "2222000000000000"), "");
+    CHECK_STR(test_app_cmd("y1100012345" "8" "0102030405060708"), "");
+    CHECK_STR(test_app_cmd("y1000000103" "0" "0000000000000000"), "");
+    CHECK_EQ(remote_set(0x104, 0, 1, 0x44000000u, 0), 1);
+    CHECK_STR(test_app_cmd("y"), "y0400000000\r");
+
+    CHECK_STR(request(0x100, false, 2, &mb), "t10021111");
+    CHECK_EQ(mb, BOARD_FLEXCAN_REMOTE_MB_FIRST);
+    CHECK_STR(request(0x101, false, 2, &mb), "t10122222");
+    CHECK_EQ(mb, BOARD_FLEXCAN_REMOTE_MB_FIRST + 1);
+    CHECK_STR(request(0x12345, true, 8, &mb), "T0001234580102030405060708");
+    CHECK_EQ(mb, BOARD_FLEXCAN_REMOTE_MB_FIRST + 2);
+    CHECK_STR(request(0x103, false, 0, &mb), "t1030");
+    CHECK_EQ(mb, BOARD_FLEXCAN_REMOTE_MB_FIRST + 3);
+    CHECK_EQ(mb, BOARD_FLEXCAN_REMOTE_MB_LAST);
+
+    // Answered requests are not forwarded, the others are
+    CHECK_STR(test_app_recv(), "");
+    CHECK_STR(request(0x104, false, 1, &mb), "");
+    CHECK_STR(test_app_recv(), "r10410000000000000000\r");
+    // The same ID as a standard and as an extended frame are different
+    CHECK_STR(request(0x100, true, 2, &mb), "");
+    CHECK_STR(test_app_recv(), "R0000010020000000000000000\r");
+
+    // Mailboxes are re-armed after answering
+    CHECK_STR(request(0x100, false, 2, &mb), "t10021111");
+    CHECK_STR(test_app_cmd("y"), "y0400000005\r");
+
+    // Update in place keeps the mailbox and the count
+    CHECK_STR(test_app_cmd("y1000000101" "3" "AABBCC0000000000"), "");
+    CHECK_STR(request(0x101, false, 3, &mb), "t1013AABBCC");
+    CHECK_EQ(mb, BOARD_FLEXCAN_REMOTE_MB_FIRST + 1);
+    CHECK_STR(test_app_cmd("y"), "y0400000006\r");
+
+    // Removing an entry frees its mailbox for the next one
+    CHECK_STR(test_app_cmd("y2000000101"), "");
+    CHECK_EQ(remote_remove(0x101, 0), 1);
+    CHECK_STR(request(0x101, false, 3, &mb), "");
+    CHECK_STR(test_app_recv(), "r10130000000000000000\r");
+    CHECK_STR(test_app_cmd("y1000000104" "1" "4400000000000000"), "");
+    CHECK_STR(request(0x104, false, 1, &mb), "t104144");
+    CHECK_EQ(mb, BOARD_FLEXCAN_REMOTE_MB_FIRST + 1);
+
+    // Entries survive closing and reopening the channel
+    test_app_cmd("C");
+    test_app_cmd("O");
+    CHECK_STR(request(0x103, false, 0, &mb), "t1030");
+    CHECK_EQ(mb, BOARD_FLEXCAN_REMOTE_MB_FIRST + 3);
+
+    // Bus load counts the request and the answer
+    busload_stats_t stats;
+    test_app_cmd("b0064");
+    host_advance_us(200000);
+    test_app_run(2);
+    for (uint32_t i = 0; i < 10; i++)
+        CHECK_STR(request(0x12345, true, 8, &mb), "T0001234580102030405060708");
+    host_advance_us(100000);
+    test_app_run(2);
+    busload_get_stats(&stats);
+    CHECK_EQ(stats.frames, 20);
+
+    // Both show up in a capture triggered by the answer's ID
+    test_app_cmd("X1100012345" "1FFFFFFF" "0101");
+    CHECK_STR(request(0x12345, true, 8, &mb), "T0001234580102030405060708");
+    test_app_recv();
+    host_cdc_send_str(0, "X\r");
+    test_app_run(10);
+    const char *rx = test_app_recv();
+    const char *req = strstr(rx, "R0001234580000000000000000\r");
+    const char *ans = strstr(rx, "T0001234580102030405060708\r");
+    CHECK(req != NULL && ans != NULL && req < ans);
+    CHECK(strstr(rx, "X0002\r") != NULL);
+
+    // 'y0' releases all mailboxes
+    CHECK_STR(test_app_cmd("y0"), "");
+    CHECK_STR(test_app_cmd("y"), "y0000000000\r");
+    CHECK_STR(request(0x100, false, 2, &mb), "");
+    CHECK_STR(test_app_recv(), "r10020000000000000000\r");
+
+    return TEST_RESULT();
+}
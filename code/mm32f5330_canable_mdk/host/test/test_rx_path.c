@@ -0,0 +1,78 @@
+//
+// test_rx_path: The RX FIFO is drained whatever the USB host does
+//
+// With the host not polling the bulk IN endpoint the CDC TX FIFO fills up.
+// Frames must still be taken from the controller and seen by the device
+// consumers; only slcan lines are dropped, counted as ERR_USBTX_BUSY, and
+// every line that does reach the host is complete.
+//
+
+#include "test.h"
+#include "error.h"
+#include "busload.h"
+#include "can.h"
+
+#define FRAMES  500u
+
+int main(void)
+{
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    CHECK(host_can_enabled());
+
+    // The host stops reading
+    for (uint32_t i = 0; i < FRAMES; i++)
+    {
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%08X%08X", (unsigned)i, ~(unsigned)i);
+        CHECK(test_can_inject(0x100u + (i & 0xFFu), false, hex));
+        if (host_can_rx_pending() + can_rx_count() == HOST_CAN_FIFO_DEPTH)
+        {
+            test_app_run(1);
+        }
+        host_advance_us(200);
+    }
+    test_app_run(4);
+
+    CHECK_EQ(host_can_rx_pending(), 0);
+    CHECK_EQ(can_rx_count(), 0);
+    CHECK_EQ(error_count(ERR_CANRXFIFO_OVERFLOW), 0);
+
+    // Every frame was counted for the bus load
+    host_advance_us(1000000);
+    test_app_run(1);
+    busload_stats_t stats;
+    busload_get_stats(&stats);
+    CHECK_EQ(stats.frames, FRAMES);
+
+    // What the FIFO held reaches the host as whole lines, the rest is counted
+    const char *rx = test_app_recv();
+    uint32_t lines = 0;
+    for (const char *p = rx; *p; )
+    {
+        const char *cr = strchr(p, '\r');
+        CHECK(cr != NULL);
+        if (!cr)
+            break;
+        CHECK(*p == 't');
+        CHECK_EQ(cr - p, 1 + 3 + 1 + 16);
+        lines++;
+        p = cr + 1;
+    }
+    CHECK(lines > 0);
+    CHECK(error_count(ERR_USBTX_BUSY) > 0);
+    CHECK_EQ(lines + error_count(ERR_USBTX_BUSY), FRAMES);
+
+    // Once the host reads again, lines flow without loss
+    uint32_t dropped = error_count(ERR_USBTX_BUSY);
+    for (uint32_t i = 0; i < 100; i++)
+    {
+        CHECK(test_can_inject(0x7FF, false, "00"));
+        test_app_run(1);
+        test_app_recv();
+    }
+    CHECK_EQ(error_count(ERR_USBTX_BUSY), dropped);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,239 @@
+//
+// test_sched: Order, late policy and accounting of scheduled frames
+//
+// Frames go out in due time order, those with the same due time in the
+// order they were queued. A frame held up past SCHED_LATE_US is sent late
+// or dropped by its policy. E2E counters follow the transmit order, not
+// the queue order, and bus load counts scheduled frames while the host
+// collects no confirmations.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "busload.h"
+#include "sched.h"
+#include "slcan.h"
+#include "timebase.h"
+
+typedef struct
+{
+    uint32_t id;
+    uint64_t time_us;
+} sent_t;
+
+static sent_t sent[32];
+static uint32_t sent_count;
+
+// 'w' + due + policy, then the frame command. Leaves the host's input
+// alone, confirmations and long lines stay queued.
+static void schedule(uint32_t due, uint8_t drop, const char *frame)
+{
+    char line[16];
+    snprintf(line, sizeof(line), "w%08X%u\r", (unsigned)due, drop);
+    host_cdc_send_str(0, line);
+    host_cdc_send_str(0, frame);
+    host_cdc_send_str(0, "\r");
+    test_app_run(4);
+}
+
+// Run the firmware for us microseconds in 10 us steps, logging the bus
+static void run_for(uint32_t us)
+{
+    host_can_frame_t frame;
+
+    for (uint32_t t = 0; t < us; t += 10)
+    {
+        test_app_run(1);
+        while (host_can_tx_pop(&frame) && sent_count < 32)
+        {
+            sent[sent_count].id = frame.id;
+            sent[sent_count].time_us = frame.time_us;
+            sent_count++;
+        }
+    }
+}
+
+// Next 'z' line as due, sent and result, false if none
+static bool confirmation(const char **p, uint32_t *due, uint32_t *load, uint32_t *result)
+{
+    const char *z = strchr(*p, 'z');
+    if (z == NULL || strlen(z) < 19)
+        return false;
+    char b[9] = {0};
+    memcpy(b, z + 1, 8);
+    *due = (uint32_t)strtoul(b, NULL, 16);
+    memcpy(b, z + 9, 8);
+    *load = (uint32_t)strtoul(b, NULL, 16);
+    *result = (uint32_t)(z[17] - '0');
+    *p = z + 19;
+    return true;
+}
+
+static void stream_long_line(void)
+{
+    test_app_cmd("j1012345");
+    CHECK(test_can_inject(0x18ECFF00, true, "20F906FFFF452301"));
+    test_app_run(1);
+    for (uint32_t seq = 1; seq <= 255; seq++)
+    {
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%02X00000000000000", (unsigned)seq);
+        CHECK(test_can_inject(0x18EBFF00, true, hex));
+        test_app_run(1);
+    }
+}
+
+int main(void)
+{
+    uint32_t due, load, result;
+    const char *rx;
+
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+
+    //
+    // Order: by due time, then by queue order
+    //
+
+    uint32_t t0 = timebase_us();
+    uint64_t h0 = host_time_us();
+    schedule(t0 + 3000, 0, "t1030");
+    schedule(t0 + 1000, 0, "t1010");
+    schedule(t0 + 2000, 0, "t1020");
+    schedule(t0 + 2000, 0, "t1040");
+    schedule(t0 + 1500, 1, "t1050");
+    CHECK_STR(test_app_cmd("w") + 9, "0500000000\r");
+    sent_count = 0;
+    run_for(4000);
+    CHECK_EQ(sent_count, 5);
+    static const uint32_t order[] = { 0x101, 0x105, 0x102, 0x104, 0x103 };
+    static const uint32_t offset[] = { 1000, 1500, 2000, 2000, 3000 };
+    for (uint32_t i = 0; i < 5 && i < sent_count; i++)
+    {
+        CHECK_EQ(sent[i].id, order[i]);
+        // The model puts a loaded mailbox on the bus at once
+        CHECK(sent[i].time_us >= h0 + offset[i] && sent[i].time_us <= h0 + offset[i] + 10);
+    }
+    rx = test_app_recv();
+    for (uint32_t i = 0; i < 5; i++)
+    {
+        CHECK(confirmation(&rx, &due, &load, &result));
+        CHECK_EQ(due, t0 + offset[i]);
+        CHECK((int32_t)(load - due) >= 0 && (load - due) <= SCHED_LATE_US);
+        CHECK_EQ(result, SCHED_SENT);
+    }
+
+    //
+    // Late policy: the mailbox is held up past the due times
+    //
+
+    t0 = timebase_us();
+    host_can_hold_tx(true);
+    schedule(t0 + 1000, 0, "t2010");
+    schedule(t0 + 1010, 0, "t2020");       // Sent late
+    schedule(t0 + 1020, 1, "t2030");       // Dropped
+    schedule(t0 + 1030, 1, "t2040");       // Dropped
+    schedule(t0 + 2500, 1, "t2050");       // On time once released
+    sent_count = 0;
+    run_for(1200);
+    CHECK_EQ(host_can_release_tx(1), 1);
+    host_can_hold_tx(false);
+    run_for(1500);
+    CHECK_EQ(sent_count, 3);
+    CHECK_EQ(sent[0].id, 0x201);
+    CHECK_EQ(sent[1].id, 0x202);
+    CHECK_EQ(sent[2].id, 0x205);
+    rx = test_app_recv();
+    static const uint32_t results[] = { SCHED_SENT, SCHED_SENT_LATE, SCHED_DROPPED_LATE, SCHED_DROPPED_LATE, SCHED_SENT };
+    for (uint32_t i = 0; i < 5; i++)
+    {
+        CHECK(confirmation(&rx, &due, &load, &result));
+        CHECK_EQ(result, results[i]);
+    }
+
+    // Due in the past when queued
+    t0 = timebase_us();
+    schedule(t0 - 1000, 1, "t3010");
+    schedule(t0 - 1000, 0, "t3020");
+    sent_count = 0;
+    run_for(100);
+    CHECK_EQ(sent_count, 1);
+    CHECK_EQ(sent[0].id, 0x302);
+    rx = test_app_recv();
+    CHECK(confirmation(&rx, &due, &load, &result));
+    CHECK_EQ(result, SCHED_DROPPED_LATE);
+    CHECK(confirmation(&rx, &due, &load, &result));
+    CHECK_EQ(result, SCHED_SENT_LATE);
+
+    // Off bus
+    t0 = timebase_us();
+    schedule(t0 + 500, 0, "t3030");
+    test_app_cmd("C");
+    sent_count = 0;
+    run_for(1000);
+    CHECK_EQ(sent_count, 0);
+    rx = test_app_recv();
+    CHECK(confirmation(&rx, &due, &load, &result));
+    CHECK_EQ(result, SCHED_DROPPED_OFF_BUS);
+    test_app_cmd("O");
+
+    // Queue full, 'w0' drops everything
+    t0 = timebase_us();
+    for (uint32_t i = 0; i <= SCHED_QUEUE_LEN; i++)
+        schedule(t0 + 5000, 0, "t4010");
+    CHECK_EQ(sched_count(), SCHED_QUEUE_LEN);
+    // Anything else short of a due time is refused and clears nothing
+    CHECK_EQ(test_slcan_parse("w1234"), -1);
+    CHECK_EQ(test_slcan_parse("w1"), -1);
+    CHECK_EQ(test_slcan_parse("w00"), -1);
+    CHECK_EQ(sched_count(), SCHED_QUEUE_LEN);
+    test_app_cmd("w0");
+    CHECK_EQ(sched_count(), 0);
+    sent_count = 0;
+    run_for(6000);
+    CHECK_EQ(sent_count, 0);
+    test_app_recv();
+
+    //
+    // E2E: counters in transmit order
+    //
+
+    test_app_cmd("e112000000123" "0037" "00" "08");
+    t0 = timebase_us();
+    schedule(t0 + 2000, 0, "t12380000223344556677");
+    schedule(t0 + 1000, 0, "t12380000223344556677");
+    host_can_tx_clear();
+    test_app_run(300);
+    CHECK_STR(test_can_pop(), "t1238EE01223344556677");
+    CHECK_STR(test_can_pop(), "t12384202223344556677");
+    test_app_cmd("e0");
+    test_app_recv();
+
+    //
+    // Bus load while the host takes no confirmations
+    //
+
+    busload_stats_t stats;
+    test_app_cmd("b0064");
+    stream_long_line();
+    test_app_run(4);
+    CHECK(slcan_stream_busy());
+    host_advance_us(150000);
+    test_app_run(2);
+    t0 = timebase_us();
+    for (uint32_t i = 0; i < 5; i++)
+        schedule(t0 + 1000 + 500 * i, 0, "t5018AABBCCDDEEFF0011");
+    host_can_tx_clear();
+    for (uint32_t t = 0; t < 100; t++)
+    {
+        host_advance_us(1000);
+        test_app_run(1);
+    }
+    CHECK(slcan_stream_busy());
+    CHECK_EQ(host_can_tx_count(), 5);
+    busload_get_stats(&stats);
+    CHECK_EQ(stats.frames, 5);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,278 @@
+//
+// test_suspend: Frames held across suspend, bus reset and a closed port
+//
+// Directed cases first: a frame during suspend asks for one remote wakeup
+// if the host allows it and none otherwise, held frames come out in order
+// after resume with newer ones queued behind them, a bus reset during
+// suspend ends it without a resume, and a host that never sets DTR has
+// its frames held as well. Then a random walk through suspend, resume,
+// bus reset, DTR and traffic, checked against what the host must see:
+// every frame once and in order, nothing while it is away, at most one
+// wakeup request per suspend and only when allowed. The only frames a
+// bus reset may take are those of the packet in flight: the up to four
+// lines a 64-byte packet touches.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "main.h"
+#include "suspend.h"
+
+#define FRAME_ID        0x100u
+
+// Host side of the random walk
+static uint32_t next_seq;       // Sequence number of the next frame sent
+static uint32_t expect_seq;     // Next one the host expects
+static uint32_t seq_at_reset;   // next_seq at the last bus reset
+static uint32_t resets;         // Bus resets since the last line received
+static uint32_t lost;
+static char partial[64];
+static uint32_t partial_len;
+static bool resync;             // Skip a line cut short by a bus reset
+
+static bool inject(void)
+{
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%08X00000000", (unsigned)next_seq);
+    if (!test_can_inject(FRAME_ID, false, hex))
+        return false;
+    next_seq++;
+    return true;
+}
+
+// Read what the device sent, checking the order of the frames
+static uint32_t receive(void)
+{
+    char buf[1024];
+    uint32_t n, lines = 0;
+
+    while ((n = host_cdc_recv(0, buf, sizeof(buf))) > 0)
+    {
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if (buf[i] != '\r')
+            {
+                if (partial_len < sizeof(partial) - 1)
+                    partial[partial_len++] = buf[i];
+                continue;
+            }
+            partial[partial_len] = '\0';
+            partial_len = 0;
+            bool whole = strncmp(partial, "t1008", 5) == 0 && strlen(partial) == 21;
+            if (resync)
+            {
+                resync = false;
+                if (!whole)
+                    continue;
+            }
+            lines++;
+            CHECK(whole);
+            char seq_hex[9] = {0};
+            memcpy(seq_hex, partial + 5, 8);
+            uint32_t seq = (uint32_t)strtoul(seq_hex, NULL, 16);
+            // A gap only for frames sent before the last bus reset
+            CHECK(seq >= expect_seq);
+            if (seq > expect_seq)
+            {
+                CHECK(seq <= seq_at_reset);
+                CHECK(seq - expect_seq <= 4 * resets);
+                lost += seq - expect_seq;
+            }
+            expect_seq = seq + 1;
+            resets = 0;
+        }
+    }
+    return lines;
+}
+
+static void directed(void)
+{
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    next_seq = expect_seq = seq_at_reset = 0;
+
+    // Remote wakeup allowed: one request, frames held until resume
+    host_usb_suspend(true);
+    test_app_run(4);
+    CHECK_EQ(host_usb_wakeup_requests(), 0);
+    for (uint32_t i = 0; i < 5; i++)
+    {
+        CHECK(inject());
+        test_app_run(2);
+    }
+    test_app_run(100);
+    CHECK_EQ(host_usb_wakeup_requests(), 1);
+    CHECK_EQ(host_cdc_tx_queued(0), 0);
+    host_usb_resume();
+    CHECK(inject());
+    test_app_run(4);
+    CHECK_EQ(receive(), 6);
+    CHECK_EQ(expect_seq, 6);
+
+    // Not allowed: no request, nothing lost
+    host_usb_suspend(false);
+    for (uint32_t i = 0; i < 10; i++)
+    {
+        CHECK(inject());
+        test_app_run(2);
+    }
+    test_app_run(100);
+    CHECK_EQ(host_usb_wakeup_requests(), 1);
+    host_usb_resume();
+    test_app_run(4);
+    CHECK_EQ(receive(), 10);
+
+    // Bus reset while suspended: awake again, frames held until DTR
+    host_usb_suspend(true);
+    CHECK(inject());
+    test_app_run(4);
+    CHECK_EQ(host_usb_wakeup_requests(), 2);
+    host_usb_bus_reset();
+    seq_at_reset = next_seq;
+    host_usb_mount(true);
+    CHECK(inject());
+    test_app_run(10);
+    CHECK_EQ(receive(), 0);
+    host_cdc_set_dtr(0, true);
+    test_app_run(4);
+    CHECK_EQ(receive(), 2);
+    CHECK_EQ(lost, 0);
+    CHECK_EQ(expect_seq, next_seq);
+
+    // A host which never sets DTR: held during suspend all the same
+    host_reset();
+    app_init();
+    host_usb_mount(true);
+    host_cdc_send_str(0, "S8\rO\r");
+    test_app_run(4);
+    test_app_recv();
+    next_seq = expect_seq = 0;
+    CHECK(inject());
+    test_app_run(4);
+    CHECK_EQ(receive(), 1);
+    host_usb_suspend(true);
+    CHECK(inject());
+    test_app_run(4);
+    CHECK_EQ(host_cdc_tx_queued(0), 0);
+    CHECK_EQ(host_usb_wakeup_requests(), 1);
+    host_usb_resume();
+    test_app_run(4);
+    CHECK_EQ(receive(), 1);
+    CHECK_EQ(expect_seq, next_seq);
+}
+
+static void random_walk(uint32_t steps)
+{
+    bool suspended = false, dtr = true, mounted = true;
+    bool wakeup_en = false, frame_while_asleep = false;
+    uint32_t wakeups_before = 0;
+
+    test_app_boot();
+    test_app_cmd("S8");
+    test_app_cmd("O");
+    next_seq = expect_seq = seq_at_reset = lost = resets = 0;
+    partial_len = 0;
+
+    srand(47);
+    for (uint32_t step = 0; step < steps; step++)
+    {
+        uint32_t r = (uint32_t)rand() % 100u;
+        bool away = suspended || !dtr || !mounted;
+
+        if (r < 45)
+        {
+            // Keep the frames pending within what the ring holds. While
+            // the host is away they go to the ring, not the CDC FIFO.
+            uint32_t queued = host_cdc_tx_queued(0);
+            if (next_seq - expect_seq < SUSPEND_DEPTH && inject())
+            {
+                frame_while_asleep |= suspended;
+                test_app_run(2);
+                if (away)
+                    CHECK(host_cdc_tx_queued(0) <= queued);
+            }
+        }
+        else if (r < 70)
+        {
+            if (!away)
+                receive();
+        }
+        else if (r < 78)
+        {
+            if (!suspended && mounted)
+            {
+                wakeup_en = rand() & 1;
+                frame_while_asleep = false;
+                wakeups_before = host_usb_wakeup_requests();
+                host_usb_suspend(wakeup_en);
+                suspended = true;
+            }
+        }
+        else if (r < 86)
+        {
+            if (suspended)
+            {
+                test_app_run(4);
+                uint32_t wakeups = host_usb_wakeup_requests() - wakeups_before;
+                CHECK(wakeups <= 1);
+                if (!wakeup_en)
+                    CHECK_EQ(wakeups, 0);
+                else if (frame_while_asleep)
+                    CHECK_EQ(wakeups, 1);
+                host_usb_resume();
+                suspended = false;
+            }
+        }
+        else if (r < 90)
+        {
+            host_usb_bus_reset();
+            seq_at_reset = next_seq;
+            resets++;
+            partial_len = 0;
+            resync = true;
+            suspended = false;
+            mounted = false;
+            dtr = false;
+        }
+        else if (r < 94)
+        {
+            if (!mounted)
+            {
+                host_usb_mount(true);
+                mounted = true;
+            }
+        }
+        else
+        {
+            if (mounted && !suspended)
+            {
+                dtr = !dtr;
+                host_cdc_set_dtr(0, dtr);
+            }
+        }
+        test_app_run(2);
+    }
+
+    // Back to an open port: everything still pending arrives
+    if (suspended)
+        host_usb_resume();
+    if (!mounted)
+        host_usb_mount(true);
+    host_cdc_set_dtr(0, true);
+    for (uint32_t i = 0; i < 20; i++)
+    {
+        test_app_run(10);
+        receive();
+    }
+    CHECK_EQ(expect_seq, next_seq);
+    CHECK(next_seq > steps / 8);
+    printf("%u frames, %u lost at bus resets\n", (unsigned)next_seq, (unsigned)lost);
+}
+
+int main(void)
+{
+    directed();
+    random_walk(200000);
+    return TEST_RESULT();
+}
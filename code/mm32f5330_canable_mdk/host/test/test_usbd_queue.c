@@ -0,0 +1,344 @@
+//
+// test_usbd_queue: Depth, high-water mark and overflows of the USB event queue
+//
+// The TinyUSB device stack and CDC class run unmodified on a DCD played by
+// this test, which enumerates the device and then raises events through
+// the DCD event API as the controller's interrupt would. A flood of
+// transfer completions with no tud_task() in between must fill the queue
+// to exactly its configured depth and count every event beyond it as an
+// overflow, while SOFs never take a slot. Then slcan traffic at the frame
+// rate of a saturated 1 Mbit/s bus in both directions is run with
+// tud_task() at the end of every interrupt, as the port does, and must
+// pass every byte without an overflow.
+//
+
+#include <stdlib.h>
+#include "test.h"
+#include "host_hw.h"
+#include "tusb.h"
+#include "device/dcd.h"
+
+#define EP_OUT          0x02u
+#define EP_IN           0x83u
+#define PACKET          64u
+
+// 8-byte frames at 1 Mbit/s with worst case stuffing: 135 bits each
+#define FRAMES_PER_MS   8u
+#define LINE            "t1238112233445566778\r"
+#define LINE_LEN        21u
+#define RUN_MS          1000u
+
+int test_failures = 0;
+
+// Transfers armed by the stack, per endpoint number and direction
+typedef struct
+{
+    uint8_t *buf;
+    uint16_t len;
+    bool busy;
+} xfer_t;
+
+static xfer_t xfers[16][2];
+static bool int_enabled;
+static uint32_t int_masks;
+static uint32_t int_nested;     // Masked again while already masked
+
+static xfer_t *xfer_of(uint8_t ep_addr)
+{
+    return &xfers[tu_edpt_number(ep_addr)][tu_edpt_dir(ep_addr)];
+}
+
+//
+// DCD
+//
+
+void dcd_init(uint8_t rhport)
+{
+    (void)rhport;
+    memset(xfers, 0, sizeof(xfers));
+}
+
+void dcd_int_enable(uint8_t rhport)
+{
+    (void)rhport;
+    int_enabled = true;
+}
+
+void dcd_int_disable(uint8_t rhport)
+{
+    (void)rhport;
+    // A lock taken inside another one would unmask too early on release
+    if (!int_enabled)
+        int_nested++;
+    int_enabled = false;
+    int_masks++;
+}
+
+void dcd_int_handler(uint8_t rhport)
+{
+    (void)rhport;
+}
+
+void dcd_set_address(uint8_t rhport, uint8_t dev_addr)
+{
+    (void)dev_addr;
+    // Status stage of SET_ADDRESS
+    dcd_edpt_xfer(rhport, 0x80, NULL, 0);
+}
+
+void dcd_remote_wakeup(uint8_t rhport)
+{
+    (void)rhport;
+}
+
+void dcd_sof_enable(uint8_t rhport, bool en)
+{
+    (void)rhport;
+    (void)en;
+}
+
+bool dcd_edpt_open(uint8_t rhport, tusb_desc_endpoint_t const * desc_ep)
+{
+    (void)rhport;
+    memset(xfer_of(desc_ep->bEndpointAddress), 0, sizeof(xfer_t));
+    return true;
+}
+
+void dcd_edpt_close_all(uint8_t rhport)
+{
+    (void)rhport;
+    memset(&xfers[1], 0, sizeof(xfers) - sizeof(xfers[0]));
+}
+
+bool dcd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t * buffer, uint16_t total_bytes)
+{
+    (void)rhport;
+    xfer_t *x = xfer_of(ep_addr);
+    x->buf = buffer;
+    x->len = total_bytes;
+    x->busy = true;
+    return true;
+}
+
+void dcd_edpt_stall(uint8_t rhport, uint8_t ep_addr)
+{
+    (void)rhport;
+    xfer_of(ep_addr)->busy = false;
+}
+
+void dcd_edpt_clear_stall(uint8_t rhport, uint8_t ep_addr)
+{
+    (void)rhport;
+    (void)ep_addr;
+}
+
+//
+// Application callbacks, which the CDC class calls unconditionally
+//
+
+void tud_cdc_rx_cb(uint8_t itf)
+{
+    (void)itf;
+}
+
+void tud_cdc_rx_wanted_cb(uint8_t itf, char wanted_char)
+{
+    (void)itf;
+    (void)wanted_char;
+}
+
+void tud_cdc_tx_complete_cb(uint8_t itf)
+{
+    (void)itf;
+}
+
+void tud_cdc_line_state_cb(uint8_t itf, bool dtr, bool rts)
+{
+    (void)itf;
+    (void)dtr;
+    (void)rts;
+}
+
+void tud_cdc_line_coding_cb(uint8_t itf, cdc_line_coding_t const* p_line_coding)
+{
+    (void)itf;
+    (void)p_line_coding;
+}
+
+void tud_cdc_send_break_cb(uint8_t itf, uint16_t duration_ms)
+{
+    (void)itf;
+    (void)duration_ms;
+}
+
+//
+// Host
+//
+
+// One USB interrupt: the event, then tud_task() as tud_dcd_port.c does
+static void interrupt_xfer(uint8_t ep_addr, uint32_t len)
+{
+    xfer_of(ep_addr)->busy = false;
+    dcd_event_xfer_complete(0, ep_addr, len, XFER_RESULT_SUCCESS, true);
+    tud_task();
+}
+
+// A control request without data stage, up to its status stage
+static void control(uint8_t type, uint8_t request, uint16_t value, uint16_t index)
+{
+    const uint8_t setup[8] = { type, request, value & 0xFFu, value >> 8, index & 0xFFu, index >> 8, 0, 0 };
+
+    dcd_event_setup_received(0, setup, true);
+    tud_task();
+    CHECK(xfer_of(0x80)->busy);
+    CHECK_EQ(xfer_of(0x80)->len, 0);
+    interrupt_xfer(0x80, 0);
+}
+
+static void enumerate(void)
+{
+    tusb_init();
+    CHECK(int_enabled);
+    dcd_event_bus_reset(0, TUSB_SPEED_FULL, true);
+    tud_task();
+    control(0x00, TUSB_REQ_SET_ADDRESS, 5, 0);
+    control(0x00, TUSB_REQ_SET_CONFIGURATION, 1, 0);
+    CHECK(tud_mounted());
+    // Open the slcan port with DTR
+    control(0x21, CDC_REQUEST_SET_CONTROL_LINE_STATE, 3, 0);
+    CHECK(tud_cdc_connected());
+    CHECK(xfer_of(EP_OUT)->busy);
+    CHECK_EQ(xfer_of(EP_OUT)->len, PACKET);
+}
+
+static void check_flood(void)
+{
+    tud_queue_stats_t stats;
+    uint32_t n = 3u * CFG_TUD_TASK_QUEUE_SZ;
+
+    tud_queue_stats_reset();
+    tud_queue_stats(&stats);
+    CHECK_EQ(stats.depth, CFG_TUD_TASK_QUEUE_SZ);
+    CHECK_EQ(stats.high_water, 0);
+    CHECK_EQ(stats.events, 0);
+    CHECK_EQ(stats.overflows, 0);
+
+    // One byte per OUT packet, none handled until the interrupt returns
+    xfer_of(EP_OUT)->buf[0] = 'x';
+    for (uint32_t i = 0; i < n; i++)
+        dcd_event_xfer_complete(0, EP_OUT, 1, XFER_RESULT_SUCCESS, true);
+    tud_queue_stats(&stats);
+    CHECK_EQ(stats.high_water, CFG_TUD_TASK_QUEUE_SZ);
+    CHECK_EQ(stats.events, CFG_TUD_TASK_QUEUE_SZ);
+    CHECK_EQ(stats.overflows, n - CFG_TUD_TASK_QUEUE_SZ);
+
+    // Only the queued ones reach the class
+    tud_task();
+    CHECK_EQ(tud_cdc_available(), CFG_TUD_TASK_QUEUE_SZ);
+    tud_cdc_read_flush();
+    tud_queue_stats(&stats);
+    CHECK_EQ(stats.high_water, CFG_TUD_TASK_QUEUE_SZ);
+    CHECK_EQ(stats.events, CFG_TUD_TASK_QUEUE_SZ);
+
+    // SOFs are handled in the interrupt and never queued
+    tud_queue_stats_reset();
+    for (uint32_t i = 0; i < 1000; i++)
+        dcd_event_sof(0, i & 0x7FFu, true);
+    tud_queue_stats(&stats);
+    CHECK_EQ(stats.events, 0);
+    CHECK_EQ(stats.high_water, 0);
+
+    // Events from thread context mask the interrupt for the queue and
+    // again for the statistics, never one inside the other, and leave it
+    // enabled
+    uint32_t masks = int_masks;
+    int_nested = 0;
+    for (uint32_t i = 0; i < n; i++)
+        dcd_event_xfer_complete(0, EP_OUT, 1, XFER_RESULT_SUCCESS, false);
+    CHECK(int_masks >= masks + 2 * n);
+    CHECK_EQ(int_nested, 0);
+    CHECK(int_enabled);
+    tud_queue_stats(&stats);
+    CHECK_EQ(stats.overflows, n - CFG_TUD_TASK_QUEUE_SZ);
+    tud_task();
+    tud_cdc_read_flush();
+
+    // Clearing keeps the depth
+    tud_queue_stats_reset();
+    tud_queue_stats(&stats);
+    CHECK_EQ(stats.depth, CFG_TUD_TASK_QUEUE_SZ);
+    CHECK_EQ(stats.high_water, 0);
+    CHECK_EQ(stats.overflows, 0);
+}
+
+// A saturated bus both ways: the host sends frames to transmit and polls
+// the received ones, one token per interrupt
+static void check_sustained(void)
+{
+    tud_queue_stats_t stats;
+    static char host_out[FRAMES_PER_MS * LINE_LEN];
+    static uint8_t app_buf[1024];
+    uint64_t sent_in = 0, got_in = 0, sent_out = 0, got_out = 0;
+    bool in_ok = true, out_ok = true;
+
+    for (uint32_t i = 0; i < FRAMES_PER_MS; i++)
+        memcpy(&host_out[i * LINE_LEN], LINE, LINE_LEN);
+
+    tud_queue_stats_reset();
+    for (uint32_t ms = 0; ms < RUN_MS; ms++)
+    {
+        dcd_event_sof(0, ms & 0x7FFu, true);
+
+        // Main loop: frames off the bus to the host, commands read
+        for (uint32_t i = 0; i < FRAMES_PER_MS && tud_cdc_write_available() >= LINE_LEN; i++)
+            sent_in += tud_cdc_write(LINE, LINE_LEN);
+        tud_cdc_write_flush();
+        uint32_t n;
+        while ((n = tud_cdc_read(app_buf, sizeof(app_buf))) > 0)
+        {
+            for (uint32_t i = 0; i < n; i++)
+                out_ok &= app_buf[i] == (uint8_t)LINE[(got_out + i) % LINE_LEN];
+            got_out += n;
+        }
+
+        // Host: OUT packets while the device takes them, IN polled empty
+        uint32_t pos = 0;
+        while (pos < sizeof(host_out) && xfer_of(EP_OUT)->busy)
+        {
+            uint32_t len = sizeof(host_out) - pos;
+            if (len > PACKET)
+                len = PACKET;
+            memcpy(xfer_of(EP_OUT)->buf, &host_out[pos], len);
+            pos += len;
+            sent_out += len;
+            interrupt_xfer(EP_OUT, len);
+        }
+        while (xfer_of(EP_IN)->busy)
+        {
+            xfer_t *x = xfer_of(EP_IN);
+            for (uint32_t i = 0; i < x->len; i++)
+                in_ok &= x->buf[i] == (uint8_t)LINE[(got_in + i) % LINE_LEN];
+            got_in += x->len;
+            interrupt_xfer(EP_IN, x->len);
+        }
+    }
+
+    CHECK(in_ok);
+    CHECK(out_ok);
+    CHECK_EQ(sent_in, (uint64_t)RUN_MS * FRAMES_PER_MS * LINE_LEN);
+    CHECK_EQ(got_in, sent_in);
+    CHECK_EQ(sent_out, (uint64_t)RUN_MS * FRAMES_PER_MS * LINE_LEN);
+    CHECK(got_out + CFG_TUD_CDC_RX_BUFSIZE >= sent_out);
+    tud_queue_stats(&stats);
+    CHECK_EQ(stats.overflows, 0);
+    CHECK(stats.high_water >= 1 && stats.high_water <= 2);
+    printf("%u events, high water %u of %u\n", (unsigned)stats.events, stats.high_water, stats.depth);
+}
+
+int main(void)
+{
+    enumerate();
+    check_flood();
+    check_sustained();
+    return TEST_RESULT();
+}
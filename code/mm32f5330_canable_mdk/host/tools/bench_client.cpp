@@ -0,0 +1,212 @@
+//
+// bench_client: Runs the on-device loopback benchmark over the slcan tty
+//
+// Works against the adapter's CDC device node or the pty of vcan_bridge.
+// Sends the 'B' command, reads the looped-back frames the adapter forwards
+// and its 'B' result line, and checks the sequence numbers the generator
+// puts into bytes 0..3 of every payload.
+//
+//   bench_client /dev/ttyACM0 [-n frames] [-r frames/s] [-i first-last] [-d min-max]
+//
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace {
+
+struct Options
+{
+    std::string tty;
+    uint32_t count = 10000;
+    uint32_t rate = 0;
+    uint32_t id_first = 0x100, id_last = 0x1FF;
+    uint32_t dlc_min = 8, dlc_max = 8;
+};
+
+struct Result
+{
+    uint32_t frames = 0;
+    uint32_t frames_per_s = 0;
+    uint32_t cdc_bytes_per_s = 0;
+    uint32_t drops = 0;
+};
+
+class SlcanPort
+{
+public:
+    explicit SlcanPort(const std::string &path)
+    {
+        fd_ = open(path.c_str(), O_RDWR | O_NOCTTY);
+        if (fd_ < 0)
+            return;
+        termios tio{};
+        tcgetattr(fd_, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(fd_, TCSANOW, &tio);
+        tcflush(fd_, TCIOFLUSH);
+    }
+
+    ~SlcanPort()
+    {
+        if (fd_ >= 0)
+            close(fd_);
+    }
+
+    bool ok() const { return fd_ >= 0; }
+
+    bool send(const std::string &line)
+    {
+        std::string out = line + "\r";
+        return write(fd_, out.data(), out.size()) == (ssize_t)out.size();
+    }
+
+    // Next CR-terminated line, false on timeout
+    bool line(std::string &out, int timeout_ms)
+    {
+        for (;;)
+        {
+            size_t cr = buf_.find('\r');
+            if (cr != std::string::npos)
+            {
+                out = buf_.substr(0, cr);
+                buf_.erase(0, cr + 1);
+                return true;
+            }
+            pollfd pfd{fd_, POLLIN, 0};
+            if (poll(&pfd, 1, timeout_ms) <= 0)
+                return false;
+            char chunk[4096];
+            ssize_t n = read(fd_, chunk, sizeof(chunk));
+            if (n <= 0)
+                return false;
+            buf_.append(chunk, (size_t)n);
+        }
+    }
+
+private:
+    int fd_ = -1;
+    std::string buf_;
+};
+
+uint32_t hex(const std::string &s, size_t pos, size_t digits)
+{
+    return (uint32_t)std::strtoul(s.substr(pos, digits).c_str(), nullptr, 16);
+}
+
+bool parse_range(const char *arg, uint32_t &lo, uint32_t &hi, int base)
+{
+    char *end;
+    lo = (uint32_t)std::strtoul(arg, &end, base);
+    if (*end != '-')
+        return false;
+    hi = (uint32_t)std::strtoul(end + 1, &end, base);
+    return *end == '\0';
+}
+
+int usage(const char *argv0)
+{
+    std::fprintf(stderr, "usage: %s tty [-n frames] [-r frames/s] [-i first-last] [-d min-max]\n", argv0);
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opt;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        if (a == "-n" && i + 1 < argc)
+            opt.count = (uint32_t)std::strtoul(argv[++i], nullptr, 0);
+        else if (a == "-r" && i + 1 < argc)
+            opt.rate = (uint32_t)std::strtoul(argv[++i], nullptr, 0);
+        else if (a == "-i" && i + 1 < argc)
+        {
+            if (!parse_range(argv[++i], opt.id_first, opt.id_last, 16))
+                return usage(argv[0]);
+        }
+        else if (a == "-d" && i + 1 < argc)
+        {
+            if (!parse_range(argv[++i], opt.dlc_min, opt.dlc_max, 10))
+                return usage(argv[0]);
+        }
+        else if (a[0] != '-' && opt.tty.empty())
+            opt.tty = a;
+        else
+            return usage(argv[0]);
+    }
+    if (opt.tty.empty() || opt.rate > 0xFFFF || opt.dlc_min < 4)
+    {
+        // Sequence numbers need the first four payload bytes
+        if (opt.dlc_min < 4)
+            std::fprintf(stderr, "bench_client: DLC must be 4 or more\n");
+        return usage(argv[0]);
+    }
+
+    SlcanPort port(opt.tty);
+    if (!port.ok())
+    {
+        std::perror(opt.tty.c_str());
+        return 1;
+    }
+
+    char cmd[32];
+    std::snprintf(cmd, sizeof(cmd), "B%03X%03X%X%X%08X%04X", (unsigned)opt.id_first, (unsigned)opt.id_last,
+                  (unsigned)opt.dlc_min, (unsigned)opt.dlc_max, (unsigned)opt.count, (unsigned)opt.rate);
+    auto t0 = std::chrono::steady_clock::now();
+    if (!port.send(cmd))
+    {
+        std::perror("write");
+        return 1;
+    }
+
+    // Looped-back frames until the result line
+    Result res;
+    uint32_t lines = 0, gaps = 0, expected = 0;
+    bool done = false;
+    std::string l;
+    while (!done && port.line(l, 5000))
+    {
+        if (l.size() == 33 && l[0] == 'B')
+        {
+            res.frames = hex(l, 1, 8);
+            res.frames_per_s = hex(l, 9, 8);
+            res.cdc_bytes_per_s = hex(l, 17, 8);
+            res.drops = hex(l, 25, 8);
+            done = true;
+        }
+        else if (l.size() >= 13 && l[0] == 't')
+        {
+            uint32_t seq = hex(l, 5, 8);
+            if (seq != expected)
+                gaps++;
+            expected = seq + 1;
+            lines++;
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    if (!done)
+    {
+        std::fprintf(stderr, "bench_client: no result line from the adapter\n");
+        return 1;
+    }
+    std::printf("device: %u frames, %u frames/s, %u CDC bytes/s, %u dropped\n",
+                (unsigned)res.frames, (unsigned)res.frames_per_s, (unsigned)res.cdc_bytes_per_s, (unsigned)res.drops);
+    std::printf("host:   %u frames in %.3f s, %.0f frames/s, %u sequence gaps\n",
+                (unsigned)lines, elapsed, lines / elapsed, (unsigned)gaps);
+
+    // Whatever the device forwarded must have arrived, in order
+    bool consistent = (lines == res.frames) && (res.frames + res.drops == opt.count) && (gaps == 0 || res.drops > 0);
+    return consistent ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+//
+// cdc_throughput: Frames delivered to the host by CDC TX FIFO size
+//
+// A 1 Mbit/s bus carries back-to-back 8-byte frames, one every 125 us,
+// and every one is forwarded as a 22-byte slcan line. The emulated host
+// polls the bulk IN endpoint once per 1 ms frame for up to 19 packets,
+// the most a full speed frame holds, but every 50 ms it stops polling for
+// stall_ms as a busy host application or a USB hub would. Lines that do
+// not fit into the TX FIFO meanwhile are dropped by the firmware. Each
+// FIFO size from one packet up to the build's size is run with the same
+// traffic; the table shows the frames lost in percent.
+//
+//   cdc_throughput [-n ms] [-l loop_us]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "host_hw.h"
+#include "host_tud.h"
+#include "tusb_config.h"
+
+#define USB_FRAME_US    1000u
+#define USB_FRAME_BYTES (19u * 64u)
+#define FRAME_US        125u
+#define STALL_PERIOD_US 50000u
+
+static const uint16_t fifo_sizes[] = { 64, 128, 256, 512, CFG_TUD_CDC_TX_BUFSIZE };
+static const uint32_t stalls_ms[] = { 0, 2, 5, 10 };
+
+static uint32_t loop_us = 20;
+
+// Frames lost in percent with this FIFO size and host stall, -1 if the
+// device did not come up
+static double run(uint16_t fifo_size, uint32_t stall_ms, uint32_t ms)
+{
+    static uint8_t buf[USB_FRAME_BYTES];
+    host_can_frame_t frame;
+    uint32_t injected = 0, lines = 0;
+
+    host_cdc_fifo_size(fifo_size, 0);
+    host_reset();
+    app_init();
+    host_usb_mount(true);
+    host_cdc_set_dtr(0, true);
+    host_cdc_send_str(0, "S8\rO\r");
+    for (uint32_t t = 0; t < USB_FRAME_US; t += loop_us)
+    {
+        app_process();
+        host_advance_us(loop_us);
+    }
+    while (host_cdc_recv(0, buf, sizeof(buf)) > 0)
+        ;
+    if (!host_can_enabled())
+    {
+        return -1.0;
+    }
+
+    memset(&frame, 0, sizeof(frame));
+    frame.id = 0x123;
+    frame.dlc = 8;
+    uint64_t start = host_time_us();
+    uint64_t end = start + (uint64_t)ms * USB_FRAME_US;
+    uint64_t next_frame = start;
+    uint64_t next_poll = start + USB_FRAME_US;
+
+    while (host_time_us() < end)
+    {
+        uint64_t now = host_time_us();
+        if (now >= next_frame)
+        {
+            frame.time_us = now;
+            frame.data[0] = (uint8_t)injected;
+            if (host_can_inject(&frame))
+                injected++;
+            next_frame += FRAME_US;
+        }
+        if (now >= next_poll)
+        {
+            bool stalled = ((now - start) % STALL_PERIOD_US) < (uint64_t)stall_ms * USB_FRAME_US;
+            if (!stalled)
+            {
+                uint32_t n = host_cdc_recv(0, buf, sizeof(buf));
+                for (uint32_t i = 0; i < n; i++)
+                    lines += (buf[i] == '\r');
+            }
+            next_poll += USB_FRAME_US;
+        }
+        app_process();
+        host_advance_us(loop_us);
+    }
+
+    // What is still queued reaches the host once it polls again
+    for (uint32_t i = 0; i < 16; i++)
+    {
+        for (uint32_t t = 0; t < USB_FRAME_US; t += loop_us)
+        {
+            app_process();
+            host_advance_us(loop_us);
+        }
+        uint32_t n = host_cdc_recv(0, buf, sizeof(buf));
+        for (uint32_t j = 0; j < n; j++)
+            lines += (buf[j] == '\r');
+    }
+
+    if (lines > injected)
+    {
+        fprintf(stderr, "cdc_throughput: %u lines for %u frames\n", (unsigned)lines, (unsigned)injected);
+        return -1.0;
+    }
+    return injected ? 100.0 * (injected - lines) / injected : 0.0;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t ms = 1000;
+    bool failed = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            ms = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            loop_us = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else
+        {
+            fprintf(stderr, "usage: %s [-n ms] [-l loop_us]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    printf("%u ms of 8000 frames/s, frames lost in %% by host stall every %u ms\n",
+           (unsigned)ms, (unsigned)(STALL_PERIOD_US / USB_FRAME_US));
+    printf("fifo  ");
+    for (uint32_t s = 0; s < sizeof(stalls_ms) / sizeof(stalls_ms[0]); s++)
+        printf("  %3u ms", (unsigned)stalls_ms[s]);
+    printf("\n");
+    for (uint32_t f = 0; f < sizeof(fifo_sizes) / sizeof(fifo_sizes[0]); f++)
+    {
+        printf("%5u ", fifo_sizes[f]);
+        for (uint32_t s = 0; s < sizeof(stalls_ms) / sizeof(stalls_ms[0]); s++)
+        {
+            double lost = run(fifo_sizes[f], stalls_ms[s], ms);
+            if (lost < 0)
+                failed = true;
+            printf(" %6.1f%%", lost);
+        }
+        printf("\n");
+    }
+
+    // The build's FIFO keeps up while the host polls every frame
+    host_cdc_fifo_size(0, 0);
+    if (run(CFG_TUD_CDC_TX_BUFSIZE, 0, ms) != 0.0)
+    {
+        fprintf(stderr, "cdc_throughput: frames lost with the build's FIFO and no stall\n");
+        failed = true;
+    }
+    return failed ? 1 : 0;
+}
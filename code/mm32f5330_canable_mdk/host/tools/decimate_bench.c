@@ -0,0 +1,83 @@
+//
+// decimate_bench: Cost of the decimation lookup by rule count
+//
+// With 32 and with DECIMATE_MAX_RULES rules, frames either match the last
+// rule (the longest rule scan plus the per-ID state lookup) or no rule at
+// all (the full scan and nothing else). Host nanoseconds per
+// decimate_keep() call.
+//
+//   decimate_bench [-n frames]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "decimate.h"
+
+// IDs in the frame mix, all matched by the last rule
+#define BENCH_IDS   16u
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double bench(uint32_t nrules, uint8_t matching, uint32_t total)
+{
+    FLEXCAN_Mb_Type frames[BENCH_IDS];
+
+    // Single-ID rules on 0x100 + i, the last one a mask rule over 0x600..0x60F
+    decimate_clear();
+    for (uint32_t i = 0; i + 1 < nrules; i++)
+    {
+        decimate_add(DECIMATE_EVERY_NTH, 0x100u + i, 0x7FFu, 0, 4);
+    }
+    decimate_add(DECIMATE_EVERY_NTH, 0x600u, 0x7F0u, 0, 4);
+
+    for (uint32_t i = 0; i < BENCH_IDS; i++)
+    {
+        memset(&frames[i], 0, sizeof(frames[i]));
+        frames[i].ID = (matching ? 0x600u : 0x700u) + i;
+        frames[i].FORMAT = FLEXCAN_MbFormat_Standard;
+        frames[i].TYPE = FLEXCAN_MbType_Data;
+        frames[i].LENGTH = 8;
+    }
+
+    uint32_t kept = 0;
+    double t0 = now_s();
+    for (uint32_t i = 0; i < total; i++)
+    {
+        kept += decimate_keep(&frames[i % BENCH_IDS]);
+    }
+    double t1 = now_s();
+    (void)kept;
+    return (t1 - t0) * 1e9 / total;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t total = 2000000;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            total = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else
+        {
+            fprintf(stderr, "usage: %s [-n frames]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    static const uint32_t rule_counts[] = { 1, 32, DECIMATE_MAX_RULES };
+    printf("rules  ns/frame matched  ns/frame unmatched\n");
+    for (uint32_t i = 0; i < sizeof(rule_counts) / sizeof(rule_counts[0]); i++)
+    {
+        printf("%5u  %16.1f  %18.1f\n", (unsigned)rule_counts[i],
+               bench(rule_counts[i], 1, total), bench(rule_counts[i], 0, total));
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+//
+// dedup_bench: Cost of the change-only lookup by table occupancy
+//
+// Frames cycle through n IDs, all repeating their payload, so every call
+// is a hit that gets suppressed; past DEDUP_TABLE_SIZE IDs the extra ones
+// miss the full table and take the longest probe. Host nanoseconds per
+// dedup_forward() call.
+//
+//   dedup_bench [-n frames]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dedup.h"
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double bench(uint32_t nids, uint32_t total)
+{
+    FLEXCAN_Mb_Type frames[DEDUP_TABLE_SIZE * 2];
+
+    dedup_enable(1, 0);
+    for (uint32_t i = 0; i < nids; i++)
+    {
+        memset(&frames[i], 0, sizeof(frames[i]));
+        // IDs spaced like a real bus' message list
+        frames[i].ID = 0x100u + 0x13u * i;
+        frames[i].FORMAT = FLEXCAN_MbFormat_Standard;
+        frames[i].TYPE = FLEXCAN_MbType_Data;
+        frames[i].LENGTH = 8;
+        frames[i].WORD0 = 0x11223344u;
+        frames[i].WORD1 = i;
+        dedup_forward(&frames[i]);
+    }
+
+    uint32_t passed = 0;
+    double t0 = now_s();
+    for (uint32_t i = 0; i < total; i++)
+    {
+        passed += dedup_forward(&frames[i % nids]);
+    }
+    double t1 = now_s();
+    (void)passed;
+    return (t1 - t0) * 1e9 / total;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t total = 2000000;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            total = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else
+        {
+            fprintf(stderr, "usage: %s [-n frames]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    static const uint32_t occupancy[] = { 1, 8, 32, DEDUP_TABLE_SIZE * 3 / 4, DEDUP_TABLE_SIZE, DEDUP_TABLE_SIZE + 16 };
+    printf("ids  ns/frame\n");
+    for (uint32_t i = 0; i < sizeof(occupancy) / sizeof(occupancy[0]); i++)
+    {
+        printf("%3u  %8.1f\n", (unsigned)occupancy[i], bench(occupancy[i], total));
+    }
+    return 0;
+}
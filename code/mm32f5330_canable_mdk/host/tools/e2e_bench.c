@@ -0,0 +1,77 @@
+//
+// e2e_bench: Cost of e2e_protect() per frame loaded into a mailbox
+//
+// Every frame written to a TX mailbox goes through e2e_protect(). With
+// all E2E_MAX_PROFILES slots in use this times a frame without a profile
+// (the full lookup), and protected frames of both profiles at 2 and 8
+// bytes with the match in the last slot. Host nanoseconds per call.
+//
+//   e2e_bench [-n frames]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "e2e.h"
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double bench(uint32_t id, uint8_t len, uint32_t total)
+{
+    FLEXCAN_Mb_Type frame;
+    uint32_t sum = 0;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.ID = id;
+    frame.FORMAT = FLEXCAN_MbFormat_Standard;
+    frame.TYPE = FLEXCAN_MbType_Data;
+    frame.LENGTH = len;
+
+    double t0 = now_s();
+    for (uint32_t i = 0; i < total; i++)
+    {
+        frame.WORD1 = i;
+        e2e_protect(&frame);
+        sum += frame.WORD0;
+    }
+    double t1 = now_s();
+    (void)sum;
+    return (t1 - t0) * 1e9 / total;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t total = 5000000;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            total = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else
+        {
+            fprintf(stderr, "usage: %s [-n frames]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // Slots 0..5 for other IDs, P01 on 0x106, P02 on 0x107
+    e2e_clear();
+    for (uint8_t slot = 0; slot < E2E_MAX_PROFILES - 2u; slot++)
+        e2e_set(slot, E2E_P01, 0x100u + slot, 0, slot, 0, 8);
+    e2e_set(E2E_MAX_PROFILES - 2u, E2E_P01, 0x106, 0, 0x0123, 0, 8);
+    e2e_set(E2E_MAX_PROFILES - 1u, E2E_P02, 0x107, 0, 0x37, 0, 8);
+
+    printf("frame          ns/frame\n");
+    printf("no profile     %8.1f\n", bench(0x200, 8, total));
+    printf("P01, 2 bytes   %8.1f\n", bench(0x106, 2, total));
+    printf("P01, 8 bytes   %8.1f\n", bench(0x106, 8, total));
+    printf("P02, 2 bytes   %8.1f\n", bench(0x107, 2, total));
+    printf("P02, 8 bytes   %8.1f\n", bench(0x107, 8, total));
+    return 0;
+}
@@ -0,0 +1,215 @@
+//
+// latency_report: The 'U' dump of the USB latency tracer as a table
+//
+// Reads what the adapter answers to 'U' on stdin, CR or LF separated, and
+// prints per stage the frame count, min, mean and max in microseconds and
+// the 50th and 99th percentile as the upper bound of the log2 bucket they
+// fall in, followed by the histogram. A dump that is cut short, out of
+// order, or whose buckets do not add up to the stage's count makes the
+// exit status 1.
+//
+//   printf 'U\r' > /dev/ttyACM0; cat /dev/ttyACM0 | latency_report
+//
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "latency.h"
+
+#define BAR_WIDTH   40u
+
+static const char *stage_names[] =
+{
+    "rx-encode",
+    "rx-enqueue",
+    "rx-usb",
+    "rx-total",
+    "tx-parse",
+    "tx-mailbox",
+};
+
+typedef struct
+{
+    bool seen;
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t mean;
+    uint32_t hist[LATENCY_HIST_BUCKETS];
+} stage_t;
+
+static stage_t stages[LATENCY_MAX];
+
+static bool hex_field(const char *p, uint8_t digits, uint32_t *value)
+{
+    char buf[9];
+    char *end;
+
+    memcpy(buf, p, digits);
+    buf[digits] = '\0';
+    *value = (uint32_t)strtoul(buf, &end, 16);
+    return end == buf + digits;
+}
+
+// Upper bound in us of the bucket holding the given fraction of frames
+static const char *percentile(const stage_t *s, uint32_t permille)
+{
+    static char str[16];
+    uint64_t target = ((uint64_t)s->count * permille + 999u) / 1000u;
+    uint64_t seen = 0;
+
+    for (uint32_t b = 0; b < LATENCY_HIST_BUCKETS; b++)
+    {
+        seen += s->hist[b];
+        if (seen >= target)
+        {
+            if (b == LATENCY_HIST_BUCKETS - 1)
+                snprintf(str, sizeof(str), ">=%lu", 1ul << b);
+            else
+                snprintf(str, sizeof(str), "<%lu", 2ul << b);
+            return str;
+        }
+    }
+    return "-";
+}
+
+static void report(void)
+{
+    printf("%-11s %10s %10s %10s %10s %10s %10s\n", "stage", "count", "min", "p50", "mean", "p99", "max");
+    for (uint32_t i = 0; i < LATENCY_MAX; i++)
+    {
+        const stage_t *s = &stages[i];
+        if (s->count == 0)
+        {
+            printf("%-11s %10u\n", stage_names[i], 0u);
+            continue;
+        }
+        printf("%-11s %10u %10u %10s %10u", stage_names[i], s->count, s->min, percentile(s, 500), s->mean);
+        printf(" %10s %10u\n", percentile(s, 990), s->max);
+    }
+
+    for (uint32_t i = 0; i < LATENCY_MAX; i++)
+    {
+        const stage_t *s = &stages[i];
+        uint32_t peak = 0;
+        if (s->count == 0)
+            continue;
+        for (uint32_t b = 0; b < LATENCY_HIST_BUCKETS; b++)
+        {
+            if (s->hist[b] > peak)
+                peak = s->hist[b];
+        }
+        printf("\n%s\n", stage_names[i]);
+        for (uint32_t b = 0; b < LATENCY_HIST_BUCKETS; b++)
+        {
+            if (s->hist[b] == 0)
+                continue;
+            uint32_t width = (uint32_t)(((uint64_t)s->hist[b] * BAR_WIDTH + peak - 1) / peak);
+            printf("  %8lu us %10u ", b ? 1ul << b : 0ul, s->hist[b]);
+            for (uint32_t w = 0; w < width; w++)
+                putchar('#');
+            putchar('\n');
+        }
+    }
+}
+
+// One dump line into the stage tables; other slcan traffic is skipped
+static bool parse(const char *p, int32_t *stage, int32_t *bucket, bool *done)
+{
+    size_t len = strlen(p);
+    uint32_t v[4];
+
+    if (p[0] == 'U' && len == 1)
+    {
+        *done = true;
+        return true;
+    }
+    if (p[0] == 'U')
+    {
+        if (len != 34 || !hex_field(p + 1, 1, &v[0]) || !hex_field(p + 2, 8, &v[1])
+            || !hex_field(p + 10, 8, &v[2]) || !hex_field(p + 18, 8, &v[3])
+            || (int32_t)v[0] != *stage + 1 || v[0] >= LATENCY_MAX)
+            return false;
+        stage_t *s = &stages[v[0]];
+        *stage = (int32_t)v[0];
+        *bucket = -1;
+        s->seen = true;
+        s->count = v[1];
+        s->min = v[2];
+        s->max = v[3];
+        return hex_field(p + 26, 8, &s->mean);
+    }
+    if (p[0] == 'u')
+    {
+        if (len != 12 || !hex_field(p + 1, 1, &v[0]) || !hex_field(p + 2, 2, &v[1])
+            || !hex_field(p + 4, 8, &v[2]) || (int32_t)v[0] != *stage
+            || (int32_t)v[1] <= *bucket || v[1] >= LATENCY_HIST_BUCKETS)
+            return false;
+        *bucket = (int32_t)v[1];
+        stages[*stage].hist[*bucket] = v[2];
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    char line[64];
+    uint32_t pos = 0;
+    int c;
+    int32_t stage = -1;
+    int32_t bucket = -1;
+    bool done = false, ok = true;
+    uint32_t lineno = 0;
+
+    if (argc > 1)
+    {
+        fprintf(stderr, "usage: %s < dump\n", argv[0]);
+        return 2;
+    }
+    if (sizeof(stage_names) / sizeof(stage_names[0]) != LATENCY_MAX)
+    {
+        fprintf(stderr, "stage names out of date\n");
+        return 2;
+    }
+
+    // Lines end in CR as sent by the adapter, or LF once logged
+    while (!done && (c = getchar()) != EOF)
+    {
+        if (c != '\r' && c != '\n')
+        {
+            if (pos < sizeof(line) - 1)
+                line[pos++] = (char)c;
+            continue;
+        }
+        if (pos == 0)
+            continue;
+        line[pos] = '\0';
+        pos = 0;
+        lineno++;
+        if (!parse(line, &stage, &bucket, &done))
+        {
+            fprintf(stderr, "line %u: malformed \"%s\"\n", lineno, line);
+            ok = false;
+        }
+    }
+
+    if (!done || stage != LATENCY_MAX - 1)
+    {
+        fprintf(stderr, "dump incomplete\n");
+        ok = false;
+    }
+    for (uint32_t i = 0; i < LATENCY_MAX; i++)
+    {
+        uint64_t sum = 0;
+        for (uint32_t b = 0; b < LATENCY_HIST_BUCKETS; b++)
+            sum += stages[i].hist[b];
+        if (stages[i].seen && sum != stages[i].count)
+        {
+            fprintf(stderr, "%s: buckets hold %lu of %u frames\n", stage_names[i], (unsigned long)sum, stages[i].count);
+            ok = false;
+        }
+    }
+    report();
+    return ok ? 0 : 1;
+}
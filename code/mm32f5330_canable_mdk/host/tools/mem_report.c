@@ -0,0 +1,149 @@
+//
+// mem_report: Static data per firmware object against the RAM plan
+//
+// Lists the data and BSS symbols of the given firmware archives with nm
+// and sums them per object, as the target linker's RW/ZI column would.
+// The peripheral models (host_*) are left out. Pool buffers are counted
+// in the pool, not in the fixed part: the CAN TX queue in can.c and the
+// CDC FIFOs, which live in the TinyUSB class driver on the target.
+// Pointers are 8 bytes on the build machine, so the figures are an upper
+// bound of the target's. Fails if the fixed data exceeds MEM_FIXED_SIZE;
+// what is left of it is the room for TinyUSB's own state, which is not
+// built on the host.
+//
+//   mem_report archive...
+//
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mem_plan.h"
+
+#define MAX_OBJECTS     64u
+
+typedef struct
+{
+    char name[48];
+    unsigned long bytes;
+} object_t;
+
+static object_t objects[MAX_OBJECTS];
+static uint32_t object_count;
+
+static object_t *object(const char *name)
+{
+    for (uint32_t i = 0; i < object_count; i++)
+    {
+        if (!strcmp(objects[i].name, name))
+            return &objects[i];
+    }
+    if (object_count >= MAX_OBJECTS)
+        return NULL;
+    object_t *o = &objects[object_count++];
+    snprintf(o->name, sizeof(o->name), "%s", name);
+    o->bytes = 0;
+    return o;
+}
+
+static bool scan(const char *archive)
+{
+    char cmd[512], line[256];
+    object_t *o = NULL;
+
+    snprintf(cmd, sizeof(cmd), "nm -S -t d '%s'", archive);
+    FILE *p = popen(cmd, "r");
+    if (p == NULL)
+        return false;
+    while (fgets(line, sizeof(line), p))
+    {
+        char a[64], b[64], c[8], d[128];
+        size_t len = strlen(line);
+
+        // "name.c.o:" starts the symbols of the next object
+        if (len > 3 && !strcmp(line + len - 3, "o:\n"))
+        {
+            line[len - 2] = '\0';
+            char *dot = strstr(line, ".c.o");
+            if (dot)
+                *dot = '\0';
+            o = strncmp(line, "host_", 5) ? object(line) : NULL;
+            continue;
+        }
+        if (o == NULL || sscanf(line, "%63s %63s %7s %127s", a, b, c, d) != 4)
+            continue;
+        if (strchr("bBdD", c[0]))
+            o->bytes += strtoul(b, NULL, 10);
+    }
+    return pclose(p) == 0;
+}
+
+static int by_size(const void *a, const void *b)
+{
+    const object_t *x = a, *y = b;
+    return (x->bytes < y->bytes) - (x->bytes > y->bytes);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long fixed = 0;
+    const unsigned long txq = (unsigned long)MEM_CAN_TXQ_LEN * MEM_CAN_TXQ_ITEM;
+    const unsigned long cdc = (unsigned long)MEM_CDC_INTERFACES * (MEM_CDC_TX_BUFSIZE + MEM_CDC_RX_BUFSIZE);
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s archive...\n", argv[0]);
+        return 2;
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        if (!scan(argv[i]))
+        {
+            fprintf(stderr, "mem_report: cannot list %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    // The TX queue is counted in the pool
+    object_t *can = object("can");
+    if (can == NULL || can->bytes < txq)
+    {
+        fprintf(stderr, "mem_report: CAN TX queue of %lu bytes not found in can.c\n", txq);
+        return 1;
+    }
+    can->bytes -= txq;
+
+    qsort(objects, object_count, sizeof(objects[0]), by_size);
+    printf("object                 bytes\n");
+    for (uint32_t i = 0; i < object_count; i++)
+    {
+        if (objects[i].bytes == 0)
+            continue;
+        printf("%-20s %7lu\n", objects[i].name, objects[i].bytes);
+        fixed += objects[i].bytes;
+    }
+
+    printf("\npool %u bytes: CDC TX %u x %u, CDC RX %u x %u, CAN TX queue %u x %u\n",
+           MEM_POOL_SIZE, MEM_CDC_INTERFACES, MEM_CDC_TX_BUFSIZE, MEM_CDC_INTERFACES, MEM_CDC_RX_BUFSIZE,
+           MEM_CAN_TXQ_LEN, MEM_CAN_TXQ_ITEM);
+    printf("pool used            %7lu of %u\n", cdc + txq, MEM_POOL_SIZE);
+    printf("fixed measured       %7lu of %u, %ld left for TinyUSB\n",
+           fixed, MEM_FIXED_SIZE, (long)MEM_FIXED_SIZE - (long)fixed);
+    printf("RAM planned          %7u of %u, NCM %u, stack %u\n",
+           MEM_FIXED_SIZE + MEM_NCM_SIZE + MEM_POOL_SIZE + MEM_STACK_SIZE, MEM_RAM_SIZE,
+           MEM_NCM_SIZE, MEM_STACK_SIZE);
+
+    if (cdc + txq > MEM_POOL_SIZE)
+    {
+        fprintf(stderr, "mem_report: pool buffers exceed MEM_POOL_SIZE\n");
+        return 1;
+    }
+    if (fixed > MEM_FIXED_SIZE)
+    {
+        fprintf(stderr, "mem_report: fixed data exceeds MEM_FIXED_SIZE by %lu bytes\n",
+                fixed - MEM_FIXED_SIZE);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+//
+// notify_decode: Bus state notifications of the interrupt endpoint as text
+//
+// Decodes SERIAL_STATE notifications as captured from endpoint 0x81, e.g.
+// by usbmon or Wireshark, given as hex on the command line or one per
+// line on stdin. The levels are printed first, then the events latched
+// since the previous notification. Anything that is not a SERIAL_STATE
+// notification of the slcan interface is reported and makes the exit
+// status 1.
+//
+//   notify_decode [hex...]
+//   a1200000000002000b00 -> on-bus active | warning
+//
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "notify.h"
+
+static const struct
+{
+    uint16_t bit;
+    const char *name;
+} bits[] =
+{
+    { NOTIFY_ON_BUS,  "on-bus" },
+    { NOTIFY_ACTIVE,  "active" },
+    { NOTIFY_BUS_OFF, "bus-off" },
+    { NOTIFY_WARNING, "warning" },
+    { NOTIFY_PASSIVE, "passive" },
+    { NOTIFY_OVERRUN, "overrun" },
+};
+
+// Hex digits, spaces and colons allowed between bytes, to bytes
+static int parse_hex(const char *s, uint8_t *buf, int size)
+{
+    int n = 0;
+
+    while (*s)
+    {
+        if (isspace((unsigned char)*s) || *s == ':')
+        {
+            s++;
+            continue;
+        }
+        if (!isxdigit((unsigned char)s[0]) || !isxdigit((unsigned char)s[1]) || n >= size)
+            return -1;
+        char byte[3] = { s[0], s[1], 0 };
+        buf[n++] = (uint8_t)strtoul(byte, NULL, 16);
+        s += 2;
+    }
+    return n;
+}
+
+static bool decode(const char *hex)
+{
+    uint8_t buf[32];
+    int n = parse_hex(hex, buf, sizeof(buf));
+
+    if (n != NOTIFY_LEN || buf[0] != 0xA1 || buf[1] != 0x20 || buf[6] != 2 || buf[7] != 0)
+    {
+        printf("%s -> not a SERIAL_STATE notification\n", hex);
+        return false;
+    }
+    if (buf[4] != NOTIFY_ITF * 2u || buf[5] != 0)
+    {
+        printf("%s -> interface %u, not slcan\n", hex, buf[4]);
+        return false;
+    }
+
+    uint16_t state = buf[8] | buf[9] << 8;
+    const char *sep = " |";
+    printf("%s ->", hex);
+    if ((state & ~NOTIFY_EVENTS) == 0)
+        printf(" off-bus");
+    for (unsigned i = 0; i < sizeof(bits) / sizeof(bits[0]); i++)
+    {
+        if ((state & bits[i].bit) && !(bits[i].bit & NOTIFY_EVENTS))
+            printf(" %s", bits[i].name);
+    }
+    for (unsigned i = 0; i < sizeof(bits) / sizeof(bits[0]); i++)
+    {
+        if ((state & bits[i].bit) && (bits[i].bit & NOTIFY_EVENTS))
+        {
+            printf("%s %s", sep, bits[i].name);
+            sep = ",";
+        }
+    }
+    uint16_t unknown = state & ~(NOTIFY_ON_BUS | NOTIFY_ACTIVE | NOTIFY_EVENTS);
+    if (unknown)
+        printf(" (unknown bits %04X)", unknown);
+    printf("\n");
+    return unknown == 0;
+}
+
+int main(int argc, char **argv)
+{
+    bool ok = true;
+    char line[256];
+
+    if (argc > 1 && argv[1][0] == '-')
+    {
+        fprintf(stderr, "usage: %s [hex...]\n", argv[0]);
+        return 2;
+    }
+    for (int i = 1; i < argc; i++)
+        ok &= decode(argv[i]);
+    if (argc == 1)
+    {
+        while (fgets(line, sizeof(line), stdin))
+        {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0])
+                ok &= decode(line);
+        }
+    }
+    return ok ? 0 : 1;
+}
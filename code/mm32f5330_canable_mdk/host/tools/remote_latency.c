@@ -0,0 +1,180 @@
+//
+// remote_latency: Remote frame response time, mailbox answer versus host
+//
+// Remote requests arrive at random times on the modelled bus, once with a
+// 'y' entry answering them from a mailbox and once without, so that the
+// host has to answer with a 't' command. The emulated host works like a
+// full speed CDC-ACM driver: it sees IN data at the next 1 ms frame, its
+// application takes the turnaround time to reply, and the reply goes OUT
+// at the frame after that. The main loop takes loop_us per pass.
+// Latency is virtual time from the request being received to the answer
+// being on the bus; the request and answer frame times themselves are
+// not included. The model sends a mailbox answer at once, on the bus it
+// follows the request's intermission (3 bit times).
+//
+//   remote_latency [-n requests] [-t turnaround_us] [-l loop_us]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "host_hw.h"
+#include "host_tud.h"
+
+#define USB_FRAME_US    1000u
+#define REQUEST_ID      0x123u
+
+typedef struct
+{
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    uint32_t count;
+} latency_t;
+
+static uint32_t loop_us = 20;
+static uint32_t turnaround_us = 200;
+
+static void run_until(uint64_t t)
+{
+    while (host_time_us() < t)
+    {
+        app_process();
+        host_advance_us(loop_us);
+    }
+}
+
+static void drain(void)
+{
+    uint8_t buf[256];
+    while (host_cdc_recv(0, buf, sizeof(buf)) > 0)
+        ;
+}
+
+static void add(latency_t *l, uint64_t us)
+{
+    if (l->count == 0 || us < l->min)
+        l->min = us;
+    if (us > l->max)
+        l->max = us;
+    l->sum += us;
+    l->count++;
+}
+
+// One request, the answer taken from the device's mailbox or the host
+static bool request(bool by_host, latency_t *l)
+{
+    host_can_frame_t frame;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.id = REQUEST_ID;
+    frame.rtr = 1;
+    frame.dlc = 8;
+    frame.time_us = host_time_us();
+    host_can_tx_clear();
+    host_can_inject(&frame);
+
+    uint64_t start = frame.time_us;
+    uint64_t deadline = start + 20u * USB_FRAME_US;
+    uint64_t reply_at = 0;
+
+    while (host_time_us() < deadline)
+    {
+        if (host_can_tx_pop(&frame))
+        {
+            add(l, frame.time_us - start);
+            return true;
+        }
+        run_until(host_time_us() + loop_us);
+        if (!by_host)
+            continue;
+
+        // The host sees the line at the next frame, answers after its
+        // turnaround, and the answer goes OUT at the frame after that
+        uint64_t now = host_time_us();
+        if (reply_at == 0 && (now % USB_FRAME_US) < loop_us)
+        {
+            char buf[64];
+            uint32_t n = host_cdc_recv(0, buf, sizeof(buf) - 1);
+            buf[n] = '\0';
+            if (strchr(buf, 'r'))
+            {
+                uint64_t ready = now + turnaround_us;
+                reply_at = (ready / USB_FRAME_US + 1u) * USB_FRAME_US;
+            }
+        }
+        if (reply_at && now >= reply_at)
+        {
+            host_cdc_send_str(0, "t12381122334455667788\r");
+            reply_at = UINT64_MAX;
+        }
+    }
+    return false;
+}
+
+static void report(const char *name, const latency_t *l)
+{
+    printf("%-8s %6u %8.1f %8.1f %8.1f\n", name, (unsigned)l->count,
+           (double)l->min, l->count ? (double)l->sum / l->count : 0.0, (double)l->max);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t total = 1000;
+    latency_t mailbox = {0}, host = {0};
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            total = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            turnaround_us = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            loop_us = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else
+        {
+            fprintf(stderr, "usage: %s [-n requests] [-t turnaround_us] [-l loop_us]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    host_reset();
+    app_init();
+    host_usb_mount(true);
+    host_cdc_set_dtr(0, true);
+    host_cdc_send_str(0, "S8\rO\r");
+    run_until(host_time_us() + 1000u);
+    drain();
+    if (!host_can_enabled())
+    {
+        fprintf(stderr, "remote_latency: channel did not open\n");
+        return 1;
+    }
+
+    srand(37);
+    for (uint32_t pass = 0; pass < 2; pass++)
+    {
+        bool by_host = (pass == 1);
+
+        host_cdc_send_str(0, by_host ? "y0\r" : "y100000012381122334455667788\r");
+        run_until(host_time_us() + 1000u);
+        drain();
+        for (uint32_t i = 0; i < total; i++)
+        {
+            // Requests at a random phase of the USB frame
+            run_until(host_time_us() + 2u * USB_FRAME_US + (uint32_t)rand() % USB_FRAME_US);
+            drain();
+            if (!request(by_host, by_host ? &host : &mailbox))
+            {
+                fprintf(stderr, "remote_latency: request %u not answered\n", (unsigned)i);
+                return 1;
+            }
+        }
+    }
+
+    printf("path     count   min_us   avg_us   max_us\n");
+    report("mailbox", &mailbox);
+    report("host", &host);
+    return 0;
+}
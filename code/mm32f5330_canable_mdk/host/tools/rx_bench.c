@@ -0,0 +1,160 @@
+//
+// rx_bench: Frames per second through the firmware's receive and transmit paths
+//
+// Runs the unmodified main loop against the host models. Frames injected
+// into the FlexCAN RX FIFO go through can_rx_process() to slcan lines the
+// emulated USB host reads back; 't' commands sent over the CDC interface
+// go through cdc_process() and can_process() onto the modelled bus. The
+// rates are host CPU throughput of the firmware code, not of the target.
+//
+//   rx_bench [-n frames] [-q]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "main.h"
+#include "can.h"
+#include "host_hw.h"
+#include "host_tud.h"
+
+// Virtual time of one 8-byte standard frame at 1 Mbit/s
+#define FRAME_US    111u
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// slcan lines carrying received frames
+static uint32_t count_frames(const uint8_t *buf, uint32_t len, uint8_t *line_start)
+{
+    uint32_t frames = 0;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        if (*line_start)
+        {
+            *line_start = 0;
+            if (buf[i] == 't' || buf[i] == 'T' || buf[i] == 'r' || buf[i] == 'R')
+                frames++;
+        }
+        if (buf[i] == '\r' || buf[i] == '\a')
+            *line_start = 1;
+    }
+    return frames;
+}
+
+static uint32_t drain(uint8_t *line_start)
+{
+    uint8_t buf[4096];
+    uint32_t frames = 0;
+    uint32_t n;
+
+    while ((n = host_cdc_recv(0, buf, sizeof(buf))) > 0)
+    {
+        frames += count_frames(buf, n, line_start);
+    }
+    return frames;
+}
+
+static uint32_t bench_rx(uint32_t total)
+{
+    host_can_frame_t frame;
+    uint32_t injected = 0, received = 0;
+    uint8_t line_start = 1;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.dlc = 8;
+    while (received < total)
+    {
+        while (injected < total && host_can_rx_pending() + can_rx_count() < HOST_CAN_FIFO_DEPTH)
+        {
+            frame.id = 0x100u + (injected & 0x3FFu);
+            memcpy(frame.data, &injected, sizeof(injected));
+            host_can_inject(&frame);
+            injected++;
+            host_advance_us(FRAME_US);
+        }
+        app_process();
+        received += drain(&line_start);
+    }
+    return received;
+}
+
+static uint32_t bench_tx(uint32_t total)
+{
+    host_can_frame_t frame;
+    char line[32];
+    uint32_t queued = 0, sent = 0;
+    uint8_t line_start = 1;
+
+    host_can_tx_clear();
+    while (sent < total)
+    {
+        // Keep a few commands ahead, as a host writing in bulk does
+        while (queued < total && queued - sent < 16u && host_cdc_rx_queued(0) < 512u)
+        {
+            snprintf(line, sizeof(line), "t%03X811223344%08X\r", 0x200u + (queued & 0xFFu), (unsigned)queued);
+            host_cdc_send_str(0, line);
+            queued++;
+        }
+        app_process();
+        host_advance_us(FRAME_US);
+        while (host_can_tx_pop(&frame))
+            sent++;
+        drain(&line_start);
+    }
+    return sent;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t total = 200000;
+    int quiet = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            total = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-q"))
+            quiet = 1;
+        else
+        {
+            fprintf(stderr, "usage: %s [-n frames] [-q]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    host_reset();
+    app_init();
+    host_usb_mount(true);
+    host_cdc_set_dtr(0, true);
+
+    // 1 Mbit/s, open
+    host_cdc_send_str(0, "S8\rO\r");
+    for (int i = 0; i < 4; i++)
+        app_process();
+    uint8_t line_start = 1;
+    drain(&line_start);
+    if (!host_can_enabled())
+    {
+        fprintf(stderr, "rx_bench: channel did not open\n");
+        return 1;
+    }
+
+    double t0 = now_s();
+    uint32_t rx = bench_rx(total);
+    double t1 = now_s();
+    uint32_t tx = bench_tx(total);
+    double t2 = now_s();
+
+    if (!quiet)
+    {
+        printf("rx: %u frames in %.3f s, %.0f frames/s\n", rx, t1 - t0, rx / (t1 - t0));
+        printf("tx: %u frames in %.3f s, %.0f frames/s\n", tx, t2 - t1, tx / (t2 - t1));
+    }
+    return (rx == total && tx == total) ? 0 : 1;
+}
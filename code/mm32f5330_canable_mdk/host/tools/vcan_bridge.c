@@ -0,0 +1,397 @@
+//
+// vcan_bridge: The firmware as a slcan adapter between a pty and SocketCAN
+//
+// The FlexCAN model is attached to a SocketCAN interface, normally a vcan,
+// and the slcan CDC interface to a pseudo terminal, so the standard tools
+// talk to the unmodified main loop:
+//
+//   ip link add vcan0 type vcan && ip link set vcan0 up
+//   vcan_bridge -i vcan0 -l /tmp/ttyCANable &
+//   slcand -o -s8 /tmp/ttyCANable slcan0 && ip link set slcan0 up
+//   candump slcan0 &  cangen vcan0 -g 0
+//
+// Time runs in real time. A host that stops reading the pty stops the
+// bulk IN endpoint, as a stalled USB host would.
+//
+// -i none leaves the bus side unconnected, for the loopback benchmark of
+// bench_client. --self-test N needs no CAN interface either: N frames are
+// generated on the bus side at --rate frames/s (25000 by default) and a
+// child process reads them back through the pty. It fails if a line is
+// dropped or the rate is not sustained. --vcan-test N does the same with
+// the frames written to the -i interface from a second socket, so that
+// they come through SocketCAN; it exits with 77 where the kernel has no
+// CAN support or no such interface.
+//
+
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include "main.h"
+#include "error.h"
+#include "tusb.h"
+#include "host_hw.h"
+#include "host_tud.h"
+
+// From can.h, which pulls in the device header whose register names
+// clash with the termios macros
+uint8_t can_rx_count(void);
+
+// Exit status of a test that cannot run here
+#define SKIPPED             77
+
+// Private variables
+static int can_fd = -1;
+static int pty_master = -1;
+static char pty_path[128];
+static uint8_t to_host[4096];
+static uint32_t to_host_len;
+static uint8_t to_device[4096];
+static uint32_t to_device_len;
+
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int open_can(const char *ifname)
+{
+    struct sockaddr_can addr;
+    struct ifreq ifr;
+    int fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+
+    if (fd < 0)
+    {
+        int err = errno;
+        perror("socket");
+        errno = err;
+        return -1;
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0)
+    {
+        int err = errno;
+        perror(ifname);
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+static int open_pty(const char *link)
+{
+    int slave;
+    struct termios tio;
+
+    if (openpty(&pty_master, &slave, pty_path, NULL, NULL) < 0)
+    {
+        perror("openpty");
+        return -1;
+    }
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    // The slave stays open so that the master never sees a hangup
+    fcntl(pty_master, F_SETFL, O_NONBLOCK);
+
+    if (link)
+    {
+        unlink(link);
+        if (symlink(pty_path, link) < 0)
+        {
+            perror(link);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// SocketCAN to the controller, while its RX FIFO has room
+static uint32_t bus_to_controller(void)
+{
+    struct can_frame cf;
+    uint32_t moved = 0;
+
+    while (can_fd >= 0 && host_can_rx_pending() + can_rx_count() < HOST_CAN_FIFO_DEPTH)
+    {
+        if (read(can_fd, &cf, sizeof(cf)) != (ssize_t)sizeof(cf))
+            break;
+
+        host_can_frame_t frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.ext = (cf.can_id & CAN_EFF_FLAG) != 0;
+        frame.rtr = (cf.can_id & CAN_RTR_FLAG) != 0;
+        frame.id = cf.can_id & (frame.ext ? CAN_EFF_MASK : CAN_SFF_MASK);
+        frame.dlc = cf.can_dlc > 8 ? 8 : cf.can_dlc;
+        memcpy(frame.data, cf.data, frame.dlc);
+        frame.time_us = host_time_us();
+        host_can_inject(&frame);
+        moved++;
+    }
+    return moved;
+}
+
+// Frames the controller sent, to SocketCAN
+static uint32_t controller_to_bus(void)
+{
+    host_can_frame_t frame;
+    uint32_t moved = 0;
+
+    while (host_can_tx_pop(&frame))
+    {
+        struct can_frame cf;
+        memset(&cf, 0, sizeof(cf));
+        cf.can_id = frame.id | (frame.ext ? CAN_EFF_FLAG : 0) | (frame.rtr ? CAN_RTR_FLAG : 0);
+        cf.can_dlc = frame.dlc;
+        memcpy(cf.data, frame.data, frame.dlc);
+        if (can_fd >= 0 && write(can_fd, &cf, sizeof(cf)) != (ssize_t)sizeof(cf))
+            error_assert(ERR_CAN_TXFAIL);
+        moved++;
+    }
+    return moved;
+}
+
+// pty to the CDC OUT endpoint, and the CDC IN endpoint to the pty
+static uint32_t pty_exchange(void)
+{
+    uint32_t moved = 0;
+    ssize_t n;
+
+    if (to_device_len < sizeof(to_device))
+    {
+        n = read(pty_master, to_device + to_device_len, sizeof(to_device) - to_device_len);
+        if (n > 0)
+            to_device_len += (uint32_t)n;
+    }
+    if (to_device_len)
+    {
+        uint32_t room = CFG_TUD_CDC_RX_BUFSIZE - host_cdc_rx_queued(0);
+        uint32_t sent = host_cdc_send(0, to_device, to_device_len < room ? to_device_len : room);
+        memmove(to_device, to_device + sent, to_device_len - sent);
+        to_device_len -= sent;
+        moved += sent;
+    }
+
+    // The IN endpoint is only polled while the pty takes the data
+    if (to_host_len == 0)
+    {
+        to_host_len = host_cdc_recv(0, to_host, sizeof(to_host));
+    }
+    if (to_host_len)
+    {
+        n = write(pty_master, to_host, to_host_len);
+        if (n > 0)
+        {
+            memmove(to_host, to_host + n, to_host_len - (uint32_t)n);
+            to_host_len -= (uint32_t)n;
+            moved += (uint32_t)n;
+        }
+    }
+    return moved;
+}
+
+// The slcan host of the self-test: opens the channel and counts frame lines
+static int selftest_reader(uint32_t total)
+{
+    char buf[8192];
+    int line_start = 1;
+    uint32_t lines = 0;
+    double t0 = 0;
+    int fd = open(pty_path, O_RDWR | O_NOCTTY);
+
+    if (fd < 0)
+    {
+        perror(pty_path);
+        return 1;
+    }
+    // 1 Mbit/s, open
+    if (write(fd, "S8\rO\r", 5) != 5)
+    {
+        perror("write");
+        return 1;
+    }
+    while (lines < total)
+    {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, 2000) <= 0)
+            break;
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        if (t0 == 0)
+            t0 = now_s();
+        for (ssize_t i = 0; i < n; i++)
+        {
+            if (line_start && buf[i] == 't')
+                lines++;
+            line_start = (buf[i] == '\r');
+        }
+    }
+    double t1 = now_s();
+    double rate = lines / (t1 - t0);
+    printf("self-test: %u of %u frames read from the pty in %.3f s, %.0f frames/s\n",
+           (unsigned)lines, (unsigned)total, t1 - t0, rate);
+    return (lines == total && rate > 20000.0) ? 0 : 1;
+}
+
+// Generate total frames at rate frames/s, into the controller's FIFO or,
+// with gen_fd, onto the SocketCAN interface the bridge reads from
+static int selftest(uint32_t total, uint32_t rate, int gen_fd)
+{
+    host_can_frame_t frame;
+    struct can_frame cf;
+    uint32_t injected = 0;
+    int status = 1;
+    pid_t reader = fork();
+
+    if (reader == 0)
+    {
+        int ret = selftest_reader(total);
+        fflush(stdout);
+        _exit(ret);
+    }
+
+    memset(&frame, 0, sizeof(frame));
+    frame.dlc = 8;
+    memset(&cf, 0, sizeof(cf));
+    cf.can_dlc = 8;
+    double t0 = 0;
+    for (;;)
+    {
+        if (waitpid(reader, &status, WNOHANG) == reader)
+            break;
+        host_poll();
+        if (host_can_enabled() && t0 == 0)
+            t0 = now_s();
+        // Frames due at the bus rate, as long as the FIFO has room
+        uint32_t due = t0 ? (uint32_t)((now_s() - t0) * rate) + 1u : 0u;
+        while (gen_fd < 0 && injected < total && injected < due
+               && host_can_rx_pending() + can_rx_count() < HOST_CAN_FIFO_DEPTH)
+        {
+            frame.id = 0x100u + (injected & 0x3FFu);
+            memcpy(frame.data, &injected, sizeof(injected));
+            host_can_inject(&frame);
+            injected++;
+        }
+        // A frame the interface does not take now is written again later
+        while (gen_fd >= 0 && injected < total && injected < due)
+        {
+            cf.can_id = 0x100u + (injected & 0x3FFu);
+            memcpy(cf.data, &injected, sizeof(injected));
+            if (write(gen_fd, &cf, sizeof(cf)) != (ssize_t)sizeof(cf))
+                break;
+            injected++;
+        }
+        bus_to_controller();
+        pty_exchange();
+        app_process();
+        pty_exchange();
+    }
+    printf("self-test: %u frames generated, %u lines dropped\n",
+           (unsigned)injected, (unsigned)error_count(ERR_USBTX_BUSY));
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0 && error_count(ERR_USBTX_BUSY) == 0) ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *ifname = "vcan0";
+    const char *link = NULL;
+    uint32_t selftest_frames = 0;
+    uint32_t selftest_rate = 25000;
+    int gen_fd = -1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-i") && i + 1 < argc)
+            ifname = argv[++i];
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+            link = argv[++i];
+        else if (!strcmp(argv[i], "--self-test") && i + 1 < argc)
+            selftest_frames = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--vcan-test") && i + 1 < argc)
+        {
+            selftest_frames = (uint32_t)strtoul(argv[++i], NULL, 0);
+            gen_fd = 0;
+        }
+        else if (!strcmp(argv[i], "--rate") && i + 1 < argc)
+            selftest_rate = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else
+        {
+            fprintf(stderr, "usage: %s [-i canif] [-l pty-link] [--self-test|--vcan-test frames [--rate frames/s]]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (open_pty(link) < 0)
+        return 1;
+    if (!selftest_frames && strcmp(ifname, "none") && (can_fd = open_can(ifname)) < 0)
+        return 1;
+    if (gen_fd == 0)
+    {
+        if ((can_fd = open_can(ifname)) < 0 || (gen_fd = open_can(ifname)) < 0)
+            return (errno == EAFNOSUPPORT || errno == ENODEV) ? SKIPPED : 1;
+        // The generator only writes, frames sent by the bridge are not kept
+        setsockopt(gen_fd, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
+    }
+
+    host_reset();
+    host_realtime(true);
+    app_init();
+    host_usb_mount(true);
+    // A tty has no DTR towards the device, the port counts as open
+    host_cdc_set_dtr(0, true);
+
+    if (selftest_frames)
+        return selftest(selftest_frames, selftest_rate, gen_fd);
+
+    printf("%s <-> %s\n", link ? link : pty_path, ifname);
+    fflush(stdout);
+
+    for (;;)
+    {
+        host_poll();
+        uint32_t moved = bus_to_controller();
+        moved += pty_exchange();
+        app_process();
+        moved += pty_exchange();
+        moved += controller_to_bus();
+
+        // Idle: sleep until there is something to do, at most one tick
+        if (!moved)
+        {
+            struct pollfd fds[2] = {
+                { .fd = can_fd, .events = POLLIN },
+                { .fd = pty_master, .events = POLLIN | (to_host_len ? POLLOUT : 0) },
+            };
+            poll(fds, 2, 1);
+        }
+    }
+}